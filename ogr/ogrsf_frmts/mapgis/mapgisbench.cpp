@@ -0,0 +1,654 @@
+/******************************************************************************
+ * $Id: mapgisbench.cpp 30013 2012-03-02 14:10:26Z fuxin $
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Generates synthetic WMAP files and benchmarks reading them
+ *           through OGR.
+ * Author:   ZhouShun, shunzhou@foxmail.com
+ *
+ ******************************************************************************
+ * Copyright (c) 1999,  Les Technologies SoftMap Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "ogrsf_frmts.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+#ifdef WIN32
+#  include <windows.h>
+#  include <psapi.h>
+#else
+#  include <sys/time.h>
+#  include <sys/resource.h>
+#endif
+
+CPL_CVSID("$Id: mapgisbench.cpp 30013 2012-03-02 14:10:26Z fuxin $");
+
+/* Origin and spacing of the generated data, in map units. */
+#define BENCH_ORIGIN_X      540000.0
+#define BENCH_ORIGIN_Y      4400000.0
+#define BENCH_CELL_SIZE     10.0
+
+/************************************************************************/
+/*                               Usage()                                */
+/************************************************************************/
+
+static void Usage()
+
+{
+    printf( "Usage: mapgisbench generate {wat|wal|wap} <records> <file>\n"
+            "                            [-vertices n] [-noshare] [-seed n]\n"
+            "       mapgisbench bench [-header] [-fetch n] [-seed n]\n"
+            "                         <file> [<file>...]\n"
+            "\n"
+            "generate writes <records> points, lines or polygons.  Lines\n"
+            "have -vertices vertices (default 10), as have polygon arcs\n"
+            "(default 2).  Polygons form a grid whose shared boundaries\n"
+            "are single arcs, unless -noshare gives every polygon arcs of\n"
+            "its own.\n"
+            "\n"
+            "bench prints one CSV line per file: open latency, full scan\n"
+            "throughput, a scan filtered to the central 1%% of the extent,\n"
+            "the mean latency of -fetch random GetFeature() calls\n"
+            "(default 1000) and the peak resident size of the process.\n"
+            "Run one file per process to get the peak size per file.\n" );
+    exit( 1 );
+}
+
+/************************************************************************/
+/*                               Random()                               */
+/*                                                                      */
+/*      A small LCG, so runs are reproducible across platforms.         */
+/************************************************************************/
+
+static GUInt32 nRandomState = 1;
+
+static double Random()
+
+{
+    nRandomState = nRandomState * 1664525U + 1013904223U;
+    return (nRandomState >> 8) / 16777216.0;
+}
+
+/************************************************************************/
+/*                              GetTime()                               */
+/*                                                                      */
+/*      Wall clock seconds.                                             */
+/************************************************************************/
+
+static double GetTime()
+
+{
+#ifdef WIN32
+    LARGE_INTEGER nFrequency, nCounter;
+    QueryPerformanceFrequency( &nFrequency );
+    QueryPerformanceCounter( &nCounter );
+    return (double) nCounter.QuadPart / (double) nFrequency.QuadPart;
+#else
+    struct timeval sTime;
+    gettimeofday( &sTime, NULL );
+    return sTime.tv_sec + sTime.tv_usec * 1e-6;
+#endif
+}
+
+/************************************************************************/
+/*                            GetPeakRSS()                              */
+/*                                                                      */
+/*      Peak resident size of the process so far, in kilobytes.         */
+/************************************************************************/
+
+static GIntBig GetPeakRSS()
+
+{
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS sCounters;
+    if( !GetProcessMemoryInfo( GetCurrentProcess(), &sCounters,
+                               sizeof(sCounters) ) )
+        return -1;
+    return (GIntBig) (sCounters.PeakWorkingSetSize / 1024);
+#else
+    struct rusage sUsage;
+    if( getrusage( RUSAGE_SELF, &sUsage ) != 0 )
+        return -1;
+    return (GIntBig) sUsage.ru_maxrss;
+#endif
+}
+
+/************************************************************************/
+/*                           GeneratePoints()                           */
+/*                                                                      */
+/*      One in ten points is an annotation, the rest sub-graphs.        */
+/************************************************************************/
+
+static void GeneratePoints( FILE *fp, GIntBig nRecords )
+
+{
+    double dfSide = sqrt( (double) nRecords ) * BENCH_CELL_SIZE;
+
+    fprintf( fp, "WMAP9022\n" CPL_FRMT_GIB "\n", nRecords );
+
+    for( GIntBig i = 0; i < nRecords; i++ )
+    {
+        double dfX = BENCH_ORIGIN_X + Random() * dfSide;
+        double dfY = BENCH_ORIGIN_Y + Random() * dfSide;
+
+        if( i % 10 == 0 )
+            fprintf( fp, "%.6f,%.6f," CPL_FRMT_GIB ",0,\"T" CPL_FRMT_GIB
+                     "\",2.500000,2.000000,0.000000,0.000000,3,0,0,0,1,"
+                     "%d,0\n", dfX, dfY, i + 1, i + 1, (int) (i % 255) );
+        else
+            fprintf( fp, "%.6f,%.6f," CPL_FRMT_GIB ",1,%d,0.500000,"
+                     "0.500000,0.000000,0,1,0.050000,%d,0\n",
+                     dfX, dfY, i + 1, 1 + (int) (i % 500),
+                     (int) (i % 255) );
+    }
+}
+
+/************************************************************************/
+/*                           GenerateLines()                            */
+/*                                                                      */
+/*      Random walks of nVertices vertices.                             */
+/************************************************************************/
+
+static void GenerateLines( FILE *fp, GIntBig nRecords, int nVertices )
+
+{
+    double dfSide = sqrt( (double) nRecords ) * BENCH_CELL_SIZE;
+
+    // Lines are counted one more than there are.
+    fprintf( fp, "WMAP9021\n" CPL_FRMT_GIB "\n", nRecords + 1 );
+
+    for( GIntBig i = 0; i < nRecords; i++ )
+    {
+        double dfX = BENCH_ORIGIN_X + Random() * dfSide;
+        double dfY = BENCH_ORIGIN_Y + Random() * dfSide;
+        double dfLength = 0.0;
+
+        fprintf( fp, "1,0,1,0.100000,10.000000,10.000000,1,%d,0\n%d\n",
+                 (int) (i % 255), nVertices );
+
+        for( int j = 0; j < nVertices; j++ )
+        {
+            if( j > 0 )
+            {
+                double dfDX = (Random() - 0.5) * BENCH_CELL_SIZE;
+                double dfDY = (Random() - 0.5) * BENCH_CELL_SIZE;
+                dfX += dfDX;
+                dfY += dfDY;
+                dfLength += sqrt( dfDX * dfDX + dfDY * dfDY );
+            }
+            fprintf( fp, "%.6f,%.6f\n", dfX, dfY );
+        }
+
+        fprintf( fp, CPL_FRMT_GIB ",%.6f\n", i + 1, dfLength );
+    }
+}
+
+/************************************************************************/
+/*                            WriteArc()                                */
+/*                                                                      */
+/*      An arc from (dfX1,dfY1) to (dfX2,dfY2), its inner vertices      */
+/*      bulging sideways so they are not collinear.                     */
+/************************************************************************/
+
+static void WriteArc( FILE *fp, GIntBig nId, GIntBig nFrom, GIntBig nTo,
+                      GIntBig nLeft, GIntBig nRight, int nVertices,
+                      double dfX1, double dfY1, double dfX2, double dfY2 )
+
+{
+    double dfBulge = (nId % 2 ? 0.05 : -0.05) * BENCH_CELL_SIZE;
+    double dfLength = 0.0, dfLastX = dfX1, dfLastY = dfY1;
+
+    fprintf( fp, "1,0,1,0.100000,10.000000,10.000000,1,1,0\n"
+             CPL_FRMT_GIB "," CPL_FRMT_GIB "\n"
+             CPL_FRMT_GIB "," CPL_FRMT_GIB "\n%d\n",
+             nFrom, nTo, nLeft, nRight, nVertices );
+
+    for( int j = 0; j < nVertices; j++ )
+    {
+        double dfT = j / (double) (nVertices - 1);
+        double dfOffset = (j == 0 || j == nVertices - 1) ? 0.0
+            : dfBulge * sin( dfT * 3.14159265358979 );
+        // Offset at right angles to the arc direction.
+        double dfX = dfX1 + (dfX2 - dfX1) * dfT
+            - (dfY2 - dfY1) / BENCH_CELL_SIZE * dfOffset;
+        double dfY = dfY1 + (dfY2 - dfY1) * dfT
+            + (dfX2 - dfX1) / BENCH_CELL_SIZE * dfOffset;
+
+        dfLength += sqrt( (dfX - dfLastX) * (dfX - dfLastX)
+                          + (dfY - dfLastY) * (dfY - dfLastY) );
+        dfLastX = dfX;
+        dfLastY = dfY;
+        fprintf( fp, "%.6f,%.6f\n", dfX, dfY );
+    }
+
+    fprintf( fp, CPL_FRMT_GIB ",%.6f\n", nId, dfLength );
+}
+
+/************************************************************************/
+/*                          GeneratePolygons()                          */
+/*                                                                      */
+/*      A grid of nCols square cells per row, the first nRecords of     */
+/*      them being polygons.  With bShare the grid lines are arcs       */
+/*      between the nodes at the cell corners, each shared by the two   */
+/*      cells it separates:                                             */
+/*                                                                      */
+/*        h(i,j), node (i,j) to (i,j+1): id i*nCols + j + 1             */
+/*        v(i,j), node (i,j) to (i+1,j): id nH + i*(nCols+1) + j + 1    */
+/*                                                                      */
+/*      Otherwise every cell has four arcs and four nodes of its own.   */
+/************************************************************************/
+
+static void GeneratePolygons( FILE *fp, GIntBig nRecords, int nVertices,
+                              int bShare )
+
+{
+    GIntBig nCols = (GIntBig) ceil( sqrt( (double) nRecords ) );
+    GIntBig nRows = (nRecords + nCols - 1) / nCols;
+    GIntBig nH = (nRows + 1) * nCols;
+    GIntBig nV = nRows * (nCols + 1);
+    GIntBig i, j;
+
+#define CELL_ID(r,c) ( (r) >= 0 && (r) < nRows && (c) >= 0 && (c) < nCols \
+                       && (r) * nCols + (c) < nRecords \
+                       ? (r) * nCols + (c) + 1 : 0 )
+#define NODE_X(c) ( BENCH_ORIGIN_X + (c) * BENCH_CELL_SIZE )
+#define NODE_Y(r) ( BENCH_ORIGIN_Y + (r) * BENCH_CELL_SIZE )
+
+    fprintf( fp, "WMAP9023\n" );
+
+    if( bShare )
+    {
+/* -------------------------------------------------------------------- */
+/*      Arcs, north of a horizontal arc and west of a vertical one      */
+/*      being on its left.                                              */
+/* -------------------------------------------------------------------- */
+        fprintf( fp, CPL_FRMT_GIB "\n", nH + nV );
+
+        for( i = 0; i <= nRows; i++ )
+            for( j = 0; j < nCols; j++ )
+                WriteArc( fp, i * nCols + j + 1,
+                          i * (nCols + 1) + j + 1, i * (nCols + 1) + j + 2,
+                          CELL_ID(i, j), CELL_ID(i - 1, j), nVertices,
+                          NODE_X(j), NODE_Y(i), NODE_X(j + 1), NODE_Y(i) );
+
+        for( i = 0; i < nRows; i++ )
+            for( j = 0; j <= nCols; j++ )
+                WriteArc( fp, nH + i * (nCols + 1) + j + 1,
+                          i * (nCols + 1) + j + 1,
+                          (i + 1) * (nCols + 1) + j + 1,
+                          CELL_ID(i, j - 1), CELL_ID(i, j), nVertices,
+                          NODE_X(j), NODE_Y(i), NODE_X(j), NODE_Y(i + 1) );
+
+/* -------------------------------------------------------------------- */
+/*      Nodes at the cell corners.                                      */
+/* -------------------------------------------------------------------- */
+        fprintf( fp, CPL_FRMT_GIB "\n", (nRows + 1) * (nCols + 1) + 1 );
+
+        for( i = 0; i <= nRows; i++ )
+        {
+            for( j = 0; j <= nCols; j++ )
+            {
+                GIntBig anArcs[4];
+                int nArcs = 0;
+
+                if( j < nCols )
+                    anArcs[nArcs++] = i * nCols + j + 1;
+                if( j > 0 )
+                    anArcs[nArcs++] = -(i * nCols + j);
+                if( i < nRows )
+                    anArcs[nArcs++] = nH + i * (nCols + 1) + j + 1;
+                if( i > 0 )
+                    anArcs[nArcs++] = -(nH + (i - 1) * (nCols + 1) + j + 1);
+
+                fprintf( fp, "%.6f,%.6f\n%dN\n", NODE_X(j), NODE_Y(i),
+                         nArcs );
+                for( int k = 0; k < nArcs; k++ )
+                    fprintf( fp, CPL_FRMT_GIB "\n", anArcs[k] );
+            }
+        }
+    }
+    else
+    {
+/* -------------------------------------------------------------------- */
+/*      Four arcs and nodes per cell, counter-clockwise from the        */
+/*      south west corner.                                              */
+/* -------------------------------------------------------------------- */
+        static const int anCornerX[5] = { 0, 1, 1, 0, 0 };
+        static const int anCornerY[5] = { 0, 0, 1, 1, 0 };
+
+        fprintf( fp, CPL_FRMT_GIB "\n", 4 * nRecords );
+
+        for( GIntBig iCell = 0; iCell < nRecords; iCell++ )
+        {
+            GIntBig nRow = iCell / nCols, nCol = iCell % nCols;
+
+            for( int k = 0; k < 4; k++ )
+                WriteArc( fp, 4 * iCell + k + 1,
+                          4 * iCell + k + 1, 4 * iCell + (k + 1) % 4 + 1,
+                          iCell + 1, 0, nVertices,
+                          NODE_X(nCol + anCornerX[k]),
+                          NODE_Y(nRow + anCornerY[k]),
+                          NODE_X(nCol + anCornerX[k+1]),
+                          NODE_Y(nRow + anCornerY[k+1]) );
+        }
+
+        fprintf( fp, CPL_FRMT_GIB "\n", 4 * nRecords + 1 );
+
+        for( GIntBig iCell = 0; iCell < nRecords; iCell++ )
+        {
+            GIntBig nRow = iCell / nCols, nCol = iCell % nCols;
+
+            for( int k = 0; k < 4; k++ )
+                fprintf( fp, "%.6f,%.6f\n2N\n" CPL_FRMT_GIB "\n"
+                         CPL_FRMT_GIB "\n",
+                         NODE_X(nCol + anCornerX[k]),
+                         NODE_Y(nRow + anCornerY[k]),
+                         4 * iCell + k + 1, -(4 * iCell + (k + 3) % 4 + 1) );
+        }
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Polygons, counted as they are, each one ring of four arcs.      */
+/* -------------------------------------------------------------------- */
+    double dfArea = BENCH_CELL_SIZE * BENCH_CELL_SIZE;
+
+    fprintf( fp, CPL_FRMT_GIB "\n", nRecords );
+
+    for( GIntBig iCell = 0; iCell < nRecords; iCell++ )
+    {
+        GIntBig nRow = iCell / nCols, nCol = iCell % nCols;
+
+        fprintf( fp, "%d,0,1.000000,1.000000,0,0,%d,0," CPL_FRMT_GIB
+                 ",%.6f,%.6f\n5\n", 1 + (int) (iCell % 500),
+                 (int) (iCell % 255), iCell + 1, dfArea,
+                 4 * BENCH_CELL_SIZE );
+
+        if( bShare )
+            fprintf( fp, CPL_FRMT_GIB "\n" CPL_FRMT_GIB "\n"
+                     CPL_FRMT_GIB "\n" CPL_FRMT_GIB "\n0\n",
+                     nRow * nCols + nCol + 1,
+                     nH + nRow * (nCols + 1) + nCol + 2,
+                     -((nRow + 1) * nCols + nCol + 1),
+                     -(nH + nRow * (nCols + 1) + nCol + 1) );
+        else
+            fprintf( fp, CPL_FRMT_GIB "\n" CPL_FRMT_GIB "\n"
+                     CPL_FRMT_GIB "\n" CPL_FRMT_GIB "\n0\n",
+                     4 * iCell + 1, 4 * iCell + 2,
+                     4 * iCell + 3, 4 * iCell + 4 );
+    }
+}
+
+/************************************************************************/
+/*                              Generate()                              */
+/************************************************************************/
+
+static int Generate( int nArgc, char **papszArgv )
+
+{
+    const char *pszType = NULL, *pszFilename = NULL;
+    GIntBig nRecords = 0;
+    int nVertices = -1, bShare = TRUE;
+
+    for( int iArg = 0; iArg < nArgc; iArg++ )
+    {
+        if( EQUAL(papszArgv[iArg], "-vertices") && iArg + 1 < nArgc )
+            nVertices = atoi( papszArgv[++iArg] );
+        else if( EQUAL(papszArgv[iArg], "-noshare") )
+            bShare = FALSE;
+        else if( EQUAL(papszArgv[iArg], "-seed") && iArg + 1 < nArgc )
+            nRandomState = (GUInt32) atoi( papszArgv[++iArg] );
+        else if( papszArgv[iArg][0] == '-' )
+            Usage();
+        else if( pszType == NULL )
+            pszType = papszArgv[iArg];
+        else if( nRecords == 0 )
+            nRecords = CPLScanUIntBig( papszArgv[iArg],
+                                       (int) strlen(papszArgv[iArg]) );
+        else if( pszFilename == NULL )
+            pszFilename = papszArgv[iArg];
+        else
+            Usage();
+    }
+
+    if( pszFilename == NULL || nRecords <= 0 )
+        Usage();
+
+    if( nVertices < 0 )
+        nVertices = EQUAL(pszType, "wap") ? 2 : 10;
+    if( nVertices < 2 )
+        Usage();
+
+    FILE *fp = fopen( pszFilename, "wb" );
+    if( fp == NULL )
+    {
+        fprintf( stderr, "Failed to create %s.\n", pszFilename );
+        return 1;
+    }
+    setvbuf( fp, NULL, _IOFBF, 1024 * 1024 );
+
+    double dfStart = GetTime();
+
+    if( EQUAL(pszType, "wat") )
+        GeneratePoints( fp, nRecords );
+    else if( EQUAL(pszType, "wal") )
+        GenerateLines( fp, nRecords, nVertices );
+    else if( EQUAL(pszType, "wap") )
+        GeneratePolygons( fp, nRecords, nVertices, bShare );
+    else
+        Usage();
+
+    // MapGIS ends its files with blank lines.
+    fprintf( fp, "\n\n\n" );
+
+    int bOK = ferror( fp ) == 0;
+    bOK = fclose( fp ) == 0 && bOK;
+    if( !bOK )
+    {
+        fprintf( stderr, "Failed to write %s.\n", pszFilename );
+        return 1;
+    }
+
+    fprintf( stderr, "Wrote " CPL_FRMT_GIB " records to %s in %.2fs.\n",
+             nRecords, pszFilename, GetTime() - dfStart );
+
+    return 0;
+}
+
+/************************************************************************/
+/*                             ScanLayer()                              */
+/*                                                                      */
+/*      Read every feature, returning how many there were.              */
+/************************************************************************/
+
+static GIntBig ScanLayer( OGRLayer *poLayer )
+
+{
+    OGRFeature *poFeature;
+    GIntBig nFeatures = 0;
+
+    poLayer->ResetReading();
+    while( (poFeature = poLayer->GetNextFeature()) != NULL )
+    {
+        nFeatures++;
+        OGRFeature::DestroyFeature( poFeature );
+    }
+
+    return nFeatures;
+}
+
+/************************************************************************/
+/*                             BenchFile()                              */
+/************************************************************************/
+
+static int BenchFile( const char *pszFilename, int nFetch )
+
+{
+    VSIStatBufL sStat;
+
+    if( VSIStatL( pszFilename, &sStat ) != 0 )
+    {
+        fprintf( stderr, "Cannot stat %s.\n", pszFilename );
+        return FALSE;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Open.                                                           */
+/* -------------------------------------------------------------------- */
+    double dfStart = GetTime();
+    OGRDataSource *poDS =
+        OGRSFDriverRegistrar::GetRegistrar()->Open( pszFilename, FALSE );
+    double dfOpen = GetTime() - dfStart;
+
+    if( poDS == NULL || poDS->GetLayerCount() < 1 )
+    {
+        fprintf( stderr, "Failed to open %s.\n", pszFilename );
+        if( poDS != NULL )
+            OGRDataSource::DestroyDataSource( poDS );
+        return FALSE;
+    }
+
+    OGRLayer *poLayer = poDS->GetLayer( 0 );
+
+/* -------------------------------------------------------------------- */
+/*      Full scan.                                                      */
+/* -------------------------------------------------------------------- */
+    dfStart = GetTime();
+    GIntBig nFeatures = ScanLayer( poLayer );
+    double dfScan = GetTime() - dfStart;
+
+/* -------------------------------------------------------------------- */
+/*      Scan filtered to the central 1%% of the extent.                  */
+/* -------------------------------------------------------------------- */
+    OGREnvelope sExtent;
+    GIntBig nFiltered = 0;
+    double dfFiltered = 0.0;
+
+    if( poLayer->GetExtent( &sExtent, TRUE ) == OGRERR_NONE )
+    {
+        double dfCX = (sExtent.MinX + sExtent.MaxX) / 2;
+        double dfCY = (sExtent.MinY + sExtent.MaxY) / 2;
+        double dfHW = (sExtent.MaxX - sExtent.MinX) / 20;
+        double dfHH = (sExtent.MaxY - sExtent.MinY) / 20;
+
+        poLayer->SetSpatialFilterRect( dfCX - dfHW, dfCY - dfHH,
+                                       dfCX + dfHW, dfCY + dfHH );
+        dfStart = GetTime();
+        nFiltered = ScanLayer( poLayer );
+        dfFiltered = GetTime() - dfStart;
+        poLayer->SetSpatialFilter( NULL );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Random access.                                                  */
+/* -------------------------------------------------------------------- */
+    double dfFetch = 0.0;
+
+    if( nFeatures > 0 && nFetch > 0 )
+    {
+        dfStart = GetTime();
+        for( int i = 0; i < nFetch; i++ )
+        {
+            long nFID = (long) (Random() * nFeatures);
+            OGRFeature::DestroyFeature( poLayer->GetFeature( nFID ) );
+        }
+        dfFetch = (GetTime() - dfStart) / nFetch;
+    }
+
+    double dfMB = sStat.st_size / (1024.0 * 1024.0);
+
+    printf( "%s,%s," CPL_FRMT_GIB ",%.3f,%.3f,%.3f,%.0f,%.2f,"
+            CPL_FRMT_GIB ",%.3f,%.1f," CPL_FRMT_GIB "\n",
+            pszFilename, CPLGetExtension( pszFilename ), nFeatures, dfMB,
+            dfOpen * 1000.0, dfScan,
+            dfScan > 0 ? nFeatures / dfScan : 0.0,
+            dfScan > 0 ? dfMB / dfScan : 0.0,
+            nFiltered, dfFiltered, dfFetch * 1e6, GetPeakRSS() );
+    fflush( stdout );
+
+    OGRDataSource::DestroyDataSource( poDS );
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                               Bench()                                */
+/************************************************************************/
+
+static int Bench( int nArgc, char **papszArgv )
+
+{
+    int nFetch = 1000, bHeader = FALSE, bOK = TRUE, nFiles = 0;
+
+    for( int iArg = 0; iArg < nArgc; iArg++ )
+    {
+        if( EQUAL(papszArgv[iArg], "-header") )
+            bHeader = TRUE;
+        else if( EQUAL(papszArgv[iArg], "-fetch") && iArg + 1 < nArgc )
+            nFetch = atoi( papszArgv[++iArg] );
+        else if( EQUAL(papszArgv[iArg], "-seed") && iArg + 1 < nArgc )
+            nRandomState = (GUInt32) atoi( papszArgv[++iArg] );
+        else if( papszArgv[iArg][0] == '-' )
+            Usage();
+        else
+            nFiles++;
+    }
+
+    if( nFiles == 0 )
+        Usage();
+
+    OGRRegisterAll();
+
+    if( bHeader )
+        printf( "file,type,features,size_mb,open_ms,scan_s,features_per_s,"
+                "mb_per_s,filtered_features,filtered_scan_s,"
+                "getfeature_us,peak_rss_kb\n" );
+
+    for( int iArg = 0; iArg < nArgc; iArg++ )
+    {
+        if( EQUAL(papszArgv[iArg], "-fetch")
+            || EQUAL(papszArgv[iArg], "-seed") )
+            iArg++;
+        else if( papszArgv[iArg][0] != '-' )
+            bOK = BenchFile( papszArgv[iArg], nFetch ) && bOK;
+    }
+
+    return bOK ? 0 : 1;
+}
+
+/************************************************************************/
+/*                                main()                                */
+/************************************************************************/
+
+int main( int nArgc, char **papszArgv )
+
+{
+    if( nArgc < 2 )
+        Usage();
+
+    if( EQUAL(papszArgv[1], "generate") )
+        return Generate( nArgc - 2, papszArgv + 2 );
+    if( EQUAL(papszArgv[1], "bench") )
+        return Bench( nArgc - 2, papszArgv + 2 );
+
+    Usage();
+    return 1;
+}
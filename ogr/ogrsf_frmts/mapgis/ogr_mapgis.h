@@ -32,21 +32,798 @@
 #define _OGRMapGIS_H_INCLUDED
 
 #include "ogrsf_frmts.h"
+#include "cpl_string.h"
+#include <algorithm>
+#include <deque>
+#include <list>
 #include <map>
+#include <vector>
+
+/************************************************************************/
+/*                            OGRMapGISReader                           */
+/*                                                                      */
+/*      Block buffered reader over a WMAP text file.  Lines and tokens  */
+/*      are returned as views into the read buffer, so nothing is       */
+/*      allocated per line or per token.  Views are only valid until    */
+/*      the next read or seek.                                          */
+/*                                                                      */
+/*      A reader given its file name owns the file and may close it     */
+/*      while idle; it is reopened where reading left off when more     */
+/*      data is needed.  The file is closed once its end is read, and   */
+/*      an OGRMapGISFilePool bounds the number left open.               */
+/************************************************************************/
+
+typedef struct
+{
+    const char         *pszValue;
+    int                 nLength;
+} OGRMapGISToken;
+
+int       OGRMapGISSplitLine( const char *pszLine, int nLength,
+                              OGRMapGISToken *pasTokens, int nMaxTokens );
+CPLString OGRMapGISTokenToString( const OGRMapGISToken *psToken );
+
+/* Bytes that must stay readable past the end of a line handed to */
+/* OGRMapGISParseVertex(); the SIMD kernels load 16 bytes at a time. */
+#define MAPGIS_VERTEX_PADDING   32
+
+void      OGRMapGISInitVertexParser();
+int       OGRMapGISParseVertex( const char *pszLine,
+                                double *pdfX, double *pdfY );
+double    OGRMapGISParseNumber( const char *pszValue );
+int       OGRMapGISParseInteger( const char *pszValue );
+void      OGRMapGISGetExtent( int nCount, const double *padfX,
+                              const double *padfY, OGREnvelope *psExtent );
+
+/* -------------------------------------------------------------------- */
+/*      Counters and timers of the read path, see                       */
+/*      OGRMapGISLayer::GetMetadata().  A set is only updated by one    */
+/*      thread at a time: worker batches count into their own and the   */
+/*      layer adds them up.  Times are in seconds, and summed over      */
+/*      threads.  Building with MAPGIS_DISABLE_STATS defined compiles   */
+/*      the instrumentation out.                                        */
+/* -------------------------------------------------------------------- */
+
+typedef struct
+{
+    GIntBig             nBytesRead;
+    GIntBig             nLines;
+    GIntBig             nTokens;
+    GIntBig             nVertices;
+    GIntBig             nArcLookups;
+    GIntBig             nFeatures;
+    GIntBig             nFiltered;
+    double              dfReadTime;         /* file reads */
+    double              dfDecodeTime;       /* records to features */
+    double              dfArcScanTime;      /* loading the WAP arcs */
+    double              dfGeometryTime;     /* polygon assembly */
+} OGRMapGISStats;
+
+void      OGRMapGISAddStats( OGRMapGISStats *psTotal,
+                             const OGRMapGISStats *psStats );
+double    OGRMapGISGetTime();
+
+#ifndef MAPGIS_DISABLE_STATS
+#  define MAPGIS_STAT_ADD(psStats, nField, nValue) \
+    do { if( (psStats) != NULL ) (psStats)->nField += (nValue); } while( 0 )
+#  define MAPGIS_STAT_START(dfStart) \
+    double dfStart = OGRMapGISGetTime()
+#  define MAPGIS_STAT_STOP(psStats, dfField, dfStart) \
+    MAPGIS_STAT_ADD(psStats, dfField, OGRMapGISGetTime() - (dfStart))
+#else
+#  define MAPGIS_STAT_ADD(psStats, nField, nValue)
+#  define MAPGIS_STAT_START(dfStart)
+#  define MAPGIS_STAT_STOP(psStats, dfField, dfStart)
+#endif
+
+class OGRMapGISReader;
+
+class OGRMapGISFilePool
+{
+    int                 nMaxOpen;
+    std::list<OGRMapGISReader *> apoOpen;   /* most recently used first */
+
+  public:
+                        OGRMapGISFilePool();
+
+    void                Touch( OGRMapGISReader *poReader );
+    void                Remove( OGRMapGISReader *poReader );
+};
+
+class OGRMapGISReader
+{
+    VSILFILE           *fp;
+    CPLString           osFilename;
+    OGRMapGISFilePool  *poFilePool;
+    int                 bOwnsBuffer;
+
+    char               *pabyBuffer;
+    size_t              nBufferAlloc;
+    size_t              nBufferSize;
+    size_t              nBufferPos;
+    size_t              nReadSize;
+    vsi_l_offset        nBufferOffset;
+    vsi_l_offset        nLineOffset;
+    int                 bEOF;
+    int                 bMarked;
+    vsi_l_offset        nMarkOffset;
+    OGRMapGISStats     *psStats;
+
+    /* Bytes overwritten to terminate lines still in the buffer. */
+    std::vector<vsi_l_offset> anEOLOffset;
+    std::vector<char>   achEOL;
+
+    int                 FillBuffer();
+    int                 ReopenFile();
+    void                TerminateLine( size_t nPos );
+
+  public:
+                        OGRMapGISReader( VSILFILE *fp );
+                        OGRMapGISReader( const char *pszFilename,
+                                         VSILFILE *fp,
+                                         OGRMapGISFilePool *poFilePool );
+                        OGRMapGISReader( char *pabyData, size_t nSize );
+                        ~OGRMapGISReader();
+
+    const char         *ReadLine( int *pnLength = NULL,
+                                  int bHonourStrings = FALSE );
+    int                 ReadTokens( OGRMapGISToken *pasTokens,
+                                    int nMaxTokens );
+    int                 SkipLines( int nLines );
+    int                 ReadVertices( int nCount,
+                                      double *padfX, double *padfY );
+    size_t              Read( char *pabyDest, size_t nSize );
+
+    void                SetMark();
+    void                ClearMark();
+
+    void                CloseFile();
+
+    void                SetStats( OGRMapGISStats *psStatsIn )
+                        { psStats = psStatsIn; }
+
+    vsi_l_offset        GetLineOffset() { return nLineOffset; }
+    vsi_l_offset        Tell();
+    int                 Seek( vsi_l_offset nOffset );
+};
+
+/************************************************************************/
+/*                           OGRMapGISArcStore                          */
+/*                                                                      */
+/*      The arcs of a WAP file, kept as two flat x and y arrays with    */
+/*      per arc start, vertex count, extent and length arrays indexed   */
+/*      directly by arc id.  An arc with a vertex count of zero does    */
+/*      not exist.                                                      */
+/*                                                                      */
+/*      The topology of the file is kept too: the from and to node and  */
+/*      the left and right polygon of each arc, and per node its        */
+/*      position and the signed ids of the arcs starting (+) or ending  */
+/*      (-) there.  Node ids are 1-based, in file order.                */
+/*                                                                      */
+/*      In lazy mode only the file offset of each arc's vertices is     */
+/*      kept; coordinates are decoded on demand through a separate      */
+/*      file handle and held in an LRU cache of bounded size.           */
+/*                                                                      */
+/*      Otherwise, once all arcs are in, Pack() may replace the x and   */
+/*      y arrays by abyPacked: coordinates as integer multiples of a    */
+/*      layer step from a layer origin, in millionths (the precision    */
+/*      of the file), each arc as its first vertex followed by zig-zag  */
+/*      deltas of the smallest byte width that holds them.  anStart is  */
+/*      then a byte offset.  Packing is only kept if every vertex       */
+/*      decodes to the very same double.                                */
+/************************************************************************/
+
+typedef struct
+{
+    int                 nArcId;
+    int                 iPrev;
+    int                 iNext;
+    double             *padfX;
+    double             *padfY;
+} OGRMapGISCachedArc;
+
+class OGRMapGISArcStore
+{
+    std::vector<double> adfX;
+    std::vector<double> adfY;
+    std::vector<size_t> anStart;
+    std::vector<int>    anCount;
+    std::vector<OGREnvelope> asExtent;
+    std::vector<double> adfLength;
+    int                 nArcCount;
+
+    std::vector<int>    anFromNode;
+    std::vector<int>    anToNode;
+    std::vector<int>    anLeftPolygon;
+    std::vector<int>    anRightPolygon;
+    std::vector<double> adfNodeX;
+    std::vector<double> adfNodeY;
+    std::vector<int>    anNodeArcStart;
+    std::vector<int>    anNodeArcs;
+    size_t              nVertexTotal;
+
+    int                 bPacked;
+    std::vector<GByte>  abyPacked;
+    double              dfOriginX;
+    double              dfOriginY;
+    double              dfStepX;
+    double              dfStepY;
+    void                UnpackArc( int nArcId, double *padfXOut,
+                                   double *padfYOut ) const;
+
+    int                 bLazy;
+    char               *pszFilename;
+    VSILFILE           *fp;
+    OGRMapGISReader    *poReader;
+    std::vector<vsi_l_offset> anOffset;
+    std::vector<int>    anCacheSlot;
+    std::vector<OGRMapGISCachedArc> asCache;
+    std::vector<int>    anFreeSlots;
+    int                 iMostRecent;
+    int                 iLeastRecent;
+    size_t              nCacheBudget;
+    size_t              nCacheUsed;
+    int                 nCacheHits;
+    int                 nCacheMisses;
+    int                 nCacheEvictions;
+
+    void                GrowTo( int nArcId );
+    void                Unlink( int iSlot );
+    void                LinkFirst( int iSlot );
+    int                 LoadArc( int nArcId );
+    void                FreeSlot( int iSlot );
+
+  public:
+                        OGRMapGISArcStore();
+                        ~OGRMapGISArcStore();
+
+    void                SetLazy( const char *pszFilename,
+                                 size_t nBudgetBytes );
+    int                 IsLazy() const { return bLazy; }
+
+    void                Reserve( int nArcs );
+    int                 AddArc( int nArcId, int nCount,
+                                const double *padfX, const double *padfY,
+                                double dfLength, vsi_l_offset nOffset );
+    void                SetTopology( int nArcId, int nFromNode, int nToNode,
+                                     int nLeftPolygon, int nRightPolygon );
+    void                AddNode( double dfX, double dfY,
+                                 int nArcs, const int *panArcs );
+    void                Shrink();
+    int                 Pack();
+    int                 IsPacked() const { return bPacked; }
+
+    int                 GetArcCount() const { return nArcCount; }
+    int                 GetMaxArcId() const
+                        { return (int) anCount.size() - 1; }
+    int                 HasArc( int nArcId ) const
+                        { return nArcId > 0 && nArcId < (int) anCount.size()
+                                 && anCount[nArcId] > 0; }
+    int                 GetVertexCount( int nArcId ) const
+                        { return anCount[nArcId]; }
+    int                 FetchArc( int nArcId, const double **ppadfX,
+                                  const double **ppadfY,
+                                  std::vector<double> &adfWork );
+    const OGREnvelope  &GetExtent( int nArcId ) const
+                        { return asExtent[nArcId]; }
+    double              GetLength( int nArcId ) const
+                        { return adfLength[nArcId]; }
+    int                 GetFromNode( int nArcId ) const
+                        { return anFromNode[nArcId]; }
+    int                 GetToNode( int nArcId ) const
+                        { return anToNode[nArcId]; }
+    int                 GetLeftPolygon( int nArcId ) const
+                        { return anLeftPolygon[nArcId]; }
+    int                 GetRightPolygon( int nArcId ) const
+                        { return anRightPolygon[nArcId]; }
+
+    int                 GetNodeCount() const { return (int) adfNodeX.size(); }
+    double              GetNodeX( int nNodeId ) const
+                        { return adfNodeX[nNodeId-1]; }
+    double              GetNodeY( int nNodeId ) const
+                        { return adfNodeY[nNodeId-1]; }
+    int                 GetNodeArcs( int nNodeId,
+                                     const int **ppanArcs ) const;
+
+    size_t              GetVertexTotal() const { return nVertexTotal; }
+    size_t              GetMemoryUsage() const;
+
+    int                 GetCacheHits() const { return nCacheHits; }
+    int                 GetCacheMisses() const { return nCacheMisses; }
+};
+
+/************************************************************************/
+/*                        OGRMapGISFeatureArrays                        */
+/*                                                                      */
+/*      A run of features laid out column by column, as filled by       */
+/*      OGRMapGISLayer::GetNextFeatureArrays().  Feature i has the      */
+/*      parts anPartStart[i] to anPartStart[i+1]-1, and part j the      */
+/*      vertices anVertexStart[j] to anVertexStart[j+1]-1 of adfX/Y:    */
+/*      one part of one vertex for a point, one part for a line and     */
+/*      one per ring for a polygon, the outer ring first.               */
+/*                                                                      */
+/*      The attribute columns are indexed by field of the layer         */
+/*      definition.  Each has a set flag per feature and the values in  */
+/*      the array of its type; text is NUL terminated in aachText,      */
+/*      starting at aanTextStart.  Columns of ignored fields stay       */
+/*      empty, and features have no parts if the geometry is ignored.   */
+/************************************************************************/
+
+class OGRMapGISFeatureArrays
+{
+    int                 featureType;
+    std::vector<int>    anColumns;      /* fields that are not ignored */
+    std::vector<OGRFieldType> aeColumnType;
+
+  public:
+    int                 nFeatures;
+    std::vector<long>   anFID;
+    std::vector<int>    anPartStart;
+    std::vector<int>    anVertexStart;
+    std::vector<double> adfX;
+    std::vector<double> adfY;
+
+    std::vector< std::vector<GByte> > aabySet;
+    std::vector< std::vector<int> > aanInteger;
+    std::vector< std::vector<double> > aadfReal;
+    std::vector< std::vector<int> > aanTextStart;
+    std::vector< std::vector<char> > aachText;
+
+                        OGRMapGISFeatureArrays();
+
+    void                Reset( OGRFeatureDefn *poDefn, int featureType );
+    void                Truncate( int nFeaturesIn );
+
+    void                BeginFeature( long nFID );
+    void                SetInteger( int iField, int nValue )
+                        { aabySet[iField].back() = 1;
+                          aanInteger[iField].back() = nValue; }
+    void                SetReal( int iField, double dfValue )
+                        { aabySet[iField].back() = 1;
+                          aadfReal[iField].back() = dfValue; }
+    void                SetString( int iField, const char *pszValue,
+                                   int nLength );
+    void                AddPart( int nCount, const double *padfXIn,
+                                 const double *padfYIn );
+    void                EndFeature();
+    void                ClearLastGeometry();
+
+    int                 GetPartCount() const
+                        { return (int) anVertexStart.size() - 1; }
+    int                 IsFieldSet( int iFeature, int iField ) const
+                        { return !aabySet[iField].empty()
+                                 && aabySet[iField][iFeature]; }
+    const char         *GetString( int iFeature, int iField ) const
+                        { return &aachText[iField][0]
+                                 + aanTextStart[iField][iFeature]; }
+    int                 GetBounds( int iFeature, double *padfBounds ) const;
+    OGRGeometry        *GetGeometry( int iFeature ) const;
+    void                GetFeature( int iFeature, OGRFeature *poFeature,
+                                    int bGeometry ) const;
+};
+
+/************************************************************************/
+/*                         OGRMapGISRingBuilder                         */
+/*                                                                      */
+/*      Assembles WAP polygons from arc id lists, reusing its vertex    */
+/*      scratch arrays from one polygon to the next.                    */
+/************************************************************************/
+
+class OGRMapGISRingBuilder
+{
+    std::vector<double> adfX;
+    std::vector<double> adfY;
+    std::vector<double> adfArcWork;
+    OGRMapGISStats     *psStats;
+
+    void                AppendArc( OGRMapGISArcStore *poArcs, int nArcId );
+    int                 CloseRing();
+    void                FlushRing( OGRPolygon *poPolygon );
+
+  public:
+                        OGRMapGISRingBuilder() { psStats = NULL; }
+
+    void                SetStats( OGRMapGISStats *psStatsIn )
+                        { psStats = psStatsIn; }
+
+    OGRPolygon         *BuildPolygon( OGRMapGISArcStore *poArcs,
+                                      const int *panArcIds, int nArcIds );
+    void                BuildRings( OGRMapGISArcStore *poArcs,
+                                    const int *panArcIds, int nArcIds,
+                                    OGRMapGISFeatureArrays *poArrays );
+};
+
+/************************************************************************/
+/*                           OGRMapGISScratch                           */
+/*                                                                      */
+/*      Work arrays for decoding records, one set per read position.    */
+/************************************************************************/
+
+class OGRMapGISScratch
+{
+  public:
+    std::vector<double> adfX;
+    std::vector<double> adfY;
+    std::vector<int>    anArcIds;
+    OGRMapGISRingBuilder oRingBuilder;
+
+    int                 ReadVertexRun( OGRMapGISReader *poReader,
+                                       int nCount );
+};
+
+/* -------------------------------------------------------------------- */
+/*      Attribute fields, after the leading "Layer" field.  Each field  */
+/*      names its column in the two attribute line layouts of the       */
+/*      file type, or -1 if the layout does not carry it:               */
+/*                                                                      */
+/*        WAT: annotation lines, sub-graph lines                        */
+/*        WAL: style line, id/length line after the vertices            */
+/*        WAP: polygon parameter line                                   */
+/* -------------------------------------------------------------------- */
+
+#define MAPGIS_MAX_COLUMNS      20
+
+/* Index of the first attribute field; field 0 is "Layer". */
+#define MAPGIS_FIRST_FIELD      1
+
+/* pszDefault is what the writer puts in the column when the feature    */
+/* has no such field; NULL if the value is derived from the record.     */
+typedef struct
+{
+    const char         *pszName;
+    OGRFieldType        eType;
+    int                 aiColumn[2];
+    const char         *pszDefault;
+} OGRMapGISFieldInfo;
+
+const OGRMapGISFieldInfo *OGRMapGISGetFieldInfo( int featureType,
+                                                 int *pnFieldInfo );
+int       OGRMapGISGetPointLayout( const OGRMapGISToken *pasTokens,
+                                   int nTokens );
+int       OGRMapGISParseField( const OGRMapGISFieldInfo *psInfo, int iLayout,
+                               const OGRMapGISToken *pasTokens, int nTokens,
+                               OGRField *psField, CPLString &osValue );
+
+/************************************************************************/
+/*                          OGRMapGISWorkerPool                         */
+/*                                                                      */
+/*      A fixed set of threads running OGRMapGISTasks in submission     */
+/*      order.  Only the CPL mutex and thread primitives are used, so   */
+/*      waiting is done by polling.                                     */
+/************************************************************************/
+
+#define MAPGIS_TASK_QUEUED      0
+#define MAPGIS_TASK_RUNNING     1
+#define MAPGIS_TASK_DONE        2
+#define MAPGIS_TASK_CANCELLED   3
+
+class OGRMapGISTask
+{
+  public:
+    int                 nState;     /* guarded by the pool mutex */
+
+                        OGRMapGISTask() { nState = MAPGIS_TASK_DONE; }
+    virtual            ~OGRMapGISTask() {}
+
+    virtual void        Run() = 0;
+};
+
+class OGRMapGISWorkerPool
+{
+    void               *hMutex;
+    std::deque<OGRMapGISTask *> apoQueue;
+    int                 nThreads;
+    int                 nRunning;
+    int                 bStop;
+
+    static void         WorkerMain( void *pPool );
+
+  public:
+                        OGRMapGISWorkerPool( int nThreads );
+                        ~OGRMapGISWorkerPool();
+
+    int                 GetThreadCount() { return nThreads; }
+    void                Submit( OGRMapGISTask *poTask );
+    int                 Finish( OGRMapGISTask *poTask, int bRun );
+};
+
+int       OGRMapGISGetThreadCount();
+
+/************************************************************************/
+/*                            OGRMapGISBatch                            */
+/*                                                                      */
+/*      Consecutive records read ahead by the layer and decoded by a    */
+/*      worker.  anOffset holds the file offset of each record.         */
+/*      TakeFeature() is only called from the reading thread once the   */
+/*      batch has run, and returns NULL for records that produce no     */
+/*      feature.  sStats counts the work of the worker.                 */
+/************************************************************************/
+
+class OGRMapGISBatch : public OGRMapGISTask
+{
+  public:
+    int                 nFirstRecord;
+    std::vector<vsi_l_offset> anOffset;
+    OGRMapGISStats      sStats;
+
+                        OGRMapGISBatch( int nFirstRecordIn )
+                        { nFirstRecord = nFirstRecordIn;
+                          memset( &sStats, 0, sizeof(sStats) ); }
+
+    int                 GetRecordCount() { return (int) anOffset.size(); }
+    virtual OGRFeature *TakeFeature( int iRecord ) = 0;
+};
+
+/************************************************************************/
+/*                         OGRMapGISPolygonBatch                        */
+/*                                                                      */
+/*      Attributes and arc id lists of consecutive WAP polygon          */
+/*      records, read by the layer and turned into polygons by a        */
+/*      worker.  Records the attribute filter rejected have no          */
+/*      feature and no arcs.                                            */
+/************************************************************************/
+
+class OGRMapGISPolygonBatch : public OGRMapGISBatch
+{
+  public:
+    OGRMapGISArcStore  *poArcs;
+    std::vector<int>    anArcStart;
+    std::vector<int>    anArcIds;
+    std::vector<OGRFeature *> apoFeatures;
+    std::vector<OGRGeometry *> apoGeometries;
+
+                        OGRMapGISPolygonBatch( OGRMapGISArcStore *poArcsIn,
+                                               int nFirstRecordIn );
+    virtual            ~OGRMapGISPolygonBatch();
+
+    virtual void        Run();
+    virtual OGRFeature *TakeFeature( int iRecord );
+};
+
+/************************************************************************/
+/*                         OGRMapGISRecordBatch                         */
+/*                                                                      */
+/*      The raw text of consecutive WAT or WAL records, split at        */
+/*      record boundaries by the layer and parsed by a worker into      */
+/*      attribute values and geometries.  Features are only created     */
+/*      in the reading thread, as OGRFeature references its             */
+/*      definition without locking.                                     */
+/************************************************************************/
+
+class OGRMapGISRecordBatch : public OGRMapGISBatch
+{
+    int                 ParseRecord( OGRMapGISReader *poRecordReader,
+                                     int iRecord );
+    void                ParseFields( int iRecord, int iLayout,
+                                     const OGRMapGISToken *pasTokens,
+                                     int nTokens );
+
+  public:
+    int                 featureType;
+    OGRFeatureDefn     *poFeatureDefn;
+    const OGRMapGISFieldInfo *pasFieldInfo;
+    std::vector<int>    anReadFields;
+    int                 anReadColumns[2];
+    const char         *pszLayerValue;
+    int                 bSkipGeometry;
+
+    std::vector<char>   abyData;
+    size_t              nDataSize;
+    int                 nParsed;
+    std::vector<OGRField> asFields;
+    std::vector<double> adfX;
+    std::vector<double> adfY;
+    std::vector<OGRGeometry *> apoGeometries;
+
+                        OGRMapGISRecordBatch( int nFirstRecordIn );
+    virtual            ~OGRMapGISRecordBatch();
+
+    virtual void        Run();
+    virtual OGRFeature *TakeFeature( int iRecord );
+};
+
+/************************************************************************/
+/*                            OGRMapGISCache                            */
+/*                                                                      */
+/*      A parsed copy of a layer kept beside the source as a            */
+/*      <source>.mgc sidecar, column by column: record offsets and      */
+/*      extents, one array per attribute field, the vertices of every   */
+/*      record and, for WAP files, the arcs and nodes.  The file is     */
+/*      mapped into memory and features are built from it without       */
+/*      reading the text.  It is only used while the source keeps the   */
+/*      size, modification time and leading bytes it was written for.   */
+/************************************************************************/
+
+class OGRMapGISCache
+{
+    GByte              *pabyData;
+    size_t              nSize;
+    void               *hMapping;
+    int                 bMapped;
+
+    int                 featureType;
+    int                 nRecords;
+    int                 nFieldInfo;
+    const OGRMapGISFieldInfo *pasFieldInfo;
+    vsi_l_offset        nFirstRecordOffset;
+    OGREnvelope         sExtent;
+    int                 bExtentKnown;
+
+    const GUIntBig     *panRecordOffset;
+    const double       *padfRecordBounds;
+    std::vector<const GByte *> apabyFieldSet;
+    std::vector<const GByte *> apabyFieldValues;
+    std::vector<const char *> apszFieldText;
+    const GUInt32      *panRecordPart;
+    const GUIntBig     *panPartStart;
+    const double       *padfX;
+    const double       *padfY;
+
+    int                 nArcs;
+    const GInt32       *panArcId;
+    const double       *padfArcLength;
+    const GUIntBig     *panArcStart;
+    const double       *padfArcX;
+    const double       *padfArcY;
+    const GInt32       *panArcTopology;
+    int                 nNodes;
+    const double       *padfNodeX;
+    const double       *padfNodeY;
+    const GUInt32      *panNodeArcStart;
+    const GInt32       *panNodeArcs;
+
+    int                 Map( const char *pszFilename );
+    int                 Parse( const GByte *pabyExpected );
+
+  public:
+                        OGRMapGISCache();
+                        ~OGRMapGISCache();
+
+    static CPLString    GetFilename( const char *pszSource );
+    static int          GetSourceKey( const char *pszSource,
+                                      GByte *pabyKey );
+    static OGRMapGISCache *Open( const char *pszSource, int featureType );
+
+    int                 GetRecordCount() const { return nRecords; }
+    vsi_l_offset        GetFirstRecordOffset() const
+                        { return nFirstRecordOffset; }
+    vsi_l_offset        GetRecordOffset( int iRecord ) const
+                        { return (vsi_l_offset) panRecordOffset[iRecord]; }
+    int                 GetExtent( OGREnvelope *psExtent ) const;
+    const double       *GetRecordBounds( int iRecord ) const
+                        { return padfRecordBounds + 4 * (size_t) iRecord; }
+
+    void                SetFields( OGRFeature *poFeature, int iRecord,
+                                   const std::vector<int> &anFields ) const;
+    OGRGeometry        *GetGeometry( int iRecord ) const;
+    void                CopyFields( int iRecord,
+                                    const std::vector<int> &anFields,
+                                    OGRMapGISFeatureArrays *poArrays ) const;
+    void                CopyGeometry( int iRecord,
+                                      OGRMapGISFeatureArrays *poArrays ) const;
+
+    int                 HasArcs() const { return nArcs >= 0; }
+    void                LoadArcs( OGRMapGISArcStore *poArcs ) const;
+};
 
 /************************************************************************/
 /*                            OGRMapGISLayer                             */
+/*                                                                      */
+/*      anRecordIndex holds the file offset of every                    */
+/*      MAPGIS_INDEX_INTERVAL'th feature record, and anRecordDelta      */
+/*      the offset of every record relative to the start of its block,  */
+/*      both filled in as the layer is read.  FIDs are record ordinals. */
+/*      Once complete the index is saved to a <source>.fdx sidecar.     */
+/*                                                                      */
+/*      Opening only reads the count line; arcs and the record index    */
+/*      are loaded by Initialize() when records are first needed.       */
+/*                                                                      */
+/*      With MAPGIS_CACHE=YES records are served from an                */
+/*      OGRMapGISCache, written by Initialize() if there is none.       */
 /************************************************************************/
 
+#define MAPGIS_INDEX_INTERVAL   1024
+
+/* Results of OGRMapGISLayer::ReadRecordExtent(). */
+#define MAPGIS_EXTENT_ERROR     -1
+#define MAPGIS_EXTENT_END       0
+#define MAPGIS_EXTENT_FOUND     1
+#define MAPGIS_EXTENT_EMPTY     2
+
+class OGRMapGISCursor;
+
 class OGRMapGISLayer : public OGRLayer
 {
-	VSILFILE           *fp;
+	OGRMapGISReader    *poReader;
 	int                featureType; 
 	OGRMapGISLayer       **papoLayers;
 	int                 nLayers;
     OGRFeatureDefn     *poFeatureDefn;
-	int                 idataBufferOffset; // λ
-    std::map<long, OGRFeature*> arcFeatures;
+	vsi_l_offset        nFirstRecordOffset;
+	std::vector<vsi_l_offset> anRecordIndex;
+	std::vector<GUInt32> anRecordDelta;
+	int                 bRecordIndexComplete;
+	int                 iNextRecord;
+	int                 bResumePending;
+	vsi_l_offset        nResumeOffset;
+	int                 iResumeRecord;
+	void                IndexRecord( vsi_l_offset nRecordOffset );
+	void                EndOfRecords();
+	int                 EndOfExtentScan();
+	int                 SkipRecord();
+	int                 SeekToRecord( long nIndex );
+	int                 CompleteRecordIndex();
+	int                 ReadRecordIndex();
+	int                 WriteRecordIndex();
+	int                 PeekRecordCount();
+	int                 PeekExtent( OGREnvelope *psExtent );
+	OGREnvelope         sLayerExtent;
+	int                 bExtentKnown;
+	int                 ComputeExtent();
+	int                 bInitialized;
+	int                 nArcCount;
+	void                Initialize();
+	OGRMapGISCache     *poCache;
+	int                 BuildCache();
+	void                UseCache();
+	OGRFeature         *ReadCachedRecord( int iRecord, OGRFeatureDefn *poDefn,
+										  int bSkipGeometry, int *pbFiltered );
+	int                 CachedRecordInFilter( int iRecord );
+	int                 BoundsInFilter( const double *padfBounds );
+	int                 DecodeCachedArrays( OGRMapGISFeatureArrays *poArrays,
+											int iRecord, int bSkipGeometry,
+											OGRFeature *poQueryFeature );
+	OGRFeature         *GetNextCachedFeature();
+	int                 CountCachedRecords();
+	OGRFeature         *TranslateRecord( int *pbFiltered = NULL );
+	OGRFeature         *DecodeRecord( OGRMapGISReader *poRecordReader,
+									  OGRFeatureDefn *poDefn,
+									  OGRMapGISScratch *poScratch,
+									  int bSkipGeometry, int *pbFiltered );
+	const OGRMapGISFieldInfo *pasFieldInfo;
+	int                 nFieldInfo;
+	std::vector<int>    anReadFields;
+	int                 anReadColumns[2];
+	int                 bLayerFieldIgnored;
+	void                ComputeReadColumns();
+	int                 SkipGeometry();
+	void                SetRecordFields( OGRFeature *poFeature, int iLayout,
+										 const OGRMapGISToken *pasTokens,
+										 int nTokens );
+	int                 bAttrQueryNeedsGeometry;
+	OGRMapGISFeatureArrays oArrays;
+	void                SetRecordColumns( OGRMapGISFeatureArrays *poArrays,
+										  int iLayout,
+										  const OGRMapGISToken *pasTokens,
+										  int nTokens );
+	int                 DecodeRecordArrays( OGRMapGISFeatureArrays *poArrays,
+											int bSkipGeometry,
+											OGRFeature *poQueryFeature );
+	int                 ArraysInFilter( OGRMapGISFeatureArrays *poArrays,
+										int nMatch,
+										OGRFeature *poQueryFeature );
+	int                 ReadRecordExtent( OGREnvelope *psExtent );
+	void                SuspendReading();
+	int                 ScanArcs( int nArcCount );
+    OGRMapGISArcStore   oArcs;
+    void               *hArcMutex;
+    OGRMapGISScratch    oScratch;
+
+    OGRMapGISStats      sStats;
+    char              **papszStats;
+    CPLString           osStatsInfo;
+    void                DeleteBatch( OGRMapGISBatch *poBatch );
+
+    int                 nThreads;
+    OGRMapGISWorkerPool *poPool;
+    std::deque<OGRMapGISBatch *> apoBatches;
+    int                 iBatchRecord;
+    int                 bBatchesAtEnd;
+    OGRMapGISBatch     *ReadPolygonBatch();
+    OGRMapGISBatch     *ReadRecordBatch();
+    OGRFeature         *GetNextBatchedFeature();
+    void                DiscardBatches();
+    void                StopWorkers();
 
     OGRSpatialReference *poSRS;
 
@@ -68,28 +845,45 @@ class OGRMapGISLayer : public OGRLayer
     int                 bHeaderDirty;
 
     int                 bCheckedForQIX;
+    std::vector<GByte>  abyQIX;
 
     int                 CheckForQIX();
+    int                 RecordInFilter( vsi_l_offset nRecordOffset,
+                                        const OGREnvelope &sExtent );
 
     int                 bSbnSbxDeleted;
 
+    friend class OGRMapGISCursor;
+    friend class OGRMapGISArcLayer;
+
   public:
+    OGRMapGISCursor    *CreateCursor();
+
     OGRErr              CreateSpatialIndex( int nMaxDepth );
     OGRErr              DropSpatialIndex();
     OGRErr              Repack();
 
     const char         *GetFullName() { return pszFullName; }
 
+    char              **GetMetadata( const char *pszDomain = "" );
+    virtual const char *GetInfo( const char *pszTag );
+
   public:
-                        OGRMapGISLayer(	const char *pszLayerNameIn,
-							VSILFILE *fp, int featureType);
+                        OGRMapGISLayer(	const char *pszFilename,
+							const char *pszLayerNameIn,
+							VSILFILE *fp, int featureType,
+							OGRMapGISFilePool *poFilePool );
                         ~OGRMapGISLayer();
 
     void                ResetReading();
     OGRFeature *        FetchMapGIS(int iMapGISId);
     OGRFeature *        GetNextFeature();
 	OGRFeature *		GetNextUnfilteredFeature();
+    OGRMapGISFeatureArrays *GetNextFeatureArrays( int nMaxFeatures,
+                                    OGRMapGISFeatureArrays *poArrays = NULL );
+    virtual OGRErr      SetAttributeFilter( const char *pszQuery );
     virtual OGRErr      SetNextByIndex( long nIndex );
+    virtual OGRErr      SetIgnoredFields( const char **papszFields );
 
     OGRFeature         *GetFeature( long nFeatureId );
     OGRErr              SetFeature( OGRFeature *poFeature );
@@ -100,6 +894,7 @@ class OGRMapGISLayer : public OGRLayer
     OGRFeatureDefn *    GetLayerDefn() { return poFeatureDefn; }
 
     int                 GetFeatureCount( int );
+    virtual OGRErr      GetExtent( OGREnvelope *psExtent, int bForce = TRUE );
 
     virtual OGRErr      CreateField( OGRFieldDefn *poField,
                                      int bApproxOK = TRUE );
@@ -109,16 +904,292 @@ class OGRMapGISLayer : public OGRLayer
     int                 TestCapability( const char * );
 };
 
+/************************************************************************/
+/*                            OGRMapGISCursor                           */
+/*                                                                      */
+/*      An independent read position on a layer, see                    */
+/*      OGRMapGISLayer::CreateCursor().  Each cursor has its own file   */
+/*      handle, read buffer, work arrays and copy of the layer          */
+/*      definition, and shares the arcs and record index of the layer   */
+/*      read only, so cursors of one layer can be used from different   */
+/*      threads, one thread per cursor.  Filters of the layer do not    */
+/*      apply.  Cursors must be deleted before their layer.             */
+/************************************************************************/
+
+class OGRMapGISCursor
+{
+    OGRMapGISLayer     *poLayer;
+    OGRMapGISReader    *poReader;
+    OGRFeatureDefn     *poFeatureDefn;
+    OGRMapGISScratch    oScratch;
+    int                 iNextRecord;
+
+  public:
+                        OGRMapGISCursor( OGRMapGISLayer *poLayer,
+                                         VSILFILE *fp );
+                        ~OGRMapGISCursor();
+
+    void                ResetReading();
+    OGRFeature         *GetNextFeature();
+    OGRFeature         *GetFeature( long nFID );
+
+    OGRFeatureDefn     *GetLayerDefn() { return poFeatureDefn; }
+};
+
+/************************************************************************/
+/*                           OGRMapGISArcLayer                          */
+/*                                                                      */
+/*      The arcs or the nodes of a WAP layer, read from the arc store   */
+/*      of that layer, so a boundary two polygons share is read once.   */
+/*      Arcs carry their from and to node and their left and right      */
+/*      polygon, polygon 0 being the outside; nodes the signed ids of   */
+/*      the arcs starting (+) or ending (-) there.  FIDs are the arc    */
+/*      and node ids.  The WAP layer must outlive this one.             */
+/************************************************************************/
+
+class OGRMapGISArcLayer : public OGRLayer
+{
+    OGRMapGISLayer     *poPolygonLayer;
+    int                 bNodes;
+    OGRFeatureDefn     *poFeatureDefn;
+    long                nNextFID;
+
+    long                GetMaxFID();
+    OGRFeature         *BuildFeature( long nFID, int bSkipGeometry );
+    int                 SkipGeometry();
+
+  public:
+                        OGRMapGISArcLayer( OGRMapGISLayer *poPolygonLayer,
+                                           int bNodes );
+                        ~OGRMapGISArcLayer();
+
+    void                ResetReading();
+    OGRFeature         *GetNextFeature();
+    OGRFeature         *GetFeature( long nFID );
+
+    OGRFeatureDefn     *GetLayerDefn() { return poFeatureDefn; }
+
+    int                 GetFeatureCount( int bForce = TRUE );
+    virtual OGRErr      GetExtent( OGREnvelope *psExtent, int bForce = TRUE );
+    virtual OGRSpatialReference *GetSpatialRef()
+                        { return poPolygonLayer->GetSpatialRef(); }
+
+    int                 TestCapability( const char * );
+};
+
+/************************************************************************/
+/*                            OGRMapGISWriter                           */
+/*                                                                      */
+/*      Buffered WMAP text output.  Numbers are formatted by hand,      */
+/*      reals always with the six decimals of the format.  Without a    */
+/*      file the text is only accumulated in memory.                    */
+/************************************************************************/
+
+class OGRMapGISWriter
+{
+    VSILFILE           *fp;
+    std::vector<char>   abyBuffer;
+    size_t              nBufferUsed;
+    vsi_l_offset        nFlushed;
+
+    char               *Reserve( size_t nBytes );
+
+  public:
+                        OGRMapGISWriter( VSILFILE *fp );
+                        ~OGRMapGISWriter();
+
+    void                Put( char ch ) { *Reserve( 1 ) = ch; nBufferUsed++; }
+    void                Write( const char *pabyData, size_t nBytes );
+    void                WriteString( const char *pszValue )
+                        { Write( pszValue, strlen( pszValue ) ); }
+    void                WriteQuoted( const char *pszValue );
+    void                WriteInteger( GIntBig nValue );
+    void                WriteReal( double dfValue );
+    void                WriteVertex( double dfX, double dfY );
+    void                WriteSeparator() { Put( ',' ); }
+    void                EndLine() { Put( '\n' ); }
+
+    int                 Flush();
+    vsi_l_offset        Tell() { return nFlushed + nBufferUsed; }
+
+    const char         *GetData() { return nBufferUsed ? &abyBuffer[0] : ""; }
+    size_t              GetDataSize() { return nBufferUsed; }
+};
+
+/************************************************************************/
+/*                       OGRMapGISTopologyBuilder                       */
+/*                                                                      */
+/*      Turns polygon rings into the arc/node topology of a WAP file.   */
+/*      Vertices are matched at the six decimals written, so edges      */
+/*      two rings share become one arc, written once.  Nodes are the    */
+/*      vertices where other than two edges meet, plus one vertex of    */
+/*      every ring that touches no other.  Arc, node and polygon ids    */
+/*      are 1-based; polygon 0 is the outside.                          */
+/************************************************************************/
+
+/* Dense ids for pairs of 64 bit keys, by open addressing. */
+class OGRMapGISKeyIndex
+{
+    std::vector<GIntBig> anKeyA;
+    std::vector<GIntBig> anKeyB;
+    std::vector<int>    anSlots;
+
+    void                Rehash( size_t nSlots );
+
+  public:
+    int                 Insert( GIntBig nKeyA, GIntBig nKeyB, int *pbNew );
+    int                 GetCount() const { return (int) anKeyA.size(); }
+};
+
+class OGRMapGISTopologyBuilder
+{
+    typedef struct
+    {
+        int             nFrom;
+        int             nLeft;
+        int             nRight;
+        int             nArc;
+    } Edge;
+
+    /* input rings */
+    std::vector<double> adfX;
+    std::vector<double> adfY;
+    std::vector<int>    anRingStart;
+    std::vector<int>    anRingPolygon;
+    std::vector<int>    abRingInsideLeft;
+
+    OGRMapGISKeyIndex   oVertexIndex;
+    std::vector<int>    anRingVertexStart;
+    std::vector<int>    anRingVertex;
+    std::vector<int>    anVertexDegree;
+    std::vector<int>    anVertexNode;
+    std::vector<int>    anVertexSource;
+    OGRMapGISKeyIndex   oEdgeIndex;
+    std::vector<Edge>   asEdges;
+
+    int                 FindEdge( int iVertexA, int iVertexB, int *pbNew );
+    int                 IsNode( int iVertex )
+                        { return anVertexDegree[iVertex] != 2
+                                 || anVertexNode[iVertex] != 0; }
+    int                 GetNode( int iVertex );
+    int                 AddArc( const std::vector<int> &anChain );
+
+  public:
+    /* arcs: from/to node, left/right polygon, vertices */
+    std::vector<int>    anArcFrom;
+    std::vector<int>    anArcTo;
+    std::vector<int>    anArcLeft;
+    std::vector<int>    anArcRight;
+    std::vector<int>    anArcStart;
+    std::vector<double> adfArcX;
+    std::vector<double> adfArcY;
+
+    /* nodes: position and signed ids of the arcs starting (+) or */
+    /* ending (-) there */
+    std::vector<double> adfNodeX;
+    std::vector<double> adfNodeY;
+    std::vector<std::vector<int> > aanNodeArcs;
+
+    /* per ring, signed arc ids followed by a 0 */
+    std::vector<int>    anRingArcStart;
+    std::vector<int>    anRingArcs;
+
+                        OGRMapGISTopologyBuilder();
+
+    void                AddRing( int nPolygon, int bInsideLeft, int nCount,
+                                 const double *padfX, const double *padfY );
+    int                 GetRingCount() const
+                        { return (int) anRingPolygon.size(); }
+    void                Build();
+
+    int                 GetArcCount() const
+                        { return (int) anArcFrom.size(); }
+};
+
+/************************************************************************/
+/*                         OGRMapGISWriterLayer                         */
+/*                                                                      */
+/*      A layer being written to a new WMAP text file.  Points and      */
+/*      lines are written as they come, polygons are kept until the     */
+/*      layer is closed as the arcs and nodes come first in the file.   */
+/************************************************************************/
+
+class OGRMapGISWriterLayer : public OGRLayer
+{
+    OGRFeatureDefn     *poFeatureDefn;
+    int                 featureType;
+    char               *pszFilename;
+    VSILFILE           *fp;
+    OGRMapGISWriter    *poWriter;
+    vsi_l_offset        nCountOffset;
+    int                 nRecords;
+
+    const OGRMapGISFieldInfo *pasFieldInfo;
+    int                 nFieldInfo;
+    std::vector<int>    anSourceField;
+    int                 anColumnField[2][MAPGIS_MAX_COLUMNS];
+    int                 anColumnCount[2];
+    std::vector<double> adfDerived;
+    int                 iIDField;
+    int                 iPntTypeField;
+    int                 iTextField;
+    int                 iMeasureField;
+    int                 iPerimeterField;
+
+    OGRMapGISWriter    *poPolygonLines;
+    std::vector<size_t> anPolygonLineEnd;
+    std::vector<int>    anPolygonFirstRing;
+    OGRMapGISTopologyBuilder oTopology;
+
+    int                 FindFieldInfo( const char *pszName );
+    void                WriteColumns( OGRFeature *poFeature, int iLayout,
+                                      int iFirstColumn,
+                                      OGRMapGISWriter *poOut );
+    OGRErr              WritePoint( OGRFeature *poFeature, OGRPoint *poPoint );
+    OGRErr              WriteLine( OGRFeature *poFeature,
+                                   OGRLineString *poLine );
+    OGRErr              AddPolygon( OGRFeature *poFeature,
+                                    OGRPolygon *poPolygon );
+    void                WritePolygons();
+
+  public:
+                        OGRMapGISWriterLayer( const char *pszFilename,
+                                              const char *pszLayerName,
+                                              VSILFILE *fp, int featureType );
+                        ~OGRMapGISWriterLayer();
+
+    void                ResetReading() {}
+    OGRFeature         *GetNextFeature() { return NULL; }
+
+    OGRErr              CreateFeature( OGRFeature *poFeature );
+    virtual OGRErr      CreateField( OGRFieldDefn *poField,
+                                     int bApproxOK = TRUE );
+
+    OGRFeatureDefn     *GetLayerDefn() { return poFeatureDefn; }
+    int                 TestCapability( const char * );
+};
+
 /************************************************************************/
 /*                          OGRMapGISDataSource                         */
+/*                                                                      */
+/*      One layer per WMAP file: a single file, every WMAP file of a    */
+/*      directory, or the <name>.wat/.wal/.wap files of a map set.      */
+/*      With MAPGIS_TOPOLOGY_LAYERS=YES each WAP file also gets         */
+/*      <name>_arcs and <name>_nodes layers, after the file layers.     */
 /************************************************************************/
 
 class OGRMapGISDataSource : public OGRDataSource
 {
-	VSILFILE           *fp;
-
     OGRMapGISLayer     **papoLayers;
     int                 nLayers;
+
+    OGRMapGISFilePool   oFilePool;
+
+    OGRMapGISArcLayer **papoArcLayers;
+    int                 nArcLayers;
+
+    OGRMapGISWriterLayer **papoWriterLayers;
+    int                 nWriterLayers;
     
     char                *pszName;
 
@@ -132,10 +1203,13 @@ class OGRMapGISDataSource : public OGRDataSource
 
     int                 Open( const char *, int bUpdate = FALSE/*, int bTestOpen,
                               int bForceSingleFileDataSource = FALSE */);
-    int                 OpenFile( const char *, int bUpdate, int bTestOpen );
+    int                 OpenFile( const char *, int bUpdate );
+    int                 Create( const char *pszFilename,
+                                char **papszOptions );
 
     const char          *GetName() { return pszName; }
-    int                 GetLayerCount() { return nLayers; }
+    int                 GetLayerCount()
+                        { return nLayers + nArcLayers + nWriterLayers; }
     OGRLayer            *GetLayer( int );
 
     virtual OGRLayer    *CreateLayer( const char *, 
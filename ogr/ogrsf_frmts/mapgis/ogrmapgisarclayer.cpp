@@ -0,0 +1,363 @@
+/******************************************************************************
+ * $Id: ogrmapgisarclayer.cpp 30016 2012-03-12 09:26:40Z fuxin $
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Implements OGRMapGISArcLayer, the arcs and nodes of a WAP
+ *           file as layers of their own.
+ * Author:   ZhouShun, shunzhou@foxmail.com
+ *
+ ******************************************************************************
+ * Copyright (c) 1999,  Les Technologies SoftMap Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "ogr_mapgis.h"
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+
+CPL_CVSID("$Id: ogrmapgisarclayer.cpp 30016 2012-03-12 09:26:40Z fuxin $");
+
+/* Fields of the arc layer, in order. */
+static const char * const apszArcFields[] =
+	{ "ID", "FromNode", "ToNode", "LeftPoly", "RightPoly" };
+
+/************************************************************************/
+/*                         OGRMapGISArcLayer()                          */
+/************************************************************************/
+
+OGRMapGISArcLayer::OGRMapGISArcLayer( OGRMapGISLayer *poPolygonLayerIn,
+									  int bNodesIn )
+
+{
+	poPolygonLayer = poPolygonLayerIn;
+	bNodes = bNodesIn;
+	nNextFID = 1;
+
+	CPLString osName = poPolygonLayer->GetLayerDefn()->GetName();
+	osName += bNodes ? "_nodes" : "_arcs";
+
+	poFeatureDefn = new OGRFeatureDefn( osName );
+	poFeatureDefn->Reference();
+
+	if( bNodes )
+	{
+		OGRFieldDefn oID( "ID", OFTInteger );
+		OGRFieldDefn oArcCount( "ArcCount", OFTInteger );
+		OGRFieldDefn oArcs( "Arcs", OFTIntegerList );
+
+		poFeatureDefn->AddFieldDefn( &oID );
+		poFeatureDefn->AddFieldDefn( &oArcCount );
+		poFeatureDefn->AddFieldDefn( &oArcs );
+		poFeatureDefn->SetGeomType( wkbPoint );
+	}
+	else
+	{
+		for( int iField = 0; iField < 5; iField++ )
+		{
+			OGRFieldDefn oField( apszArcFields[iField], OFTInteger );
+			poFeatureDefn->AddFieldDefn( &oField );
+		}
+
+		OGRFieldDefn oLength( "Length", OFTReal );
+		poFeatureDefn->AddFieldDefn( &oLength );
+		poFeatureDefn->SetGeomType( wkbLineString );
+	}
+}
+
+/************************************************************************/
+/*                         ~OGRMapGISArcLayer()                         */
+/************************************************************************/
+
+OGRMapGISArcLayer::~OGRMapGISArcLayer()
+
+{
+	poFeatureDefn->Release();
+}
+
+/************************************************************************/
+/*                            ResetReading()                            */
+/************************************************************************/
+
+void OGRMapGISArcLayer::ResetReading()
+
+{
+	nNextFID = 1;
+}
+
+/************************************************************************/
+/*                             GetMaxFID()                              */
+/*                                                                      */
+/*      The highest arc or node id, loading the arcs of the WAP layer   */
+/*      if that has not been done yet.                                  */
+/************************************************************************/
+
+long OGRMapGISArcLayer::GetMaxFID()
+
+{
+	poPolygonLayer->Initialize();
+
+	if( bNodes )
+		return poPolygonLayer->oArcs.GetNodeCount();
+	else
+		return poPolygonLayer->oArcs.GetMaxArcId();
+}
+
+/************************************************************************/
+/*                            SkipGeometry()                            */
+/************************************************************************/
+
+int OGRMapGISArcLayer::SkipGeometry()
+
+{
+	return poFeatureDefn->IsGeometryIgnored() && m_poFilterGeom == NULL
+		&& m_poAttrQuery == NULL;
+}
+
+/************************************************************************/
+/*                            BuildFeature()                            */
+/*                                                                      */
+/*      The feature of an arc or node id known to exist, or NULL if     */
+/*      the vertices of a lazily loaded arc can not be read.            */
+/************************************************************************/
+
+OGRFeature *OGRMapGISArcLayer::BuildFeature( long nFID, int bSkipGeometry )
+
+{
+	OGRMapGISArcStore *poArcs = &(poPolygonLayer->oArcs);
+	OGRFeature *poFeature = new OGRFeature( poFeatureDefn );
+	int nId = (int) nFID;
+
+	poFeature->SetFID( nFID );
+
+	if( bNodes )
+	{
+		const int *panArcs = NULL;
+		int nArcs = poArcs->GetNodeArcs( nId, &panArcs );
+
+		if( !poFeatureDefn->GetFieldDefn( 0 )->IsIgnored() )
+			poFeature->SetField( 0, nId );
+		if( !poFeatureDefn->GetFieldDefn( 1 )->IsIgnored() )
+			poFeature->SetField( 1, nArcs );
+		if( !poFeatureDefn->GetFieldDefn( 2 )->IsIgnored() )
+			poFeature->SetField( 2, nArcs, (int *) panArcs );
+
+		if( !bSkipGeometry )
+			poFeature->SetGeometryDirectly(
+				new OGRPoint( poArcs->GetNodeX( nId ),
+							  poArcs->GetNodeY( nId ) ) );
+
+		return poFeature;
+	}
+
+	int anValues[5];
+
+	anValues[0] = nId;
+	anValues[1] = poArcs->GetFromNode( nId );
+	anValues[2] = poArcs->GetToNode( nId );
+	anValues[3] = poArcs->GetLeftPolygon( nId );
+	anValues[4] = poArcs->GetRightPolygon( nId );
+
+	for( int iField = 0; iField < 5; iField++ )
+	{
+		if( !poFeatureDefn->GetFieldDefn( iField )->IsIgnored() )
+			poFeature->SetField( iField, anValues[iField] );
+	}
+	if( !poFeatureDefn->GetFieldDefn( 5 )->IsIgnored() )
+		poFeature->SetField( 5, poArcs->GetLength( nId ) );
+
+	if( bSkipGeometry )
+		return poFeature;
+
+/* -------------------------------------------------------------------- */
+/*      The vertices, read under the lock of the WAP layer when the     */
+/*      arcs are loaded lazily, as its cursors share the arc cache.     */
+/* -------------------------------------------------------------------- */
+	const double *padfX, *padfY;
+	std::vector<double> adfWork;
+	int bLockArcs = poArcs->IsLazy();
+
+	if( bLockArcs )
+		CPLCreateOrAcquireMutex( &(poPolygonLayer->hArcMutex), 1000.0 );
+
+	int nCount = poArcs->FetchArc( nId, &padfX, &padfY, adfWork );
+	OGRLineString *poLine = NULL;
+
+	if( nCount > 0 )
+	{
+		poLine = new OGRLineString();
+		poLine->setPoints( nCount, (double *) padfX, (double *) padfY );
+	}
+
+	if( bLockArcs )
+		CPLReleaseMutex( poPolygonLayer->hArcMutex );
+
+	if( poLine == NULL )
+	{
+		delete poFeature;
+		return NULL;
+	}
+
+	poFeature->SetGeometryDirectly( poLine );
+
+	return poFeature;
+}
+
+/************************************************************************/
+/*                           GetNextFeature()                           */
+/************************************************************************/
+
+OGRFeature *OGRMapGISArcLayer::GetNextFeature()
+
+{
+	OGRMapGISArcStore *poArcs = &(poPolygonLayer->oArcs);
+	long nMaxFID = GetMaxFID();
+	int bSkipGeometry = SkipGeometry();
+
+	while( nNextFID <= nMaxFID )
+	{
+		long nFID = nNextFID++;
+
+		if( !bNodes && !poArcs->HasArc( (int) nFID ) )
+			continue;
+
+/* -------------------------------------------------------------------- */
+/*      Pass over arcs whose extent misses the filter without           */
+/*      fetching their vertices.                                        */
+/* -------------------------------------------------------------------- */
+		if( m_poFilterGeom != NULL && !bNodes )
+		{
+			const OGREnvelope &sExtent = poArcs->GetExtent( (int) nFID );
+
+			if( sExtent.MaxX < m_sFilterEnvelope.MinX
+				|| sExtent.MinX > m_sFilterEnvelope.MaxX
+				|| sExtent.MaxY < m_sFilterEnvelope.MinY
+				|| sExtent.MinY > m_sFilterEnvelope.MaxY )
+				continue;
+		}
+
+		OGRFeature *poFeature = BuildFeature( nFID, bSkipGeometry );
+		if( poFeature == NULL )
+			return NULL;
+
+		if( (m_poFilterGeom == NULL
+			 || FilterGeometry( poFeature->GetGeometryRef() ))
+			&& (m_poAttrQuery == NULL
+				|| m_poAttrQuery->Evaluate( poFeature )) )
+			return poFeature;
+
+		delete poFeature;
+	}
+
+	return NULL;
+}
+
+/************************************************************************/
+/*                             GetFeature()                             */
+/************************************************************************/
+
+OGRFeature *OGRMapGISArcLayer::GetFeature( long nFID )
+
+{
+	if( nFID <= 0 || nFID > GetMaxFID()
+		|| (!bNodes && !poPolygonLayer->oArcs.HasArc( (int) nFID )) )
+		return NULL;
+
+	return BuildFeature( nFID, poFeatureDefn->IsGeometryIgnored() );
+}
+
+/************************************************************************/
+/*                          GetFeatureCount()                           */
+/************************************************************************/
+
+int OGRMapGISArcLayer::GetFeatureCount( int bForce )
+
+{
+	if( m_poFilterGeom != NULL || m_poAttrQuery != NULL )
+		return OGRLayer::GetFeatureCount( bForce );
+
+	if( !bForce && !poPolygonLayer->bInitialized )
+		return -1;
+
+	poPolygonLayer->Initialize();
+
+	if( bNodes )
+		return poPolygonLayer->oArcs.GetNodeCount();
+	else
+		return poPolygonLayer->oArcs.GetArcCount();
+}
+
+/************************************************************************/
+/*                             GetExtent()                              */
+/*                                                                      */
+/*      The arcs span the extent of the WAP layer.  Nodes are only      */
+/*      gone through when forced.                                       */
+/************************************************************************/
+
+OGRErr OGRMapGISArcLayer::GetExtent( OGREnvelope *psExtent, int bForce )
+
+{
+	if( !bNodes )
+		return poPolygonLayer->GetExtent( psExtent, bForce );
+
+	if( !bForce && !poPolygonLayer->bInitialized )
+		return OGRERR_FAILURE;
+
+	OGRMapGISArcStore *poArcs = &(poPolygonLayer->oArcs);
+	int nNodes = (int) GetMaxFID();
+
+	if( nNodes == 0 )
+		return OGRERR_FAILURE;
+
+	psExtent->MinX = psExtent->MaxX = poArcs->GetNodeX( 1 );
+	psExtent->MinY = psExtent->MaxY = poArcs->GetNodeY( 1 );
+
+	for( int nId = 2; nId <= nNodes; nId++ )
+	{
+		psExtent->MinX = MIN( psExtent->MinX, poArcs->GetNodeX( nId ) );
+		psExtent->MaxX = MAX( psExtent->MaxX, poArcs->GetNodeX( nId ) );
+		psExtent->MinY = MIN( psExtent->MinY, poArcs->GetNodeY( nId ) );
+		psExtent->MaxY = MAX( psExtent->MaxY, poArcs->GetNodeY( nId ) );
+	}
+
+	return OGRERR_NONE;
+}
+
+/************************************************************************/
+/*                           TestCapability()                           */
+/************************************************************************/
+
+int OGRMapGISArcLayer::TestCapability( const char * pszCap )
+
+{
+	if( EQUAL(pszCap,OLCRandomRead) )
+		return TRUE;
+
+	if( EQUAL(pszCap,OLCFastFeatureCount) )
+		return m_poFilterGeom == NULL && m_poAttrQuery == NULL;
+
+	if( EQUAL(pszCap,OLCFastGetExtent) )
+		return bNodes ? poPolygonLayer->bInitialized
+			: poPolygonLayer->TestCapability( pszCap );
+
+	if( EQUAL(pszCap,OLCIgnoreFields) )
+		return TRUE;
+
+	return FALSE;
+}
@@ -0,0 +1,1058 @@
+/******************************************************************************
+ * $Id: ogrmapgisarcstore.cpp 30007 2012-02-22 09:40:51Z fuxin $
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Implements OGRMapGISArcStore class, the flat in-memory store
+ *           of the arcs of a WAP file, and OGRMapGISRingBuilder.
+ * Author:   ZhouShun, shunzhou@foxmail.com
+ *
+ ******************************************************************************
+ * Copyright (c) 1999,  Les Technologies SoftMap Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "ogr_mapgis.h"
+#include "cpl_conv.h"
+
+CPL_CVSID("$Id: ogrmapgisarcstore.cpp 30007 2012-02-22 09:40:51Z fuxin $");
+
+/* SSE2 is part of every x86-64 target, so needs no runtime check. */
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define MAPGIS_HAVE_SSE2
+#  include <emmintrin.h>
+#endif
+
+/* Packed coordinates count millionths, the six decimals of the format. */
+#define MAPGIS_PACK_SCALE   1000000.0
+
+/* Bound on packed values, so that sums of them stay exact doubles. */
+#define MAPGIS_PACK_LIMIT   4503599627370496.0      /* 2^52 */
+
+/************************************************************************/
+/*                         OGRMapGISArcStore()                          */
+/************************************************************************/
+
+OGRMapGISArcStore::OGRMapGISArcStore()
+
+{
+	nArcCount = 0;
+	anNodeArcStart.push_back( 0 );
+	nVertexTotal = 0;
+
+	bPacked = FALSE;
+	dfOriginX = dfOriginY = 0.0;
+	dfStepX = dfStepY = 1.0;
+
+	bLazy = FALSE;
+	pszFilename = NULL;
+	fp = NULL;
+	poReader = NULL;
+	iMostRecent = -1;
+	iLeastRecent = -1;
+	nCacheBudget = 0;
+	nCacheUsed = 0;
+	nCacheHits = 0;
+	nCacheMisses = 0;
+	nCacheEvictions = 0;
+}
+
+/************************************************************************/
+/*                         ~OGRMapGISArcStore()                         */
+/************************************************************************/
+
+OGRMapGISArcStore::~OGRMapGISArcStore()
+
+{
+	if( bLazy )
+		CPLDebug( "MapGIS", "Arc cache: %d hits, %d misses, %d evictions, "
+				  "%d of %d bytes in use.",
+				  nCacheHits, nCacheMisses, nCacheEvictions,
+				  (int) nCacheUsed, (int) nCacheBudget );
+
+	for( size_t iSlot = 0; iSlot < asCache.size(); iSlot++ )
+	{
+		CPLFree( asCache[iSlot].padfX );
+		CPLFree( asCache[iSlot].padfY );
+	}
+
+	delete poReader;
+	if( fp != NULL )
+		VSIFCloseL( fp );
+	CPLFree( pszFilename );
+}
+
+/************************************************************************/
+/*                              SetLazy()                               */
+/*                                                                      */
+/*      Switch to keeping only arc offsets, decoding coordinates from   */
+/*      pszFilenameIn on demand.  Must be called before any arc is      */
+/*      added.                                                          */
+/************************************************************************/
+
+void OGRMapGISArcStore::SetLazy( const char *pszFilenameIn,
+								 size_t nBudgetBytes )
+
+{
+	CPLAssert( nArcCount == 0 );
+
+	bLazy = TRUE;
+	CPLFree( pszFilename );
+	pszFilename = CPLStrdup( pszFilenameIn );
+	nCacheBudget = nBudgetBytes;
+}
+
+/************************************************************************/
+/*                              Reserve()                               */
+/*                                                                      */
+/*      Size the per arc arrays for arc ids 1 to nArcs, which is how    */
+/*      MapGIS numbers them.                                            */
+/************************************************************************/
+
+void OGRMapGISArcStore::Reserve( int nArcs )
+
+{
+	if( nArcs <= 0 )
+		return;
+
+	if( bLazy )
+	{
+		anOffset.reserve( nArcs + 1 );
+		anCacheSlot.reserve( nArcs + 1 );
+	}
+	else
+		anStart.reserve( nArcs + 1 );
+	anCount.reserve( nArcs + 1 );
+	asExtent.reserve( nArcs + 1 );
+	adfLength.reserve( nArcs + 1 );
+	anFromNode.reserve( nArcs + 1 );
+	anToNode.reserve( nArcs + 1 );
+	anLeftPolygon.reserve( nArcs + 1 );
+	anRightPolygon.reserve( nArcs + 1 );
+}
+
+/************************************************************************/
+/*                               GrowTo()                               */
+/************************************************************************/
+
+void OGRMapGISArcStore::GrowTo( int nArcId )
+
+{
+	if( nArcId < (int) anCount.size() )
+		return;
+
+	if( bLazy )
+	{
+		anOffset.resize( nArcId + 1, 0 );
+		anCacheSlot.resize( nArcId + 1, -1 );
+	}
+	else
+		anStart.resize( nArcId + 1, 0 );
+	anCount.resize( nArcId + 1, 0 );
+	asExtent.resize( nArcId + 1 );
+	adfLength.resize( nArcId + 1, 0.0 );
+	anFromNode.resize( nArcId + 1, 0 );
+	anToNode.resize( nArcId + 1, 0 );
+	anLeftPolygon.resize( nArcId + 1, 0 );
+	anRightPolygon.resize( nArcId + 1, 0 );
+}
+
+/************************************************************************/
+/*                               AddArc()                               */
+/*                                                                      */
+/*      nOffset is the file offset of the arc's first vertex line; it   */
+/*      is only kept in lazy mode, the vertices only otherwise.         */
+/************************************************************************/
+
+int OGRMapGISArcStore::AddArc( int nArcId, int nCount,
+							   const double *padfXIn, const double *padfYIn,
+							   double dfLength, vsi_l_offset nOffset )
+
+{
+	CPLAssert( !bPacked );
+
+	if( nArcId <= 0 || nCount <= 0 )
+		return FALSE;
+
+	GrowTo( nArcId );
+	nVertexTotal += nCount;
+
+	if( anCount[nArcId] == 0 )
+		nArcCount++;
+
+	anCount[nArcId] = nCount;
+	adfLength[nArcId] = dfLength;
+
+	if( bLazy )
+		anOffset[nArcId] = nOffset;
+	else
+	{
+		anStart[nArcId] = adfX.size();
+		adfX.insert( adfX.end(), padfXIn, padfXIn + nCount );
+		adfY.insert( adfY.end(), padfYIn, padfYIn + nCount );
+	}
+
+	OGRMapGISGetExtent( nCount, padfXIn, padfYIn, &asExtent[nArcId] );
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                            SetTopology()                             */
+/*                                                                      */
+/*      Record the nodes and polygons of an arc already added.          */
+/*      Polygon 0 is the outside.                                       */
+/************************************************************************/
+
+void OGRMapGISArcStore::SetTopology( int nArcId, int nFromNode, int nToNode,
+									 int nLeftPolygon, int nRightPolygon )
+
+{
+	if( !HasArc( nArcId ) )
+		return;
+
+	anFromNode[nArcId] = nFromNode;
+	anToNode[nArcId] = nToNode;
+	anLeftPolygon[nArcId] = nLeftPolygon;
+	anRightPolygon[nArcId] = nRightPolygon;
+}
+
+/************************************************************************/
+/*                              AddNode()                               */
+/*                                                                      */
+/*      Append the next node of the node table, with the signed ids     */
+/*      of its arcs.                                                    */
+/************************************************************************/
+
+void OGRMapGISArcStore::AddNode( double dfX, double dfY,
+								 int nArcs, const int *panArcs )
+
+{
+	adfNodeX.push_back( dfX );
+	adfNodeY.push_back( dfY );
+	if( nArcs > 0 )
+		anNodeArcs.insert( anNodeArcs.end(), panArcs, panArcs + nArcs );
+	anNodeArcStart.push_back( (int) anNodeArcs.size() );
+}
+
+/************************************************************************/
+/*                            GetNodeArcs()                             */
+/*                                                                      */
+/*      Return the number of arcs meeting at a node and point           */
+/*      *ppanArcs at their signed ids.                                  */
+/************************************************************************/
+
+int OGRMapGISArcStore::GetNodeArcs( int nNodeId,
+									const int **ppanArcs ) const
+
+{
+	if( nNodeId <= 0 || nNodeId > GetNodeCount() )
+		return 0;
+
+	int iStart = anNodeArcStart[nNodeId-1];
+	int nArcs = anNodeArcStart[nNodeId] - iStart;
+
+	*ppanArcs = nArcs > 0 ? &anNodeArcs[iStart] : NULL;
+	return nArcs;
+}
+
+/************************************************************************/
+/*                               Shrink()                               */
+/*                                                                      */
+/*      Give back the slack left by growing the arrays once all arcs    */
+/*      are in.                                                         */
+/************************************************************************/
+
+void OGRMapGISArcStore::Shrink()
+
+{
+	std::vector<double>( adfX ).swap( adfX );
+	std::vector<double>( adfY ).swap( adfY );
+	std::vector<size_t>( anStart ).swap( anStart );
+	std::vector<vsi_l_offset>( anOffset ).swap( anOffset );
+	std::vector<int>( anCacheSlot ).swap( anCacheSlot );
+	std::vector<int>( anCount ).swap( anCount );
+	std::vector<OGREnvelope>( asExtent ).swap( asExtent );
+	std::vector<double>( adfLength ).swap( adfLength );
+	std::vector<int>( anFromNode ).swap( anFromNode );
+	std::vector<int>( anToNode ).swap( anToNode );
+	std::vector<int>( anLeftPolygon ).swap( anLeftPolygon );
+	std::vector<int>( anRightPolygon ).swap( anRightPolygon );
+	std::vector<double>( adfNodeX ).swap( adfNodeX );
+	std::vector<double>( adfNodeY ).swap( adfNodeY );
+	std::vector<int>( anNodeArcStart ).swap( anNodeArcStart );
+	std::vector<int>( anNodeArcs ).swap( anNodeArcs );
+}
+
+/************************************************************************/
+/*                              FetchArc()                              */
+/*                                                                      */
+/*      Return the vertex count of an arc and point *ppadfX/Y at its    */
+/*      coordinates, or return 0 if the arc can not be had.  Packed     */
+/*      arcs are decoded into adfWork, so threads each passing their    */
+/*      own can fetch at the same time.  In lazy mode the pointers are  */
+/*      only good until the next FetchArc().                            */
+/************************************************************************/
+
+int OGRMapGISArcStore::FetchArc( int nArcId, const double **ppadfX,
+								 const double **ppadfY,
+								 std::vector<double> &adfWork )
+
+{
+	if( !HasArc( nArcId ) )
+		return 0;
+
+	if( bPacked )
+	{
+		int nCount = anCount[nArcId];
+
+		if( adfWork.size() < 2 * (size_t) nCount )
+			adfWork.resize( 2 * (size_t) nCount );
+		UnpackArc( nArcId, &adfWork[0], &adfWork[nCount] );
+		*ppadfX = &adfWork[0];
+		*ppadfY = &adfWork[nCount];
+		return nCount;
+	}
+
+	if( !bLazy )
+	{
+		*ppadfX = &adfX[anStart[nArcId]];
+		*ppadfY = &adfY[anStart[nArcId]];
+		return anCount[nArcId];
+	}
+
+	int iSlot = anCacheSlot[nArcId];
+
+	if( iSlot >= 0 )
+	{
+		nCacheHits++;
+		if( iSlot != iMostRecent )
+		{
+			Unlink( iSlot );
+			LinkFirst( iSlot );
+		}
+	}
+	else
+	{
+		nCacheMisses++;
+		iSlot = LoadArc( nArcId );
+		if( iSlot < 0 )
+			return 0;
+	}
+
+	*ppadfX = asCache[iSlot].padfX;
+	*ppadfY = asCache[iSlot].padfY;
+	return anCount[nArcId];
+}
+
+/************************************************************************/
+/*                          Unlink()/LinkFirst()                        */
+/*                                                                      */
+/*      Maintain the doubly linked recency list through the cache       */
+/*      slots, most recently used first.                                */
+/************************************************************************/
+
+void OGRMapGISArcStore::Unlink( int iSlot )
+
+{
+	OGRMapGISCachedArc &sArc = asCache[iSlot];
+
+	if( sArc.iPrev >= 0 )
+		asCache[sArc.iPrev].iNext = sArc.iNext;
+	else
+		iMostRecent = sArc.iNext;
+
+	if( sArc.iNext >= 0 )
+		asCache[sArc.iNext].iPrev = sArc.iPrev;
+	else
+		iLeastRecent = sArc.iPrev;
+
+	sArc.iPrev = sArc.iNext = -1;
+}
+
+void OGRMapGISArcStore::LinkFirst( int iSlot )
+
+{
+	OGRMapGISCachedArc &sArc = asCache[iSlot];
+
+	sArc.iPrev = -1;
+	sArc.iNext = iMostRecent;
+	if( iMostRecent >= 0 )
+		asCache[iMostRecent].iPrev = iSlot;
+	iMostRecent = iSlot;
+	if( iLeastRecent < 0 )
+		iLeastRecent = iSlot;
+}
+
+/************************************************************************/
+/*                              FreeSlot()                              */
+/************************************************************************/
+
+void OGRMapGISArcStore::FreeSlot( int iSlot )
+
+{
+	OGRMapGISCachedArc &sArc = asCache[iSlot];
+
+	if( sArc.nArcId > 0 )
+	{
+		anCacheSlot[sArc.nArcId] = -1;
+		nCacheUsed -= 2 * sizeof(double) * (anCount[sArc.nArcId] + 1);
+	}
+
+	CPLFree( sArc.padfX );
+	CPLFree( sArc.padfY );
+	sArc.padfX = sArc.padfY = NULL;
+	sArc.nArcId = -1;
+	anFreeSlots.push_back( iSlot );
+}
+
+/************************************************************************/
+/*                              LoadArc()                               */
+/*                                                                      */
+/*      Decode an arc into the cache, evicting the least recently used  */
+/*      arcs until it fits the budget.  The arc just asked for is       */
+/*      always kept, even when it alone is over budget.                 */
+/************************************************************************/
+
+int OGRMapGISArcStore::LoadArc( int nArcId )
+
+{
+	int nCount = anCount[nArcId];
+	size_t nBytes = 2 * sizeof(double) * (nCount + 1);
+
+	while( iLeastRecent >= 0 && nCacheUsed + nBytes > nCacheBudget )
+	{
+		int iVictim = iLeastRecent;
+
+		Unlink( iVictim );
+		FreeSlot( iVictim );
+		nCacheEvictions++;
+	}
+
+/* -------------------------------------------------------------------- */
+/*      Open our own handle on the file the first time round.           */
+/* -------------------------------------------------------------------- */
+	if( fp == NULL )
+	{
+		fp = VSIFOpenL( pszFilename, "rb" );
+		if( fp == NULL )
+		{
+			CPLError( CE_Failure, CPLE_OpenFailed,
+					  "Failed to reopen %s to read arcs.", pszFilename );
+			return -1;
+		}
+		poReader = new OGRMapGISReader( fp );
+	}
+
+/* -------------------------------------------------------------------- */
+/*      Decode the vertices into a free slot.                           */
+/* -------------------------------------------------------------------- */
+	int iSlot;
+
+	if( !anFreeSlots.empty() )
+	{
+		iSlot = anFreeSlots.back();
+		anFreeSlots.pop_back();
+	}
+	else
+	{
+		OGRMapGISCachedArc sEmpty;
+
+		sEmpty.nArcId = -1;
+		sEmpty.iPrev = sEmpty.iNext = -1;
+		sEmpty.padfX = sEmpty.padfY = NULL;
+		iSlot = (int) asCache.size();
+		asCache.push_back( sEmpty );
+	}
+
+	OGRMapGISCachedArc &sArc = asCache[iSlot];
+
+	sArc.padfX = (double *) VSIMalloc( nBytes / 2 );
+	sArc.padfY = (double *) VSIMalloc( nBytes / 2 );
+
+	if( sArc.padfX == NULL || sArc.padfY == NULL
+		|| !poReader->Seek( anOffset[nArcId] )
+		|| poReader->ReadVertices( nCount, sArc.padfX, sArc.padfY )
+		!= nCount )
+	{
+		CPLError( CE_Failure, CPLE_FileIO,
+				  "Failed to read the vertices of arc %d.", nArcId );
+		FreeSlot( iSlot );
+		return -1;
+	}
+
+	sArc.nArcId = nArcId;
+	anCacheSlot[nArcId] = iSlot;
+	nCacheUsed += nBytes;
+	LinkFirst( iSlot );
+
+	return iSlot;
+}
+
+/************************************************************************/
+/*                           QuantizeValue()                            */
+/*                                                                      */
+/*      The value in millionths, if that is a whole number giving the   */
+/*      value back exactly.                                             */
+/************************************************************************/
+
+static int QuantizeValue( double dfValue, GIntBig *pnValue )
+
+{
+	double dfScaled = floor( dfValue * MAPGIS_PACK_SCALE + 0.5 );
+
+	if( !(fabs( dfScaled ) < MAPGIS_PACK_LIMIT) )
+		return FALSE;
+
+	double dfBack = dfScaled / MAPGIS_PACK_SCALE;
+
+	*pnValue = (GIntBig) dfScaled;
+	return memcmp( &dfBack, &dfValue, sizeof(double) ) == 0;
+}
+
+/************************************************************************/
+/*                         Varint and zig-zag                           */
+/*                                                                      */
+/*      Unsigned values are written 7 bits a byte, low bits first,      */
+/*      the high bit set on all but the last byte.  Signed deltas are   */
+/*      zig-zag mapped first, so that small magnitudes of either sign   */
+/*      become small unsigned values.                                   */
+/************************************************************************/
+
+static void PutVarint( std::vector<GByte> &abyOut, GUIntBig nValue )
+
+{
+	while( nValue >= 0x80 )
+	{
+		abyOut.push_back( (GByte) (nValue | 0x80) );
+		nValue >>= 7;
+	}
+	abyOut.push_back( (GByte) nValue );
+}
+
+static const GByte *GetVarint( const GByte *pabyIter, GUIntBig *pnValue )
+
+{
+	GUIntBig nValue = 0;
+	int nShift = 0;
+
+	while( *pabyIter & 0x80 )
+	{
+		nValue |= (GUIntBig) (*pabyIter++ & 0x7f) << nShift;
+		nShift += 7;
+	}
+	*pnValue = nValue | ((GUIntBig) *pabyIter++ << nShift);
+
+	return pabyIter;
+}
+
+static GUIntBig ZigZag( GIntBig nValue )
+
+{
+	return ((GUIntBig) nValue << 1) ^ (GUIntBig) (nValue >> 63);
+}
+
+static GIntBig UnZigZag( GUIntBig nValue )
+
+{
+	return (GIntBig) (nValue >> 1) ^ -(GIntBig) (nValue & 1);
+}
+
+/************************************************************************/
+/*                             PutDeltas()                              */
+/*                                                                      */
+/*      Append zig-zag deltas at nWidth bytes each, low byte first.     */
+/************************************************************************/
+
+static void PutDeltas( std::vector<GByte> &abyOut,
+					   const std::vector<GUIntBig> &anDeltas, int nWidth )
+
+{
+	for( size_t i = 0; i < anDeltas.size(); i++ )
+	{
+		for( int iByte = 0; iByte < nWidth; iByte++ )
+			abyOut.push_back( (GByte) (anDeltas[i] >> (8 * iByte)) );
+	}
+}
+
+/************************************************************************/
+/*                             GetDeltas()                              */
+/*                                                                      */
+/*      Decode nCount deltas of nWidth bytes each into padfOut.         */
+/************************************************************************/
+
+static const GByte *GetDeltas( const GByte *pabyIter, int nWidth,
+							   int nCount, double *padfOut )
+
+{
+	int i;
+
+	switch( nWidth )
+	{
+	case 0:
+		for( i = 0; i < nCount; i++ )
+			padfOut[i] = 0.0;
+		break;
+
+	case 1:
+		for( i = 0; i < nCount; i++ )
+		{
+			int nValue = pabyIter[i];
+			padfOut[i] = (nValue >> 1) ^ -(nValue & 1);
+		}
+		break;
+
+	case 2:
+		for( i = 0; i < nCount; i++ )
+		{
+			int nValue = pabyIter[2*i] | (pabyIter[2*i+1] << 8);
+			padfOut[i] = (nValue >> 1) ^ -(nValue & 1);
+		}
+		break;
+
+	default:
+		for( i = 0; i < nCount; i++ )
+		{
+			const GByte *pabyValue = pabyIter + (size_t) nWidth * i;
+			GUIntBig nValue = 0;
+
+			for( int iByte = nWidth - 1; iByte >= 0; iByte-- )
+				nValue = (nValue << 8) | pabyValue[iByte];
+			padfOut[i] = (double) UnZigZag( nValue );
+		}
+		break;
+	}
+
+	return pabyIter + (size_t) nWidth * nCount;
+}
+
+/************************************************************************/
+/*                          AccumulateDeltas()                          */
+/*                                                                      */
+/*      Turn a first value and the deltas after it into coordinates:    */
+/*      a running sum, times the step, from the origin, in millionths.  */
+/*      The sums are whole numbers below 2^53 and so exact whatever     */
+/*      the order of adding, and both paths give the same doubles.      */
+/************************************************************************/
+
+static void AccumulateDeltas( double *padfValues, int nCount,
+							  double dfOrigin, double dfStep )
+
+{
+	double dfSum = 0.0;
+	int i = 0;
+
+#ifdef MAPGIS_HAVE_SSE2
+	const __m128d vZero = _mm_setzero_pd();
+	const __m128d vOrigin = _mm_set1_pd( dfOrigin );
+	const __m128d vStep = _mm_set1_pd( dfStep );
+	const __m128d vScale = _mm_set1_pd( MAPGIS_PACK_SCALE );
+	__m128d vSum = vZero;
+
+	for( ; i + 2 <= nCount; i += 2 )
+	{
+		// [a, b] + [0, a] is [a, a+b], to which the sum so far is added.
+		__m128d vValues = _mm_loadu_pd( padfValues + i );
+		vValues = _mm_add_pd( vValues, _mm_unpacklo_pd( vZero, vValues ) );
+		vValues = _mm_add_pd( vValues, vSum );
+		vSum = _mm_unpackhi_pd( vValues, vValues );
+
+		vValues = _mm_add_pd( vOrigin, _mm_mul_pd( vStep, vValues ) );
+		_mm_storeu_pd( padfValues + i, _mm_div_pd( vValues, vScale ) );
+	}
+	_mm_store_sd( &dfSum, vSum );
+#endif
+
+	for( ; i < nCount; i++ )
+	{
+		dfSum += padfValues[i];
+		padfValues[i] = (dfOrigin + dfStep * dfSum) / MAPGIS_PACK_SCALE;
+	}
+}
+
+/************************************************************************/
+/*                             UnpackArc()                              */
+/*                                                                      */
+/*      A packed arc is a byte with the delta widths of x (low four     */
+/*      bits) and y, the first vertex as two varints, then the x and    */
+/*      the y deltas of the other vertices.                             */
+/************************************************************************/
+
+void OGRMapGISArcStore::UnpackArc( int nArcId, double *padfXOut,
+								   double *padfYOut ) const
+
+{
+	const GByte *pabyIter = &abyPacked[anStart[nArcId]];
+	int nCount = anCount[nArcId];
+	int nWidthX = pabyIter[0] & 0x0f;
+	int nWidthY = pabyIter[0] >> 4;
+	GUIntBig nFirstX, nFirstY;
+
+	pabyIter = GetVarint( pabyIter + 1, &nFirstX );
+	pabyIter = GetVarint( pabyIter, &nFirstY );
+
+	padfXOut[0] = (double) nFirstX;
+	pabyIter = GetDeltas( pabyIter, nWidthX, nCount - 1, padfXOut + 1 );
+	padfYOut[0] = (double) nFirstY;
+	GetDeltas( pabyIter, nWidthY, nCount - 1, padfYOut + 1 );
+
+	AccumulateDeltas( padfXOut, nCount, dfOriginX, dfStepX );
+	AccumulateDeltas( padfYOut, nCount, dfOriginY, dfStepY );
+}
+
+/************************************************************************/
+/*                                Pack()                                */
+/*                                                                      */
+/*      Replace the x and y arrays by their packed form, see the class  */
+/*      description.  Called once all arcs are in; returns FALSE and    */
+/*      leaves the arrays alone if the coordinates do not round trip.   */
+/************************************************************************/
+
+int OGRMapGISArcStore::Pack()
+
+{
+	if( bLazy || bPacked || adfX.empty() )
+		return FALSE;
+
+/* -------------------------------------------------------------------- */
+/*      The origin is the smallest value, the step the greatest common  */
+/*      divisor of the differences to it, per axis.                     */
+/* -------------------------------------------------------------------- */
+	GIntBig nMinX = 0, nMinY = 0, nFirstX = 0, nFirstY = 0;
+	GIntBig nStepX = 0, nStepY = 0;
+
+	for( size_t i = 0; i < adfX.size(); i++ )
+	{
+		GIntBig nX, nY;
+
+		if( !QuantizeValue( adfX[i], &nX ) || !QuantizeValue( adfY[i], &nY ) )
+		{
+			CPLDebug( "MapGIS", "Arcs not packed: (%.15g,%.15g) is not "
+					  "a whole number of millionths.", adfX[i], adfY[i] );
+			return FALSE;
+		}
+
+		if( i == 0 )
+		{
+			nMinX = nFirstX = nX;
+			nMinY = nFirstY = nY;
+		}
+		nMinX = MIN( nMinX, nX );
+		nMinY = MIN( nMinY, nY );
+
+		for( GIntBig nA = ABS( nX - nFirstX ); nA != 0; )
+		{
+			GIntBig nB = nStepX % nA;
+			nStepX = nA;
+			nA = nB;
+		}
+		for( GIntBig nA = ABS( nY - nFirstY ); nA != 0; )
+		{
+			GIntBig nB = nStepY % nA;
+			nStepY = nA;
+			nA = nB;
+		}
+	}
+
+	nStepX = MAX( nStepX, 1 );
+	nStepY = MAX( nStepY, 1 );
+
+/* -------------------------------------------------------------------- */
+/*      Encode every arc.                                               */
+/* -------------------------------------------------------------------- */
+	std::vector<GByte> abyNew;
+	std::vector<size_t> anNewStart( anStart.size(), 0 );
+	std::vector<GUIntBig> anDeltaX, anDeltaY;
+
+	for( int nArcId = 1; nArcId < (int) anCount.size(); nArcId++ )
+	{
+		int nCount = anCount[nArcId];
+		if( nCount == 0 )
+			continue;
+
+		const double *padfArcX = &adfX[anStart[nArcId]];
+		const double *padfArcY = &adfY[anStart[nArcId]];
+		GIntBig nLastX = 0, nLastY = 0, nArcFirstX = 0, nArcFirstY = 0;
+		GUIntBig nMaxX = 0, nMaxY = 0;
+
+		anDeltaX.resize( 0 );
+		anDeltaY.resize( 0 );
+		for( int i = 0; i < nCount; i++ )
+		{
+			GIntBig nX, nY;
+
+			QuantizeValue( padfArcX[i], &nX );
+			QuantizeValue( padfArcY[i], &nY );
+			nX = (nX - nMinX) / nStepX;
+			nY = (nY - nMinY) / nStepY;
+
+			if( i > 0 )
+			{
+				anDeltaX.push_back( ZigZag( nX - nLastX ) );
+				anDeltaY.push_back( ZigZag( nY - nLastY ) );
+				nMaxX = MAX( nMaxX, anDeltaX.back() );
+				nMaxY = MAX( nMaxY, anDeltaY.back() );
+			}
+			else
+			{
+				nArcFirstX = nX;
+				nArcFirstY = nY;
+			}
+
+			nLastX = nX;
+			nLastY = nY;
+		}
+
+		int nWidthX = 0, nWidthY = 0;
+		while( nMaxX >> (8 * nWidthX) != 0 && nWidthX < 8 )
+			nWidthX++;
+		while( nMaxY >> (8 * nWidthY) != 0 && nWidthY < 8 )
+			nWidthY++;
+
+		anNewStart[nArcId] = abyNew.size();
+		abyNew.push_back( (GByte) (nWidthX | (nWidthY << 4)) );
+		PutVarint( abyNew, (GUIntBig) nArcFirstX );
+		PutVarint( abyNew, (GUIntBig) nArcFirstY );
+		PutDeltas( abyNew, anDeltaX, nWidthX );
+		PutDeltas( abyNew, anDeltaY, nWidthY );
+	}
+
+/* -------------------------------------------------------------------- */
+/*      Switch over, then check every arc decodes to what it was.       */
+/* -------------------------------------------------------------------- */
+	std::vector<GByte>( abyNew ).swap( abyPacked );
+	anStart.swap( anNewStart );
+	dfOriginX = (double) nMinX;
+	dfOriginY = (double) nMinY;
+	dfStepX = (double) nStepX;
+	dfStepY = (double) nStepY;
+
+	std::vector<double> adfWork;
+
+	for( int nArcId = 1; nArcId < (int) anCount.size(); nArcId++ )
+	{
+		int nCount = anCount[nArcId];
+		if( nCount == 0 )
+			continue;
+
+		adfWork.resize( 2 * (size_t) nCount );
+		UnpackArc( nArcId, &adfWork[0], &adfWork[nCount] );
+
+		if( memcmp( &adfWork[0], &adfX[anNewStart[nArcId]],
+					sizeof(double) * nCount ) != 0
+			|| memcmp( &adfWork[nCount], &adfY[anNewStart[nArcId]],
+					   sizeof(double) * nCount ) != 0 )
+		{
+			CPLDebug( "MapGIS", "Arcs not packed: arc %d does not "
+					  "round trip.", nArcId );
+			std::vector<GByte>().swap( abyPacked );
+			anStart.swap( anNewStart );
+			return FALSE;
+		}
+	}
+
+	bPacked = TRUE;
+	std::vector<double>().swap( adfX );
+	std::vector<double>().swap( adfY );
+
+	CPLDebug( "MapGIS", "Packed %d arc vertices into %d bytes.",
+			  (int) nVertexTotal, (int) abyPacked.size() );
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                           GetMemoryUsage()                           */
+/************************************************************************/
+
+size_t OGRMapGISArcStore::GetMemoryUsage() const
+
+{
+	return adfX.capacity() * sizeof(double)
+		+ adfY.capacity() * sizeof(double)
+		+ anStart.capacity() * sizeof(size_t)
+		+ anOffset.capacity() * sizeof(vsi_l_offset)
+		+ anCacheSlot.capacity() * sizeof(int)
+		+ anCount.capacity() * sizeof(int)
+		+ asExtent.capacity() * sizeof(OGREnvelope)
+		+ adfLength.capacity() * sizeof(double)
+		+ (anFromNode.capacity() + anToNode.capacity()
+		   + anLeftPolygon.capacity() + anRightPolygon.capacity()
+		   + anNodeArcStart.capacity() + anNodeArcs.capacity()) * sizeof(int)
+		+ (adfNodeX.capacity() + adfNodeY.capacity()) * sizeof(double)
+		+ abyPacked.capacity()
+		+ nCacheUsed;
+}
+
+/************************************************************************/
+/*                             AppendArc()                              */
+/*                                                                      */
+/*      Append an arc to the ring being assembled in adfX/Y,            */
+/*      reversed when the id is negative.  The first vertex of an arc   */
+/*      repeats the last vertex of the one before it and is dropped.    */
+/************************************************************************/
+
+void OGRMapGISRingBuilder::AppendArc( OGRMapGISArcStore *poArcs,
+									  int nArcId )
+
+{
+	const double *padfX = NULL, *padfY = NULL;
+	int nCount = poArcs->FetchArc( ABS( nArcId ), &padfX, &padfY,
+								   adfArcWork );
+
+	MAPGIS_STAT_ADD( psStats, nArcLookups, 1 );
+	if( nCount == 0 )
+		return;
+
+	size_t nOld = adfX.size();
+	int bJoin = FALSE;
+
+	if( nOld > 0 )
+	{
+		int iFirst = nArcId > 0 ? 0 : nCount - 1;
+		bJoin = adfX[nOld-1] == padfX[iFirst]
+			&& adfY[nOld-1] == padfY[iFirst];
+	}
+
+	if( nArcId > 0 )
+	{
+		adfX.insert( adfX.end(), padfX + bJoin, padfX + nCount );
+		adfY.insert( adfY.end(), padfY + bJoin, padfY + nCount );
+	}
+	else
+	{
+		adfX.resize( nOld + nCount - bJoin );
+		adfY.resize( nOld + nCount - bJoin );
+		std::reverse_copy( padfX, padfX + nCount - bJoin, &adfX[nOld] );
+		std::reverse_copy( padfY, padfY + nCount - bJoin, &adfY[nOld] );
+	}
+}
+
+/************************************************************************/
+/*                             CloseRing()                              */
+/*                                                                      */
+/*      Close the ring gathered in adfX/Y, returning its vertex count.  */
+/************************************************************************/
+
+int OGRMapGISRingBuilder::CloseRing()
+
+{
+	int nCount = (int) adfX.size();
+
+	if( nCount > 0 && (adfX[0] != adfX[nCount-1]
+		|| adfY[0] != adfY[nCount-1]) )
+	{
+		adfX.push_back( adfX[0] );
+		adfY.push_back( adfY[0] );
+		nCount++;
+	}
+
+	return nCount;
+}
+
+/************************************************************************/
+/*                             FlushRing()                              */
+/*                                                                      */
+/*      Turn the vertices gathered in adfX/Y into a closed ring of      */
+/*      poPolygon, with a single allocation.                            */
+/************************************************************************/
+
+void OGRMapGISRingBuilder::FlushRing( OGRPolygon *poPolygon )
+
+{
+	int nCount = CloseRing();
+
+	if( nCount == 0 )
+		return;
+
+	OGRLinearRing *poRing = new OGRLinearRing();
+
+	poRing->setPoints( nCount, &adfX[0], &adfY[0] );
+	poPolygon->addRingDirectly( poRing );
+
+	adfX.resize( 0 );
+	adfY.resize( 0 );
+}
+
+/************************************************************************/
+/*                            BuildPolygon()                            */
+/*                                                                      */
+/*      Assemble a polygon from its arc id list.  The list holds the    */
+/*      rings one after another, each ended by a zero; the first ring   */
+/*      is the outer boundary.                                          */
+/************************************************************************/
+
+OGRPolygon *OGRMapGISRingBuilder::BuildPolygon( OGRMapGISArcStore *poArcs,
+												const int *panArcIds,
+												int nArcIds )
+
+{
+	MAPGIS_STAT_START( dfStart );
+	OGRPolygon *poPolygon = new OGRPolygon();
+
+	adfX.resize( 0 );
+	adfY.resize( 0 );
+	for( int i = 0; i < nArcIds; i++ )
+	{
+		if( panArcIds[i] == 0 )
+			FlushRing( poPolygon );
+		else
+			AppendArc( poArcs, panArcIds[i] );
+	}
+	FlushRing( poPolygon );
+
+	MAPGIS_STAT_STOP( psStats, dfGeometryTime, dfStart );
+
+	return poPolygon;
+}
+
+/************************************************************************/
+/*                             BuildRings()                             */
+/*                                                                      */
+/*      BuildPolygon() into the current feature of poArrays, one part   */
+/*      per ring, without creating geometry objects.                    */
+/************************************************************************/
+
+void OGRMapGISRingBuilder::BuildRings( OGRMapGISArcStore *poArcs,
+									   const int *panArcIds, int nArcIds,
+									   OGRMapGISFeatureArrays *poArrays )
+
+{
+	MAPGIS_STAT_START( dfStart );
+
+	adfX.resize( 0 );
+	adfY.resize( 0 );
+	for( int i = 0; i <= nArcIds; i++ )
+	{
+		if( i < nArcIds && panArcIds[i] != 0 )
+		{
+			AppendArc( poArcs, panArcIds[i] );
+			continue;
+		}
+
+		int nCount = CloseRing();
+		if( nCount > 0 )
+			poArrays->AddPart( nCount, &adfX[0], &adfY[0] );
+		adfX.resize( 0 );
+		adfY.resize( 0 );
+	}
+
+	MAPGIS_STAT_STOP( psStats, dfGeometryTime, dfStart );
+}
@@ -0,0 +1,758 @@
+/******************************************************************************
+ * $Id: ogrmapgisarrays.cpp 30015 2012-03-08 10:12:51Z fuxin $
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Implements OGRMapGISFeatureArrays and reading a MapGIS layer
+ *           into them, a run of features at a time.
+ * Author:   ZhouShun, shunzhou@foxmail.com
+ *
+ ******************************************************************************
+ * Copyright (c) 1999,  Les Technologies SoftMap Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "ogr_mapgis.h"
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+
+CPL_CVSID("$Id: ogrmapgisarrays.cpp 30015 2012-03-08 10:12:51Z fuxin $");
+
+/************************************************************************/
+/*                       OGRMapGISFeatureArrays()                       */
+/************************************************************************/
+
+OGRMapGISFeatureArrays::OGRMapGISFeatureArrays()
+
+{
+	featureType = 0;
+	nFeatures = 0;
+	anPartStart.push_back( 0 );
+	anVertexStart.push_back( 0 );
+}
+
+/************************************************************************/
+/*                               Reset()                                */
+/*                                                                      */
+/*      Empty the arrays and set up a column per field of poDefn that   */
+/*      is not ignored.  Allocations are kept for the next run.         */
+/************************************************************************/
+
+void OGRMapGISFeatureArrays::Reset( OGRFeatureDefn *poDefn,
+									int featureTypeIn )
+
+{
+	int nFields = poDefn->GetFieldCount();
+
+	featureType = featureTypeIn;
+	nFeatures = 0;
+
+	anFID.resize( 0 );
+	anPartStart.resize( 1 );
+	anPartStart[0] = 0;
+	anVertexStart.resize( 1 );
+	anVertexStart[0] = 0;
+	adfX.resize( 0 );
+	adfY.resize( 0 );
+
+	aabySet.resize( nFields );
+	aanInteger.resize( nFields );
+	aadfReal.resize( nFields );
+	aanTextStart.resize( nFields );
+	aachText.resize( nFields );
+
+	anColumns.resize( 0 );
+	aeColumnType.resize( 0 );
+
+	for( int iField = 0; iField < nFields; iField++ )
+	{
+		aabySet[iField].resize( 0 );
+		aanInteger[iField].resize( 0 );
+		aadfReal[iField].resize( 0 );
+		aanTextStart[iField].resize( 0 );
+		aachText[iField].resize( 0 );
+
+		OGRFieldDefn *poField = poDefn->GetFieldDefn( iField );
+		if( poField->IsIgnored() )
+			continue;
+
+		anColumns.push_back( iField );
+		aeColumnType.push_back( poField->GetType() );
+		if( poField->GetType() == OFTString )
+			aanTextStart[iField].push_back( 0 );
+	}
+}
+
+/************************************************************************/
+/*                              Truncate()                              */
+/*                                                                      */
+/*      Drop the features from nFeaturesIn on, including one begun      */
+/*      but not ended yet.                                              */
+/************************************************************************/
+
+void OGRMapGISFeatureArrays::Truncate( int nFeaturesIn )
+
+{
+	int nParts = anPartStart[nFeaturesIn];
+
+	anFID.resize( nFeaturesIn );
+	anPartStart.resize( nFeaturesIn + 1 );
+	anVertexStart.resize( nParts + 1 );
+	adfX.resize( anVertexStart[nParts] );
+	adfY.resize( anVertexStart[nParts] );
+
+	for( size_t iColumn = 0; iColumn < anColumns.size(); iColumn++ )
+	{
+		int iField = anColumns[iColumn];
+
+		aabySet[iField].resize( nFeaturesIn );
+		switch( aeColumnType[iColumn] )
+		{
+		case OFTInteger:
+			aanInteger[iField].resize( nFeaturesIn );
+			break;
+		case OFTReal:
+			aadfReal[iField].resize( nFeaturesIn );
+			break;
+		default:
+			aachText[iField].resize( aanTextStart[iField][nFeaturesIn] );
+			aanTextStart[iField].resize( nFeaturesIn + 1 );
+			break;
+		}
+	}
+
+	nFeatures = nFeaturesIn;
+}
+
+/************************************************************************/
+/*                            BeginFeature()                            */
+/*                                                                      */
+/*      Start a feature with every field unset and no parts.            */
+/************************************************************************/
+
+void OGRMapGISFeatureArrays::BeginFeature( long nFID )
+
+{
+	anFID.push_back( nFID );
+
+	for( size_t iColumn = 0; iColumn < anColumns.size(); iColumn++ )
+	{
+		int iField = anColumns[iColumn];
+
+		aabySet[iField].push_back( 0 );
+		if( aeColumnType[iColumn] == OFTInteger )
+			aanInteger[iField].push_back( 0 );
+		else if( aeColumnType[iColumn] == OFTReal )
+			aadfReal[iField].push_back( 0.0 );
+	}
+}
+
+/************************************************************************/
+/*                             SetString()                              */
+/************************************************************************/
+
+void OGRMapGISFeatureArrays::SetString( int iField, const char *pszValue,
+										int nLength )
+
+{
+	std::vector<char> &achText = aachText[iField];
+
+	achText.resize( aanTextStart[iField][nFeatures] );
+	achText.insert( achText.end(), pszValue, pszValue + nLength );
+	achText.push_back( '\0' );
+	aabySet[iField].back() = 1;
+}
+
+/************************************************************************/
+/*                              AddPart()                               */
+/************************************************************************/
+
+void OGRMapGISFeatureArrays::AddPart( int nCount, const double *padfXIn,
+									  const double *padfYIn )
+
+{
+	adfX.insert( adfX.end(), padfXIn, padfXIn + nCount );
+	adfY.insert( adfY.end(), padfYIn, padfYIn + nCount );
+	anVertexStart.push_back( (int) adfX.size() );
+}
+
+/************************************************************************/
+/*                             EndFeature()                             */
+/************************************************************************/
+
+void OGRMapGISFeatureArrays::EndFeature()
+
+{
+	for( size_t iColumn = 0; iColumn < anColumns.size(); iColumn++ )
+	{
+		if( aeColumnType[iColumn] != OFTString )
+			continue;
+
+		int iField = anColumns[iColumn];
+		aanTextStart[iField].push_back( (int) aachText[iField].size() );
+	}
+
+	anPartStart.push_back( GetPartCount() );
+	nFeatures++;
+}
+
+/************************************************************************/
+/*                         ClearLastGeometry()                          */
+/*                                                                      */
+/*      Drop the parts of the last feature, once they have served the   */
+/*      filters of a layer whose geometry is ignored.                   */
+/************************************************************************/
+
+void OGRMapGISFeatureArrays::ClearLastGeometry()
+
+{
+	int nParts = anPartStart[nFeatures-1];
+
+	anVertexStart.resize( nParts + 1 );
+	adfX.resize( anVertexStart[nParts] );
+	adfY.resize( anVertexStart[nParts] );
+	anPartStart[nFeatures] = nParts;
+}
+
+/************************************************************************/
+/*                             GetBounds()                              */
+/*                                                                      */
+/*      MinX, MinY, MaxX, MaxY of the vertices of a feature.  Returns   */
+/*      FALSE, with MinX > MaxX, if it has none.                        */
+/************************************************************************/
+
+int OGRMapGISFeatureArrays::GetBounds( int iFeature,
+									   double *padfBounds ) const
+
+{
+	int iStart = anVertexStart[anPartStart[iFeature]];
+	int nCount = anVertexStart[anPartStart[iFeature+1]] - iStart;
+
+	if( nCount == 0 )
+	{
+		padfBounds[0] = padfBounds[1] = 0.0;
+		padfBounds[2] = padfBounds[3] = -1.0;
+		return FALSE;
+	}
+
+	OGREnvelope sExtent;
+	OGRMapGISGetExtent( nCount, &adfX[0] + iStart, &adfY[0] + iStart,
+						&sExtent );
+
+	padfBounds[0] = sExtent.MinX;
+	padfBounds[1] = sExtent.MinY;
+	padfBounds[2] = sExtent.MaxX;
+	padfBounds[3] = sExtent.MaxY;
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                            GetGeometry()                             */
+/*                                                                      */
+/*      Build the geometry of a feature as GetNextFeature() would have  */
+/*      returned it, for the filters that need a geometry object.       */
+/************************************************************************/
+
+OGRGeometry *OGRMapGISFeatureArrays::GetGeometry( int iFeature ) const
+
+{
+	int iPart = anPartStart[iFeature];
+	int iEndPart = anPartStart[iFeature+1];
+
+	if( featureType == 3 )
+	{
+		OGRPolygon *poPolygon = new OGRPolygon();
+
+		for( ; iPart < iEndPart; iPart++ )
+		{
+			int iStart = anVertexStart[iPart];
+			OGRLinearRing *poRing = new OGRLinearRing();
+
+			poRing->setPoints( anVertexStart[iPart+1] - iStart,
+							   (double *) &adfX[0] + iStart,
+							   (double *) &adfY[0] + iStart );
+			poPolygon->addRingDirectly( poRing );
+		}
+
+		return poPolygon;
+	}
+
+	if( iPart == iEndPart )
+		return NULL;
+
+	int iStart = anVertexStart[iPart];
+	int nCount = anVertexStart[iPart+1] - iStart;
+
+	if( featureType == 1 )
+		return nCount > 0 ? new OGRPoint( adfX[iStart], adfY[iStart], 0.0 )
+			: NULL;
+
+	OGRLineString *poLS = new OGRLineString();
+	if( nCount > 0 )
+		poLS->setPoints( nCount, (double *) &adfX[0] + iStart,
+						 (double *) &adfY[0] + iStart );
+	poLS->setCoordinateDimension( 3 );
+
+	return poLS;
+}
+
+/************************************************************************/
+/*                             GetFeature()                             */
+/*                                                                      */
+/*      Load a feature, possibly one begun but not ended yet, into      */
+/*      poFeature for evaluating an attribute query.  Fields not set    */
+/*      in the arrays are unset.                                        */
+/************************************************************************/
+
+void OGRMapGISFeatureArrays::GetFeature( int iFeature, OGRFeature *poFeature,
+										 int bGeometry ) const
+
+{
+	poFeature->SetFID( anFID[iFeature] );
+
+	for( size_t iColumn = 0; iColumn < anColumns.size(); iColumn++ )
+	{
+		int iField = anColumns[iColumn];
+
+		if( !aabySet[iField][iFeature] )
+		{
+			poFeature->UnsetField( iField );
+			continue;
+		}
+
+		switch( aeColumnType[iColumn] )
+		{
+		case OFTInteger:
+			poFeature->SetField( iField, aanInteger[iField][iFeature] );
+			break;
+		case OFTReal:
+			poFeature->SetField( iField, aadfReal[iField][iFeature] );
+			break;
+		default:
+			poFeature->SetField( iField, GetString( iFeature, iField ) );
+			break;
+		}
+	}
+
+	poFeature->SetGeometryDirectly( bGeometry ? GetGeometry( iFeature )
+									: NULL );
+}
+
+/************************************************************************/
+/*                        GetNextFeatureArrays()                        */
+/*                                                                      */
+/*      Read up to nMaxFeatures of the features GetNextFeature() would  */
+/*      return next into poArrays, or into arrays of the layer valid    */
+/*      until the next call if poArrays is NULL.  Records are decoded   */
+/*      straight into the arrays, without OGRFeature or geometry        */
+/*      objects; only the filters that need them evaluate on one        */
+/*      scratch feature, and exact spatial tests on a geometry built    */
+/*      for records their bounds do not decide.  Returns NULL once no   */
+/*      features are left.                                              */
+/************************************************************************/
+
+OGRMapGISFeatureArrays *
+OGRMapGISLayer::GetNextFeatureArrays( int nMaxFeatures,
+									  OGRMapGISFeatureArrays *poArrays )
+
+{
+	if( poArrays == NULL )
+		poArrays = &oArrays;
+
+	Initialize();
+	poArrays->Reset( poFeatureDefn, featureType );
+
+	int bSkipGeometry = SkipGeometry();
+	int bClearGeometry = poFeatureDefn->IsGeometryIgnored() && !bSkipGeometry;
+
+	OGRFeature *poQueryFeature = m_poAttrQuery != NULL
+		? new OGRFeature( poFeatureDefn ) : NULL;
+	OGRFeature *poPrefilter = bAttrQueryNeedsGeometry ? NULL : poQueryFeature;
+
+/* -------------------------------------------------------------------- */
+/*      Carry on from where GetNextFeature() stands, or walk the        */
+/*      candidates of the spatial index as it would.                    */
+/* -------------------------------------------------------------------- */
+	if( poCache == NULL && m_poFilterGeom != NULL && panMatchingFIDs == NULL )
+		ScanIndices();
+
+	if( poCache == NULL && panMatchingFIDs != NULL )
+		SuspendReading();
+	else
+	{
+		DiscardBatches();
+		if( bResumePending )
+		{
+			bResumePending = FALSE;
+			if( poCache == NULL )
+				poReader->Seek( nResumeOffset );
+			iNextRecord = iResumeRecord;
+		}
+	}
+
+	MAPGIS_STAT_START( dfStart );
+
+	while( poArrays->nFeatures < nMaxFeatures )
+	{
+		int nMatch = m_poFilterGeom != NULL ? -1 : 1;
+		int nResult;
+
+		if( poCache != NULL )
+		{
+			if( iNextRecord >= poCache->GetRecordCount() )
+				break;
+
+			int iRecord = iNextRecord++;
+			if( m_poFilterGeom != NULL )
+				nMatch = CachedRecordInFilter( iRecord );
+
+			nResult = nMatch == 0 ? -1 : DecodeCachedArrays( poArrays,
+				iRecord, bSkipGeometry, poPrefilter );
+		}
+		else if( panMatchingFIDs != NULL )
+		{
+			if( panMatchingFIDs[iMatchingFID] == OGRNullFID )
+				break;
+			if( !SeekToRecord( panMatchingFIDs[iMatchingFID++] ) )
+				continue;
+
+			nResult = DecodeRecordArrays( poArrays, bSkipGeometry,
+										  poPrefilter );
+			if( nResult == 0 )
+				continue;
+		}
+		else
+		{
+			vsi_l_offset nRecordOffset = poReader->Tell();
+
+			nResult = DecodeRecordArrays( poArrays, bSkipGeometry,
+										  poPrefilter );
+			if( nResult == 0 )
+			{
+				EndOfRecords();
+				break;
+			}
+			IndexRecord( nRecordOffset );
+		}
+
+		if( nResult < 0 || !ArraysInFilter( poArrays, nMatch,
+											poQueryFeature ) )
+		{
+			MAPGIS_STAT_ADD( &sStats, nFiltered, 1 );
+			continue;
+		}
+
+		if( bClearGeometry )
+			poArrays->ClearLastGeometry();
+		MAPGIS_STAT_ADD( &sStats, nFeatures, 1 );
+	}
+
+	MAPGIS_STAT_STOP( &sStats, dfDecodeTime, dfStart );
+
+	delete poQueryFeature;
+
+	return poArrays->nFeatures > 0 ? poArrays : NULL;
+}
+
+/************************************************************************/
+/*                           ArraysInFilter()                           */
+/*                                                                      */
+/*      Apply what is left of the filters to the last feature of        */
+/*      poArrays, dropping it if it fails.  nMatch is what is known of  */
+/*      the spatial filter already, as from BoundsInFilter().           */
+/************************************************************************/
+
+int OGRMapGISLayer::ArraysInFilter( OGRMapGISFeatureArrays *poArrays,
+									int nMatch, OGRFeature *poQueryFeature )
+
+{
+	int iFeature = poArrays->nFeatures - 1;
+
+	if( nMatch < 0 )
+	{
+		double adfBounds[4];
+
+		poArrays->GetBounds( iFeature, adfBounds );
+		nMatch = BoundsInFilter( adfBounds );
+	}
+
+	if( nMatch < 0 )
+	{
+		OGRGeometry *poGeometry = poArrays->GetGeometry( iFeature );
+		nMatch = FilterGeometry( poGeometry ) ? 1 : 0;
+		delete poGeometry;
+	}
+
+	if( nMatch > 0 && m_poAttrQuery != NULL && bAttrQueryNeedsGeometry )
+	{
+		poArrays->GetFeature( iFeature, poQueryFeature, TRUE );
+		nMatch = m_poAttrQuery->Evaluate( poQueryFeature ) ? 1 : 0;
+	}
+
+	if( nMatch == 0 )
+		poArrays->Truncate( iFeature );
+
+	return nMatch;
+}
+
+/************************************************************************/
+/*                          SetRecordColumns()                          */
+/*                                                                      */
+/*      SetRecordFields() into the current feature of poArrays.         */
+/************************************************************************/
+
+void OGRMapGISLayer::SetRecordColumns( OGRMapGISFeatureArrays *poArrays,
+									   int iLayout,
+									   const OGRMapGISToken *pasTokens,
+									   int nTokens )
+
+{
+	OGRField sField;
+	CPLString osValue;
+
+	for( size_t iRead = 0; iRead < anReadFields.size(); iRead++ )
+	{
+		int iField = anReadFields[iRead];
+
+		if( !OGRMapGISParseField( pasFieldInfo + iField, iLayout,
+								  pasTokens, nTokens, &sField, osValue ) )
+			continue;
+
+		switch( pasFieldInfo[iField].eType )
+		{
+		case OFTInteger:
+			poArrays->SetInteger( MAPGIS_FIRST_FIELD + iField,
+								  sField.Integer );
+			break;
+		case OFTReal:
+			poArrays->SetReal( MAPGIS_FIRST_FIELD + iField, sField.Real );
+			break;
+		default:
+			poArrays->SetString( MAPGIS_FIRST_FIELD + iField,
+								 osValue.c_str(), (int) osValue.size() );
+			break;
+		}
+	}
+}
+
+/************************************************************************/
+/*                             IsRejected()                             */
+/*                                                                      */
+/*      Whether the attribute query rejects the feature begun in        */
+/*      poArrays, if it is to be evaluated on poQueryFeature.           */
+/************************************************************************/
+
+static int IsRejected( OGRFeatureQuery *poQuery,
+					   OGRMapGISFeatureArrays *poArrays, int iFeature,
+					   OGRFeature *poQueryFeature )
+
+{
+	if( poQueryFeature == NULL )
+		return FALSE;
+
+	poArrays->GetFeature( iFeature, poQueryFeature, FALSE );
+
+	return !poQuery->Evaluate( poQueryFeature );
+}
+
+/************************************************************************/
+/*                         DecodeRecordArrays()                         */
+/*                                                                      */
+/*      The counterpart of DecodeRecord(), adding the record at the     */
+/*      read position to poArrays.  If poQueryFeature is given, the     */
+/*      attribute filter is evaluated on it before the geometry is      */
+/*      read.  Returns 1 for a record added, -1 for one the filter      */
+/*      rejected and skipped, and 0 at the end of the records.          */
+/************************************************************************/
+
+int OGRMapGISLayer::DecodeRecordArrays( OGRMapGISFeatureArrays *poArrays,
+										int bSkipGeometry,
+										OGRFeature *poQueryFeature )
+
+{
+	OGRMapGISToken asTokens[MAPGIS_MAX_COLUMNS];
+	int iFeature = poArrays->nFeatures;
+
+	poArrays->BeginFeature( iNextRecord );
+
+	switch( featureType )
+	{
+	case 1:
+		{
+			int nTokens = poReader->ReadTokens( asTokens,
+				MAX( 4, MAX( anReadColumns[0], anReadColumns[1] ) ) );
+			if( nTokens < 3 )
+			{
+				poArrays->Truncate( iFeature );
+				return 0;
+			}
+
+			int iLayout = OGRMapGISGetPointLayout( asTokens, nTokens );
+
+			if( !bLayerFieldIgnored )
+				poArrays->SetString( 0, "WAT_1", 5 );
+			SetRecordColumns( poArrays, iLayout, asTokens, nTokens );
+
+			if( IsRejected( m_poAttrQuery, poArrays, iFeature,
+							 poQueryFeature ) )
+			{
+				poArrays->Truncate( iFeature );
+				return -1;
+			}
+
+			if( bSkipGeometry )
+				break;
+
+			double dfX = OGRMapGISParseNumber( asTokens[0].pszValue );
+			double dfY = OGRMapGISParseNumber( asTokens[1].pszValue );
+
+			poArrays->AddPart( 1, &dfX, &dfY );
+			break;
+		}
+	case 2:
+		{
+			int nTokens = poReader->ReadTokens( asTokens,
+				MAX( 1, anReadColumns[0] ) );
+			const char *pszLine = nTokens > 0 ? poReader->ReadLine() : NULL;
+			if( pszLine == NULL )
+			{
+				poArrays->Truncate( iFeature );
+				return 0;
+			}
+
+			if( !bLayerFieldIgnored )
+				poArrays->SetString( 0, "WAL_1", 5 );
+			SetRecordColumns( poArrays, 0, asTokens, nTokens );
+
+			int ptCount = atoi( pszLine );
+
+			// The id and length follow the vertices.
+			if( poQueryFeature != NULL )
+			{
+				vsi_l_offset nVertexOffset = poReader->Tell();
+
+				if( poReader->SkipLines( ptCount ) != ptCount )
+				{
+					poArrays->Truncate( iFeature );
+					return 0;
+				}
+
+				nTokens = poReader->ReadTokens( asTokens, 2 );
+				SetRecordColumns( poArrays, 1, asTokens, nTokens );
+
+				if( IsRejected( m_poAttrQuery, poArrays, iFeature,
+								 poQueryFeature ) )
+				{
+					poArrays->Truncate( iFeature );
+					return -1;
+				}
+
+				if( bSkipGeometry )
+					break;
+
+				poReader->Seek( nVertexOffset );
+			}
+
+			if( bSkipGeometry )
+			{
+				if( poReader->SkipLines( ptCount ) != ptCount )
+				{
+					poArrays->Truncate( iFeature );
+					return 0;
+				}
+			}
+			else
+			{
+				if( !oScratch.ReadVertexRun( poReader, ptCount ) )
+				{
+					poArrays->Truncate( iFeature );
+					return 0;
+				}
+
+				poArrays->AddPart( ptCount, &oScratch.adfX[0],
+								   &oScratch.adfY[0] );
+			}
+
+			nTokens = poReader->ReadTokens( asTokens, 2 );
+			if( poQueryFeature == NULL )
+				SetRecordColumns( poArrays, 1, asTokens, nTokens );
+			break;
+		}
+	case 3:
+		{
+			int nTokens = poReader->ReadTokens( asTokens,
+				MAX( 1, anReadColumns[0] ) );
+			const char *pszLine = nTokens > 0 ? poReader->ReadLine() : NULL;
+			if( pszLine == NULL )
+			{
+				poArrays->Truncate( iFeature );
+				return 0;
+			}
+
+			if( !bLayerFieldIgnored )
+				poArrays->SetString( 0, "WAP_1", 5 );
+			SetRecordColumns( poArrays, 0, asTokens, nTokens );
+
+			int numOfArc = atoi( pszLine );
+
+			if( IsRejected( m_poAttrQuery, poArrays, iFeature,
+							 poQueryFeature ) )
+			{
+				poReader->SkipLines( numOfArc );
+				poArrays->Truncate( iFeature );
+				return -1;
+			}
+
+			if( bSkipGeometry )
+			{
+				poReader->SkipLines( numOfArc );
+				break;
+			}
+
+			std::vector<int> &anArcIds = oScratch.anArcIds;
+
+			anArcIds.resize( 0 );
+			for( int i = 0; i < numOfArc; i++ )
+			{
+				pszLine = poReader->ReadLine();
+				if( pszLine == NULL )
+					break;
+				anArcIds.push_back( atoi( pszLine ) );
+			}
+
+			// The lazy arc cache is shared with the cursors.
+			int bLockArcs = oArcs.IsLazy();
+			if( bLockArcs )
+				CPLCreateOrAcquireMutex( &hArcMutex, 1000.0 );
+
+			oScratch.oRingBuilder.BuildRings( &oArcs,
+				anArcIds.empty() ? NULL : &anArcIds[0],
+				(int) anArcIds.size(), poArrays );
+
+			if( bLockArcs )
+				CPLReleaseMutex( hArcMutex );
+			break;
+		}
+	}
+
+	poArrays->EndFeature();
+
+	return 1;
+}
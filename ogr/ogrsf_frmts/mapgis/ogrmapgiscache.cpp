@@ -0,0 +1,1451 @@
+/******************************************************************************
+ * $Id: ogrmapgiscache.cpp 30014 2012-03-05 09:37:20Z fuxin $
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Implements OGRMapGISCache, the binary columnar .mgc copy of a
+ *           parsed MapGIS WMAP layer.
+ * Author:   ZhouShun, shunzhou@foxmail.com
+ *
+ ******************************************************************************
+ * Copyright (c) 1999,  Les Technologies SoftMap Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "ogr_mapgis.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+#ifdef WIN32
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif
+
+CPL_CVSID("$Id: ogrmapgiscache.cpp 30014 2012-03-05 09:37:20Z fuxin $");
+
+/* -------------------------------------------------------------------- */
+/*      The .mgc file is in the byte order of the machine, and only     */
+/*      little endian machines write or use it, so that its arrays can  */
+/*      be used where they are mapped.  A 128 byte header:              */
+/*                                                                      */
+/*        char[8]  "MGISMGC2"                                           */
+/*        uint32   file type, 1 WAT, 2 WAL, 3 WAP                       */
+/*        uint32   record count                                         */
+/*        uint64   source file size                                     */
+/*        uint64   source modification time                             */
+/*        uint64   hash of the first MGC_HASH_BYTES bytes of the source */
+/*        uint64   offset of the first record                           */
+/*        uint32   attribute field count                                */
+/*        int32    arc count, -1 if the arcs are not kept               */
+/*        uint64   part count                                           */
+/*        uint64   vertex count                                         */
+/*        uint64   arc vertex count                                     */
+/*        double   layer MinX, MinY, MaxX, MaxY; MinX > MaxX if unknown */
+/*        uint32   node count                                           */
+/*        uint32   reserved, 0                                          */
+/*        uint64   node arc count                                       */
+/*                                                                      */
+/*      is followed by these arrays, each padded to 8 bytes:            */
+/*                                                                      */
+/*        uint64   record offsets[record count]                         */
+/*        double   record MinX, MinY, MaxX, MaxY[record count]          */
+/*        per attribute field, in OGRMapGISFieldInfo order:             */
+/*          uint8    set flags[record count]                            */
+/*          int32    values[record count]            (OFTInteger)       */
+/*          double   values[record count]            (OFTReal)          */
+/*          uint32   text offsets[record count + 1]  (OFTString)        */
+/*          char     nul terminated text[last text offset]              */
+/*        uint32   first part of each record[record count + 1]          */
+/*        uint64   first vertex of each part[part count + 1]            */
+/*        double   x[vertex count], y[vertex count]                     */
+/*        int32    arc ids[arc count]                                   */
+/*        double   arc lengths[arc count]                               */
+/*        uint64   first vertex of each arc[arc count + 1]              */
+/*        double   arc x[arc vertex count], arc y[arc vertex count]     */
+/*        int32    arc from node, to node, left and right polygon       */
+/*                 [4 * arc count]                                      */
+/*        double   node x[node count], node y[node count]               */
+/*        uint32   first arc of each node[node count + 1]               */
+/*        int32    signed node arc ids[node arc count]                  */
+/*                                                                      */
+/*      A point has one part of one vertex, a line one part, and a      */
+/*      polygon one part per ring, the outer ring first.  FIDs are      */
+/*      record ordinals as always, so they are not stored.  The arc and */
+/*      node sections are only there if the arcs are kept.              */
+/* -------------------------------------------------------------------- */
+
+#define MGC_SIGNATURE   "MGISMGC2"
+#define MGC_HEADER_SIZE 128
+#define MGC_KEY_SIZE    24
+#define MGC_HASH_BYTES  4096
+
+/************************************************************************/
+/*                          OGRMapGISCache()                            */
+/************************************************************************/
+
+OGRMapGISCache::OGRMapGISCache()
+
+{
+    pabyData = NULL;
+    nSize = 0;
+    hMapping = NULL;
+    bMapped = FALSE;
+
+    featureType = 0;
+    nRecords = 0;
+    nFieldInfo = 0;
+    pasFieldInfo = NULL;
+    nFirstRecordOffset = 0;
+    bExtentKnown = FALSE;
+
+    panRecordOffset = NULL;
+    padfRecordBounds = NULL;
+    panRecordPart = NULL;
+    panPartStart = NULL;
+    padfX = NULL;
+    padfY = NULL;
+
+    nArcs = -1;
+    panArcId = NULL;
+    padfArcLength = NULL;
+    panArcStart = NULL;
+    padfArcX = NULL;
+    padfArcY = NULL;
+    panArcTopology = NULL;
+    nNodes = 0;
+    padfNodeX = NULL;
+    padfNodeY = NULL;
+    panNodeArcStart = NULL;
+    panNodeArcs = NULL;
+}
+
+/************************************************************************/
+/*                          ~OGRMapGISCache()                           */
+/************************************************************************/
+
+OGRMapGISCache::~OGRMapGISCache()
+
+{
+    if( !bMapped )
+        CPLFree( pabyData );
+#ifdef WIN32
+    else
+    {
+        UnmapViewOfFile( pabyData );
+        CloseHandle( (HANDLE) hMapping );
+    }
+#else
+    else
+        munmap( pabyData, nSize );
+#endif
+}
+
+/************************************************************************/
+/*                            GetFilename()                             */
+/************************************************************************/
+
+CPLString OGRMapGISCache::GetFilename( const char *pszSource )
+
+{
+    CPLString osCache = pszSource;
+
+    osCache += ".mgc";
+
+    return osCache;
+}
+
+/************************************************************************/
+/*                            GetSourceKey()                            */
+/*                                                                      */
+/*      The size, modification time and a hash of the leading bytes of  */
+/*      the source, as they appear in the header.  The hash catches an  */
+/*      edit that keeps the size within the resolution of the time.     */
+/************************************************************************/
+
+int OGRMapGISCache::GetSourceKey( const char *pszSource, GByte *pabyKey )
+
+{
+    VSIStatBufL sStat;
+
+    if( VSIStatL( pszSource, &sStat ) != 0 )
+        return FALSE;
+
+    VSILFILE *fp = VSIFOpenL( pszSource, "rb" );
+    if( fp == NULL )
+        return FALSE;
+
+    GByte abyHead[MGC_HASH_BYTES];
+    size_t nHead = VSIFReadL( abyHead, 1, sizeof(abyHead), fp );
+    VSIFCloseL( fp );
+
+    // 64 bit FNV-1a.
+    GUIntBig nHash = (((GUIntBig) 0xcbf29ce4) << 32) | 0x84222325;
+    GUIntBig nPrime = (((GUIntBig) 0x100) << 32) | 0x1b3;
+
+    for( size_t i = 0; i < nHead; i++ )
+    {
+        nHash ^= abyHead[i];
+        nHash *= nPrime;
+    }
+
+    GUIntBig anKey[3] = { (GUIntBig) sStat.st_size,
+                          (GUIntBig) sStat.st_mtime, nHash };
+    memcpy( pabyKey, anKey, MGC_KEY_SIZE );
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                                Open()                                */
+/*                                                                      */
+/*      Map the cache of pszSource, or return NULL if there is none     */
+/*      for the source as it is now.                                    */
+/************************************************************************/
+
+OGRMapGISCache *OGRMapGISCache::Open( const char *pszSource,
+                                      int featureType )
+
+{
+#ifdef CPL_MSB
+    return NULL;
+#else
+    GByte abyKey[MGC_KEY_SIZE];
+    CPLString osCache = GetFilename( pszSource );
+    VSIStatBufL sStat;
+
+    if( VSIStatL( osCache, &sStat ) != 0
+        || !GetSourceKey( pszSource, abyKey ) )
+        return NULL;
+
+    OGRMapGISCache *poCache = new OGRMapGISCache();
+
+    poCache->featureType = featureType;
+    poCache->pasFieldInfo =
+        OGRMapGISGetFieldInfo( featureType, &poCache->nFieldInfo );
+
+    if( !poCache->Map( osCache ) || !poCache->Parse( abyKey ) )
+    {
+        CPLDebug( "MapGIS", "Ignoring out of date or corrupt cache %s.",
+                  osCache.c_str() );
+        delete poCache;
+        return NULL;
+    }
+
+    CPLDebug( "MapGIS", "Using cache %s (%d records%s).",
+              osCache.c_str(), poCache->nRecords,
+              poCache->bMapped ? ", mapped" : "" );
+
+    return poCache;
+#endif
+}
+
+/************************************************************************/
+/*                                Map()                                 */
+/*                                                                      */
+/*      Map the cache file read only.  Files on the virtual file        */
+/*      systems, or that fail to map, are read into memory instead.     */
+/************************************************************************/
+
+int OGRMapGISCache::Map( const char *pszFilename )
+
+{
+    VSIStatBufL sStat;
+
+    if( VSIStatL( pszFilename, &sStat ) != 0
+        || sStat.st_size < MGC_HEADER_SIZE
+        || (vsi_l_offset) (size_t) sStat.st_size
+           != (vsi_l_offset) sStat.st_size )
+        return FALSE;
+
+    nSize = (size_t) sStat.st_size;
+
+    if( !EQUALN( pszFilename, "/vsi", 4 ) )
+    {
+#ifdef WIN32
+        HANDLE hFile = CreateFileA( pszFilename, GENERIC_READ,
+                                    FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                    FILE_ATTRIBUTE_NORMAL, NULL );
+        if( hFile != INVALID_HANDLE_VALUE )
+        {
+            HANDLE hMap = CreateFileMapping( hFile, NULL, PAGE_READONLY,
+                                             0, 0, NULL );
+            CloseHandle( hFile );
+
+            if( hMap != NULL )
+            {
+                pabyData = (GByte *)
+                    MapViewOfFile( hMap, FILE_MAP_READ, 0, 0, 0 );
+                if( pabyData != NULL )
+                {
+                    hMapping = hMap;
+                    bMapped = TRUE;
+                    return TRUE;
+                }
+                CloseHandle( hMap );
+            }
+        }
+#else
+        int fd = open( pszFilename, O_RDONLY );
+        if( fd >= 0 )
+        {
+            void *pMap = mmap( NULL, nSize, PROT_READ, MAP_SHARED, fd, 0 );
+            close( fd );
+
+            if( pMap != MAP_FAILED )
+            {
+                pabyData = (GByte *) pMap;
+                bMapped = TRUE;
+                return TRUE;
+            }
+        }
+#endif
+    }
+
+    VSILFILE *fp = VSIFOpenL( pszFilename, "rb" );
+    if( fp == NULL )
+        return FALSE;
+
+    pabyData = (GByte *) VSIMalloc( nSize );
+    int bOK = pabyData != NULL
+        && VSIFReadL( pabyData, 1, nSize, fp ) == nSize;
+
+    VSIFCloseL( fp );
+
+    return bOK;
+}
+
+/************************************************************************/
+/*                            TakeSection()                             */
+/*                                                                      */
+/*      Return the next nBytes of the file and step past them and       */
+/*      their padding, or NULL if the file is too short.                */
+/************************************************************************/
+
+static const GByte *TakeSection( const GByte *pabyData, size_t nSize,
+                                 size_t *pnPos, GUIntBig nBytes )
+
+{
+    GUIntBig nPadded = (nBytes + 7) & ~((GUIntBig) 7);
+
+    if( nPadded < nBytes || nPadded > (GUIntBig) (nSize - *pnPos) )
+        return NULL;
+
+    const GByte *pabySection = pabyData + *pnPos;
+    *pnPos += (size_t) nPadded;
+
+    return pabySection;
+}
+
+/************************************************************************/
+/*                                Parse()                               */
+/*                                                                      */
+/*      Check the header against the source and this build, and find    */
+/*      the arrays.  The part and vertex tables are checked through,    */
+/*      so that building geometries later can trust them.               */
+/************************************************************************/
+
+int OGRMapGISCache::Parse( const GByte *pabyExpected )
+
+{
+    GUInt32 nType, nRecordCount, nFields, nNodeCount;
+    GInt32 nArcCount;
+    GUIntBig nFirstOffset, nParts, nVertices, nArcVertices, nNodeArcs;
+    double adfExtent[4];
+
+    if( memcmp( pabyData, MGC_SIGNATURE, 8 ) != 0
+        || memcmp( pabyData + 16, pabyExpected, MGC_KEY_SIZE ) != 0 )
+        return FALSE;
+
+    memcpy( &nType, pabyData + 8, 4 );
+    memcpy( &nRecordCount, pabyData + 12, 4 );
+    memcpy( &nFirstOffset, pabyData + 40, 8 );
+    memcpy( &nFields, pabyData + 48, 4 );
+    memcpy( &nArcCount, pabyData + 52, 4 );
+    memcpy( &nParts, pabyData + 56, 8 );
+    memcpy( &nVertices, pabyData + 64, 8 );
+    memcpy( &nArcVertices, pabyData + 72, 8 );
+    memcpy( adfExtent, pabyData + 80, 32 );
+    memcpy( &nNodeCount, pabyData + 112, 4 );
+    memcpy( &nNodeArcs, pabyData + 120, 8 );
+
+    if( (int) nType != featureType || (int) nFields != nFieldInfo
+        || nRecordCount > INT_MAX || nParts >= 0xFFFFFFFFU
+        || nVertices > (GUIntBig) nSize || nArcVertices > (GUIntBig) nSize
+        || nNodeCount > INT_MAX || nNodeArcs >= 0xFFFFFFFFU )
+        return FALSE;
+
+    nRecords = (int) nRecordCount;
+    nFirstRecordOffset = (vsi_l_offset) nFirstOffset;
+    nArcs = nArcCount;
+    nNodes = (int) nNodeCount;
+
+    if( adfExtent[0] <= adfExtent[2] && adfExtent[1] <= adfExtent[3] )
+    {
+        sExtent.MinX = adfExtent[0];
+        sExtent.MinY = adfExtent[1];
+        sExtent.MaxX = adfExtent[2];
+        sExtent.MaxY = adfExtent[3];
+        bExtentKnown = TRUE;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Records and attributes.                                         */
+/* -------------------------------------------------------------------- */
+    size_t nPos = MGC_HEADER_SIZE;
+    GUIntBig nN = nRecordCount;
+
+    panRecordOffset = (const GUIntBig *)
+        TakeSection( pabyData, nSize, &nPos, nN * 8 );
+    padfRecordBounds = (const double *)
+        TakeSection( pabyData, nSize, &nPos, nN * 32 );
+    if( panRecordOffset == NULL || padfRecordBounds == NULL )
+        return FALSE;
+
+    for( int iField = 0; iField < nFieldInfo; iField++ )
+    {
+        const GByte *pabySet = TakeSection( pabyData, nSize, &nPos, nN );
+        const GByte *pabyValues = NULL;
+        const char *pszText = NULL;
+
+        switch( pasFieldInfo[iField].eType )
+        {
+        case OFTInteger:
+            pabyValues = TakeSection( pabyData, nSize, &nPos, nN * 4 );
+            break;
+        case OFTReal:
+            pabyValues = TakeSection( pabyData, nSize, &nPos, nN * 8 );
+            break;
+        default:
+            pabyValues = TakeSection( pabyData, nSize, &nPos, nN * 4 + 4 );
+            if( pabyValues == NULL )
+                return FALSE;
+            {
+                GUInt32 nText = ((const GUInt32 *) pabyValues)[nN];
+                pszText = (const char *)
+                    TakeSection( pabyData, nSize, &nPos, nText );
+                if( nText == 0 || pszText == NULL
+                    || pszText[nText-1] != '\0' )
+                    return FALSE;
+            }
+            break;
+        }
+
+        if( pabySet == NULL || pabyValues == NULL )
+            return FALSE;
+
+        apabyFieldSet.push_back( pabySet );
+        apabyFieldValues.push_back( pabyValues );
+        apszFieldText.push_back( pszText );
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Geometries.                                                     */
+/* -------------------------------------------------------------------- */
+    panRecordPart = (const GUInt32 *)
+        TakeSection( pabyData, nSize, &nPos, nN * 4 + 4 );
+    panPartStart = (const GUIntBig *)
+        TakeSection( pabyData, nSize, &nPos, nParts * 8 + 8 );
+    padfX = (const double *)
+        TakeSection( pabyData, nSize, &nPos, nVertices * 8 );
+    padfY = (const double *)
+        TakeSection( pabyData, nSize, &nPos, nVertices * 8 );
+    if( panRecordPart == NULL || panPartStart == NULL
+        || padfX == NULL || padfY == NULL
+        || panRecordPart[0] != 0 || panRecordPart[nN] != nParts
+        || panPartStart[0] != 0 || panPartStart[nParts] != nVertices )
+        return FALSE;
+
+    for( GUIntBig i = 0; i < nN; i++ )
+    {
+        if( panRecordPart[i] > panRecordPart[i+1] )
+            return FALSE;
+    }
+    for( GUIntBig i = 0; i < nParts; i++ )
+    {
+        if( panPartStart[i] > panPartStart[i+1]
+            || panPartStart[i+1] - panPartStart[i] > INT_MAX )
+            return FALSE;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Arcs.                                                           */
+/* -------------------------------------------------------------------- */
+    if( nArcs >= 0 )
+    {
+        GUIntBig nA = (GUIntBig) nArcs;
+
+        panArcId = (const GInt32 *)
+            TakeSection( pabyData, nSize, &nPos, nA * 4 );
+        padfArcLength = (const double *)
+            TakeSection( pabyData, nSize, &nPos, nA * 8 );
+        panArcStart = (const GUIntBig *)
+            TakeSection( pabyData, nSize, &nPos, nA * 8 + 8 );
+        padfArcX = (const double *)
+            TakeSection( pabyData, nSize, &nPos, nArcVertices * 8 );
+        padfArcY = (const double *)
+            TakeSection( pabyData, nSize, &nPos, nArcVertices * 8 );
+        if( panArcId == NULL || padfArcLength == NULL || panArcStart == NULL
+            || padfArcX == NULL || padfArcY == NULL
+            || panArcStart[0] != 0 || panArcStart[nA] != nArcVertices )
+            return FALSE;
+
+        for( GUIntBig i = 0; i < nA; i++ )
+        {
+            if( panArcStart[i] > panArcStart[i+1]
+                || panArcStart[i+1] - panArcStart[i] > INT_MAX )
+                return FALSE;
+        }
+
+        GUIntBig nNN = nNodeCount;
+
+        panArcTopology = (const GInt32 *)
+            TakeSection( pabyData, nSize, &nPos, nA * 16 );
+        padfNodeX = (const double *)
+            TakeSection( pabyData, nSize, &nPos, nNN * 8 );
+        padfNodeY = (const double *)
+            TakeSection( pabyData, nSize, &nPos, nNN * 8 );
+        panNodeArcStart = (const GUInt32 *)
+            TakeSection( pabyData, nSize, &nPos, nNN * 4 + 4 );
+        panNodeArcs = (const GInt32 *)
+            TakeSection( pabyData, nSize, &nPos, nNodeArcs * 4 );
+        if( panArcTopology == NULL || padfNodeX == NULL || padfNodeY == NULL
+            || panNodeArcStart == NULL || panNodeArcs == NULL
+            || panNodeArcStart[0] != 0 || panNodeArcStart[nNN] != nNodeArcs )
+            return FALSE;
+
+        for( GUIntBig i = 0; i < nNN; i++ )
+        {
+            if( panNodeArcStart[i] > panNodeArcStart[i+1] )
+                return FALSE;
+        }
+    }
+    else if( nNodeCount != 0 || nNodeArcs != 0 )
+        return FALSE;
+
+    return nPos == nSize;
+}
+
+/************************************************************************/
+/*                             GetExtent()                              */
+/************************************************************************/
+
+int OGRMapGISCache::GetExtent( OGREnvelope *psExtent ) const
+
+{
+    if( bExtentKnown )
+        *psExtent = sExtent;
+
+    return bExtentKnown;
+}
+
+/************************************************************************/
+/*                             SetFields()                              */
+/*                                                                      */
+/*      Set the attribute fields listed in anFields, by index into      */
+/*      pasFieldInfo, from record iRecord.                              */
+/************************************************************************/
+
+void OGRMapGISCache::SetFields( OGRFeature *poFeature, int iRecord,
+                                const std::vector<int> &anFields ) const
+
+{
+    for( size_t iRead = 0; iRead < anFields.size(); iRead++ )
+    {
+        int iField = anFields[iRead];
+
+        if( !apabyFieldSet[iField][iRecord] )
+            continue;
+
+        switch( pasFieldInfo[iField].eType )
+        {
+        case OFTInteger:
+            poFeature->SetField( MAPGIS_FIRST_FIELD + iField, (int)
+                ((const GInt32 *) apabyFieldValues[iField])[iRecord] );
+            break;
+        case OFTReal:
+            poFeature->SetField( MAPGIS_FIRST_FIELD + iField,
+                ((const double *) apabyFieldValues[iField])[iRecord] );
+            break;
+        default:
+            {
+                const GUInt32 *panText =
+                    (const GUInt32 *) apabyFieldValues[iField];
+                if( panText[iRecord] < panText[nRecords] )
+                    poFeature->SetField( MAPGIS_FIRST_FIELD + iField,
+                        apszFieldText[iField] + panText[iRecord] );
+                break;
+            }
+        }
+    }
+}
+
+/************************************************************************/
+/*                            GetGeometry()                             */
+/*                                                                      */
+/*      Build the geometry of record iRecord as the text reader would:  */
+/*      3D points and lines, 2D polygons.                               */
+/************************************************************************/
+
+OGRGeometry *OGRMapGISCache::GetGeometry( int iRecord ) const
+
+{
+    GUInt32 iPart = panRecordPart[iRecord];
+    GUInt32 iEndPart = panRecordPart[iRecord+1];
+
+    if( featureType == 3 )
+    {
+        OGRPolygon *poPolygon = new OGRPolygon();
+
+        for( ; iPart < iEndPart; iPart++ )
+        {
+            size_t iStart = (size_t) panPartStart[iPart];
+            OGRLinearRing *poRing = new OGRLinearRing();
+
+            poRing->setPoints( (int) (panPartStart[iPart+1] - iStart),
+                               (double *) padfX + iStart,
+                               (double *) padfY + iStart );
+            poPolygon->addRingDirectly( poRing );
+        }
+
+        return poPolygon;
+    }
+
+    if( iPart == iEndPart )
+        return NULL;
+
+    size_t iStart = (size_t) panPartStart[iPart];
+    int nCount = (int) (panPartStart[iPart+1] - iStart);
+
+    if( featureType == 1 )
+    {
+        if( nCount == 0 )
+            return NULL;
+        return new OGRPoint( padfX[iStart], padfY[iStart], 0.0 );
+    }
+
+    OGRLineString *poLS = new OGRLineString();
+    poLS->setPoints( nCount, (double *) padfX + iStart,
+                     (double *) padfY + iStart );
+    poLS->setCoordinateDimension( 3 );
+
+    return poLS;
+}
+
+/************************************************************************/
+/*                             CopyFields()                             */
+/*                                                                      */
+/*      SetFields() into the current feature of poArrays.               */
+/************************************************************************/
+
+void OGRMapGISCache::CopyFields( int iRecord,
+                                 const std::vector<int> &anFields,
+                                 OGRMapGISFeatureArrays *poArrays ) const
+
+{
+    for( size_t iRead = 0; iRead < anFields.size(); iRead++ )
+    {
+        int iField = anFields[iRead];
+
+        if( !apabyFieldSet[iField][iRecord] )
+            continue;
+
+        switch( pasFieldInfo[iField].eType )
+        {
+        case OFTInteger:
+            poArrays->SetInteger( MAPGIS_FIRST_FIELD + iField, (int)
+                ((const GInt32 *) apabyFieldValues[iField])[iRecord] );
+            break;
+        case OFTReal:
+            poArrays->SetReal( MAPGIS_FIRST_FIELD + iField,
+                ((const double *) apabyFieldValues[iField])[iRecord] );
+            break;
+        default:
+            {
+                const GUInt32 *panText =
+                    (const GUInt32 *) apabyFieldValues[iField];
+                if( panText[iRecord] < panText[nRecords] )
+                {
+                    const char *pszText =
+                        apszFieldText[iField] + panText[iRecord];
+                    poArrays->SetString( MAPGIS_FIRST_FIELD + iField,
+                        pszText, (int) strlen( pszText ) );
+                }
+                break;
+            }
+        }
+    }
+}
+
+/************************************************************************/
+/*                            CopyGeometry()                            */
+/*                                                                      */
+/*      Append the parts of record iRecord to the current feature of    */
+/*      poArrays.                                                       */
+/************************************************************************/
+
+void OGRMapGISCache::CopyGeometry( int iRecord,
+                                   OGRMapGISFeatureArrays *poArrays ) const
+
+{
+    for( GUInt32 iPart = panRecordPart[iRecord];
+         iPart < panRecordPart[iRecord+1]; iPart++ )
+    {
+        size_t iStart = (size_t) panPartStart[iPart];
+
+        poArrays->AddPart( (int) (panPartStart[iPart+1] - iStart),
+                           padfX + iStart, padfY + iStart );
+    }
+}
+
+/************************************************************************/
+/*                              LoadArcs()                              */
+/************************************************************************/
+
+void OGRMapGISCache::LoadArcs( OGRMapGISArcStore *poArcs ) const
+
+{
+    poArcs->Reserve( nArcs );
+
+    for( int i = 0; i < nArcs; i++ )
+    {
+        size_t iStart = (size_t) panArcStart[i];
+
+        poArcs->AddArc( panArcId[i], (int) (panArcStart[i+1] - iStart),
+                        padfArcX + iStart, padfArcY + iStart,
+                        padfArcLength[i], 0 );
+        poArcs->SetTopology( panArcId[i], panArcTopology[4*i],
+                             panArcTopology[4*i+1], panArcTopology[4*i+2],
+                             panArcTopology[4*i+3] );
+    }
+
+    for( int i = 0; i < nNodes; i++ )
+    {
+        GUInt32 iStart = panNodeArcStart[i];
+
+        poArcs->AddNode( padfNodeX[i], padfNodeY[i],
+                         (int) (panNodeArcStart[i+1] - iStart),
+                         (const int *) panNodeArcs + iStart );
+    }
+
+    poArcs->Shrink();
+}
+
+/************************************************************************/
+/*                        OGRMapGISCacheBuilder                         */
+/*                                                                      */
+/*      Collects the columns of a cache in memory, a record at a        */
+/*      time, and writes them out in one go.                            */
+/************************************************************************/
+
+class OGRMapGISCacheBuilder
+{
+    int                 featureType;
+    const OGRMapGISFieldInfo *pasFieldInfo;
+    int                 nFieldInfo;
+
+    std::vector<GUIntBig> anRecordOffset;
+    std::vector<double> adfRecordBounds;
+    std::vector< std::vector<GByte> > aabyFieldSet;
+    std::vector< std::vector<GByte> > aabyFieldValues;
+    std::vector< std::vector<char> > aabyFieldText;
+    std::vector<GUInt32> anRecordPart;
+    std::vector<GUIntBig> anPartStart;
+    std::vector<double> adfX;
+    std::vector<double> adfY;
+
+    std::vector<GInt32> anArcId;
+    std::vector<double> adfArcLength;
+    std::vector<GUIntBig> anArcStart;
+    std::vector<double> adfArcX;
+    std::vector<double> adfArcY;
+    std::vector<GInt32> anArcTopology;
+    std::vector<double> adfNodeX;
+    std::vector<double> adfNodeY;
+    std::vector<GUInt32> anNodeArcStart;
+    std::vector<GInt32> anNodeArcs;
+    int                 bHaveArcs;
+
+    void                AddPart( const OGRLineString *poLine );
+
+  public:
+    OGREnvelope         sExtent;
+    int                 bExtentKnown;
+
+                        OGRMapGISCacheBuilder( int featureType );
+
+    void                AddRecord( vsi_l_offset nOffset,
+                                   OGRFeature *poFeature );
+    void                AddArcs( OGRMapGISArcStore *poArcs );
+    int                 Write( const char *pszSource,
+                               vsi_l_offset nFirstRecordOffset );
+};
+
+/************************************************************************/
+/*                       OGRMapGISCacheBuilder()                        */
+/************************************************************************/
+
+OGRMapGISCacheBuilder::OGRMapGISCacheBuilder( int featureTypeIn )
+
+{
+    featureType = featureTypeIn;
+    pasFieldInfo = OGRMapGISGetFieldInfo( featureType, &nFieldInfo );
+
+    aabyFieldSet.resize( nFieldInfo );
+    aabyFieldValues.resize( nFieldInfo );
+    aabyFieldText.resize( nFieldInfo );
+
+    anRecordPart.push_back( 0 );
+    anPartStart.push_back( 0 );
+    anArcStart.push_back( 0 );
+    anNodeArcStart.push_back( 0 );
+    bHaveArcs = FALSE;
+    bExtentKnown = FALSE;
+}
+
+/************************************************************************/
+/*                              AddPart()                               */
+/************************************************************************/
+
+void OGRMapGISCacheBuilder::AddPart( const OGRLineString *poLine )
+
+{
+    int nCount = poLine->getNumPoints();
+
+    for( int i = 0; i < nCount; i++ )
+    {
+        adfX.push_back( poLine->getX( i ) );
+        adfY.push_back( poLine->getY( i ) );
+    }
+
+    anPartStart.push_back( adfX.size() );
+}
+
+/************************************************************************/
+/*                             AddRecord()                              */
+/*                                                                      */
+/*      Add a record decoded with all its fields and its geometry.      */
+/************************************************************************/
+
+void OGRMapGISCacheBuilder::AddRecord( vsi_l_offset nOffset,
+                                       OGRFeature *poFeature )
+
+{
+    anRecordOffset.push_back( (GUIntBig) nOffset );
+
+    for( int iField = 0; iField < nFieldInfo; iField++ )
+    {
+        int iOGRField = MAPGIS_FIRST_FIELD + iField;
+        int bSet = poFeature->IsFieldSet( iOGRField );
+        std::vector<GByte> &abyValues = aabyFieldValues[iField];
+        size_t nOld = abyValues.size();
+
+        aabyFieldSet[iField].push_back( (GByte) bSet );
+
+        switch( pasFieldInfo[iField].eType )
+        {
+        case OFTInteger:
+            {
+                GInt32 nValue = bSet ?
+                    poFeature->GetFieldAsInteger( iOGRField ) : 0;
+                abyValues.resize( nOld + 4 );
+                memcpy( &abyValues[nOld], &nValue, 4 );
+                break;
+            }
+        case OFTReal:
+            {
+                double dfValue = bSet ?
+                    poFeature->GetFieldAsDouble( iOGRField ) : 0.0;
+                abyValues.resize( nOld + 8 );
+                memcpy( &abyValues[nOld], &dfValue, 8 );
+                break;
+            }
+        default:
+            {
+                std::vector<char> &abyText = aabyFieldText[iField];
+                GUInt32 nStart = (GUInt32) abyText.size();
+                const char *pszValue = bSet ?
+                    poFeature->GetFieldAsString( iOGRField ) : "";
+
+                abyValues.resize( nOld + 4 );
+                memcpy( &abyValues[nOld], &nStart, 4 );
+                abyText.insert( abyText.end(), pszValue,
+                                pszValue + strlen( pszValue ) + 1 );
+                break;
+            }
+        }
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Geometry and its extent, MinX > MaxX if there is none.          */
+/* -------------------------------------------------------------------- */
+    OGRGeometry *poGeometry = poFeature->GetGeometryRef();
+    size_t nOldParts = anPartStart.size();
+
+    if( poGeometry != NULL && featureType == 1 )
+    {
+        OGRPoint *poPoint = (OGRPoint *) poGeometry;
+        adfX.push_back( poPoint->getX() );
+        adfY.push_back( poPoint->getY() );
+        anPartStart.push_back( adfX.size() );
+    }
+    else if( poGeometry != NULL && featureType == 2 )
+        AddPart( (OGRLineString *) poGeometry );
+    else if( poGeometry != NULL )
+    {
+        OGRPolygon *poPolygon = (OGRPolygon *) poGeometry;
+        if( poPolygon->getExteriorRing() != NULL )
+        {
+            AddPart( poPolygon->getExteriorRing() );
+            for( int i = 0; i < poPolygon->getNumInteriorRings(); i++ )
+                AddPart( poPolygon->getInteriorRing( i ) );
+        }
+    }
+
+    anRecordPart.push_back( (GUInt32) (anPartStart.size() - 1) );
+
+    OGREnvelope sBounds;
+    if( anPartStart.size() > nOldParts )
+    {
+        poGeometry->getEnvelope( &sBounds );
+        if( bExtentKnown )
+            sExtent.Merge( sBounds );
+        else
+            sExtent = sBounds;
+        bExtentKnown = TRUE;
+    }
+    else
+    {
+        sBounds.MinX = 1.0;
+        sBounds.MaxX = 0.0;
+    }
+
+    adfRecordBounds.push_back( sBounds.MinX );
+    adfRecordBounds.push_back( sBounds.MinY );
+    adfRecordBounds.push_back( sBounds.MaxX );
+    adfRecordBounds.push_back( sBounds.MaxY );
+}
+
+/************************************************************************/
+/*                              AddArcs()                               */
+/************************************************************************/
+
+void OGRMapGISCacheBuilder::AddArcs( OGRMapGISArcStore *poArcs )
+
+{
+    bHaveArcs = TRUE;
+
+    std::vector<double> adfWork;
+
+    for( int nArcId = 1; nArcId <= poArcs->GetMaxArcId(); nArcId++ )
+    {
+        const double *padfArcXIn, *padfArcYIn;
+        int nCount = poArcs->FetchArc( nArcId, &padfArcXIn, &padfArcYIn,
+                                       adfWork );
+
+        if( nCount == 0 )
+            continue;
+
+        anArcId.push_back( nArcId );
+        adfArcLength.push_back( poArcs->GetLength( nArcId ) );
+        adfArcX.insert( adfArcX.end(), padfArcXIn, padfArcXIn + nCount );
+        adfArcY.insert( adfArcY.end(), padfArcYIn, padfArcYIn + nCount );
+        anArcStart.push_back( adfArcX.size() );
+        anArcTopology.push_back( poArcs->GetFromNode( nArcId ) );
+        anArcTopology.push_back( poArcs->GetToNode( nArcId ) );
+        anArcTopology.push_back( poArcs->GetLeftPolygon( nArcId ) );
+        anArcTopology.push_back( poArcs->GetRightPolygon( nArcId ) );
+    }
+
+    for( int nNodeId = 1; nNodeId <= poArcs->GetNodeCount(); nNodeId++ )
+    {
+        const int *panArcs = NULL;
+        int nArcs = poArcs->GetNodeArcs( nNodeId, &panArcs );
+
+        adfNodeX.push_back( poArcs->GetNodeX( nNodeId ) );
+        adfNodeY.push_back( poArcs->GetNodeY( nNodeId ) );
+        if( nArcs > 0 )
+            anNodeArcs.insert( anNodeArcs.end(), panArcs, panArcs + nArcs );
+        anNodeArcStart.push_back( (GUInt32) anNodeArcs.size() );
+    }
+}
+
+/************************************************************************/
+/*                            WriteSection()                            */
+/************************************************************************/
+
+static int WriteSection( VSILFILE *fp, const void *pData, size_t nBytes )
+
+{
+    static const GByte abyZero[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    size_t nPad = (8 - nBytes % 8) % 8;
+
+    return (nBytes == 0 || VSIFWriteL( pData, 1, nBytes, fp ) == nBytes)
+        && (nPad == 0 || VSIFWriteL( abyZero, 1, nPad, fp ) == nPad);
+}
+
+template<class T>
+static int WriteSection( VSILFILE *fp, const std::vector<T> &aData )
+
+{
+    return WriteSection( fp, aData.empty() ? NULL : &aData[0],
+                         aData.size() * sizeof(T) );
+}
+
+/************************************************************************/
+/*                               Write()                                */
+/*                                                                      */
+/*      Save the cache beside pszSource.  Failure, for instance on a    */
+/*      read only directory, is not an error.                           */
+/************************************************************************/
+
+int OGRMapGISCacheBuilder::Write( const char *pszSource,
+                                  vsi_l_offset nFirstRecordOffset )
+
+{
+#ifdef CPL_MSB
+    return FALSE;
+#else
+    GByte abyHeader[MGC_HEADER_SIZE];
+
+    memset( abyHeader, 0, sizeof(abyHeader) );
+    if( !OGRMapGISCache::GetSourceKey( pszSource, abyHeader + 16 ) )
+        return FALSE;
+
+    GUInt32 nType = featureType;
+    GUInt32 nRecords = (GUInt32) anRecordOffset.size();
+    GUIntBig nFirstOffset = nFirstRecordOffset;
+    GUInt32 nFields = nFieldInfo;
+    GInt32 nArcs = bHaveArcs ? (GInt32) anArcId.size() : -1;
+    GUIntBig nParts = anPartStart.size() - 1;
+    GUIntBig nVertices = adfX.size();
+    GUIntBig nArcVertices = adfArcX.size();
+    GUInt32 nNodes = (GUInt32) adfNodeX.size();
+    GUIntBig nNodeArcs = anNodeArcs.size();
+    double adfExtent[4] = { 1.0, 0.0, 0.0, 0.0 };
+
+    if( bExtentKnown )
+    {
+        adfExtent[0] = sExtent.MinX;
+        adfExtent[1] = sExtent.MinY;
+        adfExtent[2] = sExtent.MaxX;
+        adfExtent[3] = sExtent.MaxY;
+    }
+
+    memcpy( abyHeader, MGC_SIGNATURE, 8 );
+    memcpy( abyHeader + 8, &nType, 4 );
+    memcpy( abyHeader + 12, &nRecords, 4 );
+    memcpy( abyHeader + 40, &nFirstOffset, 8 );
+    memcpy( abyHeader + 48, &nFields, 4 );
+    memcpy( abyHeader + 52, &nArcs, 4 );
+    memcpy( abyHeader + 56, &nParts, 8 );
+    memcpy( abyHeader + 64, &nVertices, 8 );
+    memcpy( abyHeader + 72, &nArcVertices, 8 );
+    memcpy( abyHeader + 80, adfExtent, 32 );
+    memcpy( abyHeader + 112, &nNodes, 4 );
+    memcpy( abyHeader + 120, &nNodeArcs, 8 );
+
+    CPLString osCache = OGRMapGISCache::GetFilename( pszSource );
+    VSILFILE *fp = VSIFOpenL( osCache, "wb" );
+
+    if( fp == NULL )
+    {
+        CPLDebug( "MapGIS", "Unable to create cache %s.", osCache.c_str() );
+        return FALSE;
+    }
+
+    int bOK = WriteSection( fp, abyHeader, MGC_HEADER_SIZE )
+        && WriteSection( fp, anRecordOffset )
+        && WriteSection( fp, adfRecordBounds );
+
+    for( int iField = 0; bOK && iField < nFieldInfo; iField++ )
+    {
+        bOK = WriteSection( fp, aabyFieldSet[iField] );
+
+        if( bOK && pasFieldInfo[iField].eType == OFTString )
+        {
+            std::vector<GByte> &abyValues = aabyFieldValues[iField];
+            GUInt32 nEnd = (GUInt32) aabyFieldText[iField].size();
+            size_t nOld = abyValues.size();
+
+            // The trailing nul keeps the text area from being empty.
+            aabyFieldText[iField].push_back( '\0' );
+            abyValues.resize( nOld + 4 );
+            memcpy( &abyValues[nOld], &nEnd, 4 );
+
+            bOK = WriteSection( fp, abyValues )
+                && WriteSection( fp, aabyFieldText[iField] );
+        }
+        else if( bOK )
+            bOK = WriteSection( fp, aabyFieldValues[iField] );
+    }
+
+    bOK = bOK
+        && WriteSection( fp, anRecordPart )
+        && WriteSection( fp, anPartStart )
+        && WriteSection( fp, adfX )
+        && WriteSection( fp, adfY );
+
+    if( bOK && bHaveArcs )
+        bOK = WriteSection( fp, anArcId )
+            && WriteSection( fp, adfArcLength )
+            && WriteSection( fp, anArcStart )
+            && WriteSection( fp, adfArcX )
+            && WriteSection( fp, adfArcY )
+            && WriteSection( fp, anArcTopology )
+            && WriteSection( fp, adfNodeX )
+            && WriteSection( fp, adfNodeY )
+            && WriteSection( fp, anNodeArcStart )
+            && WriteSection( fp, anNodeArcs );
+
+    if( VSIFCloseL( fp ) != 0 )
+        bOK = FALSE;
+
+    if( !bOK )
+    {
+        VSIUnlink( osCache );
+        return FALSE;
+    }
+
+    CPLDebug( "MapGIS", "Wrote cache %s (%d records).",
+              osCache.c_str(), (int) nRecords );
+
+    return TRUE;
+#endif
+}
+
+/************************************************************************/
+/*                             BuildCache()                             */
+/*                                                                      */
+/*      Decode every record with all its fields, whatever is ignored,   */
+/*      save the columns as the layer cache and start using it.  The    */
+/*      pass also completes the record index.                           */
+/************************************************************************/
+
+int OGRMapGISLayer::BuildCache()
+
+{
+    OGRMapGISCacheBuilder oBuilder( featureType );
+
+    std::vector<int> anSavedFields = anReadFields;
+    int anSavedColumns[2] = { anReadColumns[0], anReadColumns[1] };
+
+    anReadFields.resize( 0 );
+    for( int iField = 0; iField < nFieldInfo; iField++ )
+    {
+        anReadFields.push_back( iField );
+        for( int iLayout = 0; iLayout < 2; iLayout++ )
+            anReadColumns[iLayout] = MAX( anReadColumns[iLayout],
+                pasFieldInfo[iField].aiColumn[iLayout] + 1 );
+    }
+
+    SuspendReading();
+
+    poReader->Seek( nFirstRecordOffset );
+    iNextRecord = 0;
+
+    while( TRUE )
+    {
+        vsi_l_offset nRecordOffset = poReader->Tell();
+        OGRFeature *poFeature = DecodeRecord( poReader, poFeatureDefn,
+                                              &oScratch, FALSE, NULL );
+
+        if( poFeature == NULL )
+        {
+            EndOfRecords();
+            break;
+        }
+
+        IndexRecord( nRecordOffset );
+        oBuilder.AddRecord( nRecordOffset, poFeature );
+        delete poFeature;
+    }
+
+    anReadFields = anSavedFields;
+    anReadColumns[0] = anSavedColumns[0];
+    anReadColumns[1] = anSavedColumns[1];
+
+    if( featureType == 3 )
+    {
+        // Lazy arcs are not all in memory, and are read from the text.
+        if( !oArcs.IsLazy() )
+            oBuilder.AddArcs( &oArcs );
+
+        // The extent of a WAP layer is that of its arcs.
+        if( bExtentKnown )
+        {
+            oBuilder.sExtent = sLayerExtent;
+            oBuilder.bExtentKnown = TRUE;
+        }
+    }
+
+    if( !oBuilder.Write( pszFullName, nFirstRecordOffset ) )
+        return FALSE;
+
+    poCache = OGRMapGISCache::Open( pszFullName, featureType );
+    if( poCache == NULL )
+        return FALSE;
+
+    nTotalMapGISCount = poCache->GetRecordCount();
+    bExtentKnown = poCache->GetExtent( &sLayerExtent );
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                             UseCache()                               */
+/*                                                                      */
+/*      Take the arcs, record count and record index from the cache.    */
+/*      Lazy arcs are still scanned from the text, as the cache keeps   */
+/*      coordinates rather than file offsets.                           */
+/************************************************************************/
+
+void OGRMapGISLayer::UseCache()
+
+{
+    const char *pszCacheMB = CPLGetConfigOption( "MAPGIS_ARC_CACHE_MB", NULL );
+
+    if( featureType == 3 )
+    {
+        if( (pszCacheMB != NULL && atoi( pszCacheMB ) > 0)
+            || !poCache->HasArcs() )
+        {
+            poReader->Seek( nFirstRecordOffset );
+            ScanArcs( nArcCount );
+        }
+        else
+        {
+            MAPGIS_STAT_START( dfStart );
+            poCache->LoadArcs( &oArcs );
+            MAPGIS_STAT_STOP( &sStats, dfArcScanTime, dfStart );
+        }
+    }
+
+    nFirstRecordOffset = poCache->GetFirstRecordOffset();
+    nTotalMapGISCount = poCache->GetRecordCount();
+    bExtentKnown = poCache->GetExtent( &sLayerExtent );
+
+    anRecordIndex.resize( 0 );
+    anRecordDelta.resize( 0 );
+    bRecordIndexComplete = FALSE;
+    for( iNextRecord = 0; iNextRecord < nTotalMapGISCount; )
+        IndexRecord( poCache->GetRecordOffset( iNextRecord ) );
+    bRecordIndexComplete = TRUE;
+}
+
+/************************************************************************/
+/*                          ReadCachedRecord()                          */
+/*                                                                      */
+/*      The cache counterpart of DecodeRecord(), building record        */
+/*      iRecord from the cache.  If pbFiltered is given, records the    */
+/*      attribute filter rejects on their attributes are dropped        */
+/*      before their geometry is built.                                 */
+/************************************************************************/
+
+OGRFeature *OGRMapGISLayer::ReadCachedRecord( int iRecord,
+                                              OGRFeatureDefn *poDefn,
+                                              int bSkipGeometry,
+                                              int *pbFiltered )
+
+{
+    OGRFeature *poFeature = new OGRFeature( poDefn );
+
+    if( pbFiltered != NULL )
+        *pbFiltered = FALSE;
+
+    if( !bLayerFieldIgnored )
+        poFeature->SetField( 0, featureType == 1 ? "WAT_1"
+                             : featureType == 2 ? "WAL_1" : "WAP_1" );
+    poCache->SetFields( poFeature, iRecord, anReadFields );
+    poFeature->SetFID( iRecord );
+
+    if( pbFiltered != NULL && m_poAttrQuery != NULL
+        && !bAttrQueryNeedsGeometry
+        && !m_poAttrQuery->Evaluate( poFeature ) )
+    {
+        delete poFeature;
+        *pbFiltered = TRUE;
+        return NULL;
+    }
+
+    if( !bSkipGeometry )
+        poFeature->SetGeometryDirectly( poCache->GetGeometry( iRecord ) );
+
+    return poFeature;
+}
+
+/************************************************************************/
+/*                         DecodeCachedArrays()                         */
+/*                                                                      */
+/*      The cache counterpart of DecodeRecordArrays(), adding record    */
+/*      iRecord to poArrays.  Returns -1 if the attribute filter,       */
+/*      evaluated on poQueryFeature if given, rejects the record.       */
+/************************************************************************/
+
+int OGRMapGISLayer::DecodeCachedArrays( OGRMapGISFeatureArrays *poArrays,
+                                        int iRecord, int bSkipGeometry,
+                                        OGRFeature *poQueryFeature )
+
+{
+    poArrays->BeginFeature( iRecord );
+
+    if( !bLayerFieldIgnored )
+        poArrays->SetString( 0, featureType == 1 ? "WAT_1"
+                             : featureType == 2 ? "WAL_1" : "WAP_1", 5 );
+    poCache->CopyFields( iRecord, anReadFields, poArrays );
+
+    if( poQueryFeature != NULL )
+    {
+        poArrays->GetFeature( poArrays->nFeatures, poQueryFeature, FALSE );
+        if( !m_poAttrQuery->Evaluate( poQueryFeature ) )
+        {
+            poArrays->Truncate( poArrays->nFeatures );
+            return -1;
+        }
+    }
+
+    if( !bSkipGeometry )
+        poCache->CopyGeometry( iRecord, poArrays );
+
+    poArrays->EndFeature();
+
+    return 1;
+}
+
+/************************************************************************/
+/*                         CachedRecordInFilter()                       */
+/*                                                                      */
+/*      Decide from its saved extent whether record iRecord can pass    */
+/*      the spatial filter, see BoundsInFilter().                       */
+/************************************************************************/
+
+int OGRMapGISLayer::CachedRecordInFilter( int iRecord )
+
+{
+    return BoundsInFilter( poCache->GetRecordBounds( iRecord ) );
+}
+
+/************************************************************************/
+/*                           BoundsInFilter()                           */
+/*                                                                      */
+/*      Decide from MinX, MinY, MaxX, MaxY bounds whether a feature     */
+/*      can pass the spatial filter: 0 if not, 1 if it surely does,     */
+/*      and -1 if only its geometry can tell.  Features without         */
+/*      vertices have MinX > MaxX and never pass.                       */
+/************************************************************************/
+
+int OGRMapGISLayer::BoundsInFilter( const double *padfBounds )
+
+{
+    if( !(padfBounds[0] <= padfBounds[2])
+        || padfBounds[2] < m_sFilterEnvelope.MinX
+        || padfBounds[3] < m_sFilterEnvelope.MinY
+        || m_sFilterEnvelope.MaxX < padfBounds[0]
+        || m_sFilterEnvelope.MaxY < padfBounds[1] )
+        return 0;
+
+    if( m_bFilterIsEnvelope
+        && padfBounds[0] >= m_sFilterEnvelope.MinX
+        && padfBounds[1] >= m_sFilterEnvelope.MinY
+        && padfBounds[2] <= m_sFilterEnvelope.MaxX
+        && padfBounds[3] <= m_sFilterEnvelope.MaxY )
+        return 1;
+
+    return -1;
+}
+
+/************************************************************************/
+/*                        GetNextCachedFeature()                        */
+/*                                                                      */
+/*      GetNextFeature() on the cache.  The spatial filter is first     */
+/*      tried on the saved record extents.                              */
+/************************************************************************/
+
+OGRFeature *OGRMapGISLayer::GetNextCachedFeature()
+
+{
+    if( bResumePending )
+    {
+        bResumePending = FALSE;
+        iNextRecord = iResumeRecord;
+    }
+
+    while( iNextRecord < poCache->GetRecordCount() )
+    {
+        int iRecord = iNextRecord++;
+        int nMatch = m_poFilterGeom == NULL ? 1
+            : CachedRecordInFilter( iRecord );
+
+        if( nMatch == 0 )
+        {
+            MAPGIS_STAT_ADD( &sStats, nFiltered, 1 );
+            continue;
+        }
+
+        int bFiltered = FALSE;
+        OGRFeature *poFeature = ReadCachedRecord( iRecord, poFeatureDefn,
+            SkipGeometry(), &bFiltered );
+
+        if( poFeature != NULL
+            && (nMatch > 0 || FilterGeometry( poFeature->GetGeometryRef() ))
+            && (m_poAttrQuery == NULL || !bAttrQueryNeedsGeometry
+                || m_poAttrQuery->Evaluate( poFeature )) )
+        {
+            if( poFeatureDefn->IsGeometryIgnored() )
+                poFeature->SetGeometryDirectly( NULL );
+            MAPGIS_STAT_ADD( &sStats, nFeatures, 1 );
+            return poFeature;
+        }
+
+        delete poFeature;
+        MAPGIS_STAT_ADD( &sStats, nFiltered, 1 );
+    }
+
+    return NULL;
+}
+
+/************************************************************************/
+/*                         CountCachedRecords()                         */
+/*                                                                      */
+/*      GetFeatureCount() with only a spatial filter, on the cache.     */
+/************************************************************************/
+
+int OGRMapGISLayer::CountCachedRecords()
+
+{
+    int nCount = 0;
+
+    for( int iRecord = 0; iRecord < poCache->GetRecordCount(); iRecord++ )
+    {
+        int nMatch = CachedRecordInFilter( iRecord );
+
+        if( nMatch < 0 )
+        {
+            OGRGeometry *poGeometry = poCache->GetGeometry( iRecord );
+            nMatch = FilterGeometry( poGeometry ) ? 1 : 0;
+            delete poGeometry;
+        }
+
+        nCount += nMatch;
+    }
+
+    return nCount;
+}
@@ -0,0 +1,118 @@
+/******************************************************************************
+ * $Id: ogrmapgiscursor.cpp 30012 2012-03-01 09:26:44Z fuxin $
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Implements OGRMapGISCursor, an independent read position on
+ *           a MapGIS layer.
+ * Author:   ZhouShun, shunzhou@foxmail.com
+ *
+ ******************************************************************************
+ * Copyright (c) 1999,  Les Technologies SoftMap Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "ogr_mapgis.h"
+#include "cpl_conv.h"
+
+CPL_CVSID("$Id: ogrmapgiscursor.cpp 30012 2012-03-01 09:26:44Z fuxin $");
+
+/************************************************************************/
+/*                          OGRMapGISCursor()                           */
+/*                                                                      */
+/*      Features are created on a copy of the layer definition, as      */
+/*      OGRFeatureDefn reference counting is not thread safe.           */
+/************************************************************************/
+
+OGRMapGISCursor::OGRMapGISCursor( OGRMapGISLayer *poLayerIn, VSILFILE *fp )
+
+{
+	poLayer = poLayerIn;
+	poReader = new OGRMapGISReader( poLayer->GetFullName(), fp, NULL );
+
+	poFeatureDefn = poLayer->GetLayerDefn()->Clone();
+	poFeatureDefn->Reference();
+
+	ResetReading();
+}
+
+/************************************************************************/
+/*                          ~OGRMapGISCursor()                          */
+/************************************************************************/
+
+OGRMapGISCursor::~OGRMapGISCursor()
+
+{
+	delete poReader;
+	poFeatureDefn->Release();
+}
+
+/************************************************************************/
+/*                            ResetReading()                            */
+/************************************************************************/
+
+void OGRMapGISCursor::ResetReading()
+
+{
+	poReader->Seek( poLayer->nFirstRecordOffset );
+	iNextRecord = 0;
+}
+
+/************************************************************************/
+/*                           GetNextFeature()                           */
+/************************************************************************/
+
+OGRFeature *OGRMapGISCursor::GetNextFeature()
+
+{
+	if( iNextRecord >= (int) poLayer->anRecordDelta.size() )
+		return NULL;
+
+	// The cache is only read, so cursors can share it.
+	if( poLayer->poCache != NULL )
+		return poLayer->ReadCachedRecord( iNextRecord++, poFeatureDefn,
+			poLayer->GetLayerDefn()->IsGeometryIgnored(), NULL );
+
+	OGRFeature *poFeature = poLayer->DecodeRecord( poReader, poFeatureDefn,
+		&oScratch, poLayer->GetLayerDefn()->IsGeometryIgnored(), NULL );
+
+	if( poFeature != NULL )
+		poFeature->SetFID( iNextRecord++ );
+
+	return poFeature;
+}
+
+/************************************************************************/
+/*                             GetFeature()                             */
+/*                                                                      */
+/*      Sequential reading continues after the feature fetched.         */
+/************************************************************************/
+
+OGRFeature *OGRMapGISCursor::GetFeature( long nFID )
+
+{
+	if( nFID < 0 || nFID >= (long) poLayer->anRecordDelta.size() )
+		return NULL;
+
+	poReader->Seek( poLayer->anRecordIndex[nFID / MAPGIS_INDEX_INTERVAL]
+		+ poLayer->anRecordDelta[nFID] );
+	iNextRecord = (int) nFID;
+
+	return GetNextFeature();
+}
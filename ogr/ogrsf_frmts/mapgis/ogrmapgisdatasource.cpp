@@ -34,6 +34,46 @@
 
 CPL_CVSID("Id: ogrmapgisdatasource.cpp 30003 2012-02-14 08:23:13Z fuxin $");
 
+/* The WMAP file types, in the order the files of a map set are opened. */
+static const char * const apszExtensions[] = { "wat", "wal", "wap" };
+
+/************************************************************************/
+/*                          CompareWMAPFiles()                          */
+/*                                                                      */
+/*      Order files by name, and files of the same name as a map set    */
+/*      is opened, so a file gets the same layer name either way.       */
+/************************************************************************/
+
+static int GetExtensionOrder( const char *pszFilename )
+
+{
+	for( int j = 0; j < 3; j++ )
+	{
+		if( EQUAL(CPLGetExtension(pszFilename),apszExtensions[j]) )
+			return j;
+	}
+
+	return 3;
+}
+
+static bool CompareWMAPFiles( const CPLString &osA, const CPLString &osB )
+
+{
+	CPLString osBaseA = CPLGetBasename( osA );
+	CPLString osBaseB = CPLGetBasename( osB );
+
+	if( osBaseA != osBaseB )
+		return osBaseA < osBaseB;
+
+	int nOrderA = GetExtensionOrder( osA );
+	int nOrderB = GetExtensionOrder( osB );
+
+	if( nOrderA != nOrderB )
+		return nOrderA < nOrderB;
+
+	return osA < osB;
+}
+
 /************************************************************************/
 /*                         OGRMapGISDataSource()                         */
 /************************************************************************/
@@ -44,6 +84,11 @@ OGRMapGISDataSource::OGRMapGISDataSource()
     pszName = NULL;
     papoLayers = NULL;
     nLayers = 0;
+    papoArcLayers = NULL;
+    nArcLayers = 0;
+    papoWriterLayers = NULL;
+    nWriterLayers = 0;
+    bDSUpdate = FALSE;
     bSingleFileDataSource = FALSE;
 }
 
@@ -56,6 +101,12 @@ OGRMapGISDataSource::~OGRMapGISDataSource()
 {
     CPLFree( pszName );
 
+    // Arc and node layers read from their WAP layer.
+    for( int i = 0; i < nArcLayers; i++ )
+        delete papoArcLayers[i];
+
+    CPLFree( papoArcLayers );
+
     for( int i = 0; i < nLayers; i++ )
     {
         CPLAssert( NULL != papoLayers[i] );
@@ -64,6 +115,11 @@ OGRMapGISDataSource::~OGRMapGISDataSource()
     }
     
     CPLFree( papoLayers );
+
+    for( int i = 0; i < nWriterLayers; i++ )
+        delete papoWriterLayers[i];
+
+    CPLFree( papoWriterLayers );
 }
 
 /************************************************************************/
@@ -73,7 +129,125 @@ OGRMapGISDataSource::~OGRMapGISDataSource()
 int OGRMapGISDataSource::Open( const char * pszNewName, int bUpdate/*,
                               int bTestOpen, int bForceSingleFileDataSource*/ )
 
-{    
+{
+	CPLFree( pszName );
+	pszName = CPLStrdup( pszNewName );
+
+	VSIStatBufL sStat;
+
+	if( VSIStatL( pszNewName, &sStat ) == 0 )
+	{
+		if( !VSI_ISDIR( sStat.st_mode ) )
+		{
+			bSingleFileDataSource = TRUE;
+			return OpenFile( pszNewName, bUpdate );
+		}
+
+/* -------------------------------------------------------------------- */
+/*      A directory: every WMAP file in it, in name order.  Files of    */
+/*      the same name come in map set order, wat, wal then wap.         */
+/* -------------------------------------------------------------------- */
+		char **papszFiles = VSIReadDir( pszNewName );
+		std::vector<CPLString> aosFiles;
+
+		for( int i = 0; papszFiles != NULL && papszFiles[i] != NULL; i++ )
+		{
+			if( GetExtensionOrder( papszFiles[i] ) < 3 )
+				aosFiles.push_back( papszFiles[i] );
+		}
+		CSLDestroy( papszFiles );
+
+		std::sort( aosFiles.begin(), aosFiles.end(), CompareWMAPFiles );
+
+		for( size_t i = 0; i < aosFiles.size(); i++ )
+			OpenFile( CPLFormFilename( pszNewName, aosFiles[i], NULL ),
+					  bUpdate );
+
+		return nLayers > 0;
+	}
+
+/* -------------------------------------------------------------------- */
+/*      A map set: the name without extension of its files.             */
+/* -------------------------------------------------------------------- */
+	if( CPLGetExtension( pszNewName )[0] != '\0' )
+		return FALSE;
+
+	for( int j = 0; j < 3; j++ )
+	{
+		CPLString osFilename = CPLResetExtension( pszNewName,
+												  apszExtensions[j] );
+
+		if( VSIStatL( osFilename, &sStat ) == 0 )
+			OpenFile( osFilename, bUpdate );
+	}
+
+	return nLayers > 0;
+}
+
+/************************************************************************/
+/*                               Create()                               */
+/*                                                                      */
+/*      A name with a WMAP extension is a single file data source,      */
+/*      anything else a directory getting one file per layer.           */
+/************************************************************************/
+
+int OGRMapGISDataSource::Create( const char *pszFilename,
+								 char **papszOptions )
+
+{
+	pszName = CPLStrdup( pszFilename );
+	bDSUpdate = TRUE;
+
+	if( EQUAL(CPLGetExtension(pszFilename),"wat") ||
+		EQUAL(CPLGetExtension(pszFilename),"wal") ||
+		EQUAL(CPLGetExtension(pszFilename),"wap") )
+	{
+		bSingleFileDataSource = TRUE;
+		return TRUE;
+	}
+
+	VSIStatBufL sStat;
+
+	if( VSIStatL( pszFilename, &sStat ) == 0 )
+	{
+		if( !VSI_ISDIR( sStat.st_mode ) )
+		{
+			CPLError( CE_Failure, CPLE_AppDefined,
+					  "%s exists and is not a directory.", pszFilename );
+			return FALSE;
+		}
+	}
+	else if( VSIMkdir( pszFilename, 0755 ) != 0 )
+	{
+		CPLError( CE_Failure, CPLE_OpenFailed,
+				  "Failed to create directory %s.", pszFilename );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                           TestCapability()                           */
+/************************************************************************/
+
+int OGRMapGISDataSource::TestCapability( const char * pszCap )
+
+{
+	if( EQUAL(pszCap,ODsCCreateLayer) )
+		return bDSUpdate && (!bSingleFileDataSource || nWriterLayers == 0);
+
+	return FALSE;
+}
+
+/************************************************************************/
+/*                              OpenFile()                              */
+/*                                                                      */
+/*      Add a layer for one WMAP file, named after the file.            */
+/************************************************************************/
+
+int OGRMapGISDataSource::OpenFile( const char *pszNewName, int bUpdate )
+{
 	if( !EQUAL(CPLGetExtension(pszNewName),"wat") &&
 		!EQUAL(CPLGetExtension(pszNewName),"wal") &&
 		!EQUAL(CPLGetExtension(pszNewName),"wap") )
@@ -82,7 +256,7 @@ int OGRMapGISDataSource::Open( const char * pszNewName, int bUpdate/*,
 /* -------------------------------------------------------------------- */
 /*      Open the file.                                                  */
 /* -------------------------------------------------------------------- */
-	fp = VSIFOpenL( pszNewName, "r" );
+	VSILFILE *fp = VSIFOpenL( pszNewName, "r" );
 	if( fp == NULL )
 		return FALSE;
 
@@ -91,47 +265,60 @@ int OGRMapGISDataSource::Open( const char * pszNewName, int bUpdate/*,
 /* -------------------------------------------------------------------- */
 	int featureType = -1;
 	const char* pszLine = CPLReadLineL( fp );
-	if( EQUAL( pszLine, "WMAP9022" ) )
+	if( pszLine != NULL && EQUAL( pszLine, "WMAP9022" ) )
 		featureType = 1;
-	if( EQUAL( pszLine, "WMAP9021" ) )
+	if( pszLine != NULL && EQUAL( pszLine, "WMAP9021" ) )
 		featureType = 2;
-	if( EQUAL( pszLine, "WMAP9023" ) )
+	if( pszLine != NULL && EQUAL( pszLine, "WMAP9023" ) )
 		featureType = 3;
 	if( featureType == -1 )
+	{
+		CPLDebug( "MapGIS", "%s has no WMAP header, skipped.", pszNewName );
+		VSIFCloseL( fp );
 		return FALSE;
+	}
 
 /* -------------------------------------------------------------------- */
-/*      Create a layer.                                                 */
+/*      Create a layer named after the file, or after the file and      */
+/*      its type when the same name is taken by a sibling file.         */
 /* -------------------------------------------------------------------- */
+	CPLString osLayerName = CPLGetBasename(pszNewName);
+
+	for( int i = 0; i < nLayers; i++ )
+	{
+		if( EQUAL(papoLayers[i]->GetLayerDefn()->GetName(), osLayerName) )
+		{
+			osLayerName += "_";
+			osLayerName += CPLGetExtension(pszNewName);
+			break;
+		}
+	}
+
 	nLayers++;
 	papoLayers = (OGRMapGISLayer **) CPLRealloc(papoLayers, 
 		sizeof(void*) * nLayers);
 
-	CPLString osLayerName = CPLGetBasename(pszNewName);
 	papoLayers[nLayers-1] = 
-		new OGRMapGISLayer("layer", fp, featureType);
-
-	return TRUE;
-}
+		new OGRMapGISLayer(pszNewName, osLayerName, fp, featureType,
+						   &oFilePool);
 
-/************************************************************************/
-/*                           TestCapability()                           */
-/************************************************************************/
-
-int OGRMapGISDataSource::TestCapability( const char * pszCap )
-
-{
-	return FALSE;
-}
-
-/************************************************************************/
-/*                              OpenFile()                              */
-/************************************************************************/
+/* -------------------------------------------------------------------- */
+/*      The arcs and nodes of a WAP file as layers of their own, if     */
+/*      asked for.                                                      */
+/* -------------------------------------------------------------------- */
+	if( featureType == 3 && CSLTestBoolean(
+			CPLGetConfigOption( "MAPGIS_TOPOLOGY_LAYERS", "NO" ) ) )
+	{
+		papoArcLayers = (OGRMapGISArcLayer **) CPLRealloc(papoArcLayers,
+			sizeof(void*) * (nArcLayers + 2));
+
+		papoArcLayers[nArcLayers++] =
+			new OGRMapGISArcLayer( papoLayers[nLayers-1], FALSE );
+		papoArcLayers[nArcLayers++] =
+			new OGRMapGISArcLayer( papoLayers[nLayers-1], TRUE );
+	}
 
-int OGRMapGISDataSource::OpenFile( const char *pszNewName, int bUpdate,
-                                  int bTestOpen )
-{
-    return FALSE;
+	return TRUE;
 }
 
 /************************************************************************/
@@ -145,8 +332,81 @@ OGRMapGISDataSource::CreateLayer( const char * pszLayerName,
                                  char ** papszOptions )
 
 {
+	if( !bDSUpdate )
+	{
+		CPLError( CE_Failure, CPLE_NoWriteAccess,
+				  "Data source %s is opened read-only.\n"
+				  "New layer %s cannot be created.",
+				  pszName, pszLayerName );
+		return NULL;
+	}
 
-	return FALSE;
+	if( bSingleFileDataSource && nWriterLayers > 0 )
+	{
+		CPLError( CE_Failure, CPLE_AppDefined,
+				  "Only one layer can be created in %s.", pszName );
+		return NULL;
+	}
+
+/* -------------------------------------------------------------------- */
+/*      The file type follows the extension of a single file, else      */
+/*      the geometry type.                                              */
+/* -------------------------------------------------------------------- */
+	int featureType = 0;
+	CPLString osFilename;
+
+	if( bSingleFileDataSource )
+	{
+		for( int i = 0; i < 3; i++ )
+		{
+			if( EQUAL(CPLGetExtension(pszName),apszExtensions[i]) )
+				featureType = i + 1;
+		}
+		osFilename = pszName;
+	}
+	else
+	{
+		switch( wkbFlatten(eType) )
+		{
+		case wkbPoint:
+		case wkbMultiPoint:
+			featureType = 1;
+			break;
+		case wkbLineString:
+		case wkbMultiLineString:
+			featureType = 2;
+			break;
+		case wkbPolygon:
+		case wkbMultiPolygon:
+			featureType = 3;
+			break;
+		default:
+			CPLError( CE_Failure, CPLE_NotSupported,
+					  "Geometry type %s is not supported by MapGIS files.\n"
+					  "Use a point, line or polygon layer.",
+					  OGRGeometryTypeToName( eType ) );
+			return NULL;
+		}
+		osFilename = CPLFormFilename( pszName, pszLayerName,
+									  apszExtensions[featureType-1] );
+	}
+
+	VSILFILE *fpLayer = VSIFOpenL( osFilename, "wb" );
+	if( fpLayer == NULL )
+	{
+		CPLError( CE_Failure, CPLE_OpenFailed,
+				  "Failed to create %s.", osFilename.c_str() );
+		return NULL;
+	}
+
+	nWriterLayers++;
+	papoWriterLayers = (OGRMapGISWriterLayer **) CPLRealloc(papoWriterLayers,
+		sizeof(void*) * nWriterLayers);
+	papoWriterLayers[nWriterLayers-1] =
+		new OGRMapGISWriterLayer( osFilename, pszLayerName, fpLayer,
+								  featureType );
+
+	return papoWriterLayers[nWriterLayers-1];
 }
 
 /************************************************************************/
@@ -156,10 +416,14 @@ OGRMapGISDataSource::CreateLayer( const char * pszLayerName,
 OGRLayer *OGRMapGISDataSource::GetLayer( int iLayer )
 
 {
-	if( iLayer < 0 || iLayer >= nLayers )
+	if( iLayer < 0 || iLayer >= nLayers + nArcLayers + nWriterLayers )
 		return NULL;
-	else
+	else if( iLayer < nLayers )
 		return papoLayers[iLayer];
+	else if( iLayer < nLayers + nArcLayers )
+		return papoArcLayers[iLayer - nLayers];
+	else
+		return papoWriterLayers[iLayer - nLayers - nArcLayers];
 }
 
 /************************************************************************/
@@ -170,7 +434,6 @@ OGRLayer *OGRMapGISDataSource::GetLayer( int iLayer )
 /*                                                                      */
 /*        CREATE SPATIAL INDEX ON layer_name [DEPTH n]                  */
 /*        DROP SPATIAL INDEX ON layer_name                              */
-/*        REPACK layer_name                                             */
 /************************************************************************/
 
 OGRLayer * OGRMapGISDataSource::ExecuteSQL( const char *pszStatement,
@@ -178,7 +441,63 @@ OGRLayer * OGRMapGISDataSource::ExecuteSQL( const char *pszStatement,
                                            const char *pszDialect )
 
 {
+    int bCreate = EQUALN(pszStatement, "CREATE SPATIAL INDEX ON ", 24);
+    int bDrop = EQUALN(pszStatement, "DROP SPATIAL INDEX ON ", 22);
+
+    if( !bCreate && !bDrop )
+        return OGRDataSource::ExecuteSQL( pszStatement, poSpatialFilter,
+                                          pszDialect );
+
+/* -------------------------------------------------------------------- */
+/*      Parse into keywords.                                            */
+/* -------------------------------------------------------------------- */
+    char **papszTokens = CSLTokenizeString( pszStatement );
+    int nTokens = CSLCount( papszTokens );
+
+    if( nTokens < 5
+        || (bCreate && nTokens != 5
+            && !(nTokens == 7 && EQUAL(papszTokens[5], "DEPTH")))
+        || (bDrop && nTokens != 5) )
+    {
+        CSLDestroy( papszTokens );
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Syntax error in %s SPATIAL INDEX command.\n"
+                  "Was '%s'\n"
+                  "Should be of form '%s SPATIAL INDEX ON <table>%s'",
+                  bCreate ? "CREATE" : "DROP", pszStatement,
+                  bCreate ? "CREATE" : "DROP",
+                  bCreate ? " [DEPTH <n>]" : "" );
+        return NULL;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Find the named layer.                                           */
+/* -------------------------------------------------------------------- */
+    OGRMapGISLayer *poLayer = NULL;
+
+    for( int i = 0; i < nLayers; i++ )
+    {
+        if( EQUAL(papoLayers[i]->GetLayerDefn()->GetName(), papszTokens[4]) )
+        {
+            poLayer = papoLayers[i];
+            break;
+        }
+    }
+
+    if( poLayer == NULL )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Layer %s not recognised.", papszTokens[4] );
+        CSLDestroy( papszTokens );
+        return NULL;
+    }
+
+    if( bCreate )
+        poLayer->CreateSpatialIndex( nTokens == 7 ? atoi(papszTokens[6]) : 0 );
+    else
+        poLayer->DropSpatialIndex();
 
+    CSLDestroy( papszTokens );
     return NULL;
 }
 
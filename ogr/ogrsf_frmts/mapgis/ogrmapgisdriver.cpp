@@ -78,8 +78,15 @@ OGRDataSource *OGRMapGISDriver::CreateDataSource( const char * pszName,
                                                  char **papszOptions )
 
 {
-   
-	return NULL;
+	OGRMapGISDataSource   *poDS = new OGRMapGISDataSource();
+
+	if( !poDS->Create( pszName, papszOptions ) )
+	{
+		delete poDS;
+		poDS = NULL;
+	}
+
+	return poDS;
 }
 
 /************************************************************************/
@@ -101,7 +108,10 @@ OGRErr OGRMapGISDriver::DeleteDataSource( const char *pszDataSource )
 int OGRMapGISDriver::TestCapability( const char * pszCap )
 
 {
-        return FALSE;
+	if( EQUAL(pszCap,ODrCCreateDataSource) )
+		return TRUE;
+
+	return FALSE;
 }
 
 /************************************************************************/
@@ -110,6 +120,7 @@ int OGRMapGISDriver::TestCapability( const char * pszCap )
 
 void RegisterOGRMapGIS()
 {
+    OGRMapGISInitVertexParser();
     OGRSFDriverRegistrar::GetRegistrar()->RegisterDriver( new OGRMapGISDriver );
 }
 
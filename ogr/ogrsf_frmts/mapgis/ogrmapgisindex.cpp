@@ -0,0 +1,860 @@
+/******************************************************************************
+ * $Id: ogrmapgisindex.cpp 30006 2012-02-21 10:02:17Z fuxin $
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Reading and writing the .fdx record index and .qix spatial
+ *           index sidecars of a MapGIS WMAP layer.
+ * Author:   ZhouShun, shunzhou@foxmail.com
+ *
+ ******************************************************************************
+ * Copyright (c) 1999,  Les Technologies SoftMap Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "ogr_mapgis.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+CPL_CVSID("$Id: ogrmapgisindex.cpp 30006 2012-02-21 10:02:17Z fuxin $");
+
+/* -------------------------------------------------------------------- */
+/*      The .fdx file is all little endian:                             */
+/*                                                                      */
+/*        char[8]  "MGISFDX2"                                           */
+/*        uint32   MAPGIS_INDEX_INTERVAL                                */
+/*        uint32   record count                                         */
+/*        uint64   source file size                                     */
+/*        uint64   source modification time                             */
+/*        uint64   offset of the first record                           */
+/*        double   layer MinX, MinY, MaxX, MaxY; MinX > MaxX if unknown */
+/*        uint64   block offsets[ceil(record count / interval)]         */
+/*        uint32   record deltas[record count]                          */
+/* -------------------------------------------------------------------- */
+
+#define FDX_SIGNATURE   "MGISFDX2"
+#define FDX_HEADER_SIZE 40
+#define FDX_EXTENT_SIZE 32
+
+/* -------------------------------------------------------------------- */
+/*      The .qix file shares the 40 byte header layout, with signature  */
+/*      "MGISQIX1" and the tree depth in place of the interval and      */
+/*      record count.  Nodes follow in depth first order:               */
+/*                                                                      */
+/*        double   MinX, MinY, MaxX, MaxY                               */
+/*        uint32   bytes taken by the child subtrees                    */
+/*        uint32   number of record ids                                 */
+/*        uint32   number of children                                   */
+/*        int32    record ids[]                                         */
+/*        children                                                      */
+/* -------------------------------------------------------------------- */
+
+#define QIX_SIGNATURE   "MGISQIX1"
+#define QIX_NODE_SIZE   44
+#define QIX_MAX_DEPTH   12
+
+/************************************************************************/
+/*                          GetIndexFilename()                          */
+/************************************************************************/
+
+static CPLString GetIndexFilename( const char *pszSource,
+                                   const char *pszExtension )
+
+{
+    CPLString osIndex = pszSource;
+
+    osIndex += ".";
+    osIndex += pszExtension;
+
+    return osIndex;
+}
+
+/************************************************************************/
+/*                         PutUInt32()/PutUInt64()                      */
+/************************************************************************/
+
+static void PutUInt32( GByte *pabyDst, GUInt32 nValue )
+
+{
+    CPL_LSBPTR32( &nValue );
+    memcpy( pabyDst, &nValue, 4 );
+}
+
+static void PutUInt64( GByte *pabyDst, GUIntBig nValue )
+
+{
+    CPL_LSBPTR64( &nValue );
+    memcpy( pabyDst, &nValue, 8 );
+}
+
+static GUInt32 GetUInt32( const GByte *pabySrc )
+
+{
+    GUInt32 nValue;
+
+    memcpy( &nValue, pabySrc, 4 );
+    CPL_LSBPTR32( &nValue );
+    return nValue;
+}
+
+static GUIntBig GetUInt64( const GByte *pabySrc )
+
+{
+    GUIntBig nValue;
+
+    memcpy( &nValue, pabySrc, 8 );
+    CPL_LSBPTR64( &nValue );
+    return nValue;
+}
+
+/************************************************************************/
+/*                       PutEnvelope()/GetEnvelope()                    */
+/************************************************************************/
+
+static void PutEnvelope( GByte *pabyDst, const OGREnvelope *psExtent )
+
+{
+    double adfBounds[4] = { psExtent->MinX, psExtent->MinY,
+                            psExtent->MaxX, psExtent->MaxY };
+    for( int i = 0; i < 4; i++ )
+    {
+        GUIntBig nBits;
+        memcpy( &nBits, adfBounds + i, 8 );
+        PutUInt64( pabyDst + i * 8, nBits );
+    }
+}
+
+static int GetEnvelope( const GByte *pabySrc, OGREnvelope *psExtent )
+
+{
+    double adfBounds[4];
+    for( int i = 0; i < 4; i++ )
+    {
+        GUIntBig nBits = GetUInt64( pabySrc + i * 8 );
+        memcpy( adfBounds + i, &nBits, 8 );
+    }
+
+    if( !(adfBounds[0] <= adfBounds[2] && adfBounds[1] <= adfBounds[3]) )
+        return FALSE;
+
+    psExtent->MinX = adfBounds[0];
+    psExtent->MinY = adfBounds[1];
+    psExtent->MaxX = adfBounds[2];
+    psExtent->MaxY = adfBounds[3];
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                           StatSource()                               */
+/*                                                                      */
+/*      Fill the identifying part of an index header for the source.    */
+/************************************************************************/
+
+static int StatSource( const char *pszSource, GByte *pabyHeader,
+                       const char *pszSignature, GUInt32 nParameter,
+                       vsi_l_offset nFirstRecordOffset )
+
+{
+    VSIStatBufL sStat;
+
+    if( VSIStatL( pszSource, &sStat ) != 0 )
+        return FALSE;
+
+    memcpy( pabyHeader, pszSignature, 8 );
+    PutUInt32( pabyHeader + 8, nParameter );
+    PutUInt64( pabyHeader + 16, (GUIntBig) sStat.st_size );
+    PutUInt64( pabyHeader + 24, (GUIntBig) sStat.st_mtime );
+    PutUInt64( pabyHeader + 32, (GUIntBig) nFirstRecordOffset );
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                         CheckRecordCount()                           */
+/*                                                                      */
+/*      Whether the record count in an .fdx header is one the file      */
+/*      can hold, given the size of the file.                           */
+/************************************************************************/
+
+static int CheckRecordCount( const char *pszIndex, GUInt32 nRecords )
+
+{
+    VSIStatBufL sStat;
+
+    if( nRecords > (GUInt32) INT_MAX || VSIStatL( pszIndex, &sStat ) != 0 )
+        return FALSE;
+
+    GUIntBig nBlocks = ((GUIntBig) nRecords + MAPGIS_INDEX_INTERVAL - 1)
+        / MAPGIS_INDEX_INTERVAL;
+
+    return (GUIntBig) sStat.st_size == FDX_HEADER_SIZE + FDX_EXTENT_SIZE
+        + nBlocks * 8 + (GUIntBig) nRecords * 4;
+}
+
+/************************************************************************/
+/*                          ReadRecordIndex()                           */
+/*                                                                      */
+/*      Load a complete record index saved by an earlier session.  The  */
+/*      sidecar is ignored unless it was written for this exact         */
+/*      source file size and modification time, its size matches its   */
+/*      record count and that count agrees with the count line of the   */
+/*      source.  An ignored sidecar is rebuilt by the next full read.   */
+/************************************************************************/
+
+int OGRMapGISLayer::ReadRecordIndex()
+
+{
+    GByte abyExpected[FDX_HEADER_SIZE], abyHeader[FDX_HEADER_SIZE];
+
+    if( !StatSource( pszFullName, abyExpected, FDX_SIGNATURE,
+                     MAPGIS_INDEX_INTERVAL, nFirstRecordOffset ) )
+        return FALSE;
+
+    CPLString osIndex = GetIndexFilename( pszFullName, "fdx" );
+    VSILFILE *fpIndex = VSIFOpenL( osIndex, "rb" );
+
+    if( fpIndex == NULL )
+        return FALSE;
+
+    GByte abyExtent[FDX_EXTENT_SIZE];
+
+    if( VSIFReadL( abyHeader, FDX_HEADER_SIZE, 1, fpIndex ) != 1
+        || memcmp( abyHeader, abyExpected, 12 ) != 0
+        || memcmp( abyHeader + 16, abyExpected + 16, 24 ) != 0
+        || VSIFReadL( abyExtent, FDX_EXTENT_SIZE, 1, fpIndex ) != 1 )
+    {
+        VSIFCloseL( fpIndex );
+        return FALSE;
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Read the block offsets followed by the record deltas.           */
+/* -------------------------------------------------------------------- */
+    GUInt32 nSavedRecords = GetUInt32( abyHeader + 12 );
+
+    if( !CheckRecordCount( osIndex, nSavedRecords )
+        || (nTotalMapGISCount >= 0
+            && nSavedRecords != (GUInt32) nTotalMapGISCount) )
+    {
+        CPLDebug( "MapGIS", "Ignoring record index %s, it does not match "
+                  "its source.", osIndex.c_str() );
+        VSIFCloseL( fpIndex );
+        return FALSE;
+    }
+
+    int nRecords = (int) nSavedRecords;
+    int nBlocks = (nRecords + MAPGIS_INDEX_INTERVAL - 1)
+        / MAPGIS_INDEX_INTERVAL;
+    std::vector<GByte> abyData( (size_t) nBlocks * 8
+                                + (size_t) nRecords * 4 + 1 );
+
+    if( VSIFReadL( &abyData[0], 1, abyData.size() - 1, fpIndex )
+        != abyData.size() - 1 )
+    {
+        VSIFCloseL( fpIndex );
+        return FALSE;
+    }
+
+    VSIFCloseL( fpIndex );
+
+    anRecordIndex.resize( nBlocks );
+    for( int iBlock = 0; iBlock < nBlocks; iBlock++ )
+        anRecordIndex[iBlock] = GetUInt64( &abyData[(size_t) iBlock * 8] );
+
+    anRecordDelta.resize( nRecords );
+    for( int iRecord = 0; iRecord < nRecords; iRecord++ )
+        anRecordDelta[iRecord] =
+            GetUInt32( &abyData[(size_t) nBlocks * 8
+                                + (size_t) iRecord * 4] );
+
+    bRecordIndexComplete = TRUE;
+
+    if( !bExtentKnown && GetEnvelope( abyExtent, &sLayerExtent ) )
+        bExtentKnown = TRUE;
+
+    CPLDebug( "MapGIS", "Using record index %s (%d records).",
+              osIndex.c_str(), nRecords );
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                            PeekSidecar()                             */
+/*                                                                      */
+/*      Read the header of a sidecar and the nData bytes after it, if   */
+/*      it was written for this source file size and modification       */
+/*      time.  Unlike the full checks this does not need the offset of  */
+/*      the first record, which a WAP layer only learns by scanning     */
+/*      its arcs.                                                       */
+/************************************************************************/
+
+static int PeekSidecar( const char *pszSource, const char *pszExtension,
+                        const char *pszSignature, GByte *pabyHeader,
+                        GByte *pabyData, size_t nData )
+
+{
+    GByte abyExpected[FDX_HEADER_SIZE];
+
+    if( !StatSource( pszSource, abyExpected, pszSignature, 0, 0 ) )
+        return FALSE;
+
+    CPLString osIndex = GetIndexFilename( pszSource, pszExtension );
+    VSILFILE *fpIndex = VSIFOpenL( osIndex, "rb" );
+
+    if( fpIndex == NULL )
+        return FALSE;
+
+    int bOK = VSIFReadL( pabyHeader, FDX_HEADER_SIZE, 1, fpIndex ) == 1
+        && memcmp( pabyHeader, abyExpected, 8 ) == 0
+        && memcmp( pabyHeader + 16, abyExpected + 16, 16 ) == 0
+        && (nData == 0 || VSIFReadL( pabyData, nData, 1, fpIndex ) == 1);
+
+    VSIFCloseL( fpIndex );
+
+    return bOK;
+}
+
+/************************************************************************/
+/*                          PeekRecordCount()                           */
+/*                                                                      */
+/*      The record count saved in a record or spatial index of this     */
+/*      source, or -1 if there is none.  The count line wins once it    */
+/*      is known.                                                       */
+/************************************************************************/
+
+int OGRMapGISLayer::PeekRecordCount()
+
+{
+    if( nTotalMapGISCount >= 0 )
+        return nTotalMapGISCount;
+
+    GByte abyHeader[FDX_HEADER_SIZE];
+
+    if( (PeekSidecar( pszFullName, "fdx", FDX_SIGNATURE, abyHeader, NULL, 0 )
+         && GetUInt32( abyHeader + 8 ) == MAPGIS_INDEX_INTERVAL
+         && CheckRecordCount( GetIndexFilename( pszFullName, "fdx" ),
+                              GetUInt32( abyHeader + 12 ) ))
+        || PeekSidecar( pszFullName, "qix", QIX_SIGNATURE, abyHeader,
+                        NULL, 0 ) )
+        return (int) GetUInt32( abyHeader + 12 );
+
+    return -1;
+}
+
+/************************************************************************/
+/*                            PeekExtent()                              */
+/*                                                                      */
+/*      The layer extent saved in the record index of this source, or   */
+/*      else the bounds of the root node of its spatial index.          */
+/************************************************************************/
+
+int OGRMapGISLayer::PeekExtent( OGREnvelope *psExtent )
+
+{
+    GByte abyHeader[FDX_HEADER_SIZE], abyData[QIX_NODE_SIZE];
+
+    if( PeekSidecar( pszFullName, "fdx", FDX_SIGNATURE, abyHeader,
+                     abyData, FDX_EXTENT_SIZE )
+        && GetEnvelope( abyData, psExtent ) )
+        return TRUE;
+
+    return PeekSidecar( pszFullName, "qix", QIX_SIGNATURE, abyHeader,
+                        abyData, QIX_NODE_SIZE )
+        && GetUInt32( abyHeader + 12 ) != 0
+        && GetEnvelope( abyData, psExtent );
+}
+
+/************************************************************************/
+/*                          WriteRecordIndex()                          */
+/*                                                                      */
+/*      Save the complete record index, and the layer extent if it is   */
+/*      known, beside the source.  Failure, for instance on a read      */
+/*      only directory, is not an error.                                */
+/************************************************************************/
+
+int OGRMapGISLayer::WriteRecordIndex()
+
+{
+    GByte abyHeader[FDX_HEADER_SIZE];
+
+    if( !bRecordIndexComplete
+        || !StatSource( pszFullName, abyHeader, FDX_SIGNATURE,
+                        MAPGIS_INDEX_INTERVAL, nFirstRecordOffset ) )
+        return FALSE;
+
+    int nRecords = (int) anRecordDelta.size();
+    int nBlocks = (int) anRecordIndex.size();
+
+    PutUInt32( abyHeader + 12, (GUInt32) nRecords );
+
+    std::vector<GByte> abyData( FDX_EXTENT_SIZE + nBlocks * 8
+                                + nRecords * 4 + 1 );
+
+    OGREnvelope sUnknown;
+    sUnknown.MinX = 1.0;
+    sUnknown.MaxX = 0.0;
+    PutEnvelope( &abyData[0], bExtentKnown ? &sLayerExtent : &sUnknown );
+
+    GByte *pabyIndex = &abyData[FDX_EXTENT_SIZE];
+    for( int iBlock = 0; iBlock < nBlocks; iBlock++ )
+        PutUInt64( pabyIndex + iBlock * 8, anRecordIndex[iBlock] );
+
+    for( int iRecord = 0; iRecord < nRecords; iRecord++ )
+        PutUInt32( pabyIndex + nBlocks * 8 + iRecord * 4,
+                   anRecordDelta[iRecord] );
+
+    CPLString osIndex = GetIndexFilename( pszFullName, "fdx" );
+    VSILFILE *fpIndex = VSIFOpenL( osIndex, "wb" );
+
+    if( fpIndex == NULL )
+    {
+        CPLDebug( "MapGIS", "Unable to create record index %s.",
+                  osIndex.c_str() );
+        return FALSE;
+    }
+
+    int bOK = VSIFWriteL( abyHeader, FDX_HEADER_SIZE, 1, fpIndex ) == 1
+        && (int) VSIFWriteL( &abyData[0], 1, abyData.size() - 1, fpIndex )
+        == (int) abyData.size() - 1;
+
+    VSIFCloseL( fpIndex );
+
+    if( !bOK )
+    {
+        VSIUnlink( osIndex );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                         OGRMapGISQuadNode                            */
+/************************************************************************/
+
+typedef struct
+{
+    OGREnvelope         sBounds;
+    std::vector<int>    anIds;
+    int                 anChild[4];
+} OGRMapGISQuadNode;
+
+/************************************************************************/
+/*                           QuadInsert()                               */
+/*                                                                      */
+/*      Push a record down to the deepest quadrant that holds its       */
+/*      extent entirely.                                                */
+/************************************************************************/
+
+static void QuadInsert( std::vector<OGRMapGISQuadNode> &asNodes,
+                        int iNode, int nDepth, int nMaxDepth,
+                        int nId, const OGREnvelope &sExtent )
+
+{
+    while( nDepth < nMaxDepth )
+    {
+        const OGREnvelope sBounds = asNodes[iNode].sBounds;
+        double dfMidX = (sBounds.MinX + sBounds.MaxX) / 2;
+        double dfMidY = (sBounds.MinY + sBounds.MaxY) / 2;
+        int iQuad;
+
+        if( sExtent.MaxX <= dfMidX )
+            iQuad = 0;
+        else if( sExtent.MinX >= dfMidX )
+            iQuad = 1;
+        else
+            break;
+
+        if( sExtent.MaxY <= dfMidY )
+            ;
+        else if( sExtent.MinY >= dfMidY )
+            iQuad += 2;
+        else
+            break;
+
+        if( asNodes[iNode].anChild[iQuad] < 0 )
+        {
+            OGRMapGISQuadNode sChild;
+
+            sChild.sBounds.MinX = (iQuad & 1) ? dfMidX : sBounds.MinX;
+            sChild.sBounds.MaxX = (iQuad & 1) ? sBounds.MaxX : dfMidX;
+            sChild.sBounds.MinY = (iQuad & 2) ? dfMidY : sBounds.MinY;
+            sChild.sBounds.MaxY = (iQuad & 2) ? sBounds.MaxY : dfMidY;
+            sChild.anChild[0] = sChild.anChild[1] = -1;
+            sChild.anChild[2] = sChild.anChild[3] = -1;
+
+            asNodes[iNode].anChild[iQuad] = (int) asNodes.size();
+            asNodes.push_back( sChild );
+        }
+
+        iNode = asNodes[iNode].anChild[iQuad];
+        nDepth++;
+    }
+
+    asNodes[iNode].anIds.push_back( nId );
+}
+
+/************************************************************************/
+/*                          QuadSerialize()                             */
+/************************************************************************/
+
+static void QuadSerialize( const std::vector<OGRMapGISQuadNode> &asNodes,
+                           int iNode, std::vector<GByte> &abyOut )
+
+{
+    const OGRMapGISQuadNode &sNode = asNodes[iNode];
+    size_t nStart = abyOut.size();
+    int nChildren = 0;
+
+    for( int iQuad = 0; iQuad < 4; iQuad++ )
+        if( sNode.anChild[iQuad] >= 0 )
+            nChildren++;
+
+    abyOut.resize( nStart + QIX_NODE_SIZE + 4 * sNode.anIds.size() );
+
+    GByte *pabyNode = &abyOut[nStart];
+    double adfBounds[4] = { sNode.sBounds.MinX, sNode.sBounds.MinY,
+                            sNode.sBounds.MaxX, sNode.sBounds.MaxY };
+    for( int i = 0; i < 4; i++ )
+    {
+        GUIntBig nBits;
+        memcpy( &nBits, adfBounds + i, 8 );
+        PutUInt64( pabyNode + i * 8, nBits );
+    }
+    PutUInt32( pabyNode + 36, (GUInt32) sNode.anIds.size() );
+    PutUInt32( pabyNode + 40, (GUInt32) nChildren );
+    for( size_t i = 0; i < sNode.anIds.size(); i++ )
+        PutUInt32( pabyNode + QIX_NODE_SIZE + 4 * i,
+                   (GUInt32) sNode.anIds[i] );
+
+    size_t nChildStart = abyOut.size();
+    for( int iQuad = 0; iQuad < 4; iQuad++ )
+        if( sNode.anChild[iQuad] >= 0 )
+            QuadSerialize( asNodes, sNode.anChild[iQuad], abyOut );
+
+    PutUInt32( &abyOut[nStart + 32], (GUInt32)(abyOut.size() - nChildStart) );
+}
+
+/************************************************************************/
+/*                            QuadSearch()                              */
+/*                                                                      */
+/*      Collect the ids of the nodes of a serialized tree that overlap  */
+/*      psAOI.  Returns the number of bytes the node took, or 0 if the  */
+/*      data is corrupt.                                                */
+/************************************************************************/
+
+static size_t QuadSearch( const GByte *pabyNode, size_t nAvailable,
+                          const OGREnvelope *psAOI,
+                          std::vector<long> &anFIDs )
+
+{
+    if( nAvailable < QIX_NODE_SIZE )
+        return 0;
+
+    double adfBounds[4];
+    for( int i = 0; i < 4; i++ )
+    {
+        GUIntBig nBits = GetUInt64( pabyNode + i * 8 );
+        memcpy( adfBounds + i, &nBits, 8 );
+    }
+
+    size_t nSubtree = GetUInt32( pabyNode + 32 );
+    size_t nIds = GetUInt32( pabyNode + 36 );
+    int nChildren = (int) GetUInt32( pabyNode + 40 );
+    size_t nSize = QIX_NODE_SIZE + 4 * nIds + nSubtree;
+
+    if( nIds > nAvailable / 4 || nSize > nAvailable )
+        return 0;
+
+    if( adfBounds[2] < psAOI->MinX || adfBounds[0] > psAOI->MaxX
+        || adfBounds[3] < psAOI->MinY || adfBounds[1] > psAOI->MaxY )
+        return nSize;
+
+    for( size_t i = 0; i < nIds; i++ )
+        anFIDs.push_back( (long) GetUInt32( pabyNode + QIX_NODE_SIZE + 4*i ) );
+
+    const GByte *pabyChild = pabyNode + QIX_NODE_SIZE + 4 * nIds;
+    size_t nLeft = nSubtree;
+    for( int iChild = 0; iChild < nChildren; iChild++ )
+    {
+        size_t nChildSize = QuadSearch( pabyChild, nLeft, psAOI, anFIDs );
+        if( nChildSize == 0 )
+            return 0;
+        pabyChild += nChildSize;
+        nLeft -= nChildSize;
+    }
+
+    return nSize;
+}
+
+/************************************************************************/
+/*                         CreateSpatialIndex()                         */
+/*                                                                      */
+/*      Build a quadtree over the extents of all records, computed      */
+/*      without building geometries, and save it as <source>.qix.       */
+/************************************************************************/
+
+OGRErr OGRMapGISLayer::CreateSpatialIndex( int nMaxDepth )
+
+{
+    GByte abyHeader[FDX_HEADER_SIZE];
+
+/* -------------------------------------------------------------------- */
+/*      Collect the extents of all records.                             */
+/* -------------------------------------------------------------------- */
+    std::vector<OGREnvelope> asExtents;
+    OGREnvelope sExtent, sTreeExtent;
+    int bFoundVertices = FALSE;
+
+    Initialize();
+    SuspendReading();
+
+    poReader->Seek( nFirstRecordOffset );
+    iNextRecord = 0;
+
+    while( TRUE )
+    {
+        vsi_l_offset nRecordOffset = poReader->Tell();
+        int nResult = ReadRecordExtent( &sExtent );
+
+        if( nResult == MAPGIS_EXTENT_END )
+            EndOfExtentScan();
+        if( nResult == MAPGIS_EXTENT_END || nResult == MAPGIS_EXTENT_ERROR )
+            break;
+
+        IndexRecord( nRecordOffset );
+        asExtents.push_back( sExtent );
+        if( nResult == MAPGIS_EXTENT_FOUND )
+        {
+            sTreeExtent.Merge( sExtent );
+            bFoundVertices = TRUE;
+        }
+    }
+
+    int nRecords = (int) asExtents.size();
+
+    if( nRecords != nTotalMapGISCount )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "%s: read %d records where %d were expected, "
+                  "spatial index not created.",
+                  pszFullName, nRecords, nTotalMapGISCount );
+        return OGRERR_FAILURE;
+    }
+
+    // The extent of a WAP layer is that of its arcs, kept as it is.
+    if( !bExtentKnown && featureType != 3 && bFoundVertices )
+    {
+        sLayerExtent = sTreeExtent;
+        bExtentKnown = TRUE;
+    }
+
+    if( nMaxDepth <= 0 )
+    {
+        for( nMaxDepth = 1; nMaxDepth < QIX_MAX_DEPTH
+                 && (1 << (2 * nMaxDepth)) * 8 < nRecords; nMaxDepth++ ) {}
+    }
+
+/* -------------------------------------------------------------------- */
+/*      Build and serialize the tree.                                   */
+/* -------------------------------------------------------------------- */
+    std::vector<OGRMapGISQuadNode> asNodes( 1 );
+
+    asNodes[0].sBounds = sTreeExtent;
+    asNodes[0].anChild[0] = asNodes[0].anChild[1] = -1;
+    asNodes[0].anChild[2] = asNodes[0].anChild[3] = -1;
+
+    // A record without vertices keeps its empty extent and is left out
+    // of the tree, so that no search ever returns it.
+    for( int iRecord = 0; iRecord < nRecords; iRecord++ )
+    {
+        if( asExtents[iRecord].MinX <= asExtents[iRecord].MaxX )
+            QuadInsert( asNodes, 0, 1, nMaxDepth, iRecord,
+                        asExtents[iRecord] );
+    }
+
+    if( !StatSource( pszFullName, abyHeader, QIX_SIGNATURE,
+                     (GUInt32) nMaxDepth, nFirstRecordOffset ) )
+        return OGRERR_FAILURE;
+    PutUInt32( abyHeader + 12, (GUInt32) nRecords );
+
+    abyQIX.resize( 0 );
+    QuadSerialize( asNodes, 0, abyQIX );
+
+    CPLString osIndex = GetIndexFilename( pszFullName, "qix" );
+    VSILFILE *fpIndex = VSIFOpenL( osIndex, "wb" );
+
+    if( fpIndex == NULL )
+    {
+        CPLError( CE_Failure, CPLE_OpenFailed,
+                  "Failed to create spatial index %s.", osIndex.c_str() );
+        abyQIX.resize( 0 );
+        return OGRERR_FAILURE;
+    }
+
+    int bOK = VSIFWriteL( abyHeader, FDX_HEADER_SIZE, 1, fpIndex ) == 1
+        && VSIFWriteL( &abyQIX[0], 1, abyQIX.size(), fpIndex )
+        == abyQIX.size();
+
+    VSIFCloseL( fpIndex );
+
+    if( !bOK )
+    {
+        CPLError( CE_Failure, CPLE_FileIO,
+                  "Failed to write spatial index %s.", osIndex.c_str() );
+        VSIUnlink( osIndex );
+        abyQIX.resize( 0 );
+        return OGRERR_FAILURE;
+    }
+
+    CPLDebug( "MapGIS", "Wrote spatial index %s: depth %d, %d nodes.",
+              osIndex.c_str(), nMaxDepth, (int) asNodes.size() );
+
+    bCheckedForQIX = TRUE;
+    CPLFree( panMatchingFIDs );
+    panMatchingFIDs = NULL;
+
+    return OGRERR_NONE;
+}
+
+/************************************************************************/
+/*                          DropSpatialIndex()                          */
+/************************************************************************/
+
+OGRErr OGRMapGISLayer::DropSpatialIndex()
+
+{
+    if( !CheckForQIX() )
+    {
+        CPLError( CE_Warning, CPLE_AppDefined,
+                  "Layer %s has no spatial index, DROP SPATIAL INDEX failed.",
+                  poFeatureDefn->GetName() );
+        return OGRERR_FAILURE;
+    }
+
+    abyQIX.resize( 0 );
+    bCheckedForQIX = FALSE;
+    CPLFree( panMatchingFIDs );
+    panMatchingFIDs = NULL;
+
+    CPLString osIndex = GetIndexFilename( pszFullName, "qix" );
+
+    if( VSIUnlink( osIndex ) != 0 )
+    {
+        CPLError( CE_Failure, CPLE_AppDefined,
+                  "Failed to delete file %s.", osIndex.c_str() );
+        return OGRERR_FAILURE;
+    }
+
+    return OGRERR_NONE;
+}
+
+/************************************************************************/
+/*                            CheckForQIX()                             */
+/*                                                                      */
+/*      Load <source>.qix if there is one and it was built for this     */
+/*      exact source file.                                              */
+/************************************************************************/
+
+int OGRMapGISLayer::CheckForQIX()
+
+{
+    if( bCheckedForQIX )
+        return !abyQIX.empty();
+
+    // The check needs the offset of the first record.
+    Initialize();
+
+    bCheckedForQIX = TRUE;
+
+    GByte abyExpected[FDX_HEADER_SIZE], abyHeader[FDX_HEADER_SIZE];
+
+    if( !StatSource( pszFullName, abyExpected, QIX_SIGNATURE, 0,
+                     nFirstRecordOffset ) )
+        return FALSE;
+
+    CPLString osIndex = GetIndexFilename( pszFullName, "qix" );
+    VSILFILE *fpIndex = VSIFOpenL( osIndex, "rb" );
+
+    if( fpIndex == NULL )
+        return FALSE;
+
+    VSIFSeekL( fpIndex, 0, SEEK_END );
+    vsi_l_offset nSize = VSIFTellL( fpIndex );
+    VSIFSeekL( fpIndex, 0, SEEK_SET );
+
+    if( nSize <= FDX_HEADER_SIZE
+        || VSIFReadL( abyHeader, FDX_HEADER_SIZE, 1, fpIndex ) != 1
+        || memcmp( abyHeader, abyExpected, 8 ) != 0
+        || memcmp( abyHeader + 16, abyExpected + 16, 24 ) != 0 )
+    {
+        VSIFCloseL( fpIndex );
+        return FALSE;
+    }
+
+    abyQIX.resize( (size_t) (nSize - FDX_HEADER_SIZE) );
+    if( VSIFReadL( &abyQIX[0], 1, abyQIX.size(), fpIndex ) != abyQIX.size() )
+        abyQIX.resize( 0 );
+
+    VSIFCloseL( fpIndex );
+
+    if( !abyQIX.empty() )
+        CPLDebug( "MapGIS", "Using spatial index %s.", osIndex.c_str() );
+
+    return !abyQIX.empty();
+}
+
+/************************************************************************/
+/*                            ScanIndices()                             */
+/*                                                                      */
+/*      Utilize optional spatial and attribute indices if they are      */
+/*      available.                                                      */
+/************************************************************************/
+
+int OGRMapGISLayer::ScanIndices()
+
+{
+    iMatchingFID = 0;
+
+    if( m_poFilterGeom == NULL || !CheckForQIX() )
+        return TRUE;
+
+    std::vector<long> anFIDs;
+
+    if( QuadSearch( &abyQIX[0], abyQIX.size(), &m_sFilterEnvelope,
+                    anFIDs ) == 0 )
+    {
+        CPLError( CE_Warning, CPLE_AppDefined,
+                  "Spatial index of %s is corrupt, ignoring it.",
+                  pszFullName );
+        abyQIX.resize( 0 );
+        return FALSE;
+    }
+
+    std::sort( anFIDs.begin(), anFIDs.end() );
+
+    CPLFree( panMatchingFIDs );
+    panMatchingFIDs = (long *) CPLMalloc( sizeof(long) * (anFIDs.size() + 1) );
+    for( size_t i = 0; i < anFIDs.size(); i++ )
+        panMatchingFIDs[i] = anFIDs[i];
+    panMatchingFIDs[anFIDs.size()] = OGRNullFID;
+
+    return TRUE;
+}
@@ -30,6 +30,7 @@
 #include "ogr_mapgis.h"
 #include "cpl_conv.h"
 #include "cpl_string.h"
+#include "cpl_multiproc.h"
 
 #if defined(_WIN32_WCE)
 #  include <wce_errno.h>
@@ -37,560 +38,2073 @@
 
 CPL_CVSID("$Id: ogrmapgislayer.cpp 30004 2012-02-19 08:16:08Z fuxin $");
 
+/* -------------------------------------------------------------------- */
+/*      Attribute fields of each file type, see OGRMapGISFieldInfo.     */
+/* -------------------------------------------------------------------- */
+
+static const OGRMapGISFieldInfo asWATFields[] =
+{
+	{ "ID",          OFTInteger, {  2,  2 }, NULL },
+	{ "PntType",     OFTInteger, {  3,  3 }, NULL },
+	{ "Text",        OFTString,  {  4, -1 }, "" },
+	{ "SubNo",       OFTInteger, { -1,  4 }, "1" },
+	{ "Height",      OFTReal,    {  5,  5 }, "1" },
+	{ "Width",       OFTReal,    {  6,  6 }, "1" },
+	{ "Angle",       OFTReal,    {  7,  7 }, "0" },
+	{ "Spacing",     OFTReal,    {  8, -1 }, "0" },
+	{ "ChnFont",     OFTInteger, {  9, -1 }, "3" },
+	{ "WstFont",     OFTInteger, { 10, -1 }, "0" },
+	{ "FontStyle",   OFTInteger, { 11, -1 }, "0" },
+	{ "Arrange",     OFTInteger, { 12, -1 }, "0" },
+	{ "Transparent", OFTInteger, { 13,  9 }, "1" },
+	{ "AuxColor",    OFTInteger, { -1,  8 }, "0" },
+	{ "PenWidth",    OFTReal,    { -1, 10 }, "0.05" },
+	{ "Color",       OFTInteger, { 14, 11 }, "1" },
+	{ "LayerNo",     OFTInteger, { 15, 12 }, "0" }
+};
+
+static const OGRMapGISFieldInfo asWALFields[] =
+{
+	{ "ID",          OFTInteger, { -1,  0 }, NULL },
+	{ "Length",      OFTReal,    { -1,  1 }, NULL },
+	{ "LineType",    OFTInteger, {  0, -1 }, "1" },
+	{ "AuxType",     OFTInteger, {  1, -1 }, "0" },
+	{ "Overlay",     OFTInteger, {  2, -1 }, "1" },
+	{ "PenWidth",    OFTReal,    {  3, -1 }, "0.1" },
+	{ "XFactor",     OFTReal,    {  4, -1 }, "10" },
+	{ "YFactor",     OFTReal,    {  5, -1 }, "10" },
+	{ "AuxColor",    OFTInteger, {  6, -1 }, "1" },
+	{ "Color",       OFTInteger, {  7, -1 }, "1" },
+	{ "LayerNo",     OFTInteger, {  8, -1 }, "0" }
+};
+
+static const OGRMapGISFieldInfo asWAPFields[] =
+{
+	{ "ID",          OFTInteger, {  8, -1 }, NULL },
+	{ "FillColor",   OFTInteger, {  0, -1 }, "1" },
+	{ "Pattern",     OFTInteger, {  1, -1 }, "0" },
+	{ "PatHeight",   OFTReal,    {  2, -1 }, "1" },
+	{ "PatWidth",    OFTReal,    {  3, -1 }, "1" },
+	{ "PatAngle",    OFTReal,    {  4, -1 }, "0" },
+	{ "Transparent", OFTInteger, {  5, -1 }, "0" },
+	{ "PatColor",    OFTInteger, {  6, -1 }, "1" },
+	{ "LayerNo",     OFTInteger, {  7, -1 }, "0" },
+	{ "Area",        OFTReal,    {  9, -1 }, NULL },
+	{ "Perimeter",   OFTReal,    { 10, -1 }, NULL }
+};
+
+/************************************************************************/
+/*                        OGRMapGISGetFieldInfo()                       */
+/************************************************************************/
+
+const OGRMapGISFieldInfo *OGRMapGISGetFieldInfo( int featureType,
+												 int *pnFieldInfo )
+
+{
+	switch( featureType )
+	{
+	case 1:
+		*pnFieldInfo = sizeof(asWATFields) / sizeof(asWATFields[0]);
+		return asWATFields;
+	case 2:
+		*pnFieldInfo = sizeof(asWALFields) / sizeof(asWALFields[0]);
+		return asWALFields;
+	default:
+		*pnFieldInfo = sizeof(asWAPFields) / sizeof(asWAPFields[0]);
+		return asWAPFields;
+	}
+}
+
+/************************************************************************/
+/*                       OGRMapGISGetPointLayout()                      */
+/*                                                                      */
+/*      The layout of a WAT line: annotations have point type 0 in      */
+/*      column 3, everything else is laid out like a sub-graph.         */
+/************************************************************************/
+
+int OGRMapGISGetPointLayout( const OGRMapGISToken *pasTokens, int nTokens )
+
+{
+	return nTokens > 3
+		&& OGRMapGISParseInteger( pasTokens[3].pszValue ) == 0 ? 0 : 1;
+}
+
+/************************************************************************/
+/*                         OGRMapGISParseField()                        */
+/*                                                                      */
+/*      Convert the column holding a field in an attribute line of      */
+/*      layout iLayout into *psField.  A string value is kept in        */
+/*      osValue, which psField->String then points to.  Returns FALSE   */
+/*      if the line has no value for the field.  Every record decoder   */
+/*      goes through here.                                              */
+/************************************************************************/
+
+int OGRMapGISParseField( const OGRMapGISFieldInfo *psInfo, int iLayout,
+						 const OGRMapGISToken *pasTokens, int nTokens,
+						 OGRField *psField, CPLString &osValue )
+
+{
+	int iColumn = psInfo->aiColumn[iLayout];
+	if( iColumn < 0 || iColumn >= nTokens
+		|| pasTokens[iColumn].nLength == 0 )
+		return FALSE;
+
+	const OGRMapGISToken *psToken = pasTokens + iColumn;
+
+	switch( psInfo->eType )
+	{
+	case OFTInteger:
+		psField->Integer = OGRMapGISParseInteger( psToken->pszValue );
+		break;
+	case OFTReal:
+		psField->Real = OGRMapGISParseNumber( psToken->pszValue );
+		break;
+	default:
+		osValue = OGRMapGISTokenToString( psToken );
+		psField->String = (char *) osValue.c_str();
+		break;
+	}
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                           OGRMapGISLayer()                           */
+/************************************************************************/
+
+OGRMapGISLayer::OGRMapGISLayer(	const char *pszFilename,
+								const char *pszLayerNameIn,
+								VSILFILE *fp, int featureType,
+								OGRMapGISFilePool *poFilePool )
+
+{
+
+	papoLayers = NULL;
+	nLayers = 0;
+	this->featureType = featureType;
+	pszFullName = CPLStrdup( pszFilename );
+	poFeatureDefn = new OGRFeatureDefn( pszLayerNameIn );
+	OGRFieldDefn  oLayerField( "Layer", OFTString );
+	poFeatureDefn->AddFieldDefn( &oLayerField );
+
+	pasFieldInfo = OGRMapGISGetFieldInfo( featureType, &nFieldInfo );
+
+	for( int iField = 0; iField < nFieldInfo; iField++ )
+	{
+		OGRFieldDefn oField( pasFieldInfo[iField].pszName,
+							 pasFieldInfo[iField].eType );
+		poFeatureDefn->AddFieldDefn( &oField );
+	}
+	bAttrQueryNeedsGeometry = FALSE;
+	ComputeReadColumns();
+	hArcMutex = NULL;
+	memset( &sStats, 0, sizeof(sStats) );
+	papszStats = NULL;
+
+	poFeatureDefn->Reference();
+	poFeatureDefn->SetGeomType( featureType == 1 ? wkbPoint25D
+		: featureType == 2 ? wkbLineString25D : wkbPolygon );
+
+	poReader = new OGRMapGISReader( pszFilename, fp, poFilePool );
+	poReader->SetStats( &sStats );
+	oScratch.oRingBuilder.SetStats( &sStats );
+
+/* -------------------------------------------------------------------- */
+/*      Only the count line is read here, the rest is left to           */
+/*      Initialize().  The line count of a WAL file is one more than    */
+/*      the number of records; a WAP file starts with its arc count,    */
+/*      and the polygon count is not known before the arcs are scanned. */
+/* -------------------------------------------------------------------- */
+	const char *pszLine = poReader->ReadLine();
+	int nCount = pszLine ? atoi( pszLine ) : 0;
+
+	nArcCount = 0;
+	nTotalMapGISCount = nCount;
+	if( featureType == 2 )
+		nTotalMapGISCount = MAX( 0, nCount - 1 );
+	else if( featureType == 3 )
+	{
+		nArcCount = nCount;
+		nTotalMapGISCount = -1;
+	}
+
+	nFirstRecordOffset = poReader->Tell();
+	bInitialized = FALSE;
+	bExtentKnown = FALSE;
+
+	poCache = NULL;
+	if( CSLTestBoolean( CPLGetConfigOption( "MAPGIS_CACHE", "NO" ) ) )
+		poCache = OGRMapGISCache::Open( pszFilename, featureType );
+	if( poCache != NULL )
+	{
+		nTotalMapGISCount = poCache->GetRecordCount();
+		bExtentKnown = poCache->GetExtent( &sLayerExtent );
+	}
+
+	nThreads = 1;
+	poPool = NULL;
+	iBatchRecord = 0;
+	bBatchesAtEnd = FALSE;
+
+	iNextRecord = 0;
+	bRecordIndexComplete = FALSE;
+	bResumePending = FALSE;
+
+	panMatchingFIDs = NULL;
+	iMatchingFID = 0;
+	bCheckedForQIX = FALSE;
+
+	// Only hold the file while reading it.
+	poReader->CloseFile();
+}
+
+/************************************************************************/
+/*                             Initialize()                             */
+/*                                                                      */
+/*      Prepare for reading records, on the first call that needs       */
+/*      them: load the arcs of a WAP file and pick up the record        */
+/*      index.  Opening a layer does none of this, so probing and       */
+/*      listing layers stays cheap.                                     */
+/************************************************************************/
+
+void OGRMapGISLayer::Initialize()
+
+{
+	if( bInitialized )
+		return;
+
+	bInitialized = TRUE;
+
+	if( poCache != NULL )
+		UseCache();
+	else if( featureType == 3 )
+	{
+		poReader->Seek( nFirstRecordOffset );
+
+		MAPGIS_STAT_START( dfStart );
+		int bScanned = ScanArcs( nArcCount );
+		MAPGIS_STAT_STOP( &sStats, dfArcScanTime, dfStart );
+
+		const char *pszLine = bScanned ? poReader->ReadLine() : NULL;
+		nTotalMapGISCount = pszLine ? MAX( 0, atoi( pszLine ) ) : 0;
+		nFirstRecordOffset = poReader->Tell();
+		bExtentKnown = bScanned && oArcs.GetArcCount() > 0;
+	}
+
+/* -------------------------------------------------------------------- */
+/*      Held arcs are packed to integer deltas unless asked not to.     */
+/* -------------------------------------------------------------------- */
+	if( featureType == 3
+		&& CSLTestBoolean( CPLGetConfigOption( "MAPGIS_PACK_ARCS", "YES" ) ) )
+		oArcs.Pack();
+
+/* -------------------------------------------------------------------- */
+/*      Records are decoded by a pool of threads, running while a       */
+/*      scan is.  The lazy arc cache is not thread safe.                */
+/* -------------------------------------------------------------------- */
+	if( featureType != 3 || !oArcs.IsLazy() )
+		nThreads = OGRMapGISGetThreadCount();
+
+/* -------------------------------------------------------------------- */
+/*      Pick up a saved record index, or build one now if asked to.     */
+/* -------------------------------------------------------------------- */
+	const char *pszFIDIndex = CPLGetConfigOption( "MAPGIS_FID_INDEX", "YES" );
+
+	if( poCache == NULL && CSLTestBoolean( pszFIDIndex )
+		&& !ReadRecordIndex() && EQUAL( pszFIDIndex, "EAGER" ) )
+		CompleteRecordIndex();
+
+/* -------------------------------------------------------------------- */
+/*      A cache asked for but missing or out of date is written now,    */
+/*      from one full read.                                             */
+/* -------------------------------------------------------------------- */
+	if( poCache == NULL
+		&& CSLTestBoolean( CPLGetConfigOption( "MAPGIS_CACHE", "NO" ) ) )
+		BuildCache();
+
+	poReader->Seek( nFirstRecordOffset );
+	iNextRecord = 0;
+	bResumePending = FALSE;
+}
+
+/************************************************************************/
+/*                            ReadIdPair()                              */
+/*                                                                      */
+/*      Read a "from,to" node or "left,right" polygon line.  A missing  */
+/*      id is 0.                                                        */
+/************************************************************************/
+
+static int ReadIdPair( OGRMapGISReader *poReader, int *pnFirst, int *pnSecond )
+
+{
+	OGRMapGISToken asTokens[2];
+	int nTokens = poReader->ReadTokens( asTokens, 2 );
+
+	if( nTokens < 0 )
+		return FALSE;
+
+	*pnFirst = nTokens > 0 ? atoi( asTokens[0].pszValue ) : 0;
+	*pnSecond = nTokens > 1 ? atoi( asTokens[1].pszValue ) : 0;
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                              ScanArcs()                              */
+/*                                                                      */
+/*      Load the arc section and node table of a WAP file, leaving the  */
+/*      reader on the polygon count line.  The layer extent is that of  */
+/*      the arcs.                                                       */
+/************************************************************************/
+
+int OGRMapGISLayer::ScanArcs( int nArcCount )
+
+{
+	OGRMapGISToken asTokens[2];
+	const char *pszLine;
+
+/* -------------------------------------------------------------------- */
+/*      With an arc cache budget only offsets and extents are kept.     */
+/* -------------------------------------------------------------------- */
+	const char *pszCacheMB = CPLGetConfigOption( "MAPGIS_ARC_CACHE_MB", NULL );
+	if( pszCacheMB != NULL && atoi( pszCacheMB ) > 0 )
+		oArcs.SetLazy( pszFullName,
+			(size_t) atoi( pszCacheMB ) * 1024 * 1024 );
+
+	oArcs.Reserve( nArcCount );
+
+	for( int i = 0; i < nArcCount; i++ )
+	{
+		// The style line, then the nodes and polygons of the arc.
+		int nFromNode, nToNode, nLeftPolygon, nRightPolygon;
+
+		poReader->SkipLines( 1 );
+		if( !ReadIdPair( poReader, &nFromNode, &nToNode )
+			|| !ReadIdPair( poReader, &nLeftPolygon, &nRightPolygon ) )
+			return FALSE;
+
+		pszLine = poReader->ReadLine();
+		if( pszLine == NULL )
+			return FALSE;
+		int pointCount = atoi( pszLine );
+		vsi_l_offset nVertexOffset = poReader->Tell();
+		if( !oScratch.ReadVertexRun( poReader, pointCount ) )
+			return FALSE;
+
+		// The arc id and length trail the vertices.
+		int nTokens = poReader->ReadTokens( asTokens, 2 );
+		if( nTokens < 1 )
+			return FALSE;
+
+		int nArcId = atoi( asTokens[0].pszValue );
+		if( oArcs.AddArc( nArcId, pointCount,
+				&oScratch.adfX[0], &oScratch.adfY[0],
+				nTokens > 1 ? CPLAtof( asTokens[1].pszValue ) : 0.0,
+				nVertexOffset ) )
+		{
+			oArcs.SetTopology( nArcId, nFromNode, nToNode,
+							   nLeftPolygon, nRightPolygon );
+			sLayerExtent.Merge( oArcs.GetExtent( nArcId ) );
+		}
+	}
+
+/* -------------------------------------------------------------------- */
+/*      The node table: per node its position, arc count and the       */
+/*      signed arc ids, one per line.                                   */
+/* -------------------------------------------------------------------- */
+	pszLine = poReader->ReadLine();
+	int nodeCount = pszLine ? atoi( pszLine ) : 0;
+	std::vector<int> anNodeArcs;
+
+	for( int j = 0; j < nodeCount-1; j++ )
+	{
+		double dfX, dfY;
+
+		if( poReader->ReadVertices( 1, &dfX, &dfY ) != 1 )
+			return FALSE;
+		pszLine = poReader->ReadLine();
+		if( pszLine == NULL )
+			return FALSE;
+
+		int nNodeArcs = MAX( 0, atoi( pszLine ) );
+		anNodeArcs.resize( nNodeArcs );
+		for( int k = 0; k < nNodeArcs; k++ )
+		{
+			pszLine = poReader->ReadLine();
+			if( pszLine == NULL )
+				return FALSE;
+			anNodeArcs[k] = atoi( pszLine );
+		}
+
+		oArcs.AddNode( dfX, dfY, nNodeArcs,
+					   nNodeArcs > 0 ? &anNodeArcs[0] : NULL );
+	}
+
+	oArcs.Shrink();
+
+	CPLDebug( "MapGIS", "Loaded %d arcs, %d vertices, %d nodes, %d bytes.",
+			  oArcs.GetArcCount(), (int) oArcs.GetVertexTotal(),
+			  oArcs.GetNodeCount(), (int) oArcs.GetMemoryUsage() );
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                           ReadVertexRun()                            */
+/*                                                                      */
+/*      Bulk parse the next nCount vertex lines into adfX/Y.            */
+/************************************************************************/
+
+int OGRMapGISScratch::ReadVertexRun( OGRMapGISReader *poReader, int nCount )
+
+{
+	if( nCount < 0 )
+		return FALSE;
+
+	if( (int) adfX.size() < nCount + 1 )
+	{
+		adfX.resize( nCount + 1 );
+		adfY.resize( nCount + 1 );
+	}
+
+	return poReader->ReadVertices( nCount, &adfX[0], &adfY[0] ) == nCount;
+}
+
+/************************************************************************/
+/*                           ~OGRMapGISLayer()                          */
+/************************************************************************/
+
+OGRMapGISLayer::~OGRMapGISLayer()
+
+{
+	DiscardBatches();
+	StopWorkers();
+
+#ifndef MAPGIS_DISABLE_STATS
+	if( sStats.nLines > 0 )
+	{
+		char **papszItems = GetMetadata( "MAPGIS_STATS" );
+		CPLString osItems;
+
+		for( int i = 0; papszItems != NULL && papszItems[i] != NULL; i++ )
+		{
+			if( i > 0 )
+				osItems += ", ";
+			osItems += papszItems[i];
+		}
+		CPLDebug( "MapGIS", "%s: %s", poFeatureDefn->GetName(),
+				  osItems.c_str() );
+	}
+#endif
+	CSLDestroy( papszStats );
+
+	delete poCache;
+	delete poReader;
+	if( hArcMutex != NULL )
+		CPLDestroyMutex( hArcMutex );
+	CPLFree( pszFullName );
+	CPLFree( panMatchingFIDs );
+
+	if( poFeatureDefn )
+		poFeatureDefn->Release();
+}
+
+/************************************************************************/
+/*                            ResetReading()                            */
+/************************************************************************/
+
+void OGRMapGISLayer::ResetReading()
+
+{
+	// Nothing has been read yet.
+	if( !bInitialized )
+		return;
+
+	DiscardBatches();
+	StopWorkers();
+	poReader->Seek( nFirstRecordOffset );
+	iNextRecord = 0;
+	bResumePending = FALSE;
+
+	CPLFree( panMatchingFIDs );
+	panMatchingFIDs = NULL;
+	iMatchingFID = 0;
+}
+
+/************************************************************************/
+/*                          SetIgnoredFields()                          */
+/*                                                                      */
+/*      Read positions are kept, but batches read ahead were built      */
+/*      for the previous set of fields and must go.                     */
+/************************************************************************/
+
+OGRErr OGRMapGISLayer::SetIgnoredFields( const char **papszFields )
+
+{
+	OGRErr eErr = OGRLayer::SetIgnoredFields( papszFields );
+	if( eErr != OGRERR_NONE )
+		return eErr;
+
+	DiscardBatches();
+	ComputeReadColumns();
+
+	return OGRERR_NONE;
+}
+
+/************************************************************************/
+/*                         ComputeReadColumns()                         */
+/*                                                                      */
+/*      Collect the attribute fields that are not ignored, and for      */
+/*      each line layout the number of leading columns that have to     */
+/*      be split to reach them.                                         */
+/************************************************************************/
+
+void OGRMapGISLayer::ComputeReadColumns()
+
+{
+	bLayerFieldIgnored = poFeatureDefn->GetFieldDefn( 0 )->IsIgnored();
+
+	anReadFields.resize( 0 );
+	anReadColumns[0] = 0;
+	anReadColumns[1] = 0;
+
+	for( int iField = 0; iField < nFieldInfo; iField++ )
+	{
+		if( poFeatureDefn->GetFieldDefn( MAPGIS_FIRST_FIELD + iField )
+			->IsIgnored() )
+			continue;
+
+		anReadFields.push_back( iField );
+		for( int iLayout = 0; iLayout < 2; iLayout++ )
+			anReadColumns[iLayout] = MAX( anReadColumns[iLayout],
+				pasFieldInfo[iField].aiColumn[iLayout] + 1 );
+	}
+}
+
+/************************************************************************/
+/*                            SkipGeometry()                            */
+/*                                                                      */
+/*      An ignored geometry is still decoded while a spatial filter or  */
+/*      a query on the OGR_GEOM* fields needs it.                       */
+/************************************************************************/
+
+int OGRMapGISLayer::SkipGeometry()
+
+{
+	return poFeatureDefn->IsGeometryIgnored() && m_poFilterGeom == NULL
+		&& (m_poAttrQuery == NULL || !bAttrQueryNeedsGeometry);
+}
+
+/************************************************************************/
+/*                           SetNextByIndex()                           */
+/*                                                                      */
+/*      With a filter installed the index counts matching features      */
+/*      only, so use the generic approach.                              */
+/************************************************************************/
+
+OGRErr OGRMapGISLayer::SetNextByIndex( long nIndex )
+
+{
+	if( m_poFilterGeom != NULL || m_poAttrQuery != NULL )
+		return OGRLayer::SetNextByIndex( nIndex );
+
+	Initialize();
+	DiscardBatches();
+	bResumePending = FALSE;
+	if( !SeekToRecord( nIndex ) )
+		return OGRERR_FAILURE;
+
+	return OGRERR_NONE;
+}
+
+/************************************************************************/
+/*                            SeekToRecord()                            */
+/*                                                                      */
+/*      Position the reader on record nIndex.  Records not indexed      */
+/*      yet are reached by skipping forward from the last known one,    */
+/*      indexing them on the way.                                       */
+/************************************************************************/
+
+int OGRMapGISLayer::SeekToRecord( long nIndex )
+
+{
+	if( nIndex < 0 )
+		return FALSE;
+
+	int nKnown = (int) anRecordDelta.size();
+
+	if( nIndex < nKnown )
+	{
+		poReader->Seek( anRecordIndex[nIndex / MAPGIS_INDEX_INTERVAL]
+			+ anRecordDelta[nIndex] );
+		iNextRecord = nIndex;
+		return TRUE;
+	}
+
+	if( bRecordIndexComplete )
+		return FALSE;
+
+	if( nKnown == 0 )
+	{
+		poReader->Seek( nFirstRecordOffset );
+		iNextRecord = 0;
+	}
+	else
+	{
+		poReader->Seek( anRecordIndex[(nKnown-1) / MAPGIS_INDEX_INTERVAL]
+			+ anRecordDelta[nKnown-1] );
+		iNextRecord = nKnown - 1;
+	}
+
+	while( iNextRecord < nIndex )
+	{
+		if( !SkipRecord() )
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                        CompleteRecordIndex()                         */
+/*                                                                      */
+/*      Index every record in the file, leaving the read position       */
+/*      untouched.                                                      */
+/************************************************************************/
+
+int OGRMapGISLayer::CompleteRecordIndex()
+
+{
+	if( !bRecordIndexComplete )
+	{
+		vsi_l_offset nSavedOffset = poReader->Tell();
+		int iSavedRecord = iNextRecord;
+
+		SeekToRecord( INT_MAX );
+
+		poReader->Seek( nSavedOffset );
+		iNextRecord = iSavedRecord;
+	}
+
+	return bRecordIndexComplete;
+}
+
+/************************************************************************/
+/*                           IndexRecord()                              */
+/*                                                                      */
+/*      Account for the record just read, which started at              */
+/*      nRecordOffset, and remember its offset the first time it is     */
+/*      seen.  A block spanning more than 4GB can not be expressed      */
+/*      with 32 bit deltas; indexing simply stops there.                */
+/************************************************************************/
+
+void OGRMapGISLayer::IndexRecord( vsi_l_offset nRecordOffset )
+
+{
+	if( iNextRecord == (int) anRecordDelta.size() && !bRecordIndexComplete )
+	{
+		if( iNextRecord % MAPGIS_INDEX_INTERVAL == 0 )
+			anRecordIndex.push_back( nRecordOffset );
+
+		vsi_l_offset nDelta = nRecordOffset - anRecordIndex.back();
+		if( nDelta <= 0xFFFFFFFFU )
+			anRecordDelta.push_back( (GUInt32) nDelta );
+	}
+
+	iNextRecord++;
+}
+
+/************************************************************************/
+/*                            EndOfRecords()                            */
+/*                                                                      */
+/*      Called when reading or skipping runs off the last record.  If   */
+/*      every record before it was indexed, the index is complete and   */
+/*      is worth saving.                                                */
+/************************************************************************/
+
+void OGRMapGISLayer::EndOfRecords()
+
+{
+	if( bRecordIndexComplete
+		|| iNextRecord != (int) anRecordDelta.size() )
+		return;
+
+	bRecordIndexComplete = TRUE;
+
+	if( CSLTestBoolean( CPLGetConfigOption( "MAPGIS_FID_INDEX", "YES" ) ) )
+		WriteRecordIndex();
+}
+
+/************************************************************************/
+/*                          EndOfExtentScan()                           */
+/*                                                                      */
+/*      Called when a scan of record extents from the first record      */
+/*      runs off the last one.  The scan only completes the record      */
+/*      index if it read as many records as the count line announces;   */
+/*      returns whether it did.                                         */
+/************************************************************************/
+
+int OGRMapGISLayer::EndOfExtentScan()
+
+{
+	if( iNextRecord != nTotalMapGISCount )
+	{
+		CPLDebug( "MapGIS", "%s: found %d records, the count line says %d.",
+				  pszFullName, iNextRecord, nTotalMapGISCount );
+		return FALSE;
+	}
+
+	EndOfRecords();
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                             SkipRecord()                             */
+/*                                                                      */
+/*      Step over the next record without decoding it.  Returns FALSE   */
+/*      at the end of the records.                                      */
+/************************************************************************/
+
+int OGRMapGISLayer::SkipRecord()
+
+{
+	vsi_l_offset nRecordOffset = poReader->Tell();
+	const char *pszLine = poReader->ReadLine( NULL, featureType == 1 );
+
+	if( pszLine == NULL || *pszLine == '\0' )
+	{
+		EndOfRecords();
+		return FALSE;
+	}
+
+	if( featureType == 2 || featureType == 3 )
+	{
+		pszLine = poReader->ReadLine();
+		if( pszLine == NULL )
+			return FALSE;
+
+		// Vertices and the id line for lines, arc ids for polygons.
+		int nLines = atoi( pszLine ) + ( featureType == 2 ? 1 : 0 );
+		if( poReader->SkipLines( nLines ) != nLines )
+			return FALSE;
+	}
+
+	IndexRecord( nRecordOffset );
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                            FetchMapGIS()                             */
+/*                                                                      */
+/*     Take a MapGIS id, a geometry, and a feature, and set the feature */
+/*      if the MapGISid bbox intersects the geometry.                   */
+/************************************************************************/
+
+OGRFeature *OGRMapGISLayer::FetchMapGIS(int iMapGISId)
+
+{
+   
+    return NULL;
+}
+
+/************************************************************************/
+/*                      GetNextUnfilteredFeature()                      */
+/*                                                                      */
+/*      Next record regardless of the spatial filter.  Records the      */
+/*      attribute filter can reject from their attributes alone are     */
+/*      skipped here, without decoding their geometry.                  */
+/************************************************************************/
+
+OGRFeature *OGRMapGISLayer::GetNextUnfilteredFeature()
+{
+	Initialize();
+
+	if( bResumePending )
+	{
+		bResumePending = FALSE;
+		poReader->Seek( nResumeOffset );
+		iNextRecord = iResumeRecord;
+	}
+
+	if( poCache != NULL )
+	{
+		while( iNextRecord < poCache->GetRecordCount() )
+		{
+			int bFiltered = FALSE;
+			OGRFeature *poFeature = ReadCachedRecord( iNextRecord++,
+				poFeatureDefn, SkipGeometry(), &bFiltered );
+
+			if( poFeature != NULL )
+				return poFeature;
+			MAPGIS_STAT_ADD( &sStats, nFiltered, 1 );
+		}
+
+		return NULL;
+	}
+
+	// Without geometries there is nothing to assemble for polygons.
+	if( nThreads > 1 && (featureType != 3 || !SkipGeometry()) )
+		return GetNextBatchedFeature();
+
+	while( TRUE )
+	{
+		vsi_l_offset nRecordOffset = poReader->Tell();
+		int bFiltered = FALSE;
+		OGRFeature *poFeature = TranslateRecord( &bFiltered );
+
+		if( poFeature == NULL && !bFiltered )
+		{
+			EndOfRecords();
+			return NULL;
+		}
+
+		if( poFeature != NULL )
+			poFeature->SetFID( iNextRecord );
+		IndexRecord( nRecordOffset );
+
+		if( poFeature != NULL )
+			return poFeature;
+		MAPGIS_STAT_ADD( &sStats, nFiltered, 1 );
+	}
+}
+
+/************************************************************************/
+/*                       GetNextBatchedFeature()                        */
+/*                                                                      */
+/*      Keep a bounded number of record batches in the worker pool      */
+/*      and hand out their features in file order.  A batch no worker   */
+/*      has got to yet is decoded in this thread.  The pool is started  */
+/*      on demand and stopped at the end of the records.                */
+/************************************************************************/
+
+#define MAPGIS_POLYGON_BATCH    256
+
+OGRFeature *OGRMapGISLayer::GetNextBatchedFeature()
+
+{
+	while( TRUE )
+	{
+		while( !bBatchesAtEnd && (poPool == NULL
+			|| (int) apoBatches.size() < 2 * poPool->GetThreadCount() + 1) )
+		{
+			OGRMapGISBatch *poBatch = featureType == 3
+				? ReadPolygonBatch() : ReadRecordBatch();
+			if( poBatch == NULL )
+				break;
+			if( poPool == NULL )
+				poPool = new OGRMapGISWorkerPool( nThreads );
+			poPool->Submit( poBatch );
+			apoBatches.push_back( poBatch );
+		}
+
+		if( apoBatches.empty() )
+		{
+			StopWorkers();
+			return NULL;
+		}
+
+		OGRMapGISBatch *poBatch = apoBatches.front();
+		poPool->Finish( poBatch, TRUE );
+
+		while( iBatchRecord < poBatch->GetRecordCount() )
+		{
+			OGRFeature *poFeature = poBatch->TakeFeature( iBatchRecord++ );
+			if( poFeature == NULL )
+				continue;
+
+			// Polygon batches apply the attribute filter as they are
+			// read, point and line batches only here.
+			if( featureType != 3 && m_poAttrQuery != NULL
+				&& !bAttrQueryNeedsGeometry
+				&& !m_poAttrQuery->Evaluate( poFeature ) )
+			{
+				delete poFeature;
+				MAPGIS_STAT_ADD( &sStats, nFiltered, 1 );
+				continue;
+			}
+
+			return poFeature;
+		}
+
+		apoBatches.pop_front();
+		DeleteBatch( poBatch );
+		iBatchRecord = 0;
+	}
+}
+
+/************************************************************************/
+/*                          ReadPolygonBatch()                          */
+/*                                                                      */
+/*      Read the attributes and arc id lists of the next                */
+/*      MAPGIS_POLYGON_BATCH polygon records, applying the attribute    */
+/*      filter on the way.  Returns NULL at the end of the records.     */
+/************************************************************************/
+
+OGRMapGISBatch *OGRMapGISLayer::ReadPolygonBatch()
+
+{
+	MAPGIS_STAT_START( dfStart );
+	OGRMapGISPolygonBatch *poBatch =
+		new OGRMapGISPolygonBatch( &oArcs, iNextRecord );
+
+	while( poBatch->GetRecordCount() < MAPGIS_POLYGON_BATCH )
+	{
+		vsi_l_offset nRecordOffset = poReader->Tell();
+		OGRMapGISToken asTokens[MAPGIS_MAX_COLUMNS];
+		int nTokens = poReader->ReadTokens( asTokens,
+			MAX( 1, anReadColumns[0] ) );
+
+		if( nTokens <= 0 )
+		{
+			EndOfRecords();
+			bBatchesAtEnd = TRUE;
+			break;
+		}
+
+		OGRFeature *poFeature = new OGRFeature( poFeatureDefn );
+		if( !bLayerFieldIgnored )
+			poFeature->SetField( 0, "WAP_1" );
+		SetRecordFields( poFeature, 0, asTokens, nTokens );
+		poFeature->SetFID( iNextRecord );
+
+		const char *pszLine = poReader->ReadLine();
+		if( pszLine == NULL )
+		{
+			delete poFeature;
+			bBatchesAtEnd = TRUE;
+			break;
+		}
+
+		int nArcs = atoi( pszLine );
+
+		if( m_poAttrQuery != NULL && !bAttrQueryNeedsGeometry
+			&& !m_poAttrQuery->Evaluate( poFeature ) )
+		{
+			delete poFeature;
+			poFeature = NULL;
+			poReader->SkipLines( nArcs );
+			MAPGIS_STAT_ADD( &sStats, nFiltered, 1 );
+		}
+		else
+		{
+			for( int i = 0; i < nArcs; i++ )
+			{
+				pszLine = poReader->ReadLine();
+				if( pszLine == NULL )
+					break;
+				poBatch->anArcIds.push_back( atoi( pszLine ) );
+			}
+		}
+
+		poBatch->apoFeatures.push_back( poFeature );
+		poBatch->anOffset.push_back( nRecordOffset );
+		poBatch->anArcStart.push_back( (int) poBatch->anArcIds.size() );
+		IndexRecord( nRecordOffset );
+	}
+
+	MAPGIS_STAT_STOP( &sStats, dfDecodeTime, dfStart );
+
+	if( poBatch->GetRecordCount() == 0 )
+	{
+		delete poBatch;
+		return NULL;
+	}
+
+	return poBatch;
+}
+
+/************************************************************************/
+/*                          ReadRecordBatch()                           */
+/*                                                                      */
+/*      Find the boundaries of the next run of point or line records,   */
+/*      up to MAPGIS_RECORD_BATCH records or MAPGIS_RECORD_CHUNK        */
+/*      bytes, and copy their text into a batch for a worker to         */
+/*      parse.  Returns NULL at the end of the records.                 */
+/************************************************************************/
+
+#define MAPGIS_RECORD_BATCH     8192
+#define MAPGIS_RECORD_CHUNK     (1024 * 1024)
+
+OGRMapGISBatch *OGRMapGISLayer::ReadRecordBatch()
+
+{
+	OGRMapGISRecordBatch *poBatch = new OGRMapGISRecordBatch( iNextRecord );
+	vsi_l_offset nStart = poReader->Tell();
+	vsi_l_offset nEnd = nStart;
+
+	poReader->SetMark();
+	while( poBatch->GetRecordCount() < MAPGIS_RECORD_BATCH
+		&& nEnd - nStart < MAPGIS_RECORD_CHUNK )
+	{
+		vsi_l_offset nRecordOffset = poReader->Tell();
+		if( !SkipRecord() )
+		{
+			bBatchesAtEnd = TRUE;
+			break;
+		}
+
+		poBatch->anOffset.push_back( nRecordOffset );
+		nEnd = poReader->Tell();
+	}
+
+	if( poBatch->GetRecordCount() == 0 )
+	{
+		poReader->ClearMark();
+		delete poBatch;
+		return NULL;
+	}
+
+	size_t nSize = (size_t) (nEnd - nStart);
+
+	poBatch->abyData.resize( nSize + 1 + MAPGIS_VERTEX_PADDING );
+	poReader->Seek( nStart );
+	poReader->Read( &poBatch->abyData[0], nSize );
+	poReader->ClearMark();
+	poBatch->nDataSize = nSize;
+
+	poBatch->featureType = featureType;
+	poBatch->poFeatureDefn = poFeatureDefn;
+	poBatch->pasFieldInfo = pasFieldInfo;
+	poBatch->anReadFields = anReadFields;
+	poBatch->anReadColumns[0] = anReadColumns[0];
+	poBatch->anReadColumns[1] = anReadColumns[1];
+	poBatch->pszLayerValue = bLayerFieldIgnored ? NULL
+		: featureType == 1 ? "WAT_1" : "WAL_1";
+	poBatch->bSkipGeometry = SkipGeometry();
+
+	return poBatch;
+}
+
+/************************************************************************/
+/*                            StopWorkers()                             */
+/*                                                                      */
+/*      Idle workers keep polling for tasks, so the pool is not kept    */
+/*      past the end of a scan.  No batch may be outstanding.           */
+/************************************************************************/
+
+void OGRMapGISLayer::StopWorkers()
+
+{
+	CPLAssert( apoBatches.empty() );
+
+	delete poPool;
+	poPool = NULL;
+}
+
+/************************************************************************/
+/*                           DiscardBatches()                           */
+/*                                                                      */
+/*      Drop the batches read ahead and put the reader back on the      */
+/*      first record not handed out yet.                                */
+/************************************************************************/
+
+void OGRMapGISLayer::DiscardBatches()
+
+{
+	int bFound = FALSE;
+	vsi_l_offset nOffset = 0;
+	int iRecord = 0;
+
+	for( size_t iBatch = 0; iBatch < apoBatches.size(); iBatch++ )
+	{
+		OGRMapGISBatch *poBatch = apoBatches[iBatch];
+		int iFirst = iBatch == 0 ? iBatchRecord : 0;
+
+		if( !bFound && iFirst < poBatch->GetRecordCount() )
+		{
+			nOffset = poBatch->anOffset[iFirst];
+			iRecord = poBatch->nFirstRecord + iFirst;
+			bFound = TRUE;
+		}
+
+		poPool->Finish( poBatch, FALSE );
+		DeleteBatch( poBatch );
+	}
+
+	apoBatches.clear();
+	iBatchRecord = 0;
+	bBatchesAtEnd = FALSE;
+
+	if( bFound )
+	{
+		poReader->Seek( nOffset );
+		iNextRecord = iRecord;
+	}
+}
+
 /************************************************************************/
-/*                            CSVSplitLine()                            */
+/*                            DeleteBatch()                             */
 /*                                                                      */
-/*      Tokenize a CSV line into fields in the form of a string         */
-/*      list.  This is used instead of the CPLTokenizeString()          */
-/*      because it provides correct CSV escaping and quoting            */
-/*      semantics.                                                      */
+/*      Delete a batch the workers are done with, adding up what it     */
+/*      counted.                                                        */
 /************************************************************************/
 
-static char **MapGISSplitLine( const char *pszString, char chDelimiter )
+void OGRMapGISLayer::DeleteBatch( OGRMapGISBatch *poBatch )
 
 {
-	char        **papszRetList = NULL;
-	char        *pszToken;
-	int         nTokenMax, nTokenLen;
+	OGRMapGISAddStats( &sStats, &poBatch->sStats );
+	delete poBatch;
+}
+
+/************************************************************************/
+/*                          SetRecordFields()                           */
+/*                                                                      */
+/*      Set the fields carried by an attribute line of layout iLayout,  */
+/*      leaving out ignored fields.                                     */
+/************************************************************************/
+
+void OGRMapGISLayer::SetRecordFields( OGRFeature *poFeature, int iLayout,
+									  const OGRMapGISToken *pasTokens,
+									  int nTokens )
 
-	pszToken = (char *) CPLCalloc(10,1);
-	nTokenMax = 10;
+{
+	OGRField sField;
+	CPLString osValue;
 
-	while( pszString != NULL && *pszString != '\0' )
+	for( size_t iRead = 0; iRead < anReadFields.size(); iRead++ )
 	{
-		int     bInString = FALSE;
+		int iField = anReadFields[iRead];
+
+		if( !OGRMapGISParseField( pasFieldInfo + iField, iLayout,
+								  pasTokens, nTokens, &sField, osValue ) )
+			continue;
+
+		switch( pasFieldInfo[iField].eType )
+		{
+		case OFTInteger:
+			poFeature->SetField( MAPGIS_FIRST_FIELD + iField,
+								 sField.Integer );
+			break;
+		case OFTReal:
+			poFeature->SetField( MAPGIS_FIRST_FIELD + iField, sField.Real );
+			break;
+		default:
+			poFeature->SetField( MAPGIS_FIRST_FIELD + iField,
+								 osValue.c_str() );
+			break;
+		}
+	}
+}
+
+/************************************************************************/
+/*                          TranslateRecord()                           */
+/*                                                                      */
+/*      Decode the record at the current read position, see            */
+/*      DecodeRecord().                                                 */
+/************************************************************************/
+
+OGRFeature *OGRMapGISLayer::TranslateRecord( int *pbFiltered )
+{
+	MAPGIS_STAT_START( dfStart );
+	OGRFeature *poFeature = DecodeRecord( poReader, poFeatureDefn, &oScratch,
+										  SkipGeometry(), pbFiltered );
+	MAPGIS_STAT_STOP( &sStats, dfDecodeTime, dfStart );
+
+	if( poFeature != NULL )
+		poFeature->SetFID( iNextRecord );
+
+	return poFeature;
+}
+
+/************************************************************************/
+/*                            DecodeRecord()                            */
+/*                                                                      */
+/*      Decode the record at the read position of poRecordReader into   */
+/*      a feature of poDefn.  If pbFiltered is given, the attribute     */
+/*      filter is evaluated before the geometry is read; a rejected     */
+/*      record is skipped and NULL returned with *pbFiltered set.       */
+/*                                                                      */
+/*      Only the leading columns holding fields that are not ignored    */
+/*      are split, and with bSkipGeometry the geometry is skipped line  */
+/*      by line without parsing its coordinates or looking up its       */
+/*      arcs.  Without pbFiltered nothing of the layer changes, so      */
+/*      cursors can decode concurrently.                                */
+/************************************************************************/
+
+OGRFeature *OGRMapGISLayer::DecodeRecord( OGRMapGISReader *poRecordReader,
+										  OGRFeatureDefn *poDefn,
+										  OGRMapGISScratch *poScratch,
+										  int bSkipGeometry,
+										  int *pbFiltered )
+{
+	OGRMapGISToken asTokens[MAPGIS_MAX_COLUMNS];
+	OGRFeature *poFeature = new OGRFeature( poDefn );
+	int bPrefilter = pbFiltered != NULL && m_poAttrQuery != NULL
+		&& !bAttrQueryNeedsGeometry;
 
-		nTokenLen = 0;
+	if( pbFiltered != NULL )
+		*pbFiltered = FALSE;
 
-		/* Try to find the next delimeter, marking end of token */
-		for( ; *pszString != '\0'; pszString++ )
+	switch(featureType)
+	{
+	case 1:
 		{
+			// The point type in column 3 selects the layout.
+			int nTokens = poRecordReader->ReadTokens( asTokens,
+				MAX( 4, MAX( anReadColumns[0], anReadColumns[1] ) ) );
+			if( nTokens < 3 )
+			{
+				delete poFeature;
+				return NULL;
+			}
+
+			int iLayout = OGRMapGISGetPointLayout( asTokens, nTokens );
 
-			/* End if this is a delimeter skip it and break. */
-			if( !bInString && *pszString == chDelimiter )
+			if( !bLayerFieldIgnored )
+				poFeature->SetField( 0, "WAT_1" );
+			SetRecordFields( poFeature, iLayout, asTokens, nTokens );
+
+			if( bPrefilter && !m_poAttrQuery->Evaluate( poFeature ) )
 			{
-				pszString++;
+				delete poFeature;
+				*pbFiltered = TRUE;
+				return NULL;
+			}
+
+			if( bSkipGeometry )
 				break;
+
+			double dfX = OGRMapGISParseNumber( asTokens[0].pszValue );
+			double dfY = OGRMapGISParseNumber( asTokens[1].pszValue );
+
+			poFeature->SetGeometryDirectly( new OGRPoint( dfX, dfY, 0.0 ) );
+			break;
+		}
+	case 2:
+		{
+			int nTokens = poRecordReader->ReadTokens( asTokens,
+				MAX( 1, anReadColumns[0] ) );
+			if( nTokens <= 0 )
+			{
+				delete poFeature;
+				return NULL;
+			}
+
+			if( !bLayerFieldIgnored )
+				poFeature->SetField( 0, "WAL_1" );
+			SetRecordFields( poFeature, 0, asTokens, nTokens );
+
+			const char* pszStr = poRecordReader->ReadLine();
+			if( pszStr == NULL )
+			{
+				delete poFeature;
+				return NULL;
+			}
+			int ptCount = atoi( pszStr );
+
+/* -------------------------------------------------------------------- */
+/*      The id and length follow the vertices.  When filtering, skip    */
+/*      over the vertices to them and come back only if the record      */
+/*      is accepted.                                                    */
+/* -------------------------------------------------------------------- */
+			if( bPrefilter )
+			{
+				vsi_l_offset nVertexOffset = poRecordReader->Tell();
+
+				if( poRecordReader->SkipLines( ptCount ) != ptCount )
+				{
+					delete poFeature;
+					return NULL;
+				}
+
+				nTokens = poRecordReader->ReadTokens( asTokens, 2 );
+				SetRecordFields( poFeature, 1, asTokens, nTokens );
+
+				if( !m_poAttrQuery->Evaluate( poFeature ) )
+				{
+					delete poFeature;
+					*pbFiltered = TRUE;
+					return NULL;
+				}
+
+				if( bSkipGeometry )
+					break;
+
+				poRecordReader->Seek( nVertexOffset );
 			}
 
-			if( *pszString == '"' )
+			if( bSkipGeometry )
 			{
-				if( !bInString || pszString[1] != '"' )
+				if( poRecordReader->SkipLines( ptCount ) != ptCount )
 				{
-					bInString = !bInString;
-					continue;
+					delete poFeature;
+					return NULL;
 				}
-				else  /* doubled quotes in string resolve to one quote */
+			}
+			else
+			{
+				if( !poScratch->ReadVertexRun( poRecordReader, ptCount ) )
 				{
-					pszString++;
+					delete poFeature;
+					return NULL;
 				}
+
+				OGRLineString *poLS = new OGRLineString();
+				poLS->setPoints( ptCount, &poScratch->adfX[0],
+								 &poScratch->adfY[0] );
+				poLS->setCoordinateDimension( 3 );
+				poFeature->SetGeometryDirectly( poLS );
+			}
+
+			nTokens = poRecordReader->ReadTokens( asTokens, 2 );
+			if( !bPrefilter )
+				SetRecordFields( poFeature, 1, asTokens, nTokens );
+			break;
+		}
+	case 3:
+		{
+			int nTokens = poRecordReader->ReadTokens( asTokens,
+				MAX( 1, anReadColumns[0] ) );
+			if( nTokens <= 0 )
+			{
+				delete poFeature;
+				return NULL;
+			}
+
+			if( !bLayerFieldIgnored )
+				poFeature->SetField( 0, "WAP_1" );
+			SetRecordFields( poFeature, 0, asTokens, nTokens );
+
+			const char* pszLine = poRecordReader->ReadLine();
+			if( pszLine == NULL )
+			{
+				delete poFeature;
+				return NULL;
+			}
+			int numOfArc = atoi( pszLine );
+
+			if( bPrefilter && !m_poAttrQuery->Evaluate( poFeature ) )
+			{
+				poRecordReader->SkipLines( numOfArc );
+				delete poFeature;
+				*pbFiltered = TRUE;
+				return NULL;
+			}
+
+			if( bSkipGeometry )
+			{
+				poRecordReader->SkipLines( numOfArc );
+				break;
+			}
+
+/* -------------------------------------------------------------------- */
+/*      The arc list holds the rings one after another, each ended      */
+/*      by a zero; the first ring is the outer boundary.                */
+/* -------------------------------------------------------------------- */
+			std::vector<int> &anArcIds = poScratch->anArcIds;
+
+			anArcIds.resize( 0 );
+			for ( int i = 0; i < numOfArc; i++ )
+			{
+				pszLine = poRecordReader->ReadLine();
+				if( pszLine == NULL )
+					break;
+				anArcIds.push_back( atoi( pszLine ) );
+			}
+
+			// The lazy arc cache is shared by all cursors.
+			int bLockArcs = oArcs.IsLazy();
+			if( bLockArcs )
+				CPLCreateOrAcquireMutex( &hArcMutex, 1000.0 );
+
+			OGRPolygon *ogrPolygon = poScratch->oRingBuilder.BuildPolygon(
+				&oArcs, anArcIds.empty() ? NULL : &anArcIds[0],
+				(int) anArcIds.size() );
+
+			if( bLockArcs )
+				CPLReleaseMutex( hArcMutex );
+
+			poFeature->SetGeometryDirectly( ogrPolygon );
+			break;
+		}
+	}
+
+	return poFeature;
+}
+
+/************************************************************************/
+/*                           GetNextFeature()                           */
+/************************************************************************/
+
+OGRFeature *OGRMapGISLayer::GetNextFeature()
+
+{
+    OGRFeature  *poFeature = NULL;
+
+	Initialize();
+
+	if( poCache != NULL )
+		return GetNextCachedFeature();
+
+/* -------------------------------------------------------------------- */
+/*      With a spatial index only the candidate records it returns      */
+/*      are read.                                                       */
+/* -------------------------------------------------------------------- */
+	if( m_poFilterGeom != NULL && panMatchingFIDs == NULL )
+		ScanIndices();
+
+	if( panMatchingFIDs != NULL )
+	{
+		SuspendReading();
+
+		while( panMatchingFIDs[iMatchingFID] != OGRNullFID )
+		{
+			long nFID = panMatchingFIDs[iMatchingFID++];
+
+			if( !SeekToRecord( nFID ) )
+				continue;
+
+			int bFiltered = FALSE;
+			poFeature = TranslateRecord( &bFiltered );
+			if( poFeature == NULL )
+			{
+				if( bFiltered )
+					MAPGIS_STAT_ADD( &sStats, nFiltered, 1 );
+				continue;
 			}
+			poFeature->SetFID( nFID );
+
+			if( FilterGeometry( poFeature->GetGeometryRef() )
+				&& (m_poAttrQuery == NULL || !bAttrQueryNeedsGeometry
+				|| m_poAttrQuery->Evaluate( poFeature )) )
+			{
+				if( poFeatureDefn->IsGeometryIgnored() )
+					poFeature->SetGeometryDirectly( NULL );
+				MAPGIS_STAT_ADD( &sStats, nFeatures, 1 );
+				return poFeature;
+			}
+
+			delete poFeature;
+			MAPGIS_STAT_ADD( &sStats, nFiltered, 1 );
+		}
+
+		return NULL;
+	}
+
+/* -------------------------------------------------------------------- */
+/*      Read features till we find one that satisfies our current       */
+/*      spatial criteria.                                               */
+/* -------------------------------------------------------------------- */
+	while( TRUE )
+	{
+		poFeature = GetNextUnfilteredFeature();
+		if( poFeature == NULL )
+			break;
+
+		if( (m_poFilterGeom == NULL
+			|| FilterGeometry( poFeature->GetGeometryRef() ) )
+			&& (m_poAttrQuery == NULL || !bAttrQueryNeedsGeometry
+			|| m_poAttrQuery->Evaluate( poFeature )) )
+		{
+			// Only decoded for the filters.
+			if( poFeatureDefn->IsGeometryIgnored() )
+				poFeature->SetGeometryDirectly( NULL );
+			MAPGIS_STAT_ADD( &sStats, nFeatures, 1 );
+			break;
+		}
+
+		delete poFeature;
+		MAPGIS_STAT_ADD( &sStats, nFiltered, 1 );
+	}
+	return poFeature;
+}
+
+/************************************************************************/
+/*                         SetAttributeFilter()                         */
+/*                                                                      */
+/*      Queries on the OGR_GEOMETRY, OGR_GEOM_WKT or OGR_GEOM_AREA      */
+/*      special fields need the geometry; everything else is            */
+/*      evaluated before the geometry is decoded.                       */
+/************************************************************************/
+
+OGRErr OGRMapGISLayer::SetAttributeFilter( const char *pszQuery )
+
+{
+	bAttrQueryNeedsGeometry = FALSE;
+
+	for( const char *pszIter = pszQuery;
+		 pszIter != NULL && *pszIter != '\0'; pszIter++ )
+	{
+		if( EQUALN( pszIter, "OGR_GEOM", 8 ) )
+		{
+			bAttrQueryNeedsGeometry = TRUE;
+			break;
+		}
+	}
+
+	return OGRLayer::SetAttributeFilter( pszQuery );
+}
+
+/************************************************************************/
+/*                           SuspendReading()                           */
+/*                                                                      */
+/*      Remember where sequential reading stands before the reader is   */
+/*      used for something else.  Seeking back is deferred to the next  */
+/*      GetNextFeature() so a run of GetFeature() calls does not        */
+/*      bounce the read buffer around.                                  */
+/************************************************************************/
+
+void OGRMapGISLayer::SuspendReading()
+
+{
+	DiscardBatches();
+
+	if( !bResumePending )
+	{
+		bResumePending = TRUE;
+		nResumeOffset = poReader->Tell();
+		iResumeRecord = iNextRecord;
+	}
+}
+
+/************************************************************************/
+/*                             GetFeature()                             */
+/************************************************************************/
+
+OGRFeature *OGRMapGISLayer::GetFeature( long nFeatureId )
+
+{
+	OGRFeature  *poFeature = NULL;
 
-			if( nTokenLen >= nTokenMax-2 )
-			{
-				nTokenMax = nTokenMax * 2 + 10;
-				pszToken = (char *) CPLRealloc( pszToken, nTokenMax );
-			}
+	Initialize();
 
-			pszToken[nTokenLen] = *pszString;
-			nTokenLen++;
-		}
+	if( poCache != NULL )
+	{
+		if( nFeatureId < 0 || nFeatureId >= poCache->GetRecordCount() )
+			return NULL;
 
-		pszToken[nTokenLen] = '\0';
-		papszRetList = CSLAddString( papszRetList, pszToken );
+		poFeature = ReadCachedRecord( (int) nFeatureId, poFeatureDefn,
+									  FALSE, NULL );
+		MAPGIS_STAT_ADD( &sStats, nFeatures, 1 );
+		return poFeature;
+	}
+
+	SuspendReading();
 
-		/* If the last token is an empty token, then we have to catch
-		* it now, otherwise we won't reenter the loop and it will be lost.
-		*/
-		if ( *pszString == '\0' && *(pszString-1) == chDelimiter )
+	if( SeekToRecord( nFeatureId ) )
+	{
+		poFeature = TranslateRecord();
+		if( poFeature != NULL )
 		{
-			papszRetList = CSLAddString( papszRetList, "" );
+			poFeature->SetFID( nFeatureId );
+			MAPGIS_STAT_ADD( &sStats, nFeatures, 1 );
 		}
 	}
 
-	if( papszRetList == NULL )
-		papszRetList = (char **) CPLCalloc(sizeof(char *),1);
-
-	CPLFree( pszToken );
-
-	return papszRetList;
+	return poFeature;
 }
 
 /************************************************************************/
-/*                      OGRCSVReadParseLineL()                          */
+/*                            CreateCursor()                            */
 /*                                                                      */
-/*      Read one line, and return split into fields.  The return        */
-/*      result is a stringlist, in the sense of the CSL functions.      */
+/*      The record index is completed first, so that it no longer       */
+/*      changes while cursors use it.                                   */
 /************************************************************************/
 
-char **OGRMapGISReadParseLineL( VSILFILE * fp, char chDelimiter, int bDontHonourStrings )
+OGRMapGISCursor *OGRMapGISLayer::CreateCursor()
 
 {
-	const char  *pszLine;
-	char        *pszWorkLine;
-	char        **papszReturn;
+	Initialize();
+	SuspendReading();
 
-	pszLine = CPLReadLineL( fp );
-	if( pszLine == NULL )
-		return( NULL );
-
-	/* Special fix to read NdfcFacilities.xls that has non-balanced double quotes */
-	if (chDelimiter == '\t' && bDontHonourStrings)
+	if( !CompleteRecordIndex() )
 	{
-		return CSLTokenizeStringComplex(pszLine, "\t", FALSE, TRUE);
+		CPLError( CE_Failure, CPLE_AppDefined,
+				  "Failed to index the records of %s, "
+				  "no cursor can be created.", pszFullName );
+		return NULL;
 	}
 
-/* -------------------------------------------------------------------- */
-/*      If there are no quotes, then this is the simple case.           */
-/*      Parse, and return tokens.                                       */
-/* -------------------------------------------------------------------- */
-	if( strchr(pszLine,'\"') == NULL )
-		return MapGISSplitLine( pszLine, chDelimiter );
-
-/* -------------------------------------------------------------------- */
-/*      We must now count the quotes in our working string, and as      */
-/*      long as it is odd, keep adding new lines.                       */
-/* -------------------------------------------------------------------- */
-	pszWorkLine = CPLStrdup( pszLine );
+	VSILFILE *fpCursor = VSIFOpenL( pszFullName, "rb" );
+	if( fpCursor == NULL )
+	{
+		CPLError( CE_Failure, CPLE_OpenFailed,
+				  "Failed to open %s.", pszFullName );
+		return NULL;
+	}
 
-	int i = 0, nCount = 0;
-	int nWorkLineLength = strlen(pszWorkLine);
+	return new OGRMapGISCursor( this, fpCursor );
+}
 
-	while( TRUE )
-	{
-		for( ; pszWorkLine[i] != '\0'; i++ )
-		{
-			if( pszWorkLine[i] == '\"'
-				&& (i == 0 || pszWorkLine[i-1] != '\\') )
-				nCount++;
-		}
+/************************************************************************/
+/*                             SetFeature()                             */
+/************************************************************************/
 
-		if( nCount % 2 == 0 )
-			break;
+OGRErr OGRMapGISLayer::SetFeature( OGRFeature *poFeature )
 
-		pszLine = CPLReadLineL( fp );
-		if( pszLine == NULL )
-			break;
+{
+	return NULL;
+}
 
-		int nLineLen = strlen(pszLine);
+/************************************************************************/
+/*                           DeleteFeature()                            */
+/************************************************************************/
 
-		char* pszWorkLineTmp = (char *)
-			VSIRealloc(pszWorkLine,
-			nWorkLineLength + nLineLen + 2);
-		if (pszWorkLineTmp == NULL)
-			break;
-		pszWorkLine = pszWorkLineTmp;
-		strcat( pszWorkLine + nWorkLineLength, "\n" ); // This gets lost in CPLReadLine().
-		strcat( pszWorkLine + nWorkLineLength, pszLine );
+OGRErr OGRMapGISLayer::DeleteFeature( long nFID )
 
-		nWorkLineLength += nLineLen + 1;
-	}
+{
+    return OGRERR_NONE;
+}
 
-	papszReturn = MapGISSplitLine( pszWorkLine, chDelimiter );
+/************************************************************************/
+/*                           CreateFeature()                            */
+/************************************************************************/
 
-	CPLFree( pszWorkLine );
+OGRErr OGRMapGISLayer::CreateFeature( OGRFeature *poFeature )
 
-	return papszReturn;
+{
+	return NULL;
 }
 
 /************************************************************************/
-/*                           OGRMapGISLayer()                           */
+/*                          GetFeatureCount()                           */
+/*                                                                      */
+/*      Without a filter the count comes from the record index once     */
+/*      it is complete, and from a saved index or the count line        */
+/*      before that.  For WAP files the count line follows the arcs,    */
+/*      which are only scanned if the count is forced.  With            */
+/*      only a spatial filter we count on record extents computed       */
+/*      straight from the coordinate text, visiting only the records    */
+/*      the spatial index returns if there is one.  Attribute filters   */
+/*      need the features, so the generic counter is used for those.    */
 /************************************************************************/
 
-OGRMapGISLayer::OGRMapGISLayer(	const char *pszLayerNameIn,
-							   VSILFILE *fp, int featureType )
+int OGRMapGISLayer::GetFeatureCount( int bForce )
 
 {
+	if( m_poAttrQuery != NULL )
+		return OGRLayer::GetFeatureCount( bForce );
 
-	this->fp = fp;
-	papoLayers = NULL;
-	nLayers = 0;
-	this->featureType = featureType;
-	poFeatureDefn = new OGRFeatureDefn( pszLayerNameIn );
-	OGRFieldDefn  oLayerField( "Layer", OFTString );
-	poFeatureDefn->AddFieldDefn( &oLayerField );
+	if( m_poFilterGeom == NULL )
+	{
+		if( poCache != NULL )
+			return poCache->GetRecordCount();
 
-	poFeatureDefn->Reference();
-	poFeatureDefn->SetGeomType( wkbUnknown );
-	int featureCount = atoi( CPLReadLineL(fp) );
-	idataBufferOffset = 2;
+		if( bRecordIndexComplete )
+			return (int) anRecordDelta.size();
 
-	if( featureType == 3 )
-	{
-		for( int i = 0; i < featureCount; i++ )
+		// A saved index knows the count before the layer is read.
+		int nCount = bInitialized ? -1 : PeekRecordCount();
+		if( nCount >= 0 )
+			return nCount;
+
+		if( nTotalMapGISCount < 0 )
 		{
-			CPLReadLineL( fp );
-			idataBufferOffset++;
-			CPLReadLineL( fp );
-			idataBufferOffset++;
-			CPLReadLineL( fp );
-			idataBufferOffset++;
-			int pointCount = atoi( CPLReadLineL(fp) );
-			idataBufferOffset++;
-			OGRFeature *poFeature = new OGRFeature( poFeatureDefn );
-			OGRLineString *poLS = new OGRLineString();
-			double dfX = 0.0, dfY = 0.0, dfZ = 0.0;
-			char **papszTokens = NULL;
-
-			for( int j = 0; j < pointCount; j++ )
-			{
-				papszTokens = OGRMapGISReadParseLineL( fp, ',', FALSE );
-				idataBufferOffset++;
-				if( *papszTokens == NULL )
-				{
-					delete poLS;
-					return;
-				}
-				dfX = CPLAtof(papszTokens[0]);
-				if( *( papszTokens+1 ) == NULL )
-				{
-					delete poLS;
-					return;
-				}
-				dfY = CPLAtof(papszTokens[1]);
+			if( !bForce )
+				return -1;
+			Initialize();
+		}
 
-				poLS->addPoint( dfX, dfY, dfZ );
-			}
-			poFeature->SetGeometryDirectly( poLS );
+		return nTotalMapGISCount;
+	}
 
-			papszTokens = OGRMapGISReadParseLineL( fp, ',', FALSE );
-			idataBufferOffset++;
-			if( *papszTokens == NULL )
-			{
-				delete poLS;
-				return;
-			}
-			long fID = atol(papszTokens[0]);
-			arcFeatures[fID] = poFeature;
-		}
+	// The saved record extents settle most records.
+	if( poCache != NULL )
+		return CountCachedRecords();
+
+	if( !bForce )
+		return -1;
+
+	Initialize();
+	SuspendReading();
+
+	int nCount = 0;
+	OGREnvelope sExtent;
+
+/* -------------------------------------------------------------------- */
+/*      With a spatial index only its candidates need checking.         */
+/* -------------------------------------------------------------------- */
+	if( CheckForQIX() )
+	{
+		long *panSavedFIDs = panMatchingFIDs;
+		int iSavedFID = iMatchingFID;
 
-		int nodeCount = atoi( CPLReadLineL(fp) );
-		idataBufferOffset++;
-		for( int j = 0; j < nodeCount-1; j++ )
+		panMatchingFIDs = NULL;
+		if( ScanIndices() && panMatchingFIDs != NULL )
 		{
-			CPLReadLineL( fp );
-			idataBufferOffset++;
-			int arcCount = atoi( CPLReadLineL(fp) );
-			idataBufferOffset++;
-			for( int k = 0; k < arcCount; k++ )
+			for( int i = 0; panMatchingFIDs[i] != OGRNullFID; i++ )
 			{
-				CPLReadLineL( fp );
-				idataBufferOffset++;
+				if( !SeekToRecord( panMatchingFIDs[i] ) )
+					continue;
+
+				vsi_l_offset nRecordOffset = poReader->Tell();
+				if( ReadRecordExtent( &sExtent ) == MAPGIS_EXTENT_FOUND
+					&& RecordInFilter( nRecordOffset, sExtent ) > 0 )
+					nCount++;
 			}
+
+			CPLFree( panMatchingFIDs );
+			panMatchingFIDs = panSavedFIDs;
+			iMatchingFID = iSavedFID;
+			return nCount;
 		}
-		featureCount = atoi( CPLReadLineL(fp) );
-		idataBufferOffset++;
+
+		panMatchingFIDs = panSavedFIDs;
+		iMatchingFID = iSavedFID;
 	}
-}
 
-/************************************************************************/
-/*                           ~OGRMapGISLayer()                          */
-/************************************************************************/
+/* -------------------------------------------------------------------- */
+/*      Scan all records, leaving sequential reading where it was.      */
+/* -------------------------------------------------------------------- */
+	poReader->Seek( nFirstRecordOffset );
+	iNextRecord = 0;
 
-OGRMapGISLayer::~OGRMapGISLayer()
+	while( TRUE )
+	{
+		vsi_l_offset nRecordOffset = poReader->Tell();
+		int nResult = ReadRecordExtent( &sExtent );
 
-{
-	if( poFeatureDefn )
-		poFeatureDefn->Release();
-}
+		if( nResult == MAPGIS_EXTENT_END )
+			EndOfExtentScan();
+		if( nResult == MAPGIS_EXTENT_END || nResult == MAPGIS_EXTENT_ERROR )
+			break;
 
-/************************************************************************/
-/*                            CheckForQIX()                             */
-/************************************************************************/
+		IndexRecord( nRecordOffset );
 
-int OGRMapGISLayer::CheckForQIX()
+		// A record without vertices matches no filter.
+		if( nResult == MAPGIS_EXTENT_EMPTY )
+			continue;
 
-{
-    return NULL;
+		int nMatch = RecordInFilter( nRecordOffset, sExtent );
+		if( nMatch < 0 )
+			break;
+		nCount += nMatch;
+	}
+
+	return nCount;
 }
 
 /************************************************************************/
-/*                            ScanIndices()                             */
+/*                           RecordInFilter()                           */
 /*                                                                      */
-/*      Utilize optional spatial and attribute indices if they are      */
-/*      available.                                                      */
+/*      Decide from its extent whether the record at nRecordOffset      */
+/*      passes the spatial filter, decoding the geometry only when      */
+/*      the extent straddles the filter.  Returns 1 or 0, or -1 if      */
+/*      the record could not be read.  The reader is left after the     */
+/*      record whenever it had to be decoded.                           */
 /************************************************************************/
 
-int OGRMapGISLayer::ScanIndices()
+int OGRMapGISLayer::RecordInFilter( vsi_l_offset nRecordOffset,
+									const OGREnvelope &sExtent )
 
 {
-    return TRUE;
-}
-
-/************************************************************************/
-/*                            ResetReading()                            */
-/************************************************************************/
+	if( sExtent.MaxX < m_sFilterEnvelope.MinX
+		|| sExtent.MaxY < m_sFilterEnvelope.MinY
+		|| m_sFilterEnvelope.MaxX < sExtent.MinX
+		|| m_sFilterEnvelope.MaxY < sExtent.MinY )
+		return 0;
 
-void OGRMapGISLayer::ResetReading()
+	if( m_bFilterIsEnvelope
+		&& sExtent.MinX >= m_sFilterEnvelope.MinX
+		&& sExtent.MinY >= m_sFilterEnvelope.MinY
+		&& sExtent.MaxX <= m_sFilterEnvelope.MaxX
+		&& sExtent.MaxY <= m_sFilterEnvelope.MaxY )
+		return 1;
 
-{
-	VSIFSeekL( fp, 0, 0);
-	for( int i = 0; i < idataBufferOffset; i++ )
-		CPLReadLineL(fp);
-}
+	poReader->Seek( nRecordOffset );
+	OGRFeature *poFeature = TranslateRecord();
+	if( poFeature == NULL )
+		return -1;
 
-/************************************************************************/
-/*                           SetNextByIndex()                           */
-/*                                                                      */
-/*      If we already have an FID list, we can easily resposition       */
-/*      ourselves in it.                                                */
-/************************************************************************/
+	int nMatch = FilterGeometry( poFeature->GetGeometryRef() ) ? 1 : 0;
 
-OGRErr OGRMapGISLayer::SetNextByIndex( long nIndex )
+	delete poFeature;
 
-{
-    return OGRERR_NONE;
+	return nMatch;
 }
 
 /************************************************************************/
-/*                            FetchMapGIS()                             */
+/*                          ReadRecordExtent()                          */
 /*                                                                      */
-/*     Take a MapGIS id, a geometry, and a feature, and set the feature */
-/*      if the MapGISid bbox intersects the geometry.                   */
+/*      Read the next record and return the bounds of its vertices      */
+/*      without building any feature or geometry.  Returns              */
+/*      MAPGIS_EXTENT_FOUND, or MAPGIS_EXTENT_EMPTY with MinX > MaxX    */
+/*      for a record without vertices, MAPGIS_EXTENT_END past the last  */
+/*      record and MAPGIS_EXTENT_ERROR for a record cut short.          */
 /************************************************************************/
 
-OGRFeature *OGRMapGISLayer::FetchMapGIS(int iMapGISId)
+int OGRMapGISLayer::ReadRecordExtent( OGREnvelope *psExtent )
 
 {
-   
-    return NULL;
-}
+	int nLength = 0;
+	const char *pszLine = poReader->ReadLine( &nLength, featureType == 1 );
 
-/************************************************************************/
-/*                      GetNextUnfilteredFeature()                      */
-/************************************************************************/
+	if( pszLine == NULL || *pszLine == '\0' )
+		return MAPGIS_EXTENT_END;
 
-OGRFeature *OGRMapGISLayer::GetNextUnfilteredFeature()
-{
-	char **papszTokens = NULL;
-	OGRFeature *poFeature = new OGRFeature( poFeatureDefn );
+	psExtent->MinX = psExtent->MinY = 1.0;
+	psExtent->MaxX = psExtent->MaxY = 0.0;
 
-	switch(featureType)
+	switch( featureType )
 	{
 	case 1:
 		{
-			double dfX = 0.0, dfY = 0.0, dfZ = 0.0;
-			papszTokens = OGRMapGISReadParseLineL(fp, ',', FALSE);
-			if ( *papszTokens == NULL )
-				return NULL;
-			//int nFieldCount = CSLCount( papszTokens );
-
-			//const char *pszToken = papszTokens[0];
-			//int bAllNumeric = TRUE;
-
-			//if (*pszToken != '\0')
-			//{
-			//	while( *pszToken != '\0' && bAllNumeric )
-			//	{
-			//		if( *pszToken != '.' && *pszToken != '-'
-			//			&& (*pszToken < '0' || *pszToken > '9') )
-			//			bAllNumeric = FALSE;
-			//		pszToken++;
-			//	}
-			//	if( !bAllNumeric )
-			//		return 
-			//}
-			if( *( papszTokens + 1 ) == NULL )
-				return NULL;
-			dfX = CPLAtof(papszTokens[0]);
-			dfY = CPLAtof(papszTokens[1]);
-
-			poFeature->SetGeometryDirectly( new OGRPoint( dfX, dfY, dfZ ) );
-			poFeature->SetField( "Layer", "WAT_1" );
-			poFeature->SetFID( atol(papszTokens[2]) );
-			break;
+			OGRMapGISToken asTokens[2];
+			if( OGRMapGISSplitLine( pszLine, nLength, asTokens, 2 ) < 2 )
+				return MAPGIS_EXTENT_ERROR;
+
+			psExtent->MinX = psExtent->MaxX =
+				OGRMapGISParseNumber( asTokens[0].pszValue );
+			psExtent->MinY = psExtent->MaxY =
+				OGRMapGISParseNumber( asTokens[1].pszValue );
+			return MAPGIS_EXTENT_FOUND;
 		}
 	case 2:
 		{
-			int nPolylineFlag = 0;
- 
-			double      dfX = 0.0, dfY = 0.0, dfZ = 0.0;
+			pszLine = poReader->ReadLine();
+			if( pszLine == NULL )
+				return MAPGIS_EXTENT_ERROR;
+
+			int nCount = atoi( pszLine );
+			if( nCount < 0
+				|| (nCount > 0
+					&& !oScratch.ReadVertexRun( poReader, nCount ))
+				|| poReader->ReadLine() == NULL )
+				return MAPGIS_EXTENT_ERROR;
+
+			if( nCount == 0 )
+				return MAPGIS_EXTENT_EMPTY;
+
+			OGRMapGISGetExtent( nCount, &oScratch.adfX[0], &oScratch.adfY[0],
+								psExtent );
+			return MAPGIS_EXTENT_FOUND;
+		}
+	case 3:
+		{
+			pszLine = poReader->ReadLine();
+			if( pszLine == NULL )
+				return MAPGIS_EXTENT_ERROR;
 
-			OGRLineString *poLS = new OGRLineString();
+			int nArcs = atoi( pszLine );
+			int bFirst = TRUE;
 
-			const char* pszStr = CPLReadLineL( fp );
-			if( *pszStr == NULL )
-			{
-				delete poLS;
-				return NULL;
-			}
-			int ptCount = atoi( CPLReadLineL( fp ) );
+			if( nArcs < 0 )
+				return MAPGIS_EXTENT_ERROR;
 
-			for( int i = 0; i < ptCount; i++ )
+			for( int i = 0; i < nArcs; i++ )
 			{
-				papszTokens = OGRMapGISReadParseLineL( fp, ',', FALSE );
-				if( *papszTokens == NULL )
-				{
-					delete poLS;
-					return NULL;
-				}
-				dfX = CPLAtof(papszTokens[0]);
-				if( *( papszTokens+1 ) == NULL )
-				{
-					delete poLS;
-					return NULL;
-				}
-				dfY = CPLAtof(papszTokens[1]);
+				pszLine = poReader->ReadLine();
+				if( pszLine == NULL )
+					return MAPGIS_EXTENT_ERROR;
 
-				poLS->addPoint( dfX, dfY, dfZ );
-			}
-			CPLReadLineL( fp );
+				int nArcId = ABS( atoi( pszLine ) );
+				if( !oArcs.HasArc( nArcId ) )
+					continue;
 
-			poFeature->SetGeometryDirectly( poLS );
-			poFeature->SetField( "Layer", "WAL_1" );
-			break;
-		}
-	case 3:
-		{
-			OGRLinearRing *poLS = new OGRLinearRing();
-			const char* pszStr = CPLReadLineL( fp );
-			if( *pszStr == NULL )
-			{
-				delete poLS;
-				return NULL;
-			}
-			const char* pszLine/* = CPLReadLineL( fp )*/;
-			pszLine = CPLReadLineL( fp );
-			int numOfArc = atoi( pszLine );
-			for ( int i = 0; i < numOfArc - 1; i++ )
-			{
-				int arcID = atoi( CPLReadLineL( fp ) );
-				OGRGeometry *ogrGeometry;
-				OGRLineString *ogrLineString;
-				if( arcID > 0 )
+				const OGREnvelope &sArcExtent = oArcs.GetExtent( nArcId );
+				if( bFirst )
 				{
-					ogrGeometry = arcFeatures[arcID]->GetGeometryRef();
-					ogrLineString = (OGRLineString *)ogrGeometry;
-					int numOfPoints = ogrLineString->getNumPoints();
-					for (int j = 0; j < numOfPoints; j++ )
-					{
-						OGRPoint *tempOGRPoint = new OGRPoint();
-						ogrLineString->getPoint(j, tempOGRPoint);
-						poLS->addPoint( tempOGRPoint );
-					}
-
+					*psExtent = sArcExtent;
+					bFirst = FALSE;
 				}
 				else
 				{
-					ogrGeometry = arcFeatures[-arcID]->GetGeometryRef();
-					ogrLineString = (OGRLineString *)ogrGeometry;
-					int numOfPoints = ogrLineString->getNumPoints();
-					for (int j = numOfPoints - 1; j >= 0; j-- )
-					{
-						OGRPoint *tempOGRPoint = new OGRPoint();
-						ogrLineString->getPoint(j, tempOGRPoint);
-						tempOGRPoint->setZ( 0.0 );
-						poLS->addPoint( tempOGRPoint );
-					}
+					psExtent->MinX = MIN( psExtent->MinX, sArcExtent.MinX );
+					psExtent->MaxX = MAX( psExtent->MaxX, sArcExtent.MaxX );
+					psExtent->MinY = MIN( psExtent->MinY, sArcExtent.MinY );
+					psExtent->MaxY = MAX( psExtent->MaxY, sArcExtent.MaxY );
 				}
 			}
-			OGRPolygon *ogrPolygon = new OGRPolygon;
-			ogrPolygon->addRing( poLS );
-			ogrPolygon->setCoordinateDimension( 2 );
-			poFeature->SetGeometryDirectly( ogrPolygon );
-			poFeature->SetField( "Layer", "WAP_1" );
-			CPLReadLineL( fp );
-			break;
+			return bFirst ? MAPGIS_EXTENT_EMPTY : MAPGIS_EXTENT_FOUND;
 		}
 	}
-	
-	return poFeature;
+
+	return MAPGIS_EXTENT_ERROR;
 }
 
 /************************************************************************/
-/*                           GetNextFeature()                           */
+/*                             GetExtent()                              */
+/*                                                                      */
+/*      The extent is computed once and kept, and saved with the        */
+/*      record index so a later session finds it there, or in the      */
+/*      root of a spatial index, without reading the layer.             */
 /************************************************************************/
 
-OGRFeature *OGRMapGISLayer::GetNextFeature()
+OGRErr OGRMapGISLayer::GetExtent( OGREnvelope *psExtent, int bForce )
 
 {
-    OGRFeature  *poFeature = NULL;
-/* -------------------------------------------------------------------- */
-/*      Read features till we find one that satisfies our current       */
-/*      spatial criteria.                                               */
-/* -------------------------------------------------------------------- */
-	while( TRUE )
-	{
-		poFeature = GetNextUnfilteredFeature();
-		if( poFeature == NULL )
-			break;
+	if( !bExtentKnown && !bInitialized && PeekExtent( &sLayerExtent ) )
+		bExtentKnown = TRUE;
 
-		if( (m_poFilterGeom == NULL
-			|| FilterGeometry( poFeature->GetGeometryRef() ) )
-			&& (m_poAttrQuery == NULL
-			|| m_poAttrQuery->Evaluate( poFeature )) )
-			break;
+	if( !bExtentKnown && (!bForce || !ComputeExtent()) )
+		return OGRERR_FAILURE;
 
-		delete poFeature;
-	}
-	return poFeature;
+	*psExtent = sLayerExtent;
+
+	return OGRERR_NONE;
 }
 
 /************************************************************************/
-/*                             GetFeature()                             */
+/*                           ComputeExtent()                            */
+/*                                                                      */
+/*      Find the layer extent from the coordinates alone, without       */
+/*      building features.  For WAP files these are the arcs, taken     */
+/*      as they are loaded; points and lines are read in one pass that  */
+/*      also completes the record index, which is then saved with the   */
+/*      extent.                                                         */
 /************************************************************************/
 
-OGRFeature *OGRMapGISLayer::GetFeature( long nFeatureId )
+int OGRMapGISLayer::ComputeExtent()
 
 {
-	OGRFeature  *poFeature = NULL;
+	Initialize();
 
-	return poFeature;
-}
+	if( bExtentKnown || featureType == 3 )
+		return bExtentKnown;
 
-/************************************************************************/
-/*                             SetFeature()                             */
-/************************************************************************/
+	OGREnvelope sExtent;
+	int bIndexWasComplete = bRecordIndexComplete;
+	int bFoundVertices = FALSE;
 
-OGRErr OGRMapGISLayer::SetFeature( OGRFeature *poFeature )
+	SuspendReading();
 
-{
-	return NULL;
-}
+	poReader->Seek( nFirstRecordOffset );
+	iNextRecord = 0;
+	sLayerExtent = OGREnvelope();
 
-/************************************************************************/
-/*                           DeleteFeature()                            */
-/************************************************************************/
+	while( TRUE )
+	{
+		vsi_l_offset nRecordOffset = poReader->Tell();
+		int nResult = ReadRecordExtent( &sExtent );
 
-OGRErr OGRMapGISLayer::DeleteFeature( long nFID )
+		// Only an extent over every record announced is worth keeping.
+		if( nResult == MAPGIS_EXTENT_END )
+			bExtentKnown = EndOfExtentScan() && bFoundVertices;
+		if( nResult == MAPGIS_EXTENT_END || nResult == MAPGIS_EXTENT_ERROR )
+			break;
 
-{
-    return OGRERR_NONE;
+		IndexRecord( nRecordOffset );
+		if( nResult == MAPGIS_EXTENT_FOUND )
+		{
+			sLayerExtent.Merge( sExtent );
+			bFoundVertices = TRUE;
+		}
+	}
+
+	if( !bExtentKnown )
+		sLayerExtent = OGREnvelope();
+
+	// Add the extent to an index that was saved without it.
+	if( bExtentKnown && bIndexWasComplete
+		&& CSLTestBoolean( CPLGetConfigOption( "MAPGIS_FID_INDEX", "YES" ) ) )
+		WriteRecordIndex();
+
+	return bExtentKnown;
 }
 
 /************************************************************************/
-/*                           CreateFeature()                            */
+/*                           TestCapability()                           */
 /************************************************************************/
 
-OGRErr OGRMapGISLayer::CreateFeature( OGRFeature *poFeature )
+int OGRMapGISLayer::TestCapability( const char * pszCap )
 
 {
-	return NULL;
+	if( EQUAL(pszCap,OLCRandomRead) )
+		return TRUE;
+
+	if( EQUAL(pszCap,OLCFastSetNextByIndex) )
+		return m_poFilterGeom == NULL && m_poAttrQuery == NULL;
+
+	if( EQUAL(pszCap,OLCFastFeatureCount) )
+		return m_poAttrQuery == NULL
+			&& (poCache != NULL
+				|| (m_poFilterGeom != NULL ? CheckForQIX()
+					: nTotalMapGISCount >= 0 || bRecordIndexComplete
+					|| PeekRecordCount() >= 0));
+
+	if( EQUAL(pszCap,OLCFastSpatialFilter) )
+		return poCache != NULL || CheckForQIX();
+
+	if( EQUAL(pszCap,OLCFastGetExtent) )
+	{
+		OGREnvelope sExtent;
+		return bExtentKnown || (!bInitialized && PeekExtent( &sExtent ));
+	}
+
+	if( EQUAL(pszCap,OLCIgnoreFields) )
+		return TRUE;
+
+	return FALSE;
 }
 
 /************************************************************************/
-/*                          GetFeatureCount()                           */
+/*                            GetMetadata()                             */
 /*                                                                      */
-/*      If a spatial filter is in effect, we turn control over to       */
-/*      the generic counter.  Otherwise we return the total count.      */
-/*      Eventually we should consider implementing a more efficient     */
-/*      way of counting features matching a spatial query.              */
+/*      The MAPGIS_STATS domain holds the read path counters as         */
+/*      NAME=VALUE items, times in seconds.  Work of batches still in   */
+/*      flight and of cursors is not included.                          */
 /************************************************************************/
 
-int OGRMapGISLayer::GetFeatureCount( int bForce )
+char **OGRMapGISLayer::GetMetadata( const char *pszDomain )
 
 {
+#ifndef MAPGIS_DISABLE_STATS
+	if( pszDomain == NULL || !EQUAL( pszDomain, "MAPGIS_STATS" ) )
+		return NULL;
+
+	CSLDestroy( papszStats );
+	papszStats = NULL;
+
+	papszStats = CSLSetNameValue( papszStats, "BYTES_READ",
+		CPLSPrintf( CPL_FRMT_GIB, sStats.nBytesRead ) );
+	papszStats = CSLSetNameValue( papszStats, "LINES",
+		CPLSPrintf( CPL_FRMT_GIB, sStats.nLines ) );
+	papszStats = CSLSetNameValue( papszStats, "TOKENS",
+		CPLSPrintf( CPL_FRMT_GIB, sStats.nTokens ) );
+	papszStats = CSLSetNameValue( papszStats, "VERTICES",
+		CPLSPrintf( CPL_FRMT_GIB, sStats.nVertices ) );
+	papszStats = CSLSetNameValue( papszStats, "ARC_LOOKUPS",
+		CPLSPrintf( CPL_FRMT_GIB, sStats.nArcLookups ) );
+	papszStats = CSLSetNameValue( papszStats, "ARC_CACHE_HITS",
+		CPLSPrintf( "%d", oArcs.GetCacheHits() ) );
+	papszStats = CSLSetNameValue( papszStats, "ARC_CACHE_MISSES",
+		CPLSPrintf( "%d", oArcs.GetCacheMisses() ) );
+	papszStats = CSLSetNameValue( papszStats, "FEATURES",
+		CPLSPrintf( CPL_FRMT_GIB, sStats.nFeatures ) );
+	papszStats = CSLSetNameValue( papszStats, "FILTERED",
+		CPLSPrintf( CPL_FRMT_GIB, sStats.nFiltered ) );
+	papszStats = CSLSetNameValue( papszStats, "READ_TIME",
+		CPLSPrintf( "%.6f", sStats.dfReadTime ) );
+	papszStats = CSLSetNameValue( papszStats, "DECODE_TIME",
+		CPLSPrintf( "%.6f", sStats.dfDecodeTime ) );
+	papszStats = CSLSetNameValue( papszStats, "ARC_SCAN_TIME",
+		CPLSPrintf( "%.6f", sStats.dfArcScanTime ) );
+	papszStats = CSLSetNameValue( papszStats, "GEOMETRY_TIME",
+		CPLSPrintf( "%.6f", sStats.dfGeometryTime ) );
+
+	return papszStats;
+#else
 	return NULL;
+#endif
 }
 
 /************************************************************************/
-/*                           TestCapability()                           */
+/*                              GetInfo()                               */
+/*                                                                      */
+/*      "MAPGIS_STATS" gives the GetMetadata() items one per line, for  */
+/*      callers holding only an OGRLayer.                               */
 /************************************************************************/
 
-int OGRMapGISLayer::TestCapability( const char * pszCap )
+const char *OGRMapGISLayer::GetInfo( const char *pszTag )
 
 {
-        return FALSE;
+	if( !EQUAL( pszTag, "MAPGIS_STATS" ) )
+		return OGRLayer::GetInfo( pszTag );
+
+	char **papszItems = GetMetadata( pszTag );
+	if( papszItems == NULL )
+		return NULL;
+
+	osStatsInfo = "";
+	for( int i = 0; papszItems[i] != NULL; i++ )
+	{
+		osStatsInfo += papszItems[i];
+		osStatsInfo += "\n";
+	}
+
+	return osStatsInfo.c_str();
 }
 
 /************************************************************************/
@@ -640,27 +2154,6 @@ OGRErr OGRMapGISLayer::SyncToDisk()
     return OGRERR_NONE;
 }
 
-/************************************************************************/
-/*                          DropSpatialIndex()                          */
-/************************************************************************/
-
-OGRErr OGRMapGISLayer::DropSpatialIndex()
-
-{
-
-    return OGRERR_NONE;
-}
-
-/************************************************************************/
-/*                         CreateSpatialIndex()                         */
-/************************************************************************/
-
-OGRErr OGRMapGISLayer::CreateSpatialIndex( int nMaxDepth )
-
-{
-    return OGRERR_NONE;
-}
-
 /************************************************************************/
 /*                               Repack()                               */
 /*                                                                      */
@@ -0,0 +1,731 @@
+/******************************************************************************
+ * $Id: ogrmapgisreader.cpp 30005 2012-02-20 09:12:41Z fuxin $
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Implements OGRMapGISReader class, a block buffered line and
+ *           token reader for the WMAP text exports.
+ * Author:   ZhouShun, shunzhou@foxmail.com
+ *
+ ******************************************************************************
+ * Copyright (c) 1999,  Les Technologies SoftMap Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "ogr_mapgis.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+#ifdef WIN32
+#  include <windows.h>
+#else
+#  include <sys/time.h>
+#endif
+
+CPL_CVSID("$Id: ogrmapgisreader.cpp 30005 2012-02-20 09:12:41Z fuxin $");
+
+#define MAPGIS_READ_BLOCK_SIZE  (1024 * 1024)
+
+/* First read after a seek out of the buffer; doubled on every refill up */
+/* to MAPGIS_READ_BLOCK_SIZE so random access does not pay for 1MB.      */
+#define MAPGIS_SEEK_READ_SIZE   (16 * 1024)
+
+/************************************************************************/
+/*                          OGRMapGISReader()                           */
+/************************************************************************/
+
+OGRMapGISReader::OGRMapGISReader( VSILFILE *fpIn )
+
+{
+	fp = fpIn;
+	poFilePool = NULL;
+	bOwnsBuffer = TRUE;
+	nBufferAlloc = MAPGIS_READ_BLOCK_SIZE;
+	pabyBuffer = (char *)
+		CPLCalloc( nBufferAlloc + 1 + MAPGIS_VERTEX_PADDING, 1 );
+	nBufferSize = 0;
+	nBufferPos = 0;
+	nReadSize = MAPGIS_READ_BLOCK_SIZE;
+	nBufferOffset = VSIFTellL( fp );
+	nLineOffset = nBufferOffset;
+	bEOF = FALSE;
+	bMarked = FALSE;
+	nMarkOffset = 0;
+	psStats = NULL;
+}
+
+/************************************************************************/
+/*                          OGRMapGISReader()                           */
+/*                                                                      */
+/*      Reader taking over fpIn, opened on pszFilename.                 */
+/************************************************************************/
+
+OGRMapGISReader::OGRMapGISReader( const char *pszFilename, VSILFILE *fpIn,
+								  OGRMapGISFilePool *poFilePoolIn )
+
+{
+	fp = fpIn;
+	osFilename = pszFilename;
+	poFilePool = poFilePoolIn;
+	bOwnsBuffer = TRUE;
+	nBufferAlloc = MAPGIS_READ_BLOCK_SIZE;
+	pabyBuffer = (char *)
+		CPLCalloc( nBufferAlloc + 1 + MAPGIS_VERTEX_PADDING, 1 );
+	nBufferSize = 0;
+	nBufferPos = 0;
+	nReadSize = MAPGIS_READ_BLOCK_SIZE;
+	nBufferOffset = VSIFTellL( fp );
+	nLineOffset = nBufferOffset;
+	bEOF = FALSE;
+	bMarked = FALSE;
+	nMarkOffset = 0;
+	psStats = NULL;
+
+	if( poFilePool != NULL )
+		poFilePool->Touch( this );
+}
+
+/************************************************************************/
+/*                          OGRMapGISReader()                           */
+/*                                                                      */
+/*      Reader over nSize bytes already in memory, at offset 0.  The    */
+/*      caller keeps the buffer, which must have room for a             */
+/*      terminating zero and MAPGIS_VERTEX_PADDING bytes beyond it.     */
+/************************************************************************/
+
+OGRMapGISReader::OGRMapGISReader( char *pabyData, size_t nSize )
+
+{
+	fp = NULL;
+	poFilePool = NULL;
+	bOwnsBuffer = FALSE;
+	nBufferAlloc = nSize;
+	pabyBuffer = pabyData;
+	pabyBuffer[nSize] = '\0';
+	nBufferSize = nSize;
+	nBufferPos = 0;
+	nReadSize = 0;
+	nBufferOffset = 0;
+	nLineOffset = 0;
+	bEOF = TRUE;
+	bMarked = FALSE;
+	nMarkOffset = 0;
+	psStats = NULL;
+}
+
+/************************************************************************/
+/*                          ~OGRMapGISReader()                          */
+/************************************************************************/
+
+OGRMapGISReader::~OGRMapGISReader()
+
+{
+	CloseFile();
+
+	// Memory readers do not own their buffer.
+	if( bOwnsBuffer )
+		CPLFree( pabyBuffer );
+}
+
+/************************************************************************/
+/*                             CloseFile()                              */
+/*                                                                      */
+/*      Release the file of a reader that owns it.  The buffer and      */
+/*      read position are kept.                                         */
+/************************************************************************/
+
+void OGRMapGISReader::CloseFile()
+
+{
+	if( fp == NULL || osFilename.empty() )
+		return;
+
+	if( poFilePool != NULL )
+		poFilePool->Remove( this );
+
+	VSIFCloseL( fp );
+	fp = NULL;
+}
+
+/************************************************************************/
+/*                             ReopenFile()                             */
+/*                                                                      */
+/*      Reopen a closed file where the buffer ends.                     */
+/************************************************************************/
+
+int OGRMapGISReader::ReopenFile()
+
+{
+	if( osFilename.empty() )
+		return FALSE;
+
+	fp = VSIFOpenL( osFilename, "rb" );
+	if( fp == NULL )
+	{
+		CPLError( CE_Failure, CPLE_OpenFailed,
+				  "Failed to reopen %s.", osFilename.c_str() );
+		return FALSE;
+	}
+
+	if( VSIFSeekL( fp, nBufferOffset + nBufferSize, SEEK_SET ) != 0 )
+	{
+		CloseFile();
+		return FALSE;
+	}
+
+	if( poFilePool != NULL )
+		poFilePool->Touch( this );
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                             FillBuffer()                             */
+/*                                                                      */
+/*      Discard the consumed part of the buffer and append the next     */
+/*      block of the file.  The buffer is grown when a single line      */
+/*      does not fit, or when data after the mark has to be kept.       */
+/*      Returns FALSE once nothing more can be read.                    */
+/************************************************************************/
+
+int OGRMapGISReader::FillBuffer()
+
+{
+	if( bEOF )
+		return FALSE;
+
+	size_t nDiscard = nBufferPos;
+	if( bMarked )
+		nDiscard = MIN( nDiscard, (size_t) (nMarkOffset - nBufferOffset) );
+
+	if( nDiscard > 0 )
+	{
+		memmove( pabyBuffer, pabyBuffer + nDiscard,
+			nBufferSize - nDiscard );
+		nBufferSize -= nDiscard;
+		nBufferOffset += nDiscard;
+		nBufferPos -= nDiscard;
+
+		size_t nDropped = std::lower_bound( anEOLOffset.begin(),
+			anEOLOffset.end(), nBufferOffset ) - anEOLOffset.begin();
+		anEOLOffset.erase( anEOLOffset.begin(),
+						   anEOLOffset.begin() + nDropped );
+		achEOL.erase( achEOL.begin(), achEOL.begin() + nDropped );
+	}
+
+	if( nBufferAlloc - nBufferSize < MAPGIS_READ_BLOCK_SIZE / 2 )
+	{
+		nBufferAlloc = nBufferAlloc * 2;
+		pabyBuffer = (char *) CPLRealloc( pabyBuffer,
+			nBufferAlloc + 1 + MAPGIS_VERTEX_PADDING );
+	}
+
+	if( fp == NULL && !ReopenFile() )
+	{
+		bEOF = TRUE;
+		return FALSE;
+	}
+
+	MAPGIS_STAT_START( dfStart );
+	size_t nRead = VSIFReadL( pabyBuffer + nBufferSize, 1,
+		MIN( nReadSize, nBufferAlloc - nBufferSize ), fp );
+	MAPGIS_STAT_STOP( psStats, dfReadTime, dfStart );
+	MAPGIS_STAT_ADD( psStats, nBytesRead, nRead );
+	nReadSize = MIN( nReadSize * 2, MAPGIS_READ_BLOCK_SIZE );
+	if( nRead == 0 )
+	{
+		// Nothing more to read, the file is idle until the next seek.
+		bEOF = TRUE;
+		CloseFile();
+		return FALSE;
+	}
+
+	if( poFilePool != NULL )
+		poFilePool->Touch( this );
+
+	nBufferSize += nRead;
+	pabyBuffer[nBufferSize] = '\0';
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                              ReadLine()                              */
+/*                                                                      */
+/*      Return the next line, zero terminated and without its end of    */
+/*      line characters.  The returned pointer points into the read     */
+/*      buffer and is only valid until the next read or seek.  When     */
+/*      bHonourStrings is set, newlines inside double quotes do not     */
+/*      end the line.                                                   */
+/************************************************************************/
+
+const char *OGRMapGISReader::ReadLine( int *pnLength, int bHonourStrings )
+
+{
+	size_t nScan = nBufferPos;
+
+	while( TRUE )
+	{
+		char *pszEOL = (char *) memchr( pabyBuffer + nScan, '\n',
+			nBufferSize - nScan );
+
+		if( pszEOL != NULL && bHonourStrings )
+		{
+			// Keep going while the quotes seen so far are unbalanced.
+			int nQuotes = 0;
+			for( const char *pszIter = pabyBuffer + nBufferPos;
+				pszIter < pszEOL; pszIter++ )
+			{
+				if( *pszIter == '"' )
+					nQuotes++;
+			}
+			if( nQuotes % 2 == 1 )
+			{
+				nScan = pszEOL - pabyBuffer + 1;
+				if( nScan < nBufferSize )
+					continue;
+				pszEOL = NULL;
+			}
+		}
+
+		if( pszEOL != NULL )
+		{
+			size_t nLineStart = nBufferPos;
+			size_t nLineEnd = pszEOL - pabyBuffer;
+
+			nBufferPos = nLineEnd + 1;
+			if( nLineEnd > nLineStart && pabyBuffer[nLineEnd-1] == '\r' )
+				nLineEnd--;
+			TerminateLine( nLineEnd );
+
+			nLineOffset = nBufferOffset + nLineStart;
+			MAPGIS_STAT_ADD( psStats, nLines, 1 );
+			if( pnLength != NULL )
+				*pnLength = (int) (nLineEnd - nLineStart);
+			return pabyBuffer + nLineStart;
+		}
+
+		size_t nScanned = nScan - nBufferPos;
+		if( !FillBuffer() )
+			break;
+		nScan = nBufferPos + nScanned;
+	}
+
+/* -------------------------------------------------------------------- */
+/*      Last line of the file without a trailing newline.               */
+/* -------------------------------------------------------------------- */
+	if( nBufferPos >= nBufferSize )
+		return NULL;
+
+	size_t nLineStart = nBufferPos;
+	size_t nLineEnd = nBufferSize;
+
+	nBufferPos = nBufferSize;
+	if( nLineEnd > nLineStart && pabyBuffer[nLineEnd-1] == '\r' )
+		nLineEnd--;
+	TerminateLine( nLineEnd );
+
+	nLineOffset = nBufferOffset + nLineStart;
+	MAPGIS_STAT_ADD( psStats, nLines, 1 );
+	if( pnLength != NULL )
+		*pnLength = (int) (nLineEnd - nLineStart);
+	return pabyBuffer + nLineStart;
+}
+
+/************************************************************************/
+/*                           TerminateLine()                            */
+/*                                                                      */
+/*      Zero terminate a line in place, keeping the byte overwritten    */
+/*      so that Seek() can put it back.                                 */
+/************************************************************************/
+
+void OGRMapGISReader::TerminateLine( size_t nPos )
+
+{
+	anEOLOffset.push_back( nBufferOffset + nPos );
+	achEOL.push_back( pabyBuffer[nPos] );
+	pabyBuffer[nPos] = '\0';
+}
+
+/************************************************************************/
+/*                             ReadTokens()                             */
+/*                                                                      */
+/*      Read one line and split it on commas into token views.          */
+/*      Returns the number of tokens, or -1 at end of file.             */
+/************************************************************************/
+
+int OGRMapGISReader::ReadTokens( OGRMapGISToken *pasTokens, int nMaxTokens )
+
+{
+	int nLength = 0;
+	const char *pszLine = ReadLine( &nLength, TRUE );
+	if( pszLine == NULL )
+		return -1;
+
+	int nTokens = OGRMapGISSplitLine( pszLine, nLength, pasTokens, nMaxTokens );
+	MAPGIS_STAT_ADD( psStats, nTokens, nTokens );
+
+	return nTokens;
+}
+
+/************************************************************************/
+/*                             SkipLines()                              */
+/*                                                                      */
+/*      Skip nLines lines without splitting them.  Returns the number   */
+/*      of lines actually skipped.                                      */
+/************************************************************************/
+
+int OGRMapGISReader::SkipLines( int nLines )
+
+{
+	int i;
+
+	for( i = 0; i < nLines; i++ )
+	{
+		if( ReadLine() == NULL )
+			break;
+	}
+
+	return i;
+}
+
+/************************************************************************/
+/*                                Read()                                */
+/*                                                                      */
+/*      Copy the next nSize raw bytes into pabyDest.  Returns the       */
+/*      number of bytes copied.                                         */
+/************************************************************************/
+
+size_t OGRMapGISReader::Read( char *pabyDest, size_t nSize )
+
+{
+	size_t nDone = 0;
+
+	while( nDone < nSize )
+	{
+		if( nBufferPos >= nBufferSize && !FillBuffer() )
+			break;
+
+		size_t nChunk = MIN( nSize - nDone, nBufferSize - nBufferPos );
+		memcpy( pabyDest + nDone, pabyBuffer + nBufferPos, nChunk );
+		nBufferPos += nChunk;
+		nDone += nChunk;
+	}
+
+	return nDone;
+}
+
+/************************************************************************/
+/*                              SetMark()                               */
+/*                                                                      */
+/*      Keep everything from the current position on in the buffer      */
+/*      until ClearMark(), so a run of lines can be read and then       */
+/*      seeked back to without going to the file again.                 */
+/************************************************************************/
+
+void OGRMapGISReader::SetMark()
+
+{
+	bMarked = TRUE;
+	nMarkOffset = Tell();
+}
+
+/************************************************************************/
+/*                             ClearMark()                              */
+/************************************************************************/
+
+void OGRMapGISReader::ClearMark()
+
+{
+	bMarked = FALSE;
+}
+
+/************************************************************************/
+/*                            ReadVertices()                            */
+/*                                                                      */
+/*      Read a run of nCount "x,y" vertex lines into padfX/padfY.       */
+/*      Lines the fixed-point parser rejects go through the regular     */
+/*      tokenizer and CPLAtof().  Returns the number of vertices read.  */
+/************************************************************************/
+
+int OGRMapGISReader::ReadVertices( int nCount, double *padfX, double *padfY )
+
+{
+	for( int i = 0; i < nCount; i++ )
+	{
+		int nLength = 0;
+		const char *pszLine = ReadLine( &nLength );
+		if( pszLine == NULL )
+			return i;
+
+		if( OGRMapGISParseVertex( pszLine, padfX + i, padfY + i ) )
+			continue;
+
+		OGRMapGISToken asTokens[2];
+		if( OGRMapGISSplitLine( pszLine, nLength, asTokens, 2 ) < 2 )
+			return i;
+		padfX[i] = CPLAtof( asTokens[0].pszValue );
+		padfY[i] = CPLAtof( asTokens[1].pszValue );
+	}
+
+	MAPGIS_STAT_ADD( psStats, nVertices, nCount );
+
+	return nCount;
+}
+
+/************************************************************************/
+/*                                Tell()                                */
+/*                                                                      */
+/*      File offset of the next line to be read.                        */
+/************************************************************************/
+
+vsi_l_offset OGRMapGISReader::Tell()
+
+{
+	return nBufferOffset + nBufferPos;
+}
+
+/************************************************************************/
+/*                                Seek()                                */
+/*                                                                      */
+/*      Position the reader at nOffset.  Seeks that land inside the     */
+/*      current buffer are served without touching the file.            */
+/************************************************************************/
+
+int OGRMapGISReader::Seek( vsi_l_offset nOffset )
+
+{
+	if( nOffset >= nBufferOffset && nOffset <= nBufferOffset + nBufferSize )
+	{
+		size_t nNewPos = (size_t) (nOffset - nBufferOffset);
+
+		// ReadLine() terminated the lines already returned in place,
+		// put their end of line characters back before rereading them.
+		while( !anEOLOffset.empty() && anEOLOffset.back() >= nOffset )
+		{
+			pabyBuffer[anEOLOffset.back() - nBufferOffset] = achEOL.back();
+			anEOLOffset.pop_back();
+			achEOL.pop_back();
+		}
+
+		nBufferPos = nNewPos;
+		return TRUE;
+	}
+
+	if( (fp == NULL && !ReopenFile())
+		|| VSIFSeekL( fp, nOffset, SEEK_SET ) != 0 )
+		return FALSE;
+
+	nBufferOffset = nOffset;
+	nBufferSize = 0;
+	nBufferPos = 0;
+	nReadSize = MAPGIS_SEEK_READ_SIZE;
+	anEOLOffset.resize( 0 );
+	achEOL.resize( 0 );
+	bEOF = FALSE;
+	bMarked = FALSE;
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                          OGRMapGISGetTime()                          */
+/*                                                                      */
+/*      Wall clock seconds, for the read path timers.                   */
+/************************************************************************/
+
+double OGRMapGISGetTime()
+
+{
+#ifdef WIN32
+	LARGE_INTEGER nFrequency, nCounter;
+	QueryPerformanceFrequency( &nFrequency );
+	QueryPerformanceCounter( &nCounter );
+	return (double) nCounter.QuadPart / (double) nFrequency.QuadPart;
+#else
+	struct timeval sTime;
+	gettimeofday( &sTime, NULL );
+	return sTime.tv_sec + sTime.tv_usec * 1e-6;
+#endif
+}
+
+/************************************************************************/
+/*                         OGRMapGISAddStats()                          */
+/************************************************************************/
+
+void OGRMapGISAddStats( OGRMapGISStats *psTotal,
+						const OGRMapGISStats *psStats )
+
+{
+	psTotal->nBytesRead += psStats->nBytesRead;
+	psTotal->nLines += psStats->nLines;
+	psTotal->nTokens += psStats->nTokens;
+	psTotal->nVertices += psStats->nVertices;
+	psTotal->nArcLookups += psStats->nArcLookups;
+	psTotal->nFeatures += psStats->nFeatures;
+	psTotal->nFiltered += psStats->nFiltered;
+	psTotal->dfReadTime += psStats->dfReadTime;
+	psTotal->dfDecodeTime += psStats->dfDecodeTime;
+	psTotal->dfArcScanTime += psStats->dfArcScanTime;
+	psTotal->dfGeometryTime += psStats->dfGeometryTime;
+}
+
+/************************************************************************/
+/*                         OGRMapGISFilePool()                          */
+/*                                                                      */
+/*      MAPGIS_MAX_OPEN_FILES bounds the files kept open at once.       */
+/************************************************************************/
+
+OGRMapGISFilePool::OGRMapGISFilePool()
+
+{
+	nMaxOpen = MAX( 1, atoi( CPLGetConfigOption( "MAPGIS_MAX_OPEN_FILES",
+												 "100" ) ) );
+}
+
+/************************************************************************/
+/*                               Touch()                                */
+/*                                                                      */
+/*      Note that poReader has its file open and was just used,         */
+/*      closing the least recently used files beyond the limit.         */
+/************************************************************************/
+
+void OGRMapGISFilePool::Touch( OGRMapGISReader *poReader )
+
+{
+	if( !apoOpen.empty() && apoOpen.front() == poReader )
+		return;
+
+	apoOpen.remove( poReader );
+	apoOpen.push_front( poReader );
+
+	while( (int) apoOpen.size() > nMaxOpen )
+	{
+		OGRMapGISReader *poIdle = apoOpen.back();
+		apoOpen.pop_back();
+		poIdle->CloseFile();
+	}
+}
+
+/************************************************************************/
+/*                               Remove()                               */
+/************************************************************************/
+
+void OGRMapGISFilePool::Remove( OGRMapGISReader *poReader )
+
+{
+	apoOpen.remove( poReader );
+}
+
+/************************************************************************/
+/*                         OGRMapGISSplitLine()                         */
+/*                                                                      */
+/*      Split a line on commas into (pointer, length) views of the      */
+/*      line itself; nothing is copied.  Surrounding double quotes are  */
+/*      excluded from the view, doubled quotes inside a quoted token    */
+/*      are left as is (see OGRMapGISTokenToString()).  At most         */
+/*      nMaxTokens are returned, extra columns are ignored.             */
+/************************************************************************/
+
+int OGRMapGISSplitLine( const char *pszLine, int nLength,
+						OGRMapGISToken *pasTokens, int nMaxTokens )
+
+{
+	const char *pszIter = pszLine;
+	const char *pszEnd = pszLine + nLength;
+	int nTokens = 0;
+
+	if( nLength == 0 )
+		return 0;
+
+	while( nTokens < nMaxTokens )
+	{
+		OGRMapGISToken *psToken = pasTokens + nTokens;
+
+		if( pszIter < pszEnd && *pszIter == '"' )
+		{
+			const char *pszStart = ++pszIter;
+
+			while( pszIter < pszEnd )
+			{
+				if( *pszIter == '"' )
+				{
+					if( pszIter + 1 < pszEnd && pszIter[1] == '"' )
+					{
+						pszIter += 2;
+						continue;
+					}
+					break;
+				}
+				pszIter++;
+			}
+
+			psToken->pszValue = pszStart;
+			psToken->nLength = (int) (pszIter - pszStart);
+
+			// Skip the closing quote and anything up to the delimiter.
+			while( pszIter < pszEnd && *pszIter != ',' )
+				pszIter++;
+		}
+		else
+		{
+			const char *pszComma = (const char *)
+				memchr( pszIter, ',', pszEnd - pszIter );
+			if( pszComma == NULL )
+				pszComma = pszEnd;
+
+			psToken->pszValue = pszIter;
+			psToken->nLength = (int) (pszComma - pszIter);
+			pszIter = pszComma;
+		}
+
+		nTokens++;
+
+		if( pszIter >= pszEnd )
+			break;
+
+		pszIter++; // the comma
+	}
+
+	return nTokens;
+}
+
+/************************************************************************/
+/*                       OGRMapGISTokenToString()                       */
+/*                                                                      */
+/*      Materialize a token view, resolving doubled quotes.             */
+/************************************************************************/
+
+CPLString OGRMapGISTokenToString( const OGRMapGISToken *psToken )
+
+{
+	CPLString osValue;
+
+	osValue.reserve( psToken->nLength );
+	for( int i = 0; i < psToken->nLength; i++ )
+	{
+		char ch = psToken->pszValue[i];
+		if( ch == '"' && i + 1 < psToken->nLength
+			&& psToken->pszValue[i+1] == '"' )
+			i++;
+		osValue += ch;
+	}
+
+	return osValue;
+}
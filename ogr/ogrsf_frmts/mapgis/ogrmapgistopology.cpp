@@ -0,0 +1,343 @@
+/******************************************************************************
+ * $Id: ogrmapgistopology.cpp 30010 2012-02-27 10:05:32Z fuxin $
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Implements OGRMapGISTopologyBuilder, the arc/node topology of
+ *           polygons written to a WAP file.
+ * Author:   ZhouShun, shunzhou@foxmail.com
+ *
+ ******************************************************************************
+ * Copyright (c) 1999,  Les Technologies SoftMap Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "ogr_mapgis.h"
+#include "cpl_conv.h"
+
+CPL_CVSID("$Id: ogrmapgistopology.cpp 30010 2012-02-27 10:05:32Z fuxin $");
+
+/************************************************************************/
+/*                              Rehash()                                */
+/************************************************************************/
+
+void OGRMapGISKeyIndex::Rehash( size_t nSlots )
+
+{
+	anSlots.assign( nSlots, -1 );
+
+	for( int iKey = 0; iKey < (int) anKeyA.size(); iKey++ )
+	{
+		GUIntBig nHash = (GUIntBig) anKeyA[iKey] * 0x9E3779B1U
+			+ (GUIntBig) anKeyB[iKey] * 0x85EBCA77U;
+		size_t iSlot = (size_t) (nHash ^ (nHash >> 31)) & (nSlots - 1);
+
+		while( anSlots[iSlot] >= 0 )
+			iSlot = (iSlot + 1) & (nSlots - 1);
+		anSlots[iSlot] = iKey;
+	}
+}
+
+/************************************************************************/
+/*                               Insert()                               */
+/*                                                                      */
+/*      Return the id of the key pair, adding it if it is new.          */
+/************************************************************************/
+
+int OGRMapGISKeyIndex::Insert( GIntBig nKeyA, GIntBig nKeyB, int *pbNew )
+
+{
+	if( (anKeyA.size() + 1) * 2 > anSlots.size() )
+		Rehash( MAX( (size_t) 1024, anSlots.size() * 2 ) );
+
+	size_t nMask = anSlots.size() - 1;
+	GUIntBig nHash = (GUIntBig) nKeyA * 0x9E3779B1U
+		+ (GUIntBig) nKeyB * 0x85EBCA77U;
+	size_t iSlot = (size_t) (nHash ^ (nHash >> 31)) & nMask;
+
+	while( anSlots[iSlot] >= 0 )
+	{
+		int iKey = anSlots[iSlot];
+		if( anKeyA[iKey] == nKeyA && anKeyB[iKey] == nKeyB )
+		{
+			*pbNew = FALSE;
+			return iKey;
+		}
+		iSlot = (iSlot + 1) & nMask;
+	}
+
+	anSlots[iSlot] = (int) anKeyA.size();
+	anKeyA.push_back( nKeyA );
+	anKeyB.push_back( nKeyB );
+	*pbNew = TRUE;
+
+	return anSlots[iSlot];
+}
+
+/************************************************************************/
+/*                      OGRMapGISTopologyBuilder()                      */
+/************************************************************************/
+
+OGRMapGISTopologyBuilder::OGRMapGISTopologyBuilder()
+
+{
+	anRingStart.push_back( 0 );
+	anRingVertexStart.push_back( 0 );
+	anRingArcStart.push_back( 0 );
+	anArcStart.push_back( 0 );
+}
+
+/************************************************************************/
+/*                              AddRing()                               */
+/*                                                                      */
+/*      bInsideLeft tells on which side of the ring, walking it in the  */
+/*      given order, polygon nPolygon lies.                             */
+/************************************************************************/
+
+void OGRMapGISTopologyBuilder::AddRing( int nPolygon, int bInsideLeft,
+										int nCount, const double *padfX,
+										const double *padfY )
+
+{
+	adfX.insert( adfX.end(), padfX, padfX + nCount );
+	adfY.insert( adfY.end(), padfY, padfY + nCount );
+	anRingStart.push_back( (int) adfX.size() );
+	anRingPolygon.push_back( nPolygon );
+	abRingInsideLeft.push_back( bInsideLeft );
+}
+
+/************************************************************************/
+/*                              FindEdge()                              */
+/************************************************************************/
+
+int OGRMapGISTopologyBuilder::FindEdge( int iVertexA, int iVertexB,
+										int *pbNew )
+
+{
+	int iEdge = oEdgeIndex.Insert( MIN( iVertexA, iVertexB ),
+								   MAX( iVertexA, iVertexB ), pbNew );
+
+	if( *pbNew )
+	{
+		Edge sEdge;
+
+		sEdge.nFrom = iVertexA;
+		sEdge.nLeft = 0;
+		sEdge.nRight = 0;
+		sEdge.nArc = 0;
+		asEdges.push_back( sEdge );
+	}
+
+	return iEdge;
+}
+
+/************************************************************************/
+/*                              GetNode()                               */
+/************************************************************************/
+
+int OGRMapGISTopologyBuilder::GetNode( int iVertex )
+
+{
+	if( anVertexNode[iVertex] == 0 )
+	{
+		adfNodeX.push_back( adfX[anVertexSource[iVertex]] );
+		adfNodeY.push_back( adfY[anVertexSource[iVertex]] );
+		aanNodeArcs.push_back( std::vector<int>() );
+		anVertexNode[iVertex] = (int) adfNodeX.size();
+	}
+
+	return anVertexNode[iVertex];
+}
+
+/************************************************************************/
+/*                               AddArc()                               */
+/*                                                                      */
+/*      Create the arc running along the vertex chain anChain, which    */
+/*      starts and ends on a node, and return its id.                   */
+/************************************************************************/
+
+int OGRMapGISTopologyBuilder::AddArc( const std::vector<int> &anChain )
+
+{
+	int nArc = GetArcCount() + 1;
+	int bNew = FALSE;
+	int nCount = (int) anChain.size();
+
+	for( int i = 0; i + 1 < nCount; i++ )
+		asEdges[FindEdge( anChain[i], anChain[i+1], &bNew )].nArc = nArc;
+
+	const Edge &sFirst = asEdges[FindEdge( anChain[0], anChain[1], &bNew )];
+	int bSameDir = sFirst.nFrom == anChain[0];
+
+	anArcFrom.push_back( GetNode( anChain[0] ) );
+	anArcTo.push_back( GetNode( anChain[nCount-1] ) );
+	anArcLeft.push_back( bSameDir ? sFirst.nLeft : sFirst.nRight );
+	anArcRight.push_back( bSameDir ? sFirst.nRight : sFirst.nLeft );
+
+	for( int i = 0; i < nCount; i++ )
+	{
+		adfArcX.push_back( adfX[anVertexSource[anChain[i]]] );
+		adfArcY.push_back( adfY[anVertexSource[anChain[i]]] );
+	}
+	anArcStart.push_back( (int) adfArcX.size() );
+
+	aanNodeArcs[anArcFrom.back()-1].push_back( nArc );
+	aanNodeArcs[anArcTo.back()-1].push_back( -nArc );
+
+	return nArc;
+}
+
+/************************************************************************/
+/*                               Build()                                */
+/************************************************************************/
+
+void OGRMapGISTopologyBuilder::Build()
+
+{
+	int nRings = GetRingCount();
+	int bNew = FALSE;
+
+/* -------------------------------------------------------------------- */
+/*      Number the distinct vertices of every ring, dropping repeated   */
+/*      vertices and the closing one.  Rings left with less than three  */
+/*      vertices have no area and are dropped.                          */
+/* -------------------------------------------------------------------- */
+	for( int iRing = 0; iRing < nRings; iRing++ )
+	{
+		size_t nRingStart = anRingVertex.size();
+
+		for( int i = anRingStart[iRing]; i < anRingStart[iRing+1]; i++ )
+		{
+			int iVertex = oVertexIndex.Insert(
+				(GIntBig) floor( adfX[i] * 1e6 + 0.5 ),
+				(GIntBig) floor( adfY[i] * 1e6 + 0.5 ), &bNew );
+
+			if( bNew )
+			{
+				anVertexSource.push_back( i );
+				anVertexDegree.push_back( 0 );
+				anVertexNode.push_back( 0 );
+			}
+
+			if( anRingVertex.size() == nRingStart
+				|| anRingVertex.back() != iVertex )
+				anRingVertex.push_back( iVertex );
+		}
+
+		while( anRingVertex.size() > nRingStart + 1
+			   && anRingVertex.back() == anRingVertex[nRingStart] )
+			anRingVertex.pop_back();
+
+		if( anRingVertex.size() < nRingStart + 3 )
+			anRingVertex.resize( nRingStart );
+
+		anRingVertexStart.push_back( (int) anRingVertex.size() );
+	}
+
+/* -------------------------------------------------------------------- */
+/*      Collect the edges with the polygons on either side, seen in     */
+/*      the direction they were first walked.                           */
+/* -------------------------------------------------------------------- */
+	for( int iRing = 0; iRing < nRings; iRing++ )
+	{
+		const int *panVertex = anRingVertex.empty() ? NULL
+			: &anRingVertex[0] + anRingVertexStart[iRing];
+		int nCount = anRingVertexStart[iRing+1] - anRingVertexStart[iRing];
+
+		for( int i = 0; i < nCount; i++ )
+		{
+			int iA = panVertex[i];
+			int iB = panVertex[(i + 1) % nCount];
+			int iEdge = FindEdge( iA, iB, &bNew );
+
+			if( bNew )
+			{
+				anVertexDegree[iA]++;
+				anVertexDegree[iB]++;
+			}
+
+			Edge &sEdge = asEdges[iEdge];
+			if( (sEdge.nFrom == iA) == (abRingInsideLeft[iRing] != 0) )
+				sEdge.nLeft = anRingPolygon[iRing];
+			else
+				sEdge.nRight = anRingPolygon[iRing];
+		}
+	}
+
+/* -------------------------------------------------------------------- */
+/*      Walk every ring from node to node.  The first ring to walk a    */
+/*      chain creates its arc, later ones refer to it, negated when     */
+/*      walking it backwards.                                           */
+/* -------------------------------------------------------------------- */
+	std::vector<int> anChain;
+
+	for( int iRing = 0; iRing < nRings; iRing++ )
+	{
+		const int *panVertex = anRingVertex.empty() ? NULL
+			: &anRingVertex[0] + anRingVertexStart[iRing];
+		int nCount = anRingVertexStart[iRing+1] - anRingVertexStart[iRing];
+
+		if( nCount == 0 )
+		{
+			anRingArcStart.push_back( (int) anRingArcs.size() );
+			continue;
+		}
+
+		int iStart = 0;
+		while( iStart < nCount && !IsNode( panVertex[iStart] ) )
+			iStart++;
+		if( iStart == nCount )
+		{
+			// A ring touching nothing else gets a node of its own.
+			iStart = 0;
+			GetNode( panVertex[0] );
+		}
+
+		anChain.resize( 0 );
+		anChain.push_back( panVertex[iStart] );
+
+		for( int i = 1; i <= nCount; i++ )
+		{
+			int iVertex = panVertex[(iStart + i) % nCount];
+
+			anChain.push_back( iVertex );
+			if( !IsNode( iVertex ) )
+				continue;
+
+			const Edge &sEdge =
+				asEdges[FindEdge( anChain[0], anChain[1], &bNew )];
+			int nArc = sEdge.nArc;
+
+			if( nArc == 0 )
+				nArc = AddArc( anChain );
+
+			// Edges keep the direction of the arc they belong to.
+			anRingArcs.push_back( sEdge.nFrom == anChain[0] ? nArc : -nArc );
+
+			anChain.resize( 0 );
+			anChain.push_back( iVertex );
+		}
+
+		anRingArcs.push_back( 0 );
+		anRingArcStart.push_back( (int) anRingArcs.size() );
+	}
+
+	CPLDebug( "MapGIS", "Built %d arcs and %d nodes from %d rings.",
+			  GetArcCount(), (int) adfNodeX.size(), nRings );
+}
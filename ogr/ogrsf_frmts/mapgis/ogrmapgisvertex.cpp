@@ -0,0 +1,551 @@
+/******************************************************************************
+ * $Id: ogrmapgisvertex.cpp 30006 2012-02-21 10:04:52Z fuxin $
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Fixed-point parsing of "x,y" vertex lines, with SSE4.1 and
+ *           AVX2 kernels selected at runtime, and vertex run extents.
+ * Author:   ZhouShun, shunzhou@foxmail.com
+ *
+ ******************************************************************************
+ * Copyright (c) 1999,  Les Technologies SoftMap Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+ * MapGIS writes every vertex as "%.6f,%.6f".  Such a number is parsed here
+ * as an integer mantissa and a count of fraction digits.  As long as the
+ * mantissa has at most 15 digits both it and the power of ten are exact
+ * doubles, so the single division below is correctly rounded and gives
+ * the very same double as strtod().  Anything else (exponents, a sign
+ * other than a leading '-', a missing fraction, blanks, long mantissas)
+ * is rejected and left to the CPLAtof() based slow path.
+ */
+
+#include "ogr_mapgis.h"
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+
+CPL_CVSID("$Id: ogrmapgisvertex.cpp 30006 2012-02-21 10:04:52Z fuxin $");
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define MAPGIS_HAVE_SSE41
+#  define MAPGIS_TARGET_SSE41 __attribute__((target("sse4.1")))
+#  if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__)
+#    define MAPGIS_HAVE_AVX2
+#    define MAPGIS_TARGET_AVX2 __attribute__((target("avx2")))
+#  endif
+#  include <cpuid.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  define MAPGIS_HAVE_SSE41
+#  define MAPGIS_TARGET_SSE41
+#  if _MSC_VER >= 1700
+#    define MAPGIS_HAVE_AVX2
+#    define MAPGIS_TARGET_AVX2
+#  endif
+#  include <intrin.h>
+#endif
+
+#ifdef MAPGIS_HAVE_SSE41
+#  include <smmintrin.h>
+#endif
+#ifdef MAPGIS_HAVE_AVX2
+#  include <immintrin.h>
+#endif
+
+/* SSE2 is part of every x86-64 target, so needs no runtime check. */
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define MAPGIS_HAVE_SSE2
+#  include <emmintrin.h>
+#endif
+
+#define MAPGIS_MAX_DIGITS   15
+
+static const double adfPow10[MAPGIS_MAX_DIGITS + 1] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+	1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+typedef int (*OGRMapGISVertexFunc)( const char *, double *, double * );
+
+/************************************************************************/
+/*                          ParseFixedScalar()                          */
+/*                                                                      */
+/*      Parse "[-]ddd.ddd" at pszIter.  Returns the position after the  */
+/*      number, or NULL when it is not in that form.                    */
+/************************************************************************/
+
+static const char *ParseFixedScalar( const char *pszIter, double *pdfValue )
+
+{
+	int bNegative = FALSE;
+	if( *pszIter == '-' )
+	{
+		bNegative = TRUE;
+		pszIter++;
+	}
+
+	GUIntBig nMantissa = 0;
+	int nDigits = 0;
+	while( (unsigned char)(*pszIter - '0') <= 9 )
+	{
+		nMantissa = nMantissa * 10 + (*pszIter - '0');
+		pszIter++;
+		nDigits++;
+	}
+	if( nDigits == 0 || *pszIter != '.' )
+		return NULL;
+	pszIter++;
+
+	int nFracDigits = 0;
+	while( (unsigned char)(*pszIter - '0') <= 9 )
+	{
+		nMantissa = nMantissa * 10 + (*pszIter - '0');
+		pszIter++;
+		nFracDigits++;
+	}
+	if( nFracDigits == 0 || nDigits + nFracDigits > MAPGIS_MAX_DIGITS )
+		return NULL;
+
+	double dfValue = (double) (GIntBig) nMantissa / adfPow10[nFracDigits];
+	*pdfValue = bNegative ? -dfValue : dfValue;
+
+	return pszIter;
+}
+
+/************************************************************************/
+/*                          ParseVertexScalar()                         */
+/************************************************************************/
+
+static int ParseVertexScalar( const char *pszLine, double *pdfX, double *pdfY )
+
+{
+	const char *pszIter = ParseFixedScalar( pszLine, pdfX );
+	if( pszIter == NULL || *pszIter != ',' )
+		return FALSE;
+
+	pszIter = ParseFixedScalar( pszIter + 1, pdfY );
+	return pszIter != NULL && *pszIter == '\0';
+}
+
+#ifdef MAPGIS_HAVE_SSE41
+
+/* -------------------------------------------------------------------- */
+/*      Shuffle masks that drop the decimal point and right align up    */
+/*      to 15 digits in a 16 byte register, indexed by the number of    */
+/*      integer and fraction digits.                                    */
+/* -------------------------------------------------------------------- */
+static GByte abyShuffle[MAPGIS_MAX_DIGITS + 1][MAPGIS_MAX_DIGITS + 1][16];
+
+static void InitShuffleTable()
+
+{
+	for( int nInt = 0; nInt <= MAPGIS_MAX_DIGITS; nInt++ )
+	{
+		for( int nFrac = 0; nFrac <= MAPGIS_MAX_DIGITS; nFrac++ )
+		{
+			GByte *pabyMask = abyShuffle[nInt][nFrac];
+			int nTotal = nInt + nFrac;
+
+			for( int iLane = 0; iLane < 16; iLane++ )
+			{
+				int iDigit = iLane - (16 - nTotal);
+				if( nTotal > MAPGIS_MAX_DIGITS || iDigit < 0 )
+					pabyMask[iLane] = 0x80;
+				else if( iDigit < nInt )
+					pabyMask[iLane] = (GByte) iDigit;
+				else
+					pabyMask[iLane] = (GByte) (iDigit + 1);
+			}
+		}
+	}
+}
+
+static int CountTrailingZeros( unsigned int nMask )
+
+{
+#if defined(__GNUC__)
+	return __builtin_ctz( nMask );
+#else
+	unsigned long nIndex;
+	_BitScanForward( &nIndex, nMask );
+	return (int) nIndex;
+#endif
+}
+
+/************************************************************************/
+/*                           ScanFixedSSE41()                           */
+/*                                                                      */
+/*      Locate the digits of "ddd.ddd" at pszIter with one 16 byte      */
+/*      load, and return the digits right aligned in *pvDigits.         */
+/************************************************************************/
+
+static MAPGIS_TARGET_SSE41
+int ScanFixedSSE41( const char *pszIter, __m128i *pvDigits,
+					int *pnInt, int *pnFrac )
+
+{
+	const __m128i vChars = _mm_loadu_si128( (const __m128i *) pszIter );
+	const __m128i vValues = _mm_sub_epi8( vChars, _mm_set1_epi8( '0' ) );
+	const __m128i vIsDigit = _mm_cmpeq_epi8(
+		_mm_min_epu8( vValues, _mm_set1_epi8( 9 ) ), vValues );
+	const unsigned int nNonDigit =
+		~(unsigned int) _mm_movemask_epi8( vIsDigit ) | 0x10000;
+
+	int nInt = CountTrailingZeros( nNonDigit );
+	if( nInt == 0 || nInt > MAPGIS_MAX_DIGITS - 1 || pszIter[nInt] != '.' )
+		return FALSE;
+
+	int nFrac = CountTrailingZeros( nNonDigit >> (nInt + 1) );
+	if( nFrac == 0 || nInt + nFrac > MAPGIS_MAX_DIGITS )
+		return FALSE;
+
+	*pvDigits = _mm_shuffle_epi8( vValues,
+		_mm_loadu_si128( (const __m128i *) abyShuffle[nInt][nFrac] ) );
+	*pnInt = nInt;
+	*pnFrac = nFrac;
+
+	return TRUE;
+}
+
+/************************************************************************/
+/*                          ParseVertexSSE41()                          */
+/************************************************************************/
+
+static MAPGIS_TARGET_SSE41
+int ParseVertexSSE41( const char *pszLine, double *pdfX, double *pdfY )
+
+{
+	const char *pszIter = pszLine;
+	__m128i avDigits[2];
+	int anFrac[2];
+	int anNegative[2];
+
+	for( int i = 0; i < 2; i++ )
+	{
+		int nInt;
+
+		anNegative[i] = ( *pszIter == '-' );
+		pszIter += anNegative[i];
+		if( !ScanFixedSSE41( pszIter, avDigits + i, &nInt, anFrac + i ) )
+			return FALSE;
+		pszIter += nInt + 1 + anFrac[i];
+		if( *pszIter != ( i == 0 ? ',' : '\0' ) )
+			return FALSE;
+		pszIter++;
+	}
+
+/* -------------------------------------------------------------------- */
+/*      Fold pairs of digits, then groups of four, then of eight.       */
+/* -------------------------------------------------------------------- */
+	const __m128i vMul10 = _mm_set_epi8( 1, 10, 1, 10, 1, 10, 1, 10,
+										 1, 10, 1, 10, 1, 10, 1, 10 );
+	const __m128i vMul100 = _mm_set_epi16( 1, 100, 1, 100, 1, 100, 1, 100 );
+	const __m128i vMul10000 = _mm_set_epi16( 1, 10000, 1, 10000,
+											 1, 10000, 1, 10000 );
+
+	__m128i vX = _mm_madd_epi16(
+		_mm_maddubs_epi16( avDigits[0], vMul10 ), vMul100 );
+	__m128i vY = _mm_madd_epi16(
+		_mm_maddubs_epi16( avDigits[1], vMul10 ), vMul100 );
+	__m128i vXY = _mm_madd_epi16( _mm_packus_epi32( vX, vY ), vMul10000 );
+
+	GUInt32 anGroups[4];
+	_mm_storeu_si128( (__m128i *) anGroups, vXY );
+
+	double dfX = (double) (GIntBig) ((GUIntBig) anGroups[0] * 100000000
+									 + anGroups[1]) / adfPow10[anFrac[0]];
+	double dfY = (double) (GIntBig) ((GUIntBig) anGroups[2] * 100000000
+									 + anGroups[3]) / adfPow10[anFrac[1]];
+
+	*pdfX = anNegative[0] ? -dfX : dfX;
+	*pdfY = anNegative[1] ? -dfY : dfY;
+
+	return TRUE;
+}
+
+#endif /* def MAPGIS_HAVE_SSE41 */
+
+#ifdef MAPGIS_HAVE_AVX2
+
+/************************************************************************/
+/*                          ParseVertexAVX2()                           */
+/*                                                                      */
+/*      Same as the SSE4.1 kernel, but x and y are folded together in   */
+/*      the two 128 bit lanes of one register.                          */
+/************************************************************************/
+
+static MAPGIS_TARGET_AVX2
+int ParseVertexAVX2( const char *pszLine, double *pdfX, double *pdfY )
+
+{
+	const char *pszIter = pszLine;
+	__m128i avDigits[2];
+	int anFrac[2];
+	int anNegative[2];
+
+	for( int i = 0; i < 2; i++ )
+	{
+		int nInt;
+
+		anNegative[i] = ( *pszIter == '-' );
+		pszIter += anNegative[i];
+		if( !ScanFixedSSE41( pszIter, avDigits + i, &nInt, anFrac + i ) )
+			return FALSE;
+		pszIter += nInt + 1 + anFrac[i];
+		if( *pszIter != ( i == 0 ? ',' : '\0' ) )
+			return FALSE;
+		pszIter++;
+	}
+
+	__m256i vDigits = _mm256_inserti128_si256(
+		_mm256_castsi128_si256( avDigits[0] ), avDigits[1], 1 );
+
+	vDigits = _mm256_maddubs_epi16( vDigits, _mm256_set_epi8(
+		1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10,
+		1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10 ) );
+	vDigits = _mm256_madd_epi16( vDigits, _mm256_set_epi16(
+		1, 100, 1, 100, 1, 100, 1, 100, 1, 100, 1, 100, 1, 100, 1, 100 ) );
+	vDigits = _mm256_packus_epi32( vDigits, vDigits );
+	vDigits = _mm256_madd_epi16( vDigits, _mm256_set_epi16(
+		1, 10000, 1, 10000, 1, 10000, 1, 10000,
+		1, 10000, 1, 10000, 1, 10000, 1, 10000 ) );
+
+	GUInt32 anGroups[8];
+	_mm256_storeu_si256( (__m256i *) anGroups, vDigits );
+
+	double dfX = (double) (GIntBig) ((GUIntBig) anGroups[0] * 100000000
+									 + anGroups[1]) / adfPow10[anFrac[0]];
+	double dfY = (double) (GIntBig) ((GUIntBig) anGroups[4] * 100000000
+									 + anGroups[5]) / adfPow10[anFrac[1]];
+
+	*pdfX = anNegative[0] ? -dfX : dfX;
+	*pdfY = anNegative[1] ? -dfY : dfY;
+
+	return TRUE;
+}
+
+#endif /* def MAPGIS_HAVE_AVX2 */
+
+/************************************************************************/
+/*                           SelectKernel()                             */
+/************************************************************************/
+
+static OGRMapGISVertexFunc SelectKernel()
+
+{
+	const char *pszSIMD = CPLGetConfigOption( "MAPGIS_SIMD", "YES" );
+	if( !CSLTestBoolean( pszSIMD ) )
+		return ParseVertexScalar;
+
+#if defined(MAPGIS_HAVE_SSE41)
+	int bSSE41 = FALSE, bAVX2 = FALSE;
+#  if defined(__GNUC__)
+	unsigned int nEAX, nEBX, nECX, nEDX;
+	if( __get_cpuid( 1, &nEAX, &nEBX, &nECX, &nEDX ) )
+	{
+		bSSE41 = ( nECX & (1 << 19) ) != 0;
+		int bOSXSAVE = ( nECX & (1 << 27) ) != 0;
+		if( bOSXSAVE && __get_cpuid_max( 0, NULL ) >= 7 )
+		{
+			unsigned int nXCR0Lo, nXCR0Hi;
+			__asm__( "xgetbv" : "=a" (nXCR0Lo), "=d" (nXCR0Hi) : "c" (0) );
+			__cpuid_count( 7, 0, nEAX, nEBX, nECX, nEDX );
+			bAVX2 = ( nEBX & (1 << 5) ) != 0 && ( nXCR0Lo & 6 ) == 6;
+		}
+	}
+#  else
+	int anRegs[4];
+	__cpuid( anRegs, 1 );
+	bSSE41 = ( anRegs[2] & (1 << 19) ) != 0;
+#    if _MSC_VER >= 1700
+	int bOSXSAVE = ( anRegs[2] & (1 << 27) ) != 0;
+	__cpuid( anRegs, 0 );
+	if( bOSXSAVE && anRegs[0] >= 7 )
+	{
+		__cpuidex( anRegs, 7, 0 );
+		bAVX2 = ( anRegs[1] & (1 << 5) ) != 0
+			&& ( _xgetbv( 0 ) & 6 ) == 6;
+	}
+#    endif
+#  endif
+
+	if( bSSE41 )
+		InitShuffleTable();
+
+#  if defined(MAPGIS_HAVE_AVX2)
+	if( bAVX2 && !EQUAL(pszSIMD, "SSE4") )
+	{
+		CPLDebug( "MapGIS", "Using AVX2 vertex parser." );
+		return ParseVertexAVX2;
+	}
+#  endif
+	if( bSSE41 )
+	{
+		CPLDebug( "MapGIS", "Using SSE4.1 vertex parser." );
+		return ParseVertexSSE41;
+	}
+#endif
+
+	return ParseVertexScalar;
+}
+
+/************************************************************************/
+/*                        OGRMapGISParseVertex()                        */
+/*                                                                      */
+/*      Parse a zero terminated "x,y" line on the fast path.  The line  */
+/*      must be readable for MAPGIS_VERTEX_PADDING bytes past its end.  */
+/*      Returns FALSE, leaving the outputs undefined, for anything the  */
+/*      fast path does not handle exactly.                              */
+/************************************************************************/
+
+static OGRMapGISVertexFunc pfnKernel = NULL;
+
+int OGRMapGISParseVertex( const char *pszLine, double *pdfX, double *pdfY )
+
+{
+	if( pfnKernel == NULL )
+		OGRMapGISInitVertexParser();
+
+	return pfnKernel( pszLine, pdfX, pdfY );
+}
+
+/************************************************************************/
+/*                     OGRMapGISInitVertexParser()                      */
+/*                                                                      */
+/*      Pick the vertex parser and build its tables, once.  Called      */
+/*      when the driver is registered, before any thread can parse.     */
+/************************************************************************/
+
+void OGRMapGISInitVertexParser()
+
+{
+	static void *hMutex = NULL;
+
+	CPLCreateOrAcquireMutex( &hMutex, 1000.0 );
+	if( pfnKernel == NULL )
+		pfnKernel = SelectKernel();
+	CPLReleaseMutex( hMutex );
+}
+
+/************************************************************************/
+/*                        OGRMapGISParseNumber()                        */
+/*                                                                      */
+/*      Parse a single number token, on the fast path when possible.    */
+/************************************************************************/
+
+double OGRMapGISParseNumber( const char *pszValue )
+
+{
+	double dfValue;
+	const char *pszEnd = ParseFixedScalar( pszValue, &dfValue );
+
+	if( pszEnd != NULL && ( *pszEnd == ',' || *pszEnd == '\0' ) )
+		return dfValue;
+
+	return CPLAtof( pszValue );
+}
+
+/************************************************************************/
+/*                       OGRMapGISParseInteger()                        */
+/*                                                                      */
+/*      Parse a single integer token, on the fast path when possible.   */
+/************************************************************************/
+
+int OGRMapGISParseInteger( const char *pszValue )
+
+{
+	const char *pszIter = pszValue;
+	int bNegative = FALSE;
+	int nValue = 0;
+
+	if( *pszIter == '-' )
+	{
+		bNegative = TRUE;
+		pszIter++;
+	}
+
+	const char *pszDigits = pszIter;
+	while( *pszIter >= '0' && *pszIter <= '9' && pszIter - pszDigits < 9 )
+		nValue = nValue * 10 + (*pszIter++ - '0');
+
+	if( pszIter != pszDigits && ( *pszIter == ',' || *pszIter == '\0' ) )
+		return bNegative ? -nValue : nValue;
+
+	return atoi( pszValue );
+}
+
+/************************************************************************/
+/*                         OGRMapGISGetExtent()                         */
+/*                                                                      */
+/*      Set psExtent to the bounds of nCount (at least one) vertices,   */
+/*      two at a time with SSE2 where available.                        */
+/************************************************************************/
+
+void OGRMapGISGetExtent( int nCount, const double *padfX,
+						 const double *padfY, OGREnvelope *psExtent )
+
+{
+	int i = 0;
+	double dfMinX = padfX[0], dfMaxX = padfX[0];
+	double dfMinY = padfY[0], dfMaxY = padfY[0];
+
+#ifdef MAPGIS_HAVE_SSE2
+	if( nCount >= 4 )
+	{
+		__m128d vMinX = _mm_loadu_pd( padfX ), vMaxX = vMinX;
+		__m128d vMinY = _mm_loadu_pd( padfY ), vMaxY = vMinY;
+
+		for( i = 2; i + 2 <= nCount; i += 2 )
+		{
+			__m128d vX = _mm_loadu_pd( padfX + i );
+			__m128d vY = _mm_loadu_pd( padfY + i );
+			vMinX = _mm_min_pd( vMinX, vX );
+			vMaxX = _mm_max_pd( vMaxX, vX );
+			vMinY = _mm_min_pd( vMinY, vY );
+			vMaxY = _mm_max_pd( vMaxY, vY );
+		}
+
+		double adfLanes[2];
+		_mm_storeu_pd( adfLanes, vMinX );
+		dfMinX = MIN( adfLanes[0], adfLanes[1] );
+		_mm_storeu_pd( adfLanes, vMaxX );
+		dfMaxX = MAX( adfLanes[0], adfLanes[1] );
+		_mm_storeu_pd( adfLanes, vMinY );
+		dfMinY = MIN( adfLanes[0], adfLanes[1] );
+		_mm_storeu_pd( adfLanes, vMaxY );
+		dfMaxY = MAX( adfLanes[0], adfLanes[1] );
+	}
+#endif
+
+	for( ; i < nCount; i++ )
+	{
+		dfMinX = MIN( dfMinX, padfX[i] );
+		dfMaxX = MAX( dfMaxX, padfX[i] );
+		dfMinY = MIN( dfMinY, padfY[i] );
+		dfMaxY = MAX( dfMaxY, padfY[i] );
+	}
+
+	psExtent->MinX = dfMinX;
+	psExtent->MaxX = dfMaxX;
+	psExtent->MinY = dfMinY;
+	psExtent->MaxY = dfMaxY;
+}
@@ -0,0 +1,511 @@
+/******************************************************************************
+ * $Id: ogrmapgisworkers.cpp 30008 2012-02-23 10:21:37Z fuxin $
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Implements OGRMapGISWorkerPool, a small pool of threads that
+ *           decodes batches of MapGIS records in the background.
+ * Author:   ZhouShun, shunzhou@foxmail.com
+ *
+ ******************************************************************************
+ * Copyright (c) 1999,  Les Technologies SoftMap Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "ogr_mapgis.h"
+#include "cpl_conv.h"
+#include "cpl_multiproc.h"
+
+#ifdef WIN32
+#  include <windows.h>
+#else
+#  include <unistd.h>
+#endif
+
+CPL_CVSID("$Id: ogrmapgisworkers.cpp 30008 2012-02-23 10:21:37Z fuxin $");
+
+/* Polling intervals, in seconds, of idle workers and of a waiting reader. */
+#define MAPGIS_WORKER_IDLE_SLEEP    0.0005
+#define MAPGIS_WAIT_SLEEP           0.0001
+
+/************************************************************************/
+/*                       OGRMapGISGetThreadCount()                      */
+/*                                                                      */
+/*      Number of decoding threads to use: the MAPGIS_NUM_THREADS       */
+/*      config option, or the number of processors.                     */
+/************************************************************************/
+
+int OGRMapGISGetThreadCount()
+
+{
+    const char *pszThreads = CPLGetConfigOption( "MAPGIS_NUM_THREADS", NULL );
+
+    if( pszThreads != NULL )
+        return MAX( 1, atoi( pszThreads ) );
+
+#if defined(WIN32)
+    SYSTEM_INFO sInfo;
+
+    GetSystemInfo( &sInfo );
+    return MAX( 1, (int) sInfo.dwNumberOfProcessors );
+#elif defined(_SC_NPROCESSORS_ONLN)
+    return MAX( 1, (int) sysconf( _SC_NPROCESSORS_ONLN ) );
+#else
+    return 1;
+#endif
+}
+
+/************************************************************************/
+/*                        OGRMapGISWorkerPool()                         */
+/************************************************************************/
+
+OGRMapGISWorkerPool::OGRMapGISWorkerPool( int nThreadsIn )
+
+{
+    hMutex = CPLCreateMutex();
+    CPLReleaseMutex( hMutex );
+
+    bStop = FALSE;
+    nThreads = 0;
+    nRunning = 0;
+
+    for( int i = 0; i < nThreadsIn; i++ )
+    {
+        CPLAcquireMutex( hMutex, 1000.0 );
+        nRunning++;
+        CPLReleaseMutex( hMutex );
+
+        if( CPLCreateThread( WorkerMain, this ) < 0 )
+        {
+            CPLAcquireMutex( hMutex, 1000.0 );
+            nRunning--;
+            CPLReleaseMutex( hMutex );
+            break;
+        }
+        nThreads++;
+    }
+
+    CPLDebug( "MapGIS", "Started %d decoding threads.", nThreads );
+}
+
+/************************************************************************/
+/*                        ~OGRMapGISWorkerPool()                        */
+/*                                                                      */
+/*      Threads can not be joined with the CPL API, so ask them to      */
+/*      stop and wait until the last one has checked out.  Queued       */
+/*      tasks belong to the caller and must have been cancelled.        */
+/************************************************************************/
+
+OGRMapGISWorkerPool::~OGRMapGISWorkerPool()
+
+{
+    CPLAcquireMutex( hMutex, 1000.0 );
+    CPLAssert( apoQueue.empty() );
+    bStop = TRUE;
+    CPLReleaseMutex( hMutex );
+
+    while( TRUE )
+    {
+        CPLAcquireMutex( hMutex, 1000.0 );
+        int nLeft = nRunning;
+        CPLReleaseMutex( hMutex );
+
+        if( nLeft == 0 )
+            break;
+        CPLSleep( MAPGIS_WORKER_IDLE_SLEEP );
+    }
+
+    CPLDestroyMutex( hMutex );
+}
+
+/************************************************************************/
+/*                             WorkerMain()                             */
+/************************************************************************/
+
+void OGRMapGISWorkerPool::WorkerMain( void *pPool )
+
+{
+    OGRMapGISWorkerPool *poPool = (OGRMapGISWorkerPool *) pPool;
+
+    while( TRUE )
+    {
+        OGRMapGISTask *poTask = NULL;
+
+        CPLAcquireMutex( poPool->hMutex, 1000.0 );
+        if( poPool->bStop )
+        {
+            poPool->nRunning--;
+            CPLReleaseMutex( poPool->hMutex );
+            return;
+        }
+        if( !poPool->apoQueue.empty() )
+        {
+            poTask = poPool->apoQueue.front();
+            poPool->apoQueue.pop_front();
+            poTask->nState = MAPGIS_TASK_RUNNING;
+        }
+        CPLReleaseMutex( poPool->hMutex );
+
+        if( poTask == NULL )
+        {
+            CPLSleep( MAPGIS_WORKER_IDLE_SLEEP );
+            continue;
+        }
+
+        poTask->Run();
+
+        CPLAcquireMutex( poPool->hMutex, 1000.0 );
+        poTask->nState = MAPGIS_TASK_DONE;
+        CPLReleaseMutex( poPool->hMutex );
+    }
+}
+
+/************************************************************************/
+/*                               Submit()                               */
+/************************************************************************/
+
+void OGRMapGISWorkerPool::Submit( OGRMapGISTask *poTask )
+
+{
+    CPLAcquireMutex( hMutex, 1000.0 );
+    poTask->nState = MAPGIS_TASK_QUEUED;
+    apoQueue.push_back( poTask );
+    CPLReleaseMutex( hMutex );
+}
+
+/************************************************************************/
+/*                               Finish()                               */
+/*                                                                      */
+/*      Make sure poTask is no longer queued or running.  A task no     */
+/*      worker has picked up yet is run in the calling thread when      */
+/*      bRun is set, and just dropped otherwise.  Returns TRUE if the   */
+/*      task has run.                                                   */
+/************************************************************************/
+
+int OGRMapGISWorkerPool::Finish( OGRMapGISTask *poTask, int bRun )
+
+{
+    CPLAcquireMutex( hMutex, 1000.0 );
+
+    if( poTask->nState == MAPGIS_TASK_QUEUED )
+    {
+        for( size_t i = 0; i < apoQueue.size(); i++ )
+        {
+            if( apoQueue[i] == poTask )
+            {
+                apoQueue.erase( apoQueue.begin() + i );
+                break;
+            }
+        }
+        poTask->nState = bRun ? MAPGIS_TASK_DONE : MAPGIS_TASK_CANCELLED;
+        CPLReleaseMutex( hMutex );
+
+        if( bRun )
+            poTask->Run();
+        return bRun;
+    }
+
+    while( poTask->nState == MAPGIS_TASK_RUNNING )
+    {
+        CPLReleaseMutex( hMutex );
+        CPLSleep( MAPGIS_WAIT_SLEEP );
+        CPLAcquireMutex( hMutex, 1000.0 );
+    }
+
+    int bDone = poTask->nState == MAPGIS_TASK_DONE;
+    CPLReleaseMutex( hMutex );
+
+    return bDone;
+}
+
+/************************************************************************/
+/*                       OGRMapGISPolygonBatch()                        */
+/************************************************************************/
+
+OGRMapGISPolygonBatch::OGRMapGISPolygonBatch( OGRMapGISArcStore *poArcsIn,
+                                              int nFirstRecordIn )
+        : OGRMapGISBatch( nFirstRecordIn )
+
+{
+    poArcs = poArcsIn;
+    anArcStart.push_back( 0 );
+}
+
+/************************************************************************/
+/*                       ~OGRMapGISPolygonBatch()                       */
+/************************************************************************/
+
+OGRMapGISPolygonBatch::~OGRMapGISPolygonBatch()
+
+{
+    for( size_t i = 0; i < apoFeatures.size(); i++ )
+        delete apoFeatures[i];
+    for( size_t i = 0; i < apoGeometries.size(); i++ )
+        delete apoGeometries[i];
+}
+
+/************************************************************************/
+/*                                Run()                                 */
+/*                                                                      */
+/*      Runs in a worker thread.  The arc store is only read, which     */
+/*      is safe as long as it is not in lazy mode.                      */
+/************************************************************************/
+
+void OGRMapGISPolygonBatch::Run()
+
+{
+    OGRMapGISRingBuilder oBuilder;
+    int nRecords = GetRecordCount();
+
+    oBuilder.SetStats( &sStats );
+    apoGeometries.resize( nRecords, NULL );
+
+    for( int i = 0; i < nRecords; i++ )
+    {
+        if( apoFeatures[i] == NULL )
+            continue;
+
+        int nArcIds = anArcStart[i+1] - anArcStart[i];
+
+        apoGeometries[i] = oBuilder.BuildPolygon( poArcs,
+            nArcIds > 0 ? &anArcIds[anArcStart[i]] : NULL, nArcIds );
+    }
+}
+
+/************************************************************************/
+/*                            TakeFeature()                             */
+/************************************************************************/
+
+OGRFeature *OGRMapGISPolygonBatch::TakeFeature( int iRecord )
+
+{
+    OGRFeature *poFeature = apoFeatures[iRecord];
+
+    if( poFeature != NULL )
+    {
+        apoFeatures[iRecord] = NULL;
+        poFeature->SetGeometryDirectly( apoGeometries[iRecord] );
+        apoGeometries[iRecord] = NULL;
+    }
+
+    return poFeature;
+}
+
+/************************************************************************/
+/*                        OGRMapGISRecordBatch()                        */
+/************************************************************************/
+
+OGRMapGISRecordBatch::OGRMapGISRecordBatch( int nFirstRecordIn )
+        : OGRMapGISBatch( nFirstRecordIn )
+
+{
+    featureType = 0;
+    poFeatureDefn = NULL;
+    pasFieldInfo = NULL;
+    anReadColumns[0] = 0;
+    anReadColumns[1] = 0;
+    pszLayerValue = NULL;
+    bSkipGeometry = FALSE;
+    nDataSize = 0;
+    nParsed = 0;
+}
+
+/************************************************************************/
+/*                       ~OGRMapGISRecordBatch()                        */
+/************************************************************************/
+
+OGRMapGISRecordBatch::~OGRMapGISRecordBatch()
+
+{
+    for( size_t i = 0; i < apoGeometries.size(); i++ )
+        delete apoGeometries[i];
+
+    for( size_t i = 0; i < asFields.size(); i++ )
+    {
+        int iField = anReadFields[i % anReadFields.size()];
+
+        if( pasFieldInfo[iField].eType == OFTString
+            && asFields[i].Set.nMarker1 != OGRUnsetMarker )
+            CPLFree( asFields[i].String );
+    }
+}
+
+/************************************************************************/
+/*                                Run()                                 */
+/*                                                                      */
+/*      Runs in a worker thread.  Parsing stops at the first record     */
+/*      that can not be decoded; it and the records after it produce    */
+/*      no feature.                                                     */
+/************************************************************************/
+
+void OGRMapGISRecordBatch::Run()
+
+{
+    MAPGIS_STAT_START( dfStart );
+    OGRMapGISReader oReader( &abyData[0], nDataSize );
+    int nRecords = GetRecordCount();
+    OGRField sUnset;
+
+    oReader.SetStats( &sStats );
+
+    sUnset.Set.nMarker1 = OGRUnsetMarker;
+    sUnset.Set.nMarker2 = OGRUnsetMarker;
+
+    asFields.resize( nRecords * anReadFields.size(), sUnset );
+    apoGeometries.resize( nRecords, NULL );
+
+    for( nParsed = 0; nParsed < nRecords; nParsed++ )
+    {
+        if( !ParseRecord( &oReader, nParsed ) )
+            break;
+    }
+
+    MAPGIS_STAT_STOP( &sStats, dfDecodeTime, dfStart );
+}
+
+/************************************************************************/
+/*                            ParseRecord()                             */
+/*                                                                      */
+/*      Same decoding as OGRMapGISLayer::TranslateRecord(), into the    */
+/*      batch arrays instead of a feature.                              */
+/************************************************************************/
+
+int OGRMapGISRecordBatch::ParseRecord( OGRMapGISReader *poRecordReader,
+                                       int iRecord )
+
+{
+    OGRMapGISToken asTokens[MAPGIS_MAX_COLUMNS];
+
+    if( featureType == 1 )
+    {
+        int nTokens = poRecordReader->ReadTokens( asTokens,
+            MAX( 4, MAX( anReadColumns[0], anReadColumns[1] ) ) );
+        if( nTokens < 3 )
+            return FALSE;
+
+        int iLayout = OGRMapGISGetPointLayout( asTokens, nTokens );
+
+        ParseFields( iRecord, iLayout, asTokens, nTokens );
+
+        if( !bSkipGeometry )
+            apoGeometries[iRecord] = new OGRPoint(
+                OGRMapGISParseNumber( asTokens[0].pszValue ),
+                OGRMapGISParseNumber( asTokens[1].pszValue ), 0.0 );
+        return TRUE;
+    }
+
+    int nTokens = poRecordReader->ReadTokens( asTokens,
+        MAX( 1, anReadColumns[0] ) );
+    if( nTokens <= 0 )
+        return FALSE;
+
+    ParseFields( iRecord, 0, asTokens, nTokens );
+
+    const char *pszLine = poRecordReader->ReadLine();
+    if( pszLine == NULL )
+        return FALSE;
+    int nCount = atoi( pszLine );
+    if( nCount < 0 )
+        return FALSE;
+
+    if( bSkipGeometry )
+    {
+        if( poRecordReader->SkipLines( nCount ) != nCount )
+            return FALSE;
+    }
+    else
+    {
+        if( (int) adfX.size() < nCount + 1 )
+        {
+            adfX.resize( nCount + 1 );
+            adfY.resize( nCount + 1 );
+        }
+        if( poRecordReader->ReadVertices( nCount, &adfX[0], &adfY[0] )
+            != nCount )
+            return FALSE;
+
+        OGRLineString *poLS = new OGRLineString();
+        poLS->setPoints( nCount, &adfX[0], &adfY[0] );
+        poLS->setCoordinateDimension( 3 );
+        apoGeometries[iRecord] = poLS;
+    }
+
+    nTokens = poRecordReader->ReadTokens( asTokens, 2 );
+    ParseFields( iRecord, 1, asTokens, nTokens );
+
+    return TRUE;
+}
+
+/************************************************************************/
+/*                            ParseFields()                             */
+/*                                                                      */
+/*      Convert the fields an attribute line of layout iLayout carries  */
+/*      into the OGRField values of record iRecord.                     */
+/************************************************************************/
+
+void OGRMapGISRecordBatch::ParseFields( int iRecord, int iLayout,
+                                        const OGRMapGISToken *pasTokens,
+                                        int nTokens )
+
+{
+    OGRField *pasRecordFields = &asFields[iRecord * anReadFields.size()];
+    CPLString osValue;
+
+    for( size_t iRead = 0; iRead < anReadFields.size(); iRead++ )
+    {
+        const OGRMapGISFieldInfo *psInfo = pasFieldInfo + anReadFields[iRead];
+        OGRField *psField = pasRecordFields + iRead;
+
+        if( OGRMapGISParseField( psInfo, iLayout, pasTokens, nTokens,
+                                 psField, osValue )
+            && psInfo->eType != OFTInteger && psInfo->eType != OFTReal )
+            psField->String = CPLStrdup( osValue );
+    }
+}
+
+/************************************************************************/
+/*                            TakeFeature()                             */
+/************************************************************************/
+
+OGRFeature *OGRMapGISRecordBatch::TakeFeature( int iRecord )
+
+{
+    if( iRecord >= nParsed )
+        return NULL;
+
+    OGRFeature *poFeature = new OGRFeature( poFeatureDefn );
+    OGRField *pasRecordFields = anReadFields.empty() ? NULL
+        : &asFields[iRecord * anReadFields.size()];
+
+    if( pszLayerValue != NULL )
+        poFeature->SetField( 0, pszLayerValue );
+
+    for( size_t iRead = 0; iRead < anReadFields.size(); iRead++ )
+    {
+        if( pasRecordFields[iRead].Set.nMarker1 != OGRUnsetMarker )
+            poFeature->SetField( MAPGIS_FIRST_FIELD + anReadFields[iRead],
+                                 pasRecordFields + iRead );
+    }
+
+    poFeature->SetGeometryDirectly( apoGeometries[iRecord] );
+    apoGeometries[iRecord] = NULL;
+    poFeature->SetFID( nFirstRecord + iRecord );
+
+    return poFeature;
+}
@@ -0,0 +1,769 @@
+/******************************************************************************
+ * $Id: ogrmapgiswriter.cpp 30009 2012-02-26 15:42:08Z fuxin $
+ *
+ * Project:  OpenGIS Simple Features Reference Implementation
+ * Purpose:  Implements OGRMapGISWriter and OGRMapGISWriterLayer, writing
+ *           new WMAP text files.
+ * Author:   ZhouShun, shunzhou@foxmail.com
+ *
+ ******************************************************************************
+ * Copyright (c) 1999,  Les Technologies SoftMap Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "ogr_mapgis.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+
+CPL_CVSID("$Id: ogrmapgiswriter.cpp 30009 2012-02-26 15:42:08Z fuxin $");
+
+#define MAPGIS_WRITE_BLOCK_SIZE (1024 * 1024)
+
+/* Width of the record count line, patched once the count is known. */
+#define MAPGIS_COUNT_WIDTH      10
+
+/* Style line of the arcs of a WAP file, the defaults of a WAL line. */
+#define MAPGIS_ARC_STYLE        "1,0,1,0.100000,10.000000,10.000000,1,1,0"
+
+/************************************************************************/
+/*                          OGRMapGISWriter()                           */
+/************************************************************************/
+
+OGRMapGISWriter::OGRMapGISWriter( VSILFILE *fp )
+
+{
+	this->fp = fp;
+	nBufferUsed = 0;
+	nFlushed = 0;
+
+	if( fp != NULL )
+		abyBuffer.resize( MAPGIS_WRITE_BLOCK_SIZE );
+}
+
+/************************************************************************/
+/*                          ~OGRMapGISWriter()                          */
+/************************************************************************/
+
+OGRMapGISWriter::~OGRMapGISWriter()
+
+{
+	Flush();
+}
+
+/************************************************************************/
+/*                              Reserve()                               */
+/*                                                                      */
+/*      Make room for nBytes more and return where they go.  The        */
+/*      caller advances nBufferUsed.                                    */
+/************************************************************************/
+
+char *OGRMapGISWriter::Reserve( size_t nBytes )
+
+{
+	if( nBufferUsed + nBytes > abyBuffer.size() )
+	{
+		if( fp != NULL )
+			Flush();
+
+		if( nBufferUsed + nBytes > abyBuffer.size() )
+			abyBuffer.resize( MAX( abyBuffer.size() * 2,
+								   MAX( nBufferUsed + nBytes,
+										(size_t) 4096 ) ) );
+	}
+
+	return &abyBuffer[nBufferUsed];
+}
+
+/************************************************************************/
+/*                               Flush()                                */
+/************************************************************************/
+
+int OGRMapGISWriter::Flush()
+
+{
+	if( fp == NULL || nBufferUsed == 0 )
+		return TRUE;
+
+	size_t nWritten = VSIFWriteL( &abyBuffer[0], 1, nBufferUsed, fp );
+	int bOK = nWritten == nBufferUsed;
+
+	if( !bOK )
+		CPLError( CE_Failure, CPLE_FileIO,
+				  "Failed to write %d bytes of MapGIS output, "
+				  "only %d written.", (int) nBufferUsed, (int) nWritten );
+
+	nFlushed += nBufferUsed;
+	nBufferUsed = 0;
+
+	return bOK;
+}
+
+/************************************************************************/
+/*                               Write()                                */
+/************************************************************************/
+
+void OGRMapGISWriter::Write( const char *pabyData, size_t nBytes )
+
+{
+	if( nBytes == 0 )
+		return;
+
+	memcpy( Reserve( nBytes ), pabyData, nBytes );
+	nBufferUsed += nBytes;
+}
+
+/************************************************************************/
+/*                            WriteQuoted()                             */
+/*                                                                      */
+/*      Quote a string value, doubling the quotes within it.  Line      */
+/*      breaks would end the record, so they become blanks.             */
+/************************************************************************/
+
+void OGRMapGISWriter::WriteQuoted( const char *pszValue )
+
+{
+	Put( '"' );
+	for( ; *pszValue != '\0'; pszValue++ )
+	{
+		if( *pszValue == '"' )
+			Put( '"' );
+		Put( *pszValue == '\n' || *pszValue == '\r' ? ' ' : *pszValue );
+	}
+	Put( '"' );
+}
+
+/************************************************************************/
+/*                            WriteInteger()                            */
+/************************************************************************/
+
+void OGRMapGISWriter::WriteInteger( GIntBig nValue )
+
+{
+	char achDigits[24];
+	int nDigits = 0;
+	GUIntBig nAbs = nValue < 0 ? (GUIntBig) 0 - (GUIntBig) nValue
+							   : (GUIntBig) nValue;
+
+	do
+	{
+		achDigits[nDigits++] = (char) ('0' + nAbs % 10);
+		nAbs /= 10;
+	} while( nAbs != 0 );
+
+	char *pszOut = Reserve( nDigits + 1 );
+	char *pszIter = pszOut;
+
+	if( nValue < 0 )
+		*pszIter++ = '-';
+	while( nDigits > 0 )
+		*pszIter++ = achDigits[--nDigits];
+
+	nBufferUsed += pszIter - pszOut;
+}
+
+/************************************************************************/
+/*                             WriteReal()                              */
+/*                                                                      */
+/*      Fixed notation with six decimals, as MapGIS writes them.        */
+/*      Values too large to scale to an integer go through sprintf.     */
+/************************************************************************/
+
+void OGRMapGISWriter::WriteReal( double dfValue )
+
+{
+	double dfAbs = fabs( dfValue );
+
+	if( !(dfAbs < 1e12) )
+	{
+		WriteString( CPLSPrintf( "%.6f", dfValue ) );
+		return;
+	}
+
+	GUIntBig nScaled = (GUIntBig) (dfAbs * 1e6 + 0.5);
+
+	if( dfValue < 0 && nScaled != 0 )
+		Put( '-' );
+	WriteInteger( (GIntBig) (nScaled / 1000000) );
+
+	char *pszOut = Reserve( 7 );
+	GUIntBig nFraction = nScaled % 1000000;
+
+	pszOut[0] = '.';
+	for( int i = 6; i > 0; i-- )
+	{
+		pszOut[i] = (char) ('0' + nFraction % 10);
+		nFraction /= 10;
+	}
+	nBufferUsed += 7;
+}
+
+/************************************************************************/
+/*                            WriteVertex()                             */
+/************************************************************************/
+
+void OGRMapGISWriter::WriteVertex( double dfX, double dfY )
+
+{
+	WriteReal( dfX );
+	WriteSeparator();
+	WriteReal( dfY );
+	EndLine();
+}
+
+/************************************************************************/
+/*                        OGRMapGISWriterLayer()                        */
+/************************************************************************/
+
+OGRMapGISWriterLayer::OGRMapGISWriterLayer( const char *pszFilename,
+											const char *pszLayerName,
+											VSILFILE *fp, int featureType )
+
+{
+	this->fp = fp;
+	this->featureType = featureType;
+	this->pszFilename = CPLStrdup( pszFilename );
+	nRecords = 0;
+	nCountOffset = 0;
+
+	poFeatureDefn = new OGRFeatureDefn( pszLayerName );
+	poFeatureDefn->Reference();
+	poFeatureDefn->SetGeomType( featureType == 1 ? wkbPoint :
+								featureType == 2 ? wkbLineString
+												 : wkbPolygon );
+
+/* -------------------------------------------------------------------- */
+/*      Map the columns of both line layouts to their fields.           */
+/* -------------------------------------------------------------------- */
+	pasFieldInfo = OGRMapGISGetFieldInfo( featureType, &nFieldInfo );
+	anSourceField.assign( nFieldInfo, -1 );
+	adfDerived.assign( nFieldInfo, 0.0 );
+
+	for( int iLayout = 0; iLayout < 2; iLayout++ )
+	{
+		anColumnCount[iLayout] = 0;
+		for( int iCol = 0; iCol < MAPGIS_MAX_COLUMNS; iCol++ )
+			anColumnField[iLayout][iCol] = -1;
+
+		for( int iField = 0; iField < nFieldInfo; iField++ )
+		{
+			int iCol = pasFieldInfo[iField].aiColumn[iLayout];
+			if( iCol < 0 )
+				continue;
+			anColumnField[iLayout][iCol] = iField;
+			anColumnCount[iLayout] = MAX( anColumnCount[iLayout], iCol + 1 );
+		}
+	}
+
+	iIDField = FindFieldInfo( "ID" );
+	iPntTypeField = FindFieldInfo( "PntType" );
+	iTextField = FindFieldInfo( "Text" );
+	iMeasureField = FindFieldInfo( featureType == 2 ? "Length" : "Area" );
+	iPerimeterField = FindFieldInfo( "Perimeter" );
+
+/* -------------------------------------------------------------------- */
+/*      Points and lines go straight to the file, behind a count line   */
+/*      filled in on close.  Polygons are written all at once.          */
+/* -------------------------------------------------------------------- */
+	poWriter = new OGRMapGISWriter( fp );
+	poPolygonLines = NULL;
+
+	if( featureType == 3 )
+		poPolygonLines = new OGRMapGISWriter( NULL );
+	else
+	{
+		poWriter->WriteString( featureType == 1 ? "WMAP9022" : "WMAP9021" );
+		poWriter->EndLine();
+		nCountOffset = poWriter->Tell();
+		for( int i = 0; i < MAPGIS_COUNT_WIDTH; i++ )
+			poWriter->Put( ' ' );
+		poWriter->EndLine();
+	}
+}
+
+/************************************************************************/
+/*                       ~OGRMapGISWriterLayer()                        */
+/************************************************************************/
+
+OGRMapGISWriterLayer::~OGRMapGISWriterLayer()
+
+{
+	if( featureType == 3 )
+		WritePolygons();
+
+	// MapGIS ends its files with blank lines.
+	for( int i = 0; i < 3; i++ )
+		poWriter->EndLine();
+	poWriter->Flush();
+
+	vsi_l_offset nBytes = poWriter->Tell();
+
+/* -------------------------------------------------------------------- */
+/*      Fill in the record count.  MapGIS counts one line more than     */
+/*      there are, as it does for nodes, but points as they are.        */
+/* -------------------------------------------------------------------- */
+	if( featureType != 3 )
+	{
+		const char *pszCount =
+			CPLSPrintf( "%d", featureType == 2 ? nRecords + 1 : nRecords );
+
+		if( VSIFSeekL( fp, nCountOffset, SEEK_SET ) != 0
+			|| VSIFWriteL( (void *) pszCount, 1, strlen(pszCount), fp )
+			   != strlen(pszCount) )
+			CPLError( CE_Failure, CPLE_FileIO,
+					  "Failed to write the record count of %s.",
+					  pszFilename );
+	}
+
+	CPLDebug( "MapGIS", "Wrote %d records, " CPL_FRMT_GUIB " bytes to %s.",
+			  nRecords, (GUIntBig) nBytes, pszFilename );
+
+	delete poWriter;
+	delete poPolygonLines;
+	VSIFCloseL( fp );
+
+	CPLFree( pszFilename );
+	poFeatureDefn->Release();
+}
+
+/************************************************************************/
+/*                           FindFieldInfo()                            */
+/************************************************************************/
+
+int OGRMapGISWriterLayer::FindFieldInfo( const char *pszName )
+
+{
+	for( int iField = 0; iField < nFieldInfo; iField++ )
+	{
+		if( EQUAL( pasFieldInfo[iField].pszName, pszName ) )
+			return iField;
+	}
+
+	return -1;
+}
+
+/************************************************************************/
+/*                            CreateField()                             */
+/*                                                                      */
+/*      Fields named after a MapGIS attribute fill its column, other    */
+/*      fields are accepted but not written.                            */
+/************************************************************************/
+
+OGRErr OGRMapGISWriterLayer::CreateField( OGRFieldDefn *poField,
+										  int bApproxOK )
+
+{
+	if( nRecords > 0 )
+	{
+		CPLError( CE_Failure, CPLE_AppDefined,
+				  "Cannot create fields on %s after features have been "
+				  "written.", pszFilename );
+		return OGRERR_FAILURE;
+	}
+
+	poFeatureDefn->AddFieldDefn( poField );
+
+	int iInfo = FindFieldInfo( poField->GetNameRef() );
+	if( iInfo >= 0 && anSourceField[iInfo] < 0 )
+		anSourceField[iInfo] = poFeatureDefn->GetFieldCount() - 1;
+
+	return OGRERR_NONE;
+}
+
+/************************************************************************/
+/*                            WriteColumns()                            */
+/*                                                                      */
+/*      Write the columns of layout iLayout from iFirstColumn on, each  */
+/*      from the feature field of the same name if it is set, else      */
+/*      derived from the geometry or defaulted.                         */
+/************************************************************************/
+
+void OGRMapGISWriterLayer::WriteColumns( OGRFeature *poFeature, int iLayout,
+										 int iFirstColumn,
+										 OGRMapGISWriter *poOut )
+
+{
+	for( int iCol = iFirstColumn; iCol < anColumnCount[iLayout]; iCol++ )
+	{
+		if( iCol > 0 )
+			poOut->WriteSeparator();
+
+		int iField = anColumnField[iLayout][iCol];
+		if( iField < 0 )
+		{
+			poOut->Put( '0' );
+			continue;
+		}
+
+		const OGRMapGISFieldInfo *psInfo = pasFieldInfo + iField;
+		int iSource = anSourceField[iField];
+
+		if( iSource >= 0 && poFeature->IsFieldSet( iSource ) )
+		{
+			if( psInfo->eType == OFTString )
+				poOut->WriteQuoted( poFeature->GetFieldAsString( iSource ) );
+			else if( psInfo->eType == OFTInteger )
+				poOut->WriteInteger( poFeature->GetFieldAsInteger( iSource ) );
+			else
+				poOut->WriteReal( poFeature->GetFieldAsDouble( iSource ) );
+		}
+		else if( psInfo->pszDefault == NULL )
+		{
+			if( psInfo->eType == OFTInteger )
+				poOut->WriteInteger( (GIntBig) adfDerived[iField] );
+			else
+				poOut->WriteReal( adfDerived[iField] );
+		}
+		else if( psInfo->eType == OFTString )
+			poOut->WriteQuoted( psInfo->pszDefault );
+		else if( psInfo->eType == OFTInteger )
+			poOut->WriteInteger( atoi( psInfo->pszDefault ) );
+		else
+			poOut->WriteReal( CPLAtof( psInfo->pszDefault ) );
+	}
+}
+
+/************************************************************************/
+/*                             WritePoint()                             */
+/*                                                                      */
+/*      Points with text are annotations, written in the first layout;  */
+/*      the rest are sub-graphs.                                        */
+/************************************************************************/
+
+OGRErr OGRMapGISWriterLayer::WritePoint( OGRFeature *poFeature,
+										 OGRPoint *poPoint )
+
+{
+	int iSource = anSourceField[iTextField];
+	int bText = iSource >= 0 && poFeature->IsFieldSet( iSource )
+		&& *poFeature->GetFieldAsString( iSource ) != '\0';
+	int nPntType = bText ? 0 : 1;
+
+	iSource = anSourceField[iPntTypeField];
+	if( iSource >= 0 && poFeature->IsFieldSet( iSource ) )
+		nPntType = poFeature->GetFieldAsInteger( iSource );
+
+	adfDerived[iIDField] = nRecords + 1;
+	adfDerived[iPntTypeField] = nPntType;
+
+	poWriter->WriteReal( poPoint->getX() );
+	poWriter->WriteSeparator();
+	poWriter->WriteReal( poPoint->getY() );
+	WriteColumns( poFeature, nPntType == 0 ? 0 : 1, 2, poWriter );
+	poWriter->EndLine();
+
+	nRecords++;
+
+	return OGRERR_NONE;
+}
+
+/************************************************************************/
+/*                             WriteLine()                              */
+/************************************************************************/
+
+OGRErr OGRMapGISWriterLayer::WriteLine( OGRFeature *poFeature,
+										OGRLineString *poLine )
+
+{
+	int nPoints = poLine->getNumPoints();
+
+	if( nPoints < 2 )
+	{
+		CPLError( CE_Failure, CPLE_AppDefined,
+				  "Cannot write a line of %d points to %s.",
+				  nPoints, pszFilename );
+		return OGRERR_FAILURE;
+	}
+
+	adfDerived[iIDField] = nRecords + 1;
+	adfDerived[iMeasureField] = poLine->get_Length();
+
+	WriteColumns( poFeature, 0, 0, poWriter );
+	poWriter->EndLine();
+	poWriter->WriteInteger( nPoints );
+	poWriter->EndLine();
+
+	for( int i = 0; i < nPoints; i++ )
+		poWriter->WriteVertex( poLine->getX( i ), poLine->getY( i ) );
+
+	WriteColumns( poFeature, 1, 0, poWriter );
+	poWriter->EndLine();
+
+	nRecords++;
+
+	return OGRERR_NONE;
+}
+
+/************************************************************************/
+/*                             AddPolygon()                             */
+/*                                                                      */
+/*      Hand the rings to the topology builder and keep the parameter   */
+/*      line until the polygons are written.                            */
+/************************************************************************/
+
+OGRErr OGRMapGISWriterLayer::AddPolygon( OGRFeature *poFeature,
+										 OGRPolygon *poPolygon )
+
+{
+	OGRLinearRing *poExterior = poPolygon->getExteriorRing();
+
+	if( poExterior == NULL || poExterior->getNumPoints() < 4 )
+	{
+		CPLError( CE_Failure, CPLE_AppDefined,
+				  "Cannot write an empty polygon to %s.", pszFilename );
+		return OGRERR_FAILURE;
+	}
+
+	int nPolygon = nRecords + 1;
+	double dfPerimeter = 0.0;
+	std::vector<double> adfX;
+	std::vector<double> adfY;
+
+	anPolygonFirstRing.push_back( oTopology.GetRingCount() );
+
+	for( int iRing = -1; iRing < poPolygon->getNumInteriorRings(); iRing++ )
+	{
+		OGRLinearRing *poRing = iRing < 0 ? poExterior
+			: poPolygon->getInteriorRing( iRing );
+		int nPoints = poRing->getNumPoints();
+
+		adfX.resize( nPoints );
+		adfY.resize( nPoints );
+		for( int i = 0; i < nPoints; i++ )
+		{
+			adfX[i] = poRing->getX( i );
+			adfY[i] = poRing->getY( i );
+		}
+
+		// The polygon lies left of a counter-clockwise exterior ring
+		// and of a clockwise hole.
+		int bClockwise = poRing->isClockwise();
+		oTopology.AddRing( nPolygon, iRing < 0 ? !bClockwise : bClockwise,
+						   nPoints, nPoints ? &adfX[0] : NULL,
+						   nPoints ? &adfY[0] : NULL );
+
+		dfPerimeter += poRing->get_Length();
+	}
+
+	adfDerived[iIDField] = nPolygon;
+	adfDerived[iMeasureField] = poPolygon->get_Area();
+	adfDerived[iPerimeterField] = dfPerimeter;
+
+	WriteColumns( poFeature, 0, 0, poPolygonLines );
+	poPolygonLines->EndLine();
+	anPolygonLineEnd.push_back( poPolygonLines->GetDataSize() );
+
+	nRecords++;
+
+	return OGRERR_NONE;
+}
+
+/************************************************************************/
+/*                           WritePolygons()                            */
+/*                                                                      */
+/*      Write the arcs, nodes and polygons of a WAP file.               */
+/************************************************************************/
+
+void OGRMapGISWriterLayer::WritePolygons()
+
+{
+	oTopology.Build();
+
+	poWriter->WriteString( "WMAP9023" );
+	poWriter->EndLine();
+
+/* -------------------------------------------------------------------- */
+/*      Arcs.                                                           */
+/* -------------------------------------------------------------------- */
+	int nArcs = oTopology.GetArcCount();
+
+	poWriter->WriteInteger( nArcs );
+	poWriter->EndLine();
+
+	for( int iArc = 0; iArc < nArcs; iArc++ )
+	{
+		int iStart = oTopology.anArcStart[iArc];
+		int nPoints = oTopology.anArcStart[iArc+1] - iStart;
+		const double *padfX = &oTopology.adfArcX[iStart];
+		const double *padfY = &oTopology.adfArcY[iStart];
+		double dfLength = 0.0;
+
+		poWriter->WriteString( MAPGIS_ARC_STYLE );
+		poWriter->EndLine();
+		poWriter->WriteInteger( oTopology.anArcFrom[iArc] );
+		poWriter->WriteSeparator();
+		poWriter->WriteInteger( oTopology.anArcTo[iArc] );
+		poWriter->EndLine();
+		poWriter->WriteInteger( oTopology.anArcLeft[iArc] );
+		poWriter->WriteSeparator();
+		poWriter->WriteInteger( oTopology.anArcRight[iArc] );
+		poWriter->EndLine();
+		poWriter->WriteInteger( nPoints );
+		poWriter->EndLine();
+
+		for( int i = 0; i < nPoints; i++ )
+		{
+			poWriter->WriteVertex( padfX[i], padfY[i] );
+			if( i > 0 )
+				dfLength += sqrt( (padfX[i] - padfX[i-1])
+								  * (padfX[i] - padfX[i-1])
+								  + (padfY[i] - padfY[i-1])
+								  * (padfY[i] - padfY[i-1]) );
+		}
+
+		poWriter->WriteInteger( iArc + 1 );
+		poWriter->WriteSeparator();
+		poWriter->WriteReal( dfLength );
+		poWriter->EndLine();
+	}
+
+/* -------------------------------------------------------------------- */
+/*      Nodes, counted one more than there are.                         */
+/* -------------------------------------------------------------------- */
+	int nNodes = (int) oTopology.adfNodeX.size();
+
+	poWriter->WriteInteger( nNodes + 1 );
+	poWriter->EndLine();
+
+	for( int iNode = 0; iNode < nNodes; iNode++ )
+	{
+		const std::vector<int> &anArcs = oTopology.aanNodeArcs[iNode];
+
+		poWriter->WriteVertex( oTopology.adfNodeX[iNode],
+							   oTopology.adfNodeY[iNode] );
+		poWriter->WriteInteger( (int) anArcs.size() );
+		poWriter->Put( 'N' );
+		poWriter->EndLine();
+
+		for( size_t i = 0; i < anArcs.size(); i++ )
+		{
+			poWriter->WriteInteger( anArcs[i] );
+			poWriter->EndLine();
+		}
+	}
+
+/* -------------------------------------------------------------------- */
+/*      Polygons, counted as they are: parameter line, then the signed  */
+/*      arc ids of every ring, each ring ended by a 0.                  */
+/* -------------------------------------------------------------------- */
+	int nPolygons = (int) anPolygonLineEnd.size();
+	const char *pszLines = poPolygonLines->GetData();
+	size_t nLineStart = 0;
+
+	poWriter->WriteInteger( nPolygons );
+	poWriter->EndLine();
+
+	for( int iPolygon = 0; iPolygon < nPolygons; iPolygon++ )
+	{
+		int iFirstRing = anPolygonFirstRing[iPolygon];
+		int iEndRing = iPolygon + 1 < nPolygons
+			? anPolygonFirstRing[iPolygon+1] : oTopology.GetRingCount();
+		int iFirstArc = oTopology.anRingArcStart[iFirstRing];
+		int iEndArc = oTopology.anRingArcStart[iEndRing];
+
+		poWriter->Write( pszLines + nLineStart,
+						 anPolygonLineEnd[iPolygon] - nLineStart );
+		nLineStart = anPolygonLineEnd[iPolygon];
+
+		poWriter->WriteInteger( iEndArc - iFirstArc );
+		poWriter->EndLine();
+
+		for( int i = iFirstArc; i < iEndArc; i++ )
+		{
+			poWriter->WriteInteger( oTopology.anRingArcs[i] );
+			poWriter->EndLine();
+		}
+	}
+}
+
+/************************************************************************/
+/*                           CreateFeature()                            */
+/*                                                                      */
+/*      Every part of a multi geometry becomes a record of its own.     */
+/*      FIDs are record ordinals, as when reading.                      */
+/************************************************************************/
+
+OGRErr OGRMapGISWriterLayer::CreateFeature( OGRFeature *poFeature )
+
+{
+	OGRGeometry *poGeom = poFeature->GetGeometryRef();
+
+	if( poGeom == NULL )
+	{
+		CPLError( CE_Failure, CPLE_AppDefined,
+				  "Cannot write a feature without geometry to %s.",
+				  pszFilename );
+		return OGRERR_FAILURE;
+	}
+
+	OGRwkbGeometryType eType = wkbFlatten( poGeom->getGeometryType() );
+	OGRGeometryCollection *poParts = NULL;
+
+	if( eType == wkbMultiPoint || eType == wkbMultiLineString
+		|| eType == wkbMultiPolygon )
+	{
+		poParts = (OGRGeometryCollection *) poGeom;
+		eType = eType == wkbMultiPoint ? wkbPoint :
+			eType == wkbMultiLineString ? wkbLineString : wkbPolygon;
+	}
+
+	if( eType != poFeatureDefn->GetGeomType() )
+	{
+		CPLError( CE_Failure, CPLE_NotSupported,
+				  "Cannot write a %s geometry to %s.",
+				  poGeom->getGeometryName(), pszFilename );
+		return OGRERR_FAILURE;
+	}
+
+	poFeature->SetFID( nRecords );
+
+	int nParts = poParts ? poParts->getNumGeometries() : 1;
+	OGRErr eErr = OGRERR_NONE;
+
+	for( int iPart = 0; iPart < nParts && eErr == OGRERR_NONE; iPart++ )
+	{
+		OGRGeometry *poPart = poParts ? poParts->getGeometryRef( iPart )
+									  : poGeom;
+
+		if( featureType == 1 )
+			eErr = WritePoint( poFeature, (OGRPoint *) poPart );
+		else if( featureType == 2 )
+			eErr = WriteLine( poFeature, (OGRLineString *) poPart );
+		else
+			eErr = AddPolygon( poFeature, (OGRPolygon *) poPart );
+	}
+
+	return eErr;
+}
+
+/************************************************************************/
+/*                           TestCapability()                           */
+/************************************************************************/
+
+int OGRMapGISWriterLayer::TestCapability( const char *pszCap )
+
+{
+	if( EQUAL(pszCap,OLCSequentialWrite) )
+		return TRUE;
+
+	if( EQUAL(pszCap,OLCCreateField) )
+		return TRUE;
+
+	return FALSE;
+}